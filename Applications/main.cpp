@@ -376,21 +376,24 @@ int main(void)
                 size_t numObjects=scene->create("SphereBox2013",//scene name
                                                 stitch::Vec3(0.0f, 9.0f, 0.0f),//light orig
                                                 stitch::Colour_t(50.0f, 50.0f, 50.0f),//light SPD
-                                                1, 16, false, false, g_glossySD);//objectTreeChunkSize, internalObjectTreeChunkSize, createOSGLinesNode, createOSGNormalsNode
+                                                1, 16, false, false, g_glossySD,//objectTreeChunkSize, internalObjectTreeChunkSize, createOSGLinesNode, createOSGNormalsNode
+                                                stitch::BallTree::SAH_BVH_TREE, true);//tree type, wide nodes
         //=== ===//
         //OR
         //=== 2) Caustic gears ===//
         //        size_t numObjects=scene->create("CausticGear",//scene name
         //                                        stitch::Vec3(0.0f, 6.0f, 13.5f),//light orig
         //                                        stitch::Colour_t(50.0f, 50.0f, 50.0f),//light SPD
-        //                                        1, 16, false, false, g_glossySD);//objectTreeChunkSize, internalObjectTreeChunkSize, createOSGLinesNode, createOSGNormalsNode
+        //                                        1, 16, false, false, g_glossySD,//objectTreeChunkSize, internalObjectTreeChunkSize, createOSGLinesNode, createOSGNormalsNode
+        //                                        stitch::BallTree::SAH_BVH_TREE, true);//tree type, wide nodes
         //=== ===//
         //OR
         //=== 3) Caustic ring scene ===//
         //size_t numObjects=scene->create("CausticRing",//scene name
         //                                stitch::Vec3(0.0f, 3.8f, 9.0f),//light orig
         //                                stitch::Colour_t(50.0f, 50.0f, 50.0f),//light SPD
-        //                                1, 16, false, false, g_glossySD);//objectTreeChunkSize, internalObjectTreeChunkSize, createOSGLinesNode, createOSGNormalsNode
+        //                                1, 16, false, false, g_glossySD,//objectTreeChunkSize, internalObjectTreeChunkSize, createOSGLinesNode, createOSGNormalsNode
+        //                                stitch::BallTree::SAH_BVH_TREE, true);//tree type, wide nodes
         //=== ===//
         
         endTick=timer.tick();
@@ -0,0 +1,140 @@
+/*
+ *  Arena.cpp
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Arena.h"
+
+#include <cstdint>
+
+//=======================================================================//
+stitch::Arena::Arena() :
+block_(nullptr),
+blockSize_(ARENA_MIN_BLOCK_SIZE),
+memorySize_(0)
+{
+}
+
+stitch::Arena::~Arena()
+{
+    clear();
+}
+
+inline void *stitch::Arena::allocateFromBlock(const size_t size, const size_t alignment)
+{
+    Block * const block=block_.load(std::memory_order_acquire);
+    
+    if (block==nullptr)
+    {
+        return nullptr;
+    }
+    
+    char *next=block->next_.load(std::memory_order_relaxed);
+    
+    for (;;)
+    {
+        char * const aligned=(char *)((((uintptr_t)next)+(alignment-1)) & ~((uintptr_t)(alignment-1)));
+        
+        if ((aligned>block->end_)||(((size_t)(block->end_-aligned))<size))
+        {
+            return nullptr;
+        }
+        
+        if (block->next_.compare_exchange_weak(next, aligned+size, std::memory_order_relaxed))
+        {//Otherwise another thread allocated first and next is updated to its end.
+            return aligned;
+        }
+    }
+}
+
+void *stitch::Arena::allocate(const size_t size, const size_t alignment)
+{
+    void *memory=allocateFromBlock(size, alignment);
+    
+    if (memory!=nullptr)
+    {
+        return memory;
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    memory=allocateFromBlock(size, alignment);
+    
+    if (memory!=nullptr)
+    {//Another thread started a new block while this one waited for the lock.
+        return memory;
+    }
+    
+    //=== The blocks from operator new are aligned for any type ===
+    if (size>(ARENA_MAX_BLOCK_SIZE/4))
+    {//A large allocation gets its own block so that the rest of the current block is not wasted.
+        char * const block=(char *)::operator new(size);
+        blocks_.push_back(block);
+        memorySize_+=size;
+        return block;
+    }
+    
+    const size_t headerSize=(sizeof(Block)+(alignof(std::max_align_t)-1)) & ~(alignof(std::max_align_t)-1);
+    
+    while (blockSize_<(headerSize+size))
+    {
+        blockSize_*=2;
+    }
+    
+    char * const block=(char *)::operator new(blockSize_);
+    blocks_.push_back(block);
+    memorySize_+=blockSize_;
+    
+    Block * const header=new (block) Block;
+    header->next_.store(block+headerSize+size, std::memory_order_relaxed);
+    header->end_=block+blockSize_;
+    
+    block_.store(header, std::memory_order_release);
+    
+    if (blockSize_<ARENA_MAX_BLOCK_SIZE)
+    {
+        blockSize_*=2;
+    }
+    //===
+    
+    return block+headerSize;
+}
+
+void stitch::Arena::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    for (size_t blockNum=0; blockNum<blocks_.size(); ++blockNum)
+    {
+        ::operator delete(blocks_[blockNum]);
+    }
+    
+    std::vector<char *>().swap(blocks_);
+    
+    block_.store(nullptr, std::memory_order_relaxed);
+    blockSize_=ARENA_MIN_BLOCK_SIZE;
+    memorySize_=0;
+}
+
+size_t stitch::Arena::getMemorySize() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    return memorySize_;
+}
@@ -0,0 +1,170 @@
+/*
+ *  Arena.h
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STITCH_ARENA_H
+#define STITCH_ARENA_H
+
+#define ARENA_MIN_BLOCK_SIZE 4096 //The size of an arena's first block. Each next block is twice as large, so small arenas stay small.
+#define ARENA_MAX_BLOCK_SIZE 262144 //The size that the blocks grow to. Allocations of more than a quarter of it get their own block.
+
+namespace stitch {
+    class Arena;
+    template <class T> class Pool;
+}
+
+#include <vector>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <new>
+
+namespace stitch {
+    
+    /*! \brief Hands out memory from large blocks that are all freed together, e.g. for the many small objects of a mesh or a tree.
+     
+     Allocating bumps a pointer within the current block with an atomic compare and swap, so several threads may allocate
+     from the same arena (e.g. during a parallel build) without taking a lock. Only starting a new block takes the lock.
+     Memory is not returned individually. The blocks are freed when the arena is cleared or destroyed without running the
+     destructors of the objects in them, so the objects should not own other resources and must not be deleted one by one. */
+    class Arena
+    {
+    public:
+        Arena();
+        
+        ~Arena();
+        
+        /*! @param alignment A power of two that is at most alignof(std::max_align_t). */
+        void *allocate(const size_t size, const size_t alignment);
+        
+        /*! Free all the blocks at once. Not to be called while other threads allocate. */
+        void clear();
+        
+        /*! The number of bytes of the blocks allocated from the heap. */
+        size_t getMemorySize() const;
+        
+    private:
+        Arena(const Arena &);
+        Arena & operator = (const Arena &);
+        
+        //! The header at the start of each block that allocations are bumped within.
+        struct Block
+        {
+            //! The free part of the block.
+            std::atomic<char *> next_;
+            char *end_;
+        };
+        
+        /*! Bump the allocation within the current block. @return Null if it does not fit. */
+        void *allocateFromBlock(const size_t size, const size_t alignment);
+        
+        std::vector<char *> blocks_;
+        
+        //! The block that allocations are bumped within. Null before the first allocation.
+        std::atomic<Block *> block_;
+        
+        //! The size of the next block.
+        size_t blockSize_;
+        
+        size_t memorySize_;
+        
+        mutable std::mutex mutex_;
+    };
+    
+    
+    /*! \brief Allocates objects of one type from an arena and keeps destroyed objects on a free list for reuse, e.g. the nodes of a
+     tree of which subtrees are rebuilt. Clearing the pool frees all the objects in one operation. Thread safe like the arena. */
+    template <class T>
+    class Pool
+    {
+    public:
+        Pool() :
+        numFree_(0)
+        {}
+        
+        T *create()
+        {
+            return new (allocate()) T();
+        }
+        
+        T *create(const T &lValue)
+        {
+            return new (allocate()) T(lValue);
+        }
+        
+        /*! Destruct the object and keep its memory for the next object created. */
+        void destroy(T * const object)
+        {
+            object->~T();
+            
+            std::lock_guard<std::mutex> lock(mutex_);
+            freeVector_.push_back(object);
+            ++numFree_;
+        }
+        
+        /*! Free all the objects at once without running their destructors. */
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            
+            std::vector<void *>().swap(freeVector_);
+            numFree_=0;
+            arena_.clear();
+        }
+        
+        size_t getMemorySize() const
+        {
+            return arena_.getMemorySize();
+        }
+        
+    private:
+        Pool(const Pool &);
+        Pool & operator = (const Pool &);
+        
+        void *allocate()
+        {
+            if (numFree_.load(std::memory_order_relaxed)!=0)
+            {//The lock is only taken if there are destroyed objects to reuse, e.g. not during a build from scratch.
+                std::lock_guard<std::mutex> lock(mutex_);
+                
+                if (!freeVector_.empty())
+                {
+                    void * const memory=freeVector_.back();
+                    freeVector_.pop_back();
+                    --numFree_;
+                    return memory;
+                }
+            }
+            
+            return arena_.allocate(sizeof(T), alignof(T));
+        }
+        
+        Arena arena_;
+        
+        std::vector<void *> freeVector_;
+        
+        //! The size of freeVector_, readable without the lock.
+        std::atomic<size_t> numFree_;
+        
+        std::mutex mutex_;
+    };
+}
+
+#endif// STITCH_ARENA_H
@@ -0,0 +1,1303 @@
+/*
+ *  BVHTree.cpp
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "BVHTree.h"
+
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+
+stitch::BVHTree::BVHTree(const bool spatialSplits) :
+BallTree(),
+root_(nullptr),
+numNodes_(0),
+spatialSplits_(spatialSplits),
+numTreeItems_(0)
+{
+}
+
+stitch::BVHTree::BVHTree(const BVHTree &lValue) :
+BallTree(lValue),//Clones the items in the same order.
+root_(cloneNode(nodePool_, lValue.root_)),
+numNodes_(lValue.numNodes_),
+spatialSplits_(lValue.spatialSplits_),
+numTreeItems_(lValue.numTreeItems_)
+{
+    //=== Reference the cloned items from the leaves ===
+    std::unordered_map<const BoundingVolume *, BoundingVolume *> itemClones;
+
+    const size_t numItems=itemVector_.size();
+    for (size_t itemNum=0; itemNum<numItems; ++itemNum)
+    {
+        itemClones[lValue.itemVector_[itemNum]]=itemVector_[itemNum];
+    }
+
+    leafItemVector_.reserve(lValue.leafItemVector_.size());
+
+    for (const auto itemPtr : lValue.leafItemVector_)
+    {
+        leafItemVector_.push_back(itemClones[itemPtr]);
+    }
+    //===
+}
+
+stitch::BVHTree::~BVHTree()
+{
+    clear();
+}
+
+stitch::BVHNode *stitch::BVHTree::cloneNode(Pool<BVHNode> &nodePool, const BVHNode * const node)
+{
+    if (node==nullptr)
+    {
+        return nullptr;
+    }
+
+    BVHNode *clone=nodePool.create(*node);
+
+    if (!node->isLeaf())
+    {
+        clone->children_[0]=cloneNode(nodePool, node->children_[0]);
+        clone->children_[1]=cloneNode(nodePool, node->children_[1]);
+    }
+
+    return clone;
+}
+
+size_t stitch::BVHTree::countNodes(const BVHNode * const node)
+{
+    return (node!=nullptr) ? (1+countNodes(node->children_[0])+countNodes(node->children_[1])) : 0;
+}
+
+void stitch::BVHTree::deleteNode(Pool<BVHNode> &nodePool, BVHNode * const node)
+{
+    if (node!=nullptr)
+    {
+        deleteNode(nodePool, node->children_[0]);
+        deleteNode(nodePool, node->children_[1]);
+        nodePool.destroy(node);
+    }
+}
+
+void stitch::BVHTree::clear()
+{
+    nodePool_.clear();//All the nodes at once.
+    root_=nullptr;
+    numNodes_=0;
+    std::vector<BoundingVolume *>().swap(leafItemVector_);
+    numTreeItems_=0;
+
+    BallTree::clear();
+}
+
+void stitch::BVHTree::linearise()
+{
+    nodePool_.clear();
+    root_=nullptr;
+    numNodes_=0;
+    std::vector<BoundingVolume *>().swap(leafItemVector_);
+    numTreeItems_=0;
+
+    BallTree::linearise();
+}
+
+//=======================================================================//
+void stitch::BVHTree::build(const size_t chunkSize, const uint8_t splitAxis)
+{
+    linearise();
+
+    chunkSize_=chunkSize;//Not used by the SAH build, but kept for freezeCompact (see rebuildCompact).
+
+    const size_t numItems=itemVector_.size();
+
+    if (numItems==0)
+    {
+        updateBV();
+        return;
+    }
+
+    size_t numThreads=std::thread::hardware_concurrency();
+    if (numThreads==0) numThreads=2;//Setup numThreads in case system reports 0.
+
+    std::vector<BuildItem> buildItems(numItems);
+    setupBuildItems(buildItems, itemVector_, numThreads);
+
+    if (spatialSplits_)
+    {
+        AABB rootBounds;
+        for (const auto &buildItem : buildItems)
+        {
+            rootBounds.expand(buildItem.bounds_);
+        }
+
+        std::atomic<size_t> numReferences(numItems);
+
+        root_=buildSpatialNode(nodePool_, buildItems, leafItemVector_, rootBounds.surfaceArea(),
+                               numItems*BVHTREE_SPATIAL_SPLIT_MAX_REFERENCE_RATIO, numReferences, calcSpawnDepth(numThreads));
+    } else
+    {
+        root_=buildNode(nodePool_, buildItems, 0, numItems, calcSpawnDepth(numThreads));
+
+        //=== Store the items in leaf order ===
+        leafItemVector_.resize(numItems);
+
+        for (size_t itemNum=0; itemNum<numItems; ++itemNum)
+        {
+            leafItemVector_[itemNum]=buildItems[itemNum].item_;
+        }
+        //===
+    }
+
+    numNodes_=countNodes(root_);
+
+    numTreeItems_=numItems;
+
+    updateBV();//The bounds are already known from the build so this is cheap.
+}
+
+size_t stitch::BVHTree::calcSpawnDepth(const size_t numThreads)
+{//Spawn threads for the first few levels so that there are a few subtrees per thread to balance the load.
+    size_t spawnDepth=0;
+    while ((numThreads>1)&&((((size_t)1)<<spawnDepth) < numThreads*4))
+    {
+        ++spawnDepth;
+    }
+
+    return spawnDepth;
+}
+
+void stitch::BVHTree::setupBuildItems(std::vector<BuildItem> &buildItems, const std::vector<BoundingVolume *> &items, const size_t numThreads)
+{
+    const size_t numItems=items.size();
+
+    auto setupChunk=[&buildItems, &items](const size_t start, const size_t end)
+    {
+        for (size_t itemNum=start; itemNum<end; ++itemNum)
+        {
+            BuildItem &buildItem=buildItems[itemNum];
+
+            buildItem.bounds_=items[itemNum]->getAABB();
+            buildItem.centroid_=buildItem.bounds_.centroid();
+            buildItem.item_=items[itemNum];
+        }
+    };
+
+    if (numItems<BVHTREE_PARALLEL_BUILD_MIN_ITEMS)
+    {
+        setupChunk(0, numItems);
+    } else
+    {
+        std::vector<std::thread> threadVect;
+        threadVect.reserve(numThreads);
+
+        const size_t chunkSize=(numItems+numThreads-1)/numThreads;
+
+        for (size_t start=0; start<numItems; start+=chunkSize)
+        {
+            threadVect.emplace_back(setupChunk, start, std::min(start+chunkSize, numItems));
+        }
+
+        for (auto &thread : threadVect)
+        {
+            thread.join();
+        }
+    }
+}
+
+stitch::BVHNode *stitch::BVHTree::buildNode(Pool<BVHNode> &nodePool, std::vector<BuildItem> &buildItems, const size_t start, const size_t end, const size_t spawnDepth)
+{//Note: Concurrent calls only touch their own range of buildItems. The pool is thread safe.
+    BVHNode *node=nodePool.create();
+
+    const size_t numItems=end-start;
+
+    AABB centroidBounds;
+
+    for (size_t itemNum=start; itemNum<end; ++itemNum)
+    {
+        node->bounds_.expand(buildItems[itemNum].bounds_);
+        centroidBounds.expand(buildItems[itemNum].centroid_);
+    }
+
+    node->firstItem_=start;
+    node->numItems_=numItems;
+
+    node->cost_=numItems;//The cost of a leaf. Updated below if the node is split.
+    node->builtCost_=node->cost_;
+
+    if (numItems==1)
+    {
+        return node;
+    }
+
+    const uint8_t axis=centroidBounds.maxExtentAxis();
+    const float centroidMin=centroidBounds.min_[axis];
+    const float centroidMax=centroidBounds.max_[axis];
+
+    size_t mid=start;
+
+    if (centroidMax>centroidMin)
+    {
+        const float binScale=BVHTREE_SAH_NUM_BINS/(centroidMax-centroidMin);
+
+        float minCost=((float)FLT_MAX);
+        size_t minCostSplitBin=0;
+        AABB leftBounds, rightBounds;
+
+        findObjectSplit(buildItems, start, end, node->bounds_, centroidBounds, axis, minCost, minCostSplitBin, leftBounds, rightBounds);
+
+        const float leafCost=numItems;
+
+        if ((minCost>=leafCost)&&(numItems<=BVHTREE_MAX_LEAF_SIZE))
+        {//Cheaper to intersect all the items than to split.
+            return node;
+        }
+
+        mid=std::partition(buildItems.begin()+start, buildItems.begin()+end,
+                           [=](const BuildItem &buildItem)
+                           {
+                               return std::min<size_t>((size_t)((buildItem.centroid_[axis]-centroidMin)*binScale), BVHTREE_SAH_NUM_BINS-1) <= minCostSplitBin;
+                           }) - buildItems.begin();
+    } else
+    {//All centroids coincide and no split plane can separate the items.
+        if (numItems<=BVHTREE_MAX_LEAF_SIZE)
+        {
+            return node;
+        }
+    }
+
+    if ((mid==start)||(mid==end))
+    {//Fall back to splitting the items into two equal halves.
+        mid=(start+end)/2;
+
+        std::nth_element(buildItems.begin()+start, buildItems.begin()+mid, buildItems.begin()+end,
+                         [=](const BuildItem &a, const BuildItem &b)
+                         {
+                             return a.centroid_[axis] < b.centroid_[axis];
+                         });
+    }
+
+    node->splitAxis_=axis;
+
+    if ((spawnDepth>0)&&(numItems>=BVHTREE_PARALLEL_BUILD_MIN_ITEMS))
+    {
+        std::thread childThread([&nodePool, &buildItems, node, start, mid, spawnDepth]()
+                                {
+                                    node->children_[0]=buildNode(nodePool, buildItems, start, mid, spawnDepth-1);
+                                });
+
+        node->children_[1]=buildNode(nodePool, buildItems, mid, end, spawnDepth-1);
+
+        childThread.join();
+    } else
+    {
+        node->children_[0]=buildNode(nodePool, buildItems, start, mid, 0);
+        node->children_[1]=buildNode(nodePool, buildItems, mid, end, 0);
+    }
+
+    updateNodeCost(node);
+    node->builtCost_=node->cost_;
+
+    return node;
+}
+
+void stitch::BVHTree::findObjectSplit(const std::vector<BuildItem> &buildItems, const size_t start, const size_t end,
+                                      const AABB &bounds, const AABB &centroidBounds, const uint8_t axis,
+                                      float &cost, size_t &splitBin, AABB &leftSplitBounds, AABB &rightSplitBounds)
+{
+    const float centroidMin=centroidBounds.min_[axis];
+    const float binScale=BVHTREE_SAH_NUM_BINS/(centroidBounds.max_[axis]-centroidMin);
+
+    //=== Bin the items along the axis by their centroids ===
+    size_t binCounts[BVHTREE_SAH_NUM_BINS]={0};
+    AABB binBounds[BVHTREE_SAH_NUM_BINS];
+
+    for (size_t itemNum=start; itemNum<end; ++itemNum)
+    {
+        const size_t binNum=std::min<size_t>((size_t)((buildItems[itemNum].centroid_[axis]-centroidMin)*binScale), BVHTREE_SAH_NUM_BINS-1);
+
+        ++binCounts[binNum];
+        binBounds[binNum].expand(buildItems[itemNum].bounds_);
+    }
+    //===
+
+    //=== Sweep from the right and then from the left to find the SAH cost of splitting after each bin ===
+    AABB rightBounds[BVHTREE_SAH_NUM_BINS];
+    size_t rightCounts[BVHTREE_SAH_NUM_BINS];
+    {
+        AABB sweepBounds;
+        size_t rightCount=0;
+
+        for (size_t binNum=BVHTREE_SAH_NUM_BINS-1; binNum>0; --binNum)
+        {
+            sweepBounds.expand(binBounds[binNum]);
+            rightCount+=binCounts[binNum];
+
+            rightBounds[binNum]=sweepBounds;
+            rightCounts[binNum]=rightCount;
+        }
+    }
+
+    const float nodeArea=bounds.surfaceArea();
+    const float recipNodeArea=(nodeArea>0.0f) ? (1.0f/nodeArea) : 0.0f;
+
+    cost=((float)FLT_MAX);
+    splitBin=0;
+    {
+        AABB leftBounds;
+        size_t leftCount=0;
+
+        for (size_t binNum=0; binNum<(BVHTREE_SAH_NUM_BINS-1); ++binNum)
+        {
+            leftBounds.expand(binBounds[binNum]);
+            leftCount+=binCounts[binNum];
+
+            if ((leftCount>0)&&(rightCounts[binNum+1]>0))
+            {
+                const float splitCost=BVHTREE_SAH_TRAVERSAL_COST +
+                (leftCount*leftBounds.surfaceArea() + rightCounts[binNum+1]*rightBounds[binNum+1].surfaceArea())*recipNodeArea;
+
+                if (splitCost<cost)
+                {
+                    cost=splitCost;
+                    splitBin=binNum;
+                    leftSplitBounds=leftBounds;
+                    rightSplitBounds=rightBounds[binNum+1];
+                }
+            }
+        }
+    }
+    //===
+}
+
+bool stitch::BVHTree::findSpatialSplit(const std::vector<BuildItem> &buildItems, const AABB &bounds, const uint8_t axis,
+                                       float &cost, size_t &splitBin)
+{
+    const float boundsMin=bounds.min_[axis];
+    const float boundsExtent=bounds.max_[axis]-boundsMin;
+
+    if (!(boundsExtent>0.0f))
+    {
+        return false;
+    }
+
+    const float binWidth=boundsExtent/BVHTREE_SAH_NUM_BINS;
+    const float binScale=BVHTREE_SAH_NUM_BINS/boundsExtent;
+
+    //=== Chop each reference into the bins that it overlaps. Count it as entering its first bin and exiting its last bin ===
+    size_t binEntries[BVHTREE_SAH_NUM_BINS]={0};
+    size_t binExits[BVHTREE_SAH_NUM_BINS]={0};
+    AABB binBounds[BVHTREE_SAH_NUM_BINS];
+
+    for (const auto &buildItem : buildItems)
+    {
+        size_t firstBin, lastBin;
+        getSpatialBins(buildItem.bounds_, axis, boundsMin, binScale, firstBin, lastBin);
+
+        AABB remainder=buildItem.bounds_;
+
+        for (size_t binNum=firstBin; binNum<lastBin; ++binNum)
+        {
+            AABB binPart;
+            buildItem.item_->splitAABB(remainder, axis, boundsMin+(binNum+1)*binWidth, binPart, remainder);
+
+            if (!binPart.isEmpty())
+            {
+                binBounds[binNum].expand(binPart);
+            }
+        }
+
+        if (!remainder.isEmpty())
+        {
+            binBounds[lastBin].expand(remainder);
+        }
+
+        ++binEntries[firstBin];
+        ++binExits[lastBin];
+    }
+    //===
+
+    //=== Sweep from the right and then from the left to find the SAH cost of splitting after each bin ===
+    float rightAreas[BVHTREE_SAH_NUM_BINS];
+    size_t rightCounts[BVHTREE_SAH_NUM_BINS];
+    {
+        AABB rightBounds;
+        size_t rightCount=0;
+
+        for (size_t binNum=BVHTREE_SAH_NUM_BINS-1; binNum>0; --binNum)
+        {
+            rightBounds.expand(binBounds[binNum]);
+            rightCount+=binExits[binNum];
+
+            rightAreas[binNum]=rightBounds.surfaceArea();
+            rightCounts[binNum]=rightCount;
+        }
+    }
+
+    const float nodeArea=bounds.surfaceArea();
+    const float recipNodeArea=(nodeArea>0.0f) ? (1.0f/nodeArea) : 0.0f;
+
+    bool found=false;
+    {
+        AABB leftBounds;
+        size_t leftCount=0;
+
+        for (size_t binNum=0; binNum<(BVHTREE_SAH_NUM_BINS-1); ++binNum)
+        {
+            leftBounds.expand(binBounds[binNum]);
+            leftCount+=binEntries[binNum];
+
+            if ((leftCount>0)&&(rightCounts[binNum+1]>0))
+            {
+                const float splitCost=BVHTREE_SAH_TRAVERSAL_COST +
+                (leftCount*leftBounds.surfaceArea() + rightCounts[binNum+1]*rightAreas[binNum+1])*recipNodeArea;
+
+                if (splitCost<cost)
+                {
+                    cost=splitCost;
+                    splitBin=binNum;
+                    found=true;
+                }
+            }
+        }
+    }
+    //===
+
+    return found;
+}
+
+void stitch::BVHTree::getSpatialBins(const AABB &box, const uint8_t axis, const float boundsMin, const float binScale,
+                                     size_t &firstBin, size_t &lastBin)
+{
+    firstBin=std::min<size_t>((size_t)MathUtil::max((box.min_[axis]-boundsMin)*binScale, 0.0f), BVHTREE_SAH_NUM_BINS-1);
+    lastBin=std::min<size_t>((size_t)MathUtil::max((box.max_[axis]-boundsMin)*binScale, 0.0f), BVHTREE_SAH_NUM_BINS-1);
+    lastBin=std::max(lastBin, firstBin);
+}
+
+stitch::BVHNode *stitch::BVHTree::buildSpatialNode(Pool<BVHNode> &nodePool, std::vector<BuildItem> &buildItems, std::vector<BoundingVolume *> &leafItems,
+                                                   const float rootArea, const size_t maxNumReferences, std::atomic<size_t> &numReferences,
+                                                   const size_t spawnDepth)
+{
+    BVHNode *node=nodePool.create();
+
+    const size_t numItems=buildItems.size();
+
+    AABB centroidBounds;
+
+    for (const auto &buildItem : buildItems)
+    {
+        node->bounds_.expand(buildItem.bounds_);
+        centroidBounds.expand(buildItem.centroid_);
+    }
+
+    node->firstItem_=leafItems.size();
+    node->numItems_=numItems;
+
+    node->cost_=numItems;//The cost of a leaf. Updated below if the node is split.
+    node->builtCost_=node->cost_;
+
+    //=== Find the cheapest object split and, where its children overlap, the cheapest spatial split ===
+    uint8_t objectAxis=centroidBounds.maxExtentAxis();
+    const bool objectSplittable=(numItems>1)&&(centroidBounds.max_[objectAxis]>centroidBounds.min_[objectAxis]);
+
+    float objectCost=((float)FLT_MAX);
+    size_t objectSplitBin=0;
+    AABB leftBounds, rightBounds;
+
+    if (objectSplittable)
+    {
+        findObjectSplit(buildItems, 0, numItems, node->bounds_, centroidBounds, objectAxis, objectCost, objectSplitBin, leftBounds, rightBounds);
+    }
+
+    float spatialCost=((float)FLT_MAX);
+    size_t spatialSplitBin=0;
+    uint8_t spatialAxis=0;
+
+    if ((numItems>1)&&(numReferences.load()<maxNumReferences)&&
+        ((!objectSplittable)||(leftBounds.intersection(rightBounds).surfaceArea() > (BVHTREE_SPATIAL_SPLIT_MIN_OVERLAP*rootArea))))
+    {
+        for (uint8_t axis=0; axis<3; ++axis)
+        {
+            if (findSpatialSplit(buildItems, node->bounds_, axis, spatialCost, spatialSplitBin))
+            {
+                spatialAxis=axis;
+            }
+        }
+    }
+    //===
+
+    const float leafCost=numItems;
+    const float minCost=std::min(objectCost, spatialCost);
+
+    if ((numItems==1)||((minCost>=leafCost)&&(numItems<=BVHTREE_MAX_LEAF_SIZE)))
+    {//Cheaper to intersect all the items than to split.
+        for (const auto &buildItem : buildItems)
+        {
+            leafItems.push_back(buildItem.item_);
+        }
+
+        std::vector<BuildItem>().swap(buildItems);
+        return node;
+    }
+
+    //=== Split the references ===
+    std::vector<BuildItem> leftItems, rightItems;
+
+    if (spatialCost<objectCost)
+    {//References that straddle the split plane are split to both sides.
+        const float boundsMin=node->bounds_.min_[spatialAxis];
+        const float binScale=BVHTREE_SAH_NUM_BINS/(node->bounds_.max_[spatialAxis]-boundsMin);
+        const float splitPosition=boundsMin+(spatialSplitBin+1)*((node->bounds_.max_[spatialAxis]-boundsMin)/BVHTREE_SAH_NUM_BINS);
+
+        size_t numDuplicates=0;
+
+        for (const auto &buildItem : buildItems)
+        {
+            size_t firstBin, lastBin;
+            getSpatialBins(buildItem.bounds_, spatialAxis, boundsMin, binScale, firstBin, lastBin);
+
+            if (lastBin<=spatialSplitBin)
+            {
+                leftItems.push_back(buildItem);
+            } else
+                if (firstBin>spatialSplitBin)
+                {
+                    rightItems.push_back(buildItem);
+                } else
+                {
+                    BuildItem leftItem={AABB(), Vec3(), buildItem.item_};
+                    BuildItem rightItem={AABB(), Vec3(), buildItem.item_};
+                    buildItem.item_->splitAABB(buildItem.bounds_, spatialAxis, splitPosition, leftItem.bounds_, rightItem.bounds_);
+
+                    if (leftItem.bounds_.isEmpty())
+                    {//Rounding: the item is only on the right side.
+                        rightItems.push_back(buildItem);
+                    } else
+                        if (rightItem.bounds_.isEmpty())
+                        {
+                            leftItems.push_back(buildItem);
+                        } else
+                        {
+                            leftItem.centroid_=leftItem.bounds_.centroid();
+                            rightItem.centroid_=rightItem.bounds_.centroid();
+
+                            leftItems.push_back(leftItem);
+                            rightItems.push_back(rightItem);
+                            ++numDuplicates;
+                        }
+                }
+        }
+
+        numReferences+=numDuplicates;
+    } else
+        if (objectSplittable)
+        {
+            const float centroidMin=centroidBounds.min_[objectAxis];
+            const float binScale=BVHTREE_SAH_NUM_BINS/(centroidBounds.max_[objectAxis]-centroidMin);
+
+            for (const auto &buildItem : buildItems)
+            {
+                if (std::min<size_t>((size_t)((buildItem.centroid_[objectAxis]-centroidMin)*binScale), BVHTREE_SAH_NUM_BINS-1) <= objectSplitBin)
+                {
+                    leftItems.push_back(buildItem);
+                } else
+                {
+                    rightItems.push_back(buildItem);
+                }
+            }
+        }
+
+    if ((leftItems.empty())||(rightItems.empty()))
+    {//Fall back to splitting the references into two equal halves.
+        const size_t mid=numItems/2;
+
+        std::nth_element(buildItems.begin(), buildItems.begin()+mid, buildItems.end(),
+                         [=](const BuildItem &a, const BuildItem &b)
+                         {
+                             return a.centroid_[objectAxis] < b.centroid_[objectAxis];
+                         });
+
+        leftItems.assign(buildItems.begin(), buildItems.begin()+mid);
+        rightItems.assign(buildItems.begin()+mid, buildItems.end());
+    } else
+    {
+        objectAxis=(spatialCost<objectCost) ? spatialAxis : objectAxis;
+    }
+
+    std::vector<BuildItem>().swap(buildItems);//Release the memory before building the children.
+    //===
+
+    node->splitAxis_=objectAxis;
+
+    if ((spawnDepth>0)&&(numItems>=BVHTREE_PARALLEL_BUILD_MIN_ITEMS))
+    {//Each child appends to its own leaf items which are then concatenated.
+        std::vector<BoundingVolume *> leftLeafItems, rightLeafItems;
+
+        std::thread childThread([&nodePool, &leftItems, &leftLeafItems, node, rootArea, maxNumReferences, &numReferences, spawnDepth]()
+                                {
+                                    node->children_[0]=buildSpatialNode(nodePool, leftItems, leftLeafItems, rootArea, maxNumReferences, numReferences, spawnDepth-1);
+                                });
+
+        node->children_[1]=buildSpatialNode(nodePool, rightItems, rightLeafItems, rootArea, maxNumReferences, numReferences, spawnDepth-1);
+
+        childThread.join();
+
+        offsetNodeItems(node->children_[0], leafItems.size());
+        leafItems.insert(leafItems.end(), leftLeafItems.begin(), leftLeafItems.end());
+
+        offsetNodeItems(node->children_[1], leafItems.size());
+        leafItems.insert(leafItems.end(), rightLeafItems.begin(), rightLeafItems.end());
+    } else
+    {
+        node->children_[0]=buildSpatialNode(nodePool, leftItems, leafItems, rootArea, maxNumReferences, numReferences, 0);
+        node->children_[1]=buildSpatialNode(nodePool, rightItems, leafItems, rootArea, maxNumReferences, numReferences, 0);
+    }
+
+    node->numItems_=leafItems.size()-node->firstItem_;
+
+    updateNodeCost(node);
+    node->builtCost_=node->cost_;
+
+    return node;
+}
+
+void stitch::BVHTree::updateNodeCost(BVHNode * const node)
+{
+    if (node->isLeaf())
+    {
+        node->cost_=node->numItems_;
+        return;
+    }
+
+    const BVHNode * const child0=node->children_[0];
+    const BVHNode * const child1=node->children_[1];
+
+    const float nodeArea=node->bounds_.surfaceArea();
+
+    if (nodeArea>0.0f)
+    {
+        node->cost_=BVHTREE_SAH_TRAVERSAL_COST +
+        (child0->cost_*child0->bounds_.surfaceArea() + child1->cost_*child1->bounds_.surfaceArea())/nodeArea;
+    } else
+    {//Degenerate box. A ray through the node is through both children.
+        node->cost_=BVHTREE_SAH_TRAVERSAL_COST + child0->cost_ + child1->cost_;
+    }
+}
+
+
+//=======================================================================//
+size_t stitch::BVHTree::refit()
+{
+    size_t numRebuiltNodes=0;
+
+    if (root_)
+    {
+        refitNode(root_);
+
+        size_t numThreads=std::thread::hardware_concurrency();
+        if (numThreads==0) numThreads=2;//Setup numThreads in case system reports 0.
+
+        numRebuiltNodes=rebuildDegradedNodes(root_, numThreads);
+
+        if (numRebuiltNodes>0)
+        {
+            numNodes_=countNodes(root_);
+        }
+    }
+
+    updateBV();
+
+    if ((isFrozen())||(isFrozenCompact()))
+    {//A compact tree has no build hierarchy left so none of its subtrees are rebuilt.
+        if (numRebuiltNodes>0)
+        {//The rebuilt subtrees reordered their items so the frozen form is replaced.
+            const bool wide=isFrozenWide();
+
+            freeze();
+
+            if (wide)
+            {
+                freezeWide();
+            }
+        } else
+            if (!refitFrozen())
+            {//The refitted boxes of the compact tree could not be quantised.
+                rebuildCompact();
+                ++numRebuiltNodes;
+            }
+    }
+
+    return numRebuiltNodes;
+}
+
+void stitch::BVHTree::refitNode(BVHNode * const node)
+{
+    AABB bounds;
+
+    if (node->isLeaf())
+    {
+        const size_t endItem=node->firstItem_+node->numItems_;
+
+        for (size_t itemNum=node->firstItem_; itemNum<endItem; ++itemNum)
+        {
+            bounds.expand(leafItemVector_[itemNum]->getAABB());
+        }
+    } else
+    {
+        refitNode(node->children_[0]);
+        refitNode(node->children_[1]);
+
+        bounds=node->children_[0]->bounds_;
+        bounds.expand(node->children_[1]->bounds_);
+    }
+
+    node->bounds_=bounds;
+    updateNodeCost(node);
+}
+
+size_t stitch::BVHTree::rebuildDegradedNodes(BVHNode * const node, const size_t numThreads)
+{
+    if (node->isLeaf())
+    {//The cost of a leaf does not depend on its box.
+        return 0;
+    }
+
+    if (node->cost_ > (node->builtCost_*BVHTREE_REFIT_REBUILD_COST_RATIO))
+    {
+        rebuildNode(node, numThreads);
+        return 1;
+    }
+
+    const size_t numRebuiltNodes=rebuildDegradedNodes(node->children_[0], numThreads) +
+    rebuildDegradedNodes(node->children_[1], numThreads);
+
+    if (numRebuiltNodes>0)
+    {//The boxes are unchanged, but the children are cheaper now.
+        updateNodeCost(node);
+    }
+
+    return numRebuiltNodes;
+}
+
+void stitch::BVHTree::rebuildNode(BVHNode * const node, const size_t numThreads)
+{
+    const std::vector<BoundingVolume *> items(leafItemVector_.begin()+node->firstItem_,
+                                              leafItemVector_.begin()+(node->firstItem_+node->numItems_));
+    const size_t numItems=items.size();
+
+    std::vector<BuildItem> buildItems(numItems);
+    setupBuildItems(buildItems, items, numThreads);
+
+    BVHNode * const subtree=buildNode(nodePool_, buildItems, 0, numItems, calcSpawnDepth(numThreads));
+    offsetNodeItems(subtree, node->firstItem_);
+
+    for (size_t itemNum=0; itemNum<numItems; ++itemNum)
+    {
+        leafItemVector_[node->firstItem_+itemNum]=buildItems[itemNum].item_;
+    }
+
+    //=== Replace the node's old subtree with the new one ===
+    deleteNode(nodePool_, node->children_[0]);
+    deleteNode(nodePool_, node->children_[1]);
+
+    *node=*subtree;
+    nodePool_.destroy(subtree);//Only the node itself. Its children now belong to node.
+    //===
+}
+
+void stitch::BVHTree::insertNodeItemReference(BVHNode * const node, const size_t position)
+{
+    if (node==nullptr)
+    {
+        return;
+    }
+
+    if (node->firstItem_>=position)
+    {//The whole subtree is after the new reference.
+        offsetNodeItems(node, 1);
+    } else
+        if ((node->firstItem_+node->numItems_)>=position)
+        {//The subtree ends with or contains the leaf that the reference is added to.
+            ++node->numItems_;
+
+            insertNodeItemReference(node->children_[0], position);
+            insertNodeItemReference(node->children_[1], position);
+        }
+}
+
+void stitch::BVHTree::offsetNodeItems(BVHNode * const node, const size_t offset)
+{
+    if (node!=nullptr)
+    {
+        node->firstItem_+=offset;
+
+        offsetNodeItems(node->children_[0], offset);
+        offsetNodeItems(node->children_[1], offset);
+    }
+}
+
+
+//=======================================================================//
+void stitch::BVHTree::insertItem(BoundingVolume * const item)
+{
+    if (!hasBuildHierarchy())
+    {
+        addItem(item);
+        return;
+    }
+
+    const bool frozen=isFrozen();
+    const bool wide=isFrozenWide();
+
+    unfreeze();
+
+    itemVector_.insert(itemVector_.begin()+numTreeItems_, item);//The items added after the build stay at the back.
+    ++numTreeItems_;
+
+    //=== Descend to the leaf whose box grows the least ===
+    const AABB itemBounds=item->getAABB();
+    std::vector<BVHNode *> path;
+    BVHNode *node=root_;
+
+    while (!node->isLeaf())
+    {
+        path.push_back(node);
+
+        AABB bounds0=node->children_[0]->bounds_;
+        bounds0.expand(itemBounds);
+        AABB bounds1=node->children_[1]->bounds_;
+        bounds1.expand(itemBounds);
+
+        const float area0=node->children_[0]->bounds_.surfaceArea();
+        const float area1=node->children_[1]->bounds_.surfaceArea();
+        const float growth0=bounds0.surfaceArea()-area0;
+        const float growth1=bounds1.surfaceArea()-area1;
+
+        node=((growth0<growth1)||((growth0==growth1)&&(area0<=area1))) ? node->children_[0] : node->children_[1];
+    }
+    //===
+
+    const size_t position=node->firstItem_+node->numItems_;
+    leafItemVector_.insert(leafItemVector_.begin()+position, item);
+    insertNodeItemReference(root_, position);
+
+    size_t numThreads=std::thread::hardware_concurrency();
+    if (numThreads==0) numThreads=2;//Setup numThreads in case system reports 0.
+
+    rebuildNode(node, numThreads);//Splits the leaf again if the SAH says so.
+
+    //=== Refit the path back up to the root ===
+    for (std::vector<BVHNode *>::reverse_iterator pathIter=path.rbegin(); pathIter!=path.rend(); ++pathIter)
+    {
+        BVHNode * const pathNode=*pathIter;
+
+        pathNode->bounds_=pathNode->children_[0]->bounds_;
+        pathNode->bounds_.expand(pathNode->children_[1]->bounds_);
+        updateNodeCost(pathNode);
+    }
+    //===
+
+    rebuildDegradedNodes(root_, numThreads);
+
+    numNodes_=countNodes(root_);
+    updateBV();
+
+    refreeze(frozen, wide);
+}
+
+bool stitch::BVHTree::removeItem(BoundingVolume * const item)
+{
+    if (!hasBuildHierarchy())
+    {
+        return BallTree::removeItem(item);
+    }
+
+    const std::vector<BoundingVolume *>::iterator itemIter=std::find(itemVector_.begin(), itemVector_.end(), item);
+
+    if (itemIter==itemVector_.end())
+    {
+        return false;
+    }
+
+    const bool frozen=isFrozen();
+    const bool wide=isFrozenWide();
+
+    unfreeze();
+
+    const size_t itemNum=itemIter-itemVector_.begin();
+    itemVector_.erase(itemIter);
+
+    if (itemNum<numTreeItems_)
+    {
+        --numTreeItems_;
+
+        //=== Compact the leaf items. Spatial splits may have referenced the item from several leaves ===
+        const size_t numLeafItems=leafItemVector_.size();
+        std::vector<uint32_t> numKeptBefore(numLeafItems+1);
+        size_t numKept=0;
+
+        for (size_t leafItemNum=0; leafItemNum<numLeafItems; ++leafItemNum)
+        {
+            numKeptBefore[leafItemNum]=numKept;
+
+            if (leafItemVector_[leafItemNum]!=item)
+            {
+                leafItemVector_[numKept]=leafItemVector_[leafItemNum];
+                ++numKept;
+            }
+        }
+
+        numKeptBefore[numLeafItems]=numKept;
+        leafItemVector_.resize(numKept);
+        //===
+
+        root_=removeNodeReferences(root_, numKeptBefore);
+
+        if (root_)
+        {
+            size_t numThreads=std::thread::hardware_concurrency();
+            if (numThreads==0) numThreads=2;//Setup numThreads in case system reports 0.
+
+            rebuildDegradedNodes(root_, numThreads);
+        }
+
+        numNodes_=countNodes(root_);
+    }
+
+    updateBV();
+
+    refreeze(frozen, wide);
+
+    return true;
+}
+
+stitch::BVHNode *stitch::BVHTree::removeNodeReferences(BVHNode * const node, const std::vector<uint32_t> &numKeptBefore)
+{
+    const uint32_t oldNumItems=node->numItems_;
+
+    node->numItems_=numKeptBefore[node->firstItem_+node->numItems_]-numKeptBefore[node->firstItem_];
+    node->firstItem_=numKeptBefore[node->firstItem_];
+
+    if (node->numItems_==0)
+    {
+        deleteNode(nodePool_, node);
+        return nullptr;
+    }
+
+    if (node->isLeaf())
+    {
+        if (node->numItems_!=oldNumItems)
+        {//Refit the leaf to its remaining items.
+            const size_t endItem=node->firstItem_+node->numItems_;
+
+            node->bounds_=AABB();
+            for (size_t itemNum=node->firstItem_; itemNum<endItem; ++itemNum)
+            {
+                node->bounds_.expand(leafItemVector_[itemNum]->getAABB());
+            }
+
+            updateNodeCost(node);
+        }
+
+        return node;
+    }
+
+    node->children_[0]=removeNodeReferences(node->children_[0], numKeptBefore);
+    node->children_[1]=removeNodeReferences(node->children_[1], numKeptBefore);
+
+    if ((node->children_[0]==nullptr)||(node->children_[1]==nullptr))
+    {//Replace the node by its remaining child.
+        BVHNode * const child=(node->children_[0]!=nullptr) ? node->children_[0] : node->children_[1];
+
+        *node=*child;
+        nodePool_.destroy(child);//Only the node itself. Its children now belong to node.
+
+        return node;
+    }
+
+    if (node->numItems_!=oldNumItems)
+    {
+        node->bounds_=node->children_[0]->bounds_;
+        node->bounds_.expand(node->children_[1]->bounds_);
+        updateNodeCost(node);
+    }
+
+    return node;
+}
+
+
+//=======================================================================//
+void stitch::BVHTree::updateBV()
+{
+    if (frozenMesh_!=nullptr)
+    {//No hierarchy is left once the tree is frozen over a mesh.
+        BallTree::updateBV();
+        return;
+    }
+
+    const AABB box=getAABB();
+
+    if (!box.isEmpty())
+    {
+        centre_=box.centroid();
+        radiusBV_=box.boundingSphereRadius();
+    } else
+    {
+        centre_.setZeros();
+        radiusBV_=0.0f;
+    }
+
+    visibilityMask_=(root_!=nullptr) ? updateNodeVisibilityMask(root_) : 0;
+
+    const size_t numItems=itemVector_.size();
+    for (size_t itemNum=numTreeItems_; itemNum<numItems; ++itemNum)
+    {
+        visibilityMask_|=itemVector_[itemNum]->visibilityMask_;
+    }
+}
+
+uint32_t stitch::BVHTree::updateNodeVisibilityMask(BVHNode * const node)
+{
+    if (node->isLeaf())
+    {
+        const size_t endItem=node->firstItem_+node->numItems_;
+
+        node->visibilityMask_=0;
+        for (size_t itemNum=node->firstItem_; itemNum<endItem; ++itemNum)
+        {
+            node->visibilityMask_|=leafItemVector_[itemNum]->visibilityMask_;
+        }
+    } else
+    {
+        node->visibilityMask_=updateNodeVisibilityMask(node->children_[0]) | updateNodeVisibilityMask(node->children_[1]);
+    }
+
+    return node->visibilityMask_;
+}
+
+stitch::AABB stitch::BVHTree::getAABB() const
+{
+    if (frozenMesh_!=nullptr)
+    {
+        return BallTree::getAABB();
+    }
+
+    AABB box;
+
+    if (root_)
+    {
+        box=root_->bounds_;
+    }
+
+    const size_t numItems=itemVector_.size();
+    for (size_t itemNum=numTreeItems_; itemNum<numItems; ++itemNum)
+    {
+        box.expand(itemVector_[itemNum]->getAABB());
+    }
+
+    return box;
+}
+
+
+size_t stitch::BVHTree::getTreeMemorySize() const
+{
+    return BallTree::getTreeMemorySize() + (sizeof(BVHTree)-sizeof(BallTree)) +
+    nodePool_.getMemorySize() + leafItemVector_.capacity()*sizeof(BoundingVolume *);
+}
+
+
+//=======================================================================//
+void stitch::BVHTree::freeze()
+{
+    unfreeze();
+
+    frozenItemVector_.assign(leafItemVector_.begin(), leafItemVector_.end());
+    frozenItemVector_.insert(frozenItemVector_.end(), itemVector_.begin()+numTreeItems_, itemVector_.end());
+
+    const size_t numItems=itemVector_.size();
+
+    if (numTreeItems_==numItems)
+    {
+        if (root_)
+        {
+            freezeNode(root_);
+        }
+    } else
+    {//Add a root above the hierarchy and the leaf of items added after the build.
+        frozenNodeVector_.push_back(FrozenTreeNode());
+
+        if (root_)
+        {
+            freezeNode(root_);
+        }
+
+        addFrozenLeaf(leafItemVector_.size(), frozenItemVector_.size());
+
+        frozenNodeVector_[0].bounds_=getAABB();
+        frozenNodeVector_[0].offset_=frozenNodeVector_.size();
+    }
+
+    updateFrozenStackSize();
+
+    frozenTriangles_.assign(frozenItemVector_);
+    updateFrozenVisibilityMasks();
+}
+
+uint32_t stitch::BVHTree::freezeNode(const BVHNode * const node)
+{
+    const uint32_t nodeIndex=frozenNodeVector_.size();
+    frozenNodeVector_.push_back(FrozenTreeNode());
+    frozenNodeVector_[nodeIndex].bounds_=node->bounds_;
+
+    if (node->isLeaf())
+    {//The items are frozen in the same order as the leafItemVector.
+        frozenNodeVector_[nodeIndex].offset_=node->firstItem_;
+        frozenNodeVector_[nodeIndex].numItems_=node->numItems_;
+    } else
+    {
+        freezeNode(node->children_[0]);
+        freezeNode(node->children_[1]);
+
+        frozenNodeVector_[nodeIndex].offset_=frozenNodeVector_.size();
+    }
+
+    return nodeIndex;
+}
+
+void stitch::BVHTree::calcIntersection(const Ray &ray, Intersection &intersect) const
+{
+    if ((isFrozen())||(isFrozenCompact()))
+    {
+        BallTree::calcIntersection(ray, intersect);
+        return;
+    }
+
+    if (root_)
+    {
+        const Vec3 recipDir(1.0f/ray.direction_.x(), 1.0f/ray.direction_.y(), 1.0f/ray.direction_.z());
+
+        calcNodeIntersection(root_, ray, recipDir, intersect);
+    }
+
+    //=== Items added after the build ===
+    const size_t numItems=itemVector_.size();
+    for (size_t itemNum=numTreeItems_; itemNum<numItems; ++itemNum)
+    {
+        const BoundingVolume * const itemPtr=itemVector_[itemNum];
+
+        if ((itemPtr->isVisibleTo(ray))&&(itemPtr->BVIntersected(ray)))
+        {
+            itemPtr->calcIntersection(ray, intersect);
+        }
+    }
+    //===
+}
+
+void stitch::BVHTree::calcNodeIntersection(const BVHNode * const node, const Ray &ray, const Vec3 &recipDir, Intersection &intersect) const
+{
+    float entry=0.0f;
+
+    if (((node->visibilityMask_&ray.visibilityMask_)!=0)&&
+        (node->bounds_.intersect(ray.origin_, recipDir, ray.tMin_, MathUtil::min(intersect.distance_, ray.tMax_), entry)))
+    {//The box test is against the current closest distance so subtrees beyond it are culled.
+        if (node->isLeaf())
+        {
+            const size_t endItem=node->firstItem_+node->numItems_;
+
+            for (size_t itemNum=node->firstItem_; itemNum<endItem; ++itemNum)
+            {
+                const BoundingVolume * const itemPtr=leafItemVector_[itemNum];
+
+                if ((itemPtr->isVisibleTo(ray))&&(itemPtr->BVIntersected(ray)))
+                {
+                    itemPtr->calcIntersection(ray, intersect);
+                }
+            }
+        } else
+        {//Visit the child on the near side of the split axis first.
+            const size_t nearChild=(ray.direction_[node->splitAxis_]<0.0f) ? 1 : 0;
+
+            calcNodeIntersection(node->children_[nearChild], ray, recipDir, intersect);
+            calcNodeIntersection(node->children_[1-nearChild], ray, recipDir, intersect);
+        }
+    }
+}
+
+bool stitch::BVHTree::occluded(const Ray &ray, const float tMax) const
+{
+    if ((isFrozen())||(isFrozenCompact()))
+    {
+        return BallTree::occluded(ray, tMax);
+    }
+
+    if (root_)
+    {
+        const Vec3 recipDir(1.0f/ray.direction_.x(), 1.0f/ray.direction_.y(), 1.0f/ray.direction_.z());
+
+        if (calcNodeOcclusion(root_, ray, recipDir, tMax))
+        {
+            return true;
+        }
+    }
+
+    //=== Items added after the build ===
+    const size_t numItems=itemVector_.size();
+    for (size_t itemNum=numTreeItems_; itemNum<numItems; ++itemNum)
+    {
+        const BoundingVolume * const itemPtr=itemVector_[itemNum];
+
+        if ((itemPtr->isVisibleTo(ray))&&(itemPtr->BVIntersected(ray))&&(itemPtr->occluded(ray, tMax)))
+        {
+            return true;
+        }
+    }
+    //===
+
+    return false;
+}
+
+bool stitch::BVHTree::calcNodeOcclusion(const BVHNode * const node, const Ray &ray, const Vec3 &recipDir, const float tMax) const
+{
+    float entry=0.0f;
+
+    if (((node->visibilityMask_&ray.visibilityMask_)!=0)&&(node->bounds_.intersect(ray.origin_, recipDir, ray.tMin_, tMax, entry)))
+    {
+        if (node->isLeaf())
+        {
+            const size_t endItem=node->firstItem_+node->numItems_;
+
+            for (size_t itemNum=node->firstItem_; itemNum<endItem; ++itemNum)
+            {
+                const BoundingVolume * const itemPtr=leafItemVector_[itemNum];
+
+                if ((itemPtr->isVisibleTo(ray))&&(itemPtr->BVIntersected(ray))&&(itemPtr->occluded(ray, tMax)))
+                {
+                    return true;
+                }
+            }
+        } else
+        {
+            return (calcNodeOcclusion(node->children_[0], ray, recipDir, tMax) ||
+                    calcNodeOcclusion(node->children_[1], ray, recipDir, tMax));
+        }
+    }
+
+    return false;
+}
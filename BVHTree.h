@@ -0,0 +1,286 @@
+/*
+ *  BVHTree.h
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STITCH_BVH_TREE_H
+#define STITCH_BVH_TREE_H
+
+#define BVHTREE_SAH_NUM_BINS 16
+#define BVHTREE_SAH_TRAVERSAL_COST 0.125f //Cost of a node traversal step relative to an item intersection.
+#define BVHTREE_MAX_LEAF_SIZE 64 //Leaves are never made larger than this even if the SAH says so.
+#define BVHTREE_PARALLEL_BUILD_MIN_ITEMS 4096 //Subtrees with fewer items are built by the thread that split them.
+#define BVHTREE_SPATIAL_SPLIT_MIN_OVERLAP 1.0e-5f //Spatial splits are only tried where the children of the object split overlap by more than this fraction of the root's area.
+#define BVHTREE_SPATIAL_SPLIT_MAX_REFERENCE_RATIO 4 //Spatial splits stop duplicating references once there are this many times more references than items.
+#define BVHTREE_REFIT_REBUILD_COST_RATIO 1.5f //A refitted subtree is rebuilt once its SAH cost grows beyond this factor of its cost when built.
+
+namespace stitch {
+	class BVHTree;
+    struct BVHNode;
+}
+
+#include "BallTree.h"
+#include "Arena.h"
+#include "Math/AABB.h"
+#include "Math/Ray.h"
+
+#include <vector>
+#include <atomic>
+
+namespace stitch {
+
+    //! A node of the BVHTree. A node references the range of the tree's leaf items in its subtree. An interior node has two children.
+    struct BVHNode
+    {
+        BVHNode() :
+        cost_(0.0f),
+        builtCost_(0.0f),
+        firstItem_(0),
+        numItems_(0),
+        visibilityMask_(RAY_VISIBILITY_ALL),
+        splitAxis_(0)
+        {
+            children_[0]=nullptr;
+            children_[1]=nullptr;
+        }
+
+        inline bool isLeaf() const
+        {
+            return children_[0]==nullptr;
+        }
+
+        AABB bounds_;
+        BVHNode *children_[2];
+
+        //! The SAH cost of the subtree relative to the node's surface area i.e. the expected cost of a ray through the node in item intersections.
+        float cost_;
+
+        //! The cost_ when the subtree was built. A refit that increases the cost well beyond it triggers a rebuild of the subtree.
+        float builtCost_;
+
+        uint32_t firstItem_;
+        uint32_t numItems_;
+
+        //! The union of the visibility masks of the items in the subtree (see BoundingVolume::visibilityMask_).
+        uint32_t visibilityMask_;
+
+        uint8_t splitAxis_;
+    };
+
+
+    /*! \brief Bounding volume hierarchy of axis aligned boxes built with the binned surface area heuristic (SAH).
+
+     A drop-in replacement for the BallTree (see PBRT book, Second Ed., Section 4.4). The items stay in the itemVector
+     and each leaf references a contiguous range of the leaf item vector which is in leaf order. The leaf sizes are
+     chosen by the SAH cost and not by a chunk size. Items added after the build are tested linearly until the next build.
+
+     With spatial splits (SBVH, see Stich et al. 2009, "Spatial Splits in Bounding Volume Hierarchies") a node may also be
+     split by a plane that cuts the straddling items (see BoundingVolume::splitAABB) and references them from both
+     children. This removes most of the node overlap caused by long thin items at the cost of more references. */
+	class BVHTree : public BallTree
+	{
+	public:
+        /*! Constructor.
+         @param spatialSplits Build with spatial as well as object splits (SAH_SBVH_TREE). */
+		explicit BVHTree(const bool spatialSplits=false);
+
+        BVHTree(const BVHTree &lValue);
+
+        virtual ~BVHTree();
+
+        /*! Virtual constructor idiom. Clone operator. */
+        virtual BVHTree * clone() const//Uses the copy constructor.
+        {
+            BVHTree *bvhTree=new BVHTree(*this);
+            bvhTree->refreezeLike(*this);//The copy constructor does not copy the frozen form which references the original items.
+            
+            return bvhTree;
+        }
+
+        virtual TreeType getTreeType() const
+        {
+            return spatialSplits_ ? SAH_SBVH_TREE : SAH_BVH_TREE;
+        }
+
+        virtual void clear();
+
+        virtual void linearise();
+
+        /*! Build the hierarchy over the items in the itemVector. Large subtrees are built in parallel on all the cores. The
+         node boxes and the tree's bounding sphere are calculated during the build. The chunkSize and splitAxis of the
+         BallTree interface are not used. */
+        virtual void build(const size_t chunkSize, const uint8_t splitAxis);
+
+        /*! Update the bounding sphere to enclose the tree's box and collect the visibility masks of the nodes from their items. */
+        virtual void updateBV();
+
+        /*! Refit the node boxes bottom-up to the moved items. The subtrees whose SAH cost then exceeds their cost when built by
+         BVHTREE_REFIT_REBUILD_COST_RATIO are rebuilt over their own items; the rest of the hierarchy is kept. The frozen form is
+         refitted in place if nothing was rebuilt and frozen again otherwise. A compact tree whose refitted boxes can not be
+         quantised is built and frozen compact again (see BallTree::rebuildCompact). */
+        virtual size_t refit();
+
+        virtual bool hasBuildHierarchy() const
+        {
+            return root_!=nullptr;
+        }
+
+        /*! Insert an item into the hierarchy without rebuilding it. The item is referenced from the leaf whose box grows the
+         least, the leaf is rebuilt with the SAH and the boxes on the path to it are refitted. Subtrees whose cost then exceeds
+         their cost when built by BVHTREE_REFIT_REBUILD_COST_RATIO are rebuilt, as after a refit, so repeated insertions do not
+         degrade the tree without bound. Without a hierarchy the item is only added (see addItem). */
+        virtual void insertItem(BoundingVolume * const item);
+
+        /*! Remove an item (and all its references) from the hierarchy without deleting it or rebuilding the hierarchy. The
+         emptied nodes are dropped and the boxes of the nodes that referenced it are refitted. */
+        virtual bool removeItem(BoundingVolume * const item);
+
+        virtual AABB getAABB() const;
+
+        /*! Flatten the hierarchy into the frozen form. Items added after the build are placed in an extra leaf. */
+        virtual void freeze();
+
+        virtual void calcIntersection(const Ray &ray, Intersection &intersect) const;
+
+        virtual bool occluded(const Ray &ray, const float tMax) const;
+
+        /*! Includes the nodes of the hierarchy and the leaf item references. */
+        virtual size_t getTreeMemorySize() const;
+
+        size_t getNumNodes() const
+        {
+            return numNodes_;
+        }
+
+        /*! The number of item references in the leaves. Larger than the number of items in the hierarchy if spatial splits duplicated references. */
+        size_t getNumLeafItems() const
+        {
+            return leafItemVector_.size();
+        }
+
+        /*! The SAH cost of the hierarchy, i.e. the expected number of item intersections (plus traversal steps weighted by
+         BVHTREE_SAH_TRAVERSAL_COST) of a ray through the root's box. Useful to monitor the quality of a refitted tree. */
+        float getSAHCost() const
+        {
+            return (root_!=nullptr) ? root_->cost_ : 0.0f;
+        }
+
+    private:
+        //! Per item data used during the build.
+        struct BuildItem
+        {
+            AABB bounds_;
+            Vec3 centroid_;
+            BoundingVolume *item_;
+        };
+
+        /*! Recursively build the subtree over buildItems[start, end) with nodes from the pool. The first child is built in a new thread while spawnDepth is non-zero and the subtree is large. */
+        static BVHNode *buildNode(Pool<BVHNode> &nodePool, std::vector<BuildItem> &buildItems, const size_t start, const size_t end, const size_t spawnDepth);
+
+        /*! Recursively build the subtree over the references with object and spatial splits and append its leaf items to leafItems.
+         The references are consumed. The first child is built in a new thread while spawnDepth is non-zero and the subtree is large.
+         @param rootArea The surface area of the root's box. Used to decide whether the node overlap justifies a spatial split.
+         @param maxNumReferences Spatial splits are not done once the number of references would exceed it. */
+        static BVHNode *buildSpatialNode(Pool<BVHNode> &nodePool, std::vector<BuildItem> &buildItems, std::vector<BoundingVolume *> &leafItems,
+                                         const float rootArea, const size_t maxNumReferences, std::atomic<size_t> &numReferences,
+                                         const size_t spawnDepth);
+
+        /*! Find the cheapest binned SAH object split of buildItems[start, end) by the centroids along the axis. The centroids
+         must not all coincide along the axis.
+         @param splitBin The items in the bins up to and including it go to the left child.
+         @param leftSplitBounds,rightSplitBounds The boxes of the children of the split. */
+        static void findObjectSplit(const std::vector<BuildItem> &buildItems, const size_t start, const size_t end,
+                                    const AABB &bounds, const AABB &centroidBounds, const uint8_t axis,
+                                    float &cost, size_t &splitBin, AABB &leftSplitBounds, AABB &rightSplitBounds);
+
+        /*! Find the cheapest binned SAH spatial split of the references by planes along the axis. The references are chopped
+         into the bins that they overlap (see BoundingVolume::splitAABB).
+         @param cost,splitBin Only updated if a split cheaper than the passed in cost is found. The split plane is on the
+         upper side of splitBin.
+         @return True if a cheaper split was found. */
+        static bool findSpatialSplit(const std::vector<BuildItem> &buildItems, const AABB &bounds, const uint8_t axis,
+                                     float &cost, size_t &splitBin);
+
+        /*! The first and last spatial bins along the axis that the box overlaps. */
+        static void getSpatialBins(const AABB &box, const uint8_t axis, const float boundsMin, const float binScale,
+                                   size_t &firstBin, size_t &lastBin);
+
+        /*! Fill in the build items of the items. The items are split into a chunk per thread. */
+        static void setupBuildItems(std::vector<BuildItem> &buildItems, const std::vector<BoundingVolume *> &items, const size_t numThreads);
+
+        /*! The depth up to which buildNode spawns threads so that there are a few subtrees per thread to balance the load. */
+        static size_t calcSpawnDepth(const size_t numThreads);
+
+        /*! Update the node's cost_ from its children's costs and boxes. */
+        static void updateNodeCost(BVHNode * const node);
+
+        /*! Recursively collect the visibility masks of the subtree from its items. @return The node's mask. */
+        uint32_t updateNodeVisibilityMask(BVHNode * const node);
+
+        /*! Recursively refit the boxes and costs of the subtree to the current boxes of its items. */
+        void refitNode(BVHNode * const node);
+
+        /*! Rebuild the topmost subtrees whose cost has degraded beyond BVHTREE_REFIT_REBUILD_COST_RATIO and return their number. */
+        size_t rebuildDegradedNodes(BVHNode * const node, const size_t numThreads);
+
+        /*! Rebuild the subtree below the node over the node's range of items. The node's box and item range are unchanged. */
+        void rebuildNode(BVHNode * const node, const size_t numThreads);
+
+        void calcNodeIntersection(const BVHNode * const node, const Ray &ray, const Vec3 &recipDir, Intersection &intersect) const;
+
+        bool calcNodeOcclusion(const BVHNode * const node, const Ray &ray, const Vec3 &recipDir, const float tMax) const;
+
+        uint32_t freezeNode(const BVHNode * const node);
+
+        static void offsetNodeItems(BVHNode * const node, const size_t offset);
+
+        /*! Make room in the item ranges of the subtree for a reference inserted into the leaf item vector at position, at
+         the end of the leaf that precedes it. */
+        static void insertNodeItemReference(BVHNode * const node, const size_t position);
+
+        /*! Remap the item ranges of the subtree after references were removed from the leaf item vector, drop the emptied
+         nodes and refit the boxes and costs of the nodes that lost references.
+         @param numKeptBefore The number of references kept before each old position (and before the old end).
+         @return The node, or nullptr if its whole subtree was dropped. */
+        BVHNode *removeNodeReferences(BVHNode * const node, const std::vector<uint32_t> &numKeptBefore);
+        static BVHNode *cloneNode(Pool<BVHNode> &nodePool, const BVHNode * const node);
+        
+        /*! Return the nodes of the subtree to the pool for reuse, e.g. when the subtree is rebuilt. */
+        static void deleteNode(Pool<BVHNode> &nodePool, BVHNode * const node);
+        static size_t countNodes(const BVHNode * const node);
+
+        //! The nodes of the hierarchy, which are freed together when the tree is cleared or linearised.
+        Pool<BVHNode> nodePool_;
+        
+        BVHNode *root_;
+        size_t numNodes_;
+
+        //! The items referenced by the leaves in leaf order. Items are referenced more than once if spatial splits cut them. Not owned.
+        std::vector<BoundingVolume *> leafItemVector_;
+
+        bool spatialSplits_;
+
+        //! The number of items (from the front of the itemVector) that are in the hierarchy.
+        size_t numTreeItems_;
+	};
+
+}
+
+
+#endif// STITCH_BVH_TREE_H
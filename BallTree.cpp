@@ -27,17 +27,159 @@
  */
 
 #include "BallTree.h"
+#include "BVHTree.h"
+#include "TriangleMesh.h"
+#include "TreeLayout.h"
 #include "Math/Plane.h"
 
 #include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+
+#include <emmintrin.h> //SSE2 for decoding the compact nodes.
+
+//=======================================================================//
+stitch::AABB stitch::FrozenCompactNode::getChildBounds(const size_t childNum) const
+{
+    const float scaleX=getScale(0);
+    const float scaleY=getScale(1);
+    const float scaleZ=getScale(2);
+    
+    return AABB(Vec3(origin_[0]+minX_[childNum]*scaleX, origin_[1]+minY_[childNum]*scaleY, origin_[2]+minZ_[childNum]*scaleZ),
+                Vec3(origin_[0]+maxX_[childNum]*scaleX, origin_[1]+maxY_[childNum]*scaleY, origin_[2]+maxZ_[childNum]*scaleZ));
+}
+
+bool stitch::FrozenCompactNode::quantise(const AABB * const childBounds)
+{
+    AABB bounds;
+    
+    for (size_t childNum=0; childNum<BALLTREE_WIDE_NODE_WIDTH; ++childNum)
+    {
+        if (((offset_[childNum]!=0)||(numItems_[childNum]!=0))&&(!childBounds[childNum].isEmpty()))
+        {
+            bounds.expand(childBounds[childNum]);
+        }
+    }
+    
+    if (bounds.isEmpty())
+    {//No child has a box so all of them are left at the origin.
+        bounds=AABB(Vec3(0.0f, 0.0f, 0.0f), Vec3(0.0f, 0.0f, 0.0f));
+    }
+    
+    uint8_t * const mins[3]={minX_, minY_, minZ_};
+    uint8_t * const maxs[3]={maxX_, maxY_, maxZ_};
+    
+    for (size_t axis=0; axis<3; ++axis)
+    {
+        const float boundsMin=bounds.min_[axis];
+        const float extent=bounds.max_[axis]-boundsMin;
+        
+        if (!std::isfinite(extent))
+        {
+            return false;
+        }
+        
+        //=== The smallest power of two scale at which 255 steps cover the extent ===
+        int exponent=-126;
+        
+        if (extent>0.0f)
+        {
+            frexpf(extent/255.0f, &exponent);
+            exponent=std::max(exponent, -126);
+            
+            exponent_[axis]=std::min(exponent, 127);
+            
+            if ((boundsMin+255.0f*getScale(axis))<bounds.max_[axis])
+            {//The division rounded down.
+                ++exponent;
+            }
+        }
+        
+        if (exponent>127)
+        {
+            return false;
+        }
+        //===
+        
+        origin_[axis]=boundsMin;
+        exponent_[axis]=exponent;
+        
+        const float scale=getScale(axis);
+        
+        for (size_t childNum=0; childNum<BALLTREE_WIDE_NODE_WIDTH; ++childNum)
+        {
+            const bool unused=(offset_[childNum]==0)&&(numItems_[childNum]==0);
+            
+            if ((unused)||(childBounds[childNum].isEmpty()))
+            {//A child without a box covers the node's box which is conservative.
+                mins[axis][childNum]=0;
+                maxs[axis][childNum]=unused ? 0 : 255;
+                continue;
+            }
+            
+            //=== Round outwards. Step back where the decoded bound rounded to the inside ===
+            const float childMin=childBounds[childNum].min_[axis];
+            const float childMax=childBounds[childNum].max_[axis];
+            
+            int minQ=std::min(std::max((int)floorf((childMin-boundsMin)/scale), 0), 255);
+            int maxQ=std::min(std::max((int)ceilf((childMax-boundsMin)/scale), 0), 255);
+            
+            while ((minQ>0)&&((boundsMin+minQ*scale)>childMin))
+            {
+                --minQ;
+            }
+            
+            while ((maxQ<255)&&((boundsMin+maxQ*scale)<childMax))
+            {
+                ++maxQ;
+            }
+            
+            if (((boundsMin+minQ*scale)>childMin)||((boundsMin+maxQ*scale)<childMax))
+            {
+                return false;
+            }
+            //===
+            
+            mins[axis][childNum]=minQ;
+            maxs[axis][childNum]=maxQ;
+        }
+    }
+    
+    return true;
+}
 
 stitch::BallTree::BallTree() :
-BoundingVolume()
+BoundingVolume(),
+frozenMesh_(nullptr),
+frozenStackSize_(0),
+frozenWideStackSize_(0),
+chunkSize_(0),
+compactChunkSize_(0),
+builtRadius_(0.0f),
+parent_(nullptr),
+itemIndex_(nullptr),
+editing_(false),
+editFrozen_(false),
+editWide_(false),
+editCompact_(false)
 {
 }
 
 stitch::BallTree::BallTree(const BallTree &lValue) :
-BoundingVolume(lValue)
+BoundingVolume(lValue),
+frozenMesh_(nullptr),
+frozenStackSize_(0),
+frozenWideStackSize_(0),
+chunkSize_(lValue.chunkSize_),
+compactChunkSize_(lValue.compactChunkSize_),
+builtRadius_(lValue.builtRadius_),
+parent_(nullptr),
+itemIndex_(nullptr),
+editing_(false),
+editFrozen_(false),
+editWide_(false),
+editCompact_(false)
 {
     std::vector<stitch::BoundingVolume *>::const_iterator itemIter=lValue.itemVector_.begin();
     for (; itemIter!=lValue.itemVector_.end(); ++itemIter)
@@ -49,6 +191,7 @@ BoundingVolume(lValue)
     for (; ballTreeIter!=lValue.ballTreeVector_.end(); ++ballTreeIter)
     {
         ballTreeVector_.push_back(new BallTree(*(*ballTreeIter)));
+        ballTreeVector_.back()->parent_=this;
     }
 }
 
@@ -57,6 +200,18 @@ stitch::BallTree::~BallTree()
     clear();
 }
 
+stitch::BallTree * stitch::BallTree::create(const TreeType treeType)
+{
+    switch (treeType) {
+        case SAH_BVH_TREE:
+            return new BVHTree;
+        case SAH_SBVH_TREE:
+            return new BVHTree(true);
+        default:
+            return new BallTree;
+    }
+}
+
 size_t stitch::BallTree::getNumItems() const
 {
     size_t numItems=itemVector_.size();
@@ -70,8 +225,61 @@ size_t stitch::BallTree::getNumItems() const
     return numItems;
 }
 
+size_t stitch::BallTree::getTreeMemorySize() const
+{
+    size_t treeMemorySize=sizeof(BallTree) +
+    itemVector_.capacity()*sizeof(stitch::BoundingVolume *) + ballTreeVector_.capacity()*sizeof(stitch::BallTree *) +
+    frozenNodeVector_.capacity()*sizeof(FrozenTreeNode) + frozenItemVector_.capacity()*sizeof(const stitch::BoundingVolume *) +
+    frozenTriangleVector_.capacity()*sizeof(uint32_t) + frozenTriangles_.getMemorySize() +
+    frozenWideNodeVector_.capacity()*sizeof(FrozenWideNode) + frozenCompactNodeVector_.capacity()*sizeof(FrozenCompactNode) +
+    (frozenNodeMaskVector_.capacity()+frozenWideMaskVector_.capacity())*sizeof(uint32_t);
+    
+    for (const auto itemPtr : itemVector_)
+    {
+        treeMemorySize+=itemPtr->getTreeMemorySize();
+    }
+    
+    for (const auto balltreePtr : ballTreeVector_)
+    {
+        treeMemorySize+=balltreePtr->getTreeMemorySize();
+    }
+    
+    return treeMemorySize;
+}
+
+size_t stitch::BallTree::getNumPrimitives() const
+{
+    size_t numPrimitives=0;
+    
+    if (frozenMesh_!=nullptr)
+    {//Spatial splits may reference a triangle from more than one leaf.
+        std::vector<uint8_t> referenced(frozenMesh_->getNumTriangles(), 0);
+        
+        for (const auto triangleIndex : frozenTriangleVector_)
+        {
+            referenced[triangleIndex]=1;
+        }
+        
+        numPrimitives=std::count(referenced.begin(), referenced.end(), 1);
+    }
+    
+    for (const auto itemPtr : itemVector_)
+    {
+        numPrimitives+=itemPtr->getNumPrimitives();
+    }
+    
+    for (const auto balltreePtr : ballTreeVector_)
+    {
+        numPrimitives+=balltreePtr->getNumPrimitives();
+    }
+    
+    return numPrimitives;
+}
+
 void stitch::BallTree::clear()
 {
+    unfreeze();
+    
     centre_=Vec3(0.0f, 0.0f, 0.0f);
     radiusBV_=((float)FLT_MAX);
     
@@ -92,20 +300,69 @@ void stitch::BallTree::clear()
     }
     
     ballTreeVector_.clear();
+    chunkSize_=0;
+    
+    if (parent_==nullptr)
+    {
+        clearItemIndex();
+    }
 }
 
 void stitch::BallTree::linearise()
 {//Collect all items into a linear list and delete the tree structure...
-    std::cout << "BallTree::linearise not implemented yet!\n";
-    std::cout.flush();
-    exit(-1);
+    unfreeze();
+    
+    for (auto ballTree : ballTreeVector_)
+    {
+        ballTree->linearise();
+        itemVector_.insert(itemVector_.end(), ballTree->itemVector_.begin(), ballTree->itemVector_.end());
+        
+        ballTree->itemVector_.clear();//The items are now owned by this node.
+        delete ballTree;
+    }
+    
+    ballTreeVector_.clear();
+    chunkSize_=0;
+    
+    if (parent_==nullptr)
+    {
+        clearItemIndex();
+    }
 }
 
 void stitch::BallTree::build(const size_t chunkSize, const uint8_t splitAxis)
 {
+    if (parent_==nullptr)
+    {//The items move to new nodes. The item index is made again when it is next needed.
+        clearItemIndex();
+    }
+    
+    buildSubtree(chunkSize, splitAxis);
+    
+    if (parent_!=nullptr)
+    {//E.g. a leaf split by insertItem.
+        reindexItems();
+    }
+}
+
+void stitch::BallTree::buildSubtree(const size_t chunkSize, const uint8_t splitAxis)
+{
+    unfreeze();
+    
+    chunkSize_=chunkSize;
+    
+    if (itemVector_.size()<=chunkSize)
+    {
+        updateNodeBV();
+        builtRadius_=radiusBV_;
+        return;
+    }
+    
     //New potential child trees.
     BallTree *tree0=new BallTree;
     BallTree *tree1=new BallTree;
+    tree0->parent_=this;
+    tree1->parent_=this;
     
     
     //=== Find centre of items ===
@@ -239,107 +496,2096 @@ void stitch::BallTree::build(const size_t chunkSize, const uint8_t splitAxis)
         {
             ballTreeVector_.push_back(tree0);//Add child tree. There can be more than two child trees if the build mehod is called multiple times.
         }
-        if (tree0->itemVector_.size()>chunkSize)
-        {
-            tree0->build(chunkSize, (splitAxis+1)%3);//Recursively build the tree.
-        }
+        tree0->buildSubtree(chunkSize, (splitAxis+1)%3);//Recursively build the tree. Also calculates the bounding volume of a leaf.
         
         if (tree1->itemVector_.size()>0)
         {
             ballTreeVector_.push_back(tree1);//Add child tree. There can be more than two child trees if the build mehod is called multiple times.
         }
-        if (tree1->itemVector_.size()>chunkSize)
-        {
-            tree1->build(chunkSize, (splitAxis+1)%3);//Recursively build the tree.
-        }
+        tree1->buildSubtree(chunkSize, (splitAxis+1)%3);//Recursively build the tree. Also calculates the bounding volume of a leaf.
     }
     //====================================================================
+    
+    updateNodeBV();//Bounding volume calculated in the same pass as the build.
+    builtRadius_=radiusBV_;
 }
 
 
-void stitch::BallTree::updateBV()
-{//! @todo Should be done in one traversal of the tree!
-    std::vector<stitch::BoundingVolume *>::const_iterator constItemIter=itemVector_.begin();
-    centre_.setZeros();
-    radiusBV_=0.0f;
+void stitch::BallTree::insertItem(BoundingVolume * const item)
+{
+    if (!hasBuildHierarchy())
+    {
+        addItem(item);
+        return;
+    }
     
-    size_t numBoundingSpheres=0;
+    const bool frozen=isFrozen();
+    const bool wide=isFrozenWide();
     
-    //=== Traversal 1: Find boundingSphereCentre_ ===//
-    std::vector<stitch::BallTree *>::const_iterator constBallTreeIter=ballTreeVector_.begin();
-    for (; constBallTreeIter!=ballTreeVector_.end(); ++constBallTreeIter)
-    {//Do a linear search through the ballTrees.
-        stitch::BallTree *ballTree=*constBallTreeIter;
-        ballTree->updateBV();
-        centre_+=ballTree->centre_;
-        ++numBoundingSpheres;
+    unfreeze();
+    insertNodeItem(item);
+    refreeze(frozen, wide);
+}
+
+void stitch::BallTree::insertNodeItem(BoundingVolume * const item)
+{
+    if (ballTreeVector_.empty())
+    {//Leaf.
+        itemVector_.push_back(item);
+        
+        BallTree * const root=getRoot();
+        
+        if (root->itemIndex_!=nullptr)
+        {
+            (*root->itemIndex_)[item]=this;
+        }
+        
+        if (itemVector_.size()>chunkSize_)
+        {
+            build(chunkSize_, 0);//Split the leaf. Also calculates its bounding volume.
+        } else
+        {
+            updateNodeBV();
+        }
+        
+        return;
     }
     
-    for (; constItemIter!=itemVector_.end(); ++constItemIter)
-    {//Do a linear search through the items.
-        stitch::BoundingVolume *item=*constItemIter;
-        centre_+=item->centre_;
-        ++numBoundingSpheres;
-    }
+    //=== Find the child whose bounding sphere grows the least to enclose the item ===
+    BallTree *bestBallTree=nullptr;
+    float bestGrowth=0.0f;
     
-    centre_*=1.0f/numBoundingSpheres;
-    //=================================//
+    for (const auto ballTree : ballTreeVector_)
+    {
+        const float growth=MathUtil::max(Vec3::calcDistToPoint(ballTree->centre_, item->centre_)+item->radiusBV_-ballTree->radiusBV_, 0.0f);
+        
+        if ((bestBallTree==nullptr)||(growth<bestGrowth)||((growth==bestGrowth)&&(ballTree->radiusBV_<bestBallTree->radiusBV_)))
+        {//Ties (e.g. items inside several children) go to the smaller child.
+            bestBallTree=ballTree;
+            bestGrowth=growth;
+        }
+    }
+    //===
     
+    bestBallTree->insertNodeItem(item);
     
-    //=== Traversal 2: Find boundingSphereRadius_ ===//
-    constBallTreeIter=ballTreeVector_.begin();
-    for (; constBallTreeIter!=ballTreeVector_.end(); ++constBallTreeIter)
-    {//Do a linear search through the ballTrees.
-        stitch::BallTree *ballTree=*constBallTreeIter;
-        float r=Vec3::calcDistToPoint(ballTree->centre_, centre_)+ballTree->radiusBV_;
+    if (!rebuildDegradedNode(bestBallTree))
+    {
+        updateNodeBV();
+    }
+}
+
+bool stitch::BallTree::removeItem(BoundingVolume * const item)
+{
+    if (!hasBuildHierarchy())
+    {
+        const std::vector<stitch::BoundingVolume *>::iterator itemIter=std::find(itemVector_.begin(), itemVector_.end(), item);
         
-        if (r>radiusBV_)
+        if (itemIter==itemVector_.end())
         {
-            radiusBV_=r;
+            return false;
         }
+        
+        unfreeze();
+        itemVector_.erase(itemIter);
+        return true;
     }
     
-    constItemIter=itemVector_.begin();
-    for (; constItemIter!=itemVector_.end(); ++constItemIter)
-    {//Do a linear search through the items.
-        stitch::BoundingVolume *item=*constItemIter;
-        float r=Vec3::calcDistToPoint(item->centre_, centre_)+item->radiusBV_;
-        
-        if (r>radiusBV_)
+    const bool frozen=isFrozen();
+    const bool wide=isFrozenWide();
+    
+    if (!removeNodeItem(item))
+    {
+        return false;
+    }
+    
+    unfreeze();//The frozen form references the removed item.
+    refreeze(frozen, wide);
+    
+    return true;
+}
+
+void stitch::BallTree::beginEdits()
+{
+    if (editing_)
+    {
+        return;
+    }
+    
+    editing_=true;
+    editFrozen_=isFrozen();
+    editWide_=isFrozenWide();
+    editCompact_=isFrozenCompact();
+    
+    if (hasBuildHierarchy())
+    {//The edits then leave the tree unfrozen.
+        unfreeze();
+    }
+}
+
+void stitch::BallTree::endEdits()
+{
+    if (!editing_)
+    {
+        return;
+    }
+    
+    editing_=false;
+    
+    if (editCompact_)
+    {
+        if ((!isFrozenCompact())&&(compactChunkSize_!=0))
+        {//Edited. A tree set up compact from a cache has no chunkSize to build with and is left to the caller, as after addItem.
+            rebuildCompact();
+        }
+    } else
+        if (hasBuildHierarchy())
         {
-            radiusBV_=r;
+            refreeze(editFrozen_, editWide_);
         }
+}
+
+bool stitch::BallTree::removeNodeItem(const BoundingVolume * const item)
+{
+    BallTree *node=findItemNode(item);
+    
+    if (node==nullptr)
+    {
+        return false;
     }
-    //==================================//
     
+    node->itemVector_.erase(std::find(node->itemVector_.begin(), node->itemVector_.end(), item));
+    node->updateNodeBV();
+    
+    itemIndex_->erase(item);
+    
+    //=== Update the nodes on the way back up to the root ===
+    while (node->parent_!=nullptr)
+    {
+        BallTree * const parent=node->parent_;
+        parent->updateRemovedChild(node);//May delete node.
+        node=parent;
+    }
+    //===
+    
+    return true;
 }
 
-void stitch::BallTree::calcIntersection(const Ray &ray, Intersection &intersect) const
+void stitch::BallTree::updateRemovedChild(BallTree * const child)
 {
-    //if (BVIntersected(orig, normDir)) This is currently executed by the calling code!
-    {
-        //=== 1) Find closest ray-item intersection. ===
-        for (const auto itemPtr : itemVector_)
-        {//Do a linear search through the items stored in this tree node.
-            if (itemPtr->BVIntersected(ray))
-            {
-                itemPtr->calcIntersection(ray, intersect);
-            }
+    if ((child->itemVector_.empty())&&(child->ballTreeVector_.empty()))
+    {//Drop the emptied child.
+        ballTreeVector_.erase(std::find(ballTreeVector_.begin(), ballTreeVector_.end(), child));
+        delete child;
+    } else
+        if (rebuildDegradedNode(child))
+        {
+            return;
         }
-        //============================================
-        
-        //=== 2) Continue closest ray-item intersection to the items stored in the tree children. ===
-        for (const auto balltreePtr : ballTreeVector_)
-        {//Do a linear search through the child trees.
-            if (balltreePtr->BVIntersected(ray))
-            {
-                balltreePtr->calcIntersection(ray, intersect);
-            }
+    
+    if ((ballTreeVector_.size()==1)&&(itemVector_.empty()))
+    {//Take over the content of the only child so that the tree does not grow chains of single children.
+        collapseChild();
+    }
+    
+    updateNodeBV();
+}
+
+void stitch::BallTree::collapseChild()
+{
+    BallTree * const child=ballTreeVector_[0];
+    
+    itemVector_.swap(child->itemVector_);
+    ballTreeVector_.swap(child->ballTreeVector_);
+    
+    child->ballTreeVector_.clear();//Now only references the child itself.
+    delete child;
+    
+    for (const auto ballTree : ballTreeVector_)
+    {
+        ballTree->parent_=this;
+    }
+    
+    BallTree * const root=getRoot();
+    
+    if (root->itemIndex_!=nullptr)
+    {
+        for (const auto item : itemVector_)
+        {
+            (*root->itemIndex_)[item]=this;
         }
-        //============================================
     }
 }
 
+stitch::BallTree *stitch::BallTree::getRoot()
+{
+    BallTree *root=this;
+    
+    while (root->parent_!=nullptr)
+    {
+        root=root->parent_;
+    }
+    
+    return root;
+}
+
+stitch::BallTree *stitch::BallTree::findItemNode(const BoundingVolume * const item)
+{
+    if (itemIndex_==nullptr)
+    {
+        itemIndex_=new std::unordered_map<const stitch::BoundingVolume *, BallTree *>;
+        indexItems(*itemIndex_);
+    }
+    
+    const std::unordered_map<const stitch::BoundingVolume *, BallTree *>::const_iterator indexIter=itemIndex_->find(item);
+    
+    return (indexIter!=itemIndex_->end()) ? indexIter->second : nullptr;
+}
+
+void stitch::BallTree::indexItems(std::unordered_map<const stitch::BoundingVolume *, BallTree *> &itemIndex)
+{
+    for (const auto item : itemVector_)
+    {
+        itemIndex[item]=this;
+    }
+    
+    for (const auto ballTree : ballTreeVector_)
+    {
+        ballTree->indexItems(itemIndex);
+    }
+}
+
+void stitch::BallTree::reindexItems()
+{
+    BallTree * const root=getRoot();
+    
+    if (root->itemIndex_!=nullptr)
+    {
+        indexItems(*root->itemIndex_);
+    }
+}
+
+void stitch::BallTree::clearItemIndex()
+{
+    delete itemIndex_;
+    itemIndex_=nullptr;
+}
+
+bool stitch::BallTree::rebuildDegradedNode(const BallTree * const child)
+{
+    if (child->radiusBV_<=(child->builtRadius_*BALLTREE_REBUILD_RADIUS_RATIO))
+    {
+        return false;
+    }
+    
+    const size_t chunkSize=chunkSize_;
+    const float builtRadius=builtRadius_;
+    
+    linearise();
+    build(chunkSize, 0);
+    
+    builtRadius_=builtRadius;
+    
+    return true;
+}
+
+void stitch::BallTree::updateBV()
+{
+    if (frozenMesh_!=nullptr)
+    {
+        updateFrozenMeshBV();
+        return;
+    }
+    
+    for (const auto ballTree : ballTreeVector_)
+    {
+        ballTree->updateBV();
+    }
+    
+    updateNodeBV();
+}
+
+size_t stitch::BallTree::rebuildDegradedNodes()
+{
+    for (const auto ballTree : ballTreeVector_)
+    {
+        if (rebuildDegradedNode(ballTree))
+        {//The whole node was rebuilt, including the other children.
+            return 1;
+        }
+    }
+    
+    size_t numRebuiltNodes=0;
+    
+    for (const auto ballTree : ballTreeVector_)
+    {
+        numRebuiltNodes+=ballTree->rebuildDegradedNodes();
+    }
+    
+    if (numRebuiltNodes>0)
+    {
+        updateNodeBV();
+    }
+    
+    return numRebuiltNodes;
+}
+
+size_t stitch::BallTree::refit()
+{
+    updateBV();
+    
+    const size_t numRebuiltNodes=rebuildDegradedNodes();
+    
+    if (numRebuiltNodes>0)
+    {//The rebuilt nodes reordered their items so the frozen form is replaced.
+        const bool frozen=isFrozen();
+        const bool wide=isFrozenWide();
+        
+        unfreeze();
+        refreeze(frozen, wide);
+        
+        return numRebuiltNodes;
+    }
+    
+    if (!refitFrozen())
+    {//The refitted boxes of the compact tree could not be quantised.
+        rebuildCompact();
+        return 1;
+    }
+    
+    return 0;
+}
+
+void stitch::BallTree::updateNodeBV()
+{
+    std::vector<stitch::BoundingVolume *>::const_iterator constItemIter=itemVector_.begin();
+    centre_.setZeros();
+    radiusBV_=0.0f;
+    visibilityMask_=0;
+    
+    size_t numBoundingSpheres=0;
+    
+    //=== Traversal 1: Find boundingSphereCentre_ ===//
+    std::vector<stitch::BallTree *>::const_iterator constBallTreeIter=ballTreeVector_.begin();
+    for (; constBallTreeIter!=ballTreeVector_.end(); ++constBallTreeIter)
+    {//Do a linear search through the ballTrees.
+        stitch::BallTree *ballTree=*constBallTreeIter;
+        centre_+=ballTree->centre_;
+        visibilityMask_|=ballTree->visibilityMask_;
+        ++numBoundingSpheres;
+    }
+    
+    for (; constItemIter!=itemVector_.end(); ++constItemIter)
+    {//Do a linear search through the items.
+        stitch::BoundingVolume *item=*constItemIter;
+        centre_+=item->centre_;
+        visibilityMask_|=item->visibilityMask_;
+        ++numBoundingSpheres;
+    }
+    
+    if (numBoundingSpheres==0)
+    {//Empty tree.
+        return;
+    }
+    
+    centre_*=1.0f/numBoundingSpheres;
+    //=================================//
+    
+    
+    //=== Traversal 2: Find boundingSphereRadius_ ===//
+    constBallTreeIter=ballTreeVector_.begin();
+    for (; constBallTreeIter!=ballTreeVector_.end(); ++constBallTreeIter)
+    {//Do a linear search through the ballTrees.
+        stitch::BallTree *ballTree=*constBallTreeIter;
+        float r=Vec3::calcDistToPoint(ballTree->centre_, centre_)+ballTree->radiusBV_;
+        
+        if (r>radiusBV_)
+        {
+            radiusBV_=r;
+        }
+    }
+    
+    constItemIter=itemVector_.begin();
+    for (; constItemIter!=itemVector_.end(); ++constItemIter)
+    {//Do a linear search through the items.
+        stitch::BoundingVolume *item=*constItemIter;
+        float r=Vec3::calcDistToPoint(item->centre_, centre_)+item->radiusBV_;
+        
+        if (r>radiusBV_)
+        {
+            radiusBV_=r;
+        }
+    }
+    //==================================//
+    
+}
+
+stitch::AABB stitch::BallTree::getAABB() const
+{
+    AABB box;
+    
+    for (const auto triangleIndex : frozenTriangleVector_)
+    {
+        box.expand(frozenMesh_->getTriangleAABB(triangleIndex));
+    }
+    
+    for (const auto itemPtr : itemVector_)
+    {
+        box.expand(itemPtr->getAABB());
+    }
+    
+    for (const auto balltreePtr : ballTreeVector_)
+    {
+        box.expand(balltreePtr->getAABB());
+    }
+    
+    return box;
+}
+
+void stitch::BallTree::freeze()
+{
+    unfreeze();
+    
+    freezeBallTreeNode(this);
+    updateFrozenStackSize();
+    
+    frozenTriangles_.assign(frozenItemVector_);
+    updateFrozenVisibilityMasks();
+}
+
+void stitch::BallTree::unfreeze()
+{
+    std::vector<FrozenTreeNode>().swap(frozenNodeVector_);
+    std::vector<const stitch::BoundingVolume *>().swap(frozenItemVector_);
+    frozenMesh_=nullptr;
+    std::vector<uint32_t>().swap(frozenTriangleVector_);
+    frozenTriangles_.clear();
+    frozenStackSize_=0;
+    
+    std::vector<FrozenWideNode>().swap(frozenWideNodeVector_);
+    frozenWideStackSize_=0;
+    
+    std::vector<FrozenCompactNode>().swap(frozenCompactNodeVector_);
+    
+    std::vector<uint32_t>().swap(frozenNodeMaskVector_);
+    std::vector<uint32_t>().swap(frozenWideMaskVector_);
+}
+
+void stitch::BallTree::refreeze(const bool frozen, const bool wide)
+{
+    if (wide)
+    {
+        freezeWide();
+    } else
+        if (frozen)
+        {
+            freeze();
+        }
+}
+
+void stitch::BallTree::refreezeLike(const BallTree &other)
+{
+    if (other.frozenMesh_!=nullptr)
+    {//The clone references the same triangles of the shared mesh.
+        setFrozen(other.frozenMesh_, other.frozenTriangleVector_, other.frozenNodeVector_.data(), other.frozenNodeVector_.size(),
+                  other.frozenWideNodeVector_.data(), other.frozenWideNodeVector_.size(),
+                  other.frozenCompactNodeVector_.data(), other.frozenCompactNodeVector_.size());
+        return;
+    }
+    
+    if (((other.isFrozen())||(other.isFrozenCompact()))&&(other.ballTreeVector_.empty())&&(ballTreeVector_.empty())&&(itemVector_.size()==other.itemVector_.size()))
+    {//Reference this tree's item at the same position as each of the other tree's frozen items.
+        std::unordered_map<const BoundingVolume *, const BoundingVolume *> itemClones;
+        
+        const size_t numItems=itemVector_.size();
+        for (size_t itemNum=0; itemNum<numItems; ++itemNum)
+        {
+            itemClones[other.itemVector_[itemNum]]=itemVector_[itemNum];
+        }
+        
+        std::vector<const stitch::BoundingVolume *> frozenItems;
+        frozenItems.reserve(other.frozenItemVector_.size());
+        
+        for (const auto itemPtr : other.frozenItemVector_)
+        {
+            frozenItems.push_back(itemClones[itemPtr]);
+        }
+        
+        setFrozen(frozenItems, other.frozenNodeVector_.data(), other.frozenNodeVector_.size(),
+                  other.frozenWideNodeVector_.data(), other.frozenWideNodeVector_.size(),
+                  other.frozenCompactNodeVector_.data(), other.frozenCompactNodeVector_.size());
+        return;
+    }
+    
+    if (other.isFrozenCompact())
+    {
+        freezeCompact();
+    } else
+        if (other.isFrozenWide())
+        {
+            freezeWide();
+        } else
+            if (other.isFrozen())
+            {
+                freeze();
+            }
+}
+
+bool stitch::BallTree::refitFrozen()
+{
+    if (frozenMesh_!=nullptr)
+    {//The triangles of the mesh do not move.
+        return true;
+    }
+    
+    if (!frozenTriangles_.empty())
+    {
+        frozenTriangles_.assign(frozenItemVector_);
+    }
+    
+    for (size_t nodeIndex=frozenNodeVector_.size(); nodeIndex>0; --nodeIndex)
+    {
+        FrozenTreeNode &node=frozenNodeVector_[nodeIndex-1];
+        AABB bounds;
+        
+        if (node.isLeaf())
+        {
+            const size_t endItem=node.offset_+node.numItems_;
+            
+            for (size_t itemNum=node.offset_; itemNum<endItem; ++itemNum)
+            {
+                bounds.expand(frozenItemVector_[itemNum]->getAABB());
+            }
+        } else
+        {
+            for (uint32_t childIndex=nodeIndex; childIndex<node.offset_; childIndex=frozenNodeVector_[childIndex].getSkipIndex(childIndex))
+            {
+                bounds.expand(frozenNodeVector_[childIndex].bounds_);
+            }
+        }
+        
+        node.bounds_=bounds;
+    }
+    
+    for (size_t wideNodeIndex=frozenWideNodeVector_.size(); wideNodeIndex>0; --wideNodeIndex)
+    {
+        FrozenWideNode &wideNode=frozenWideNodeVector_[wideNodeIndex-1];
+        
+        for (size_t slotNum=0; slotNum<BALLTREE_WIDE_NODE_WIDTH; ++slotNum)
+        {
+            AABB bounds;
+            
+            if (wideNode.numItems_[slotNum]!=0)
+            {//Leaf child.
+                const size_t endItem=wideNode.offset_[slotNum]+wideNode.numItems_[slotNum];
+                
+                for (size_t itemNum=wideNode.offset_[slotNum]; itemNum<endItem; ++itemNum)
+                {
+                    bounds.expand(frozenItemVector_[itemNum]->getAABB());
+                }
+            } else
+                if (wideNode.offset_[slotNum]!=0)
+                {//Interior child. The union of the child wide node's used slots.
+                    const FrozenWideNode &childNode=frozenWideNodeVector_[wideNode.offset_[slotNum]];
+                    
+                    for (size_t childSlotNum=0; childSlotNum<BALLTREE_WIDE_NODE_WIDTH; ++childSlotNum)
+                    {
+                        if ((childNode.offset_[childSlotNum]!=0)||(childNode.numItems_[childSlotNum]!=0))
+                        {
+                            bounds.expand(AABB(Vec3(childNode.minX_[childSlotNum], childNode.minY_[childSlotNum], childNode.minZ_[childSlotNum]),
+                                               Vec3(childNode.maxX_[childSlotNum], childNode.maxY_[childSlotNum], childNode.maxZ_[childSlotNum])));
+                        }
+                    }
+                } else
+                {//Unused slot.
+                    continue;
+                }
+            
+            wideNode.minX_[slotNum]=bounds.min_.x();
+            wideNode.minY_[slotNum]=bounds.min_.y();
+            wideNode.minZ_[slotNum]=bounds.min_.z();
+            wideNode.maxX_[slotNum]=bounds.max_.x();
+            wideNode.maxY_[slotNum]=bounds.max_.y();
+            wideNode.maxZ_[slotNum]=bounds.max_.z();
+        }
+    }
+    
+    for (size_t compactNodeIndex=frozenCompactNodeVector_.size(); compactNodeIndex>0; --compactNodeIndex)
+    {
+        FrozenCompactNode &compactNode=frozenCompactNodeVector_[compactNodeIndex-1];
+        AABB childBounds[BALLTREE_WIDE_NODE_WIDTH];
+        
+        for (size_t slotNum=0; slotNum<BALLTREE_WIDE_NODE_WIDTH; ++slotNum)
+        {
+            if (compactNode.numItems_[slotNum]!=0)
+            {//Leaf child.
+                const size_t endItem=compactNode.offset_[slotNum]+compactNode.numItems_[slotNum];
+                
+                for (size_t itemNum=compactNode.offset_[slotNum]; itemNum<endItem; ++itemNum)
+                {
+                    childBounds[slotNum].expand(frozenItemVector_[itemNum]->getAABB());
+                }
+            } else
+                if (compactNode.offset_[slotNum]!=0)
+                {//Interior child. The union of the child compact node's decoded used slots.
+                    const FrozenCompactNode &childNode=frozenCompactNodeVector_[compactNode.offset_[slotNum]];
+                    
+                    for (size_t childSlotNum=0; childSlotNum<BALLTREE_WIDE_NODE_WIDTH; ++childSlotNum)
+                    {
+                        if ((childNode.offset_[childSlotNum]!=0)||(childNode.numItems_[childSlotNum]!=0))
+                        {
+                            childBounds[slotNum].expand(childNode.getChildBounds(childSlotNum));
+                        }
+                    }
+                }
+        }
+        
+        if (!compactNode.quantise(childBounds))
+        {//The items moved out of the range that the compact nodes can represent.
+            unfreeze();
+            return false;
+        }
+    }
+    
+    updateFrozenVisibilityMasks();
+    
+    return true;
+}
+
+void stitch::BallTree::rebuildCompact()
+{
+    build(compactChunkSize_, 0);
+    freezeCompact();
+}
+
+void stitch::BallTree::updateFrozenVisibilityMasks()
+{
+    std::vector<uint32_t>().swap(frozenNodeMaskVector_);
+    std::vector<uint32_t>().swap(frozenWideMaskVector_);
+    
+    bool allVisible=true;
+    
+    for (const auto itemPtr : frozenItemVector_)
+    {
+        allVisible=allVisible&&(itemPtr->visibilityMask_==RAY_VISIBILITY_ALL);
+    }
+    
+    if (allVisible)
+    {
+        return;
+    }
+    
+    //=== Binary nodes. Children follow their parent so the nodes are processed in reverse ===
+    frozenNodeMaskVector_.assign(frozenNodeVector_.size(), 0);
+    
+    for (size_t nodeIndex=frozenNodeVector_.size(); nodeIndex>0; --nodeIndex)
+    {
+        const FrozenTreeNode &node=frozenNodeVector_[nodeIndex-1];
+        uint32_t visibilityMask=0;
+        
+        if (node.isLeaf())
+        {
+            const size_t endItem=node.offset_+node.numItems_;
+            
+            for (size_t itemNum=node.offset_; itemNum<endItem; ++itemNum)
+            {
+                visibilityMask|=frozenItemVector_[itemNum]->visibilityMask_;
+            }
+        } else
+        {
+            for (uint32_t childIndex=nodeIndex; childIndex<node.offset_; childIndex=frozenNodeVector_[childIndex].getSkipIndex(childIndex))
+            {
+                visibilityMask|=frozenNodeMaskVector_[childIndex];
+            }
+        }
+        
+        frozenNodeMaskVector_[nodeIndex-1]=visibilityMask;
+    }
+    //===
+    
+    if (isFrozenCompact())
+    {
+        updateFrozenWideVisibilityMasks(frozenCompactNodeVector_);
+    } else
+        if (isFrozenWide())
+        {
+            updateFrozenWideVisibilityMasks(frozenWideNodeVector_);
+        }
+}
+
+template <class WideNode>
+void stitch::BallTree::updateFrozenWideVisibilityMasks(const std::vector<WideNode> &wideNodes)
+{
+    frozenWideMaskVector_.assign(wideNodes.size()*BALLTREE_WIDE_NODE_WIDTH, 0);
+    
+    for (size_t wideNodeIndex=wideNodes.size(); wideNodeIndex>0; --wideNodeIndex)
+    {
+        const WideNode &wideNode=wideNodes[wideNodeIndex-1];
+        uint32_t * const slotMasks=&frozenWideMaskVector_[(wideNodeIndex-1)*BALLTREE_WIDE_NODE_WIDTH];
+        
+        for (size_t slotNum=0; slotNum<BALLTREE_WIDE_NODE_WIDTH; ++slotNum)
+        {
+            if (wideNode.numItems_[slotNum]!=0)
+            {//Leaf child.
+                const size_t endItem=wideNode.offset_[slotNum]+wideNode.numItems_[slotNum];
+                
+                for (size_t itemNum=wideNode.offset_[slotNum]; itemNum<endItem; ++itemNum)
+                {
+                    slotMasks[slotNum]|=frozenItemVector_[itemNum]->visibilityMask_;
+                }
+            } else
+                if (wideNode.offset_[slotNum]!=0)
+                {//Interior child. The union of the child node's slots. Unused slots have no mask.
+                    const uint32_t * const childSlotMasks=&frozenWideMaskVector_[wideNode.offset_[slotNum]*BALLTREE_WIDE_NODE_WIDTH];
+                    
+                    for (size_t childSlotNum=0; childSlotNum<BALLTREE_WIDE_NODE_WIDTH; ++childSlotNum)
+                    {
+                        slotMasks[slotNum]|=childSlotMasks[childSlotNum];
+                    }
+                }
+        }
+    }
+}
+
+void stitch::BallTree::setFrozen(const std::vector<const stitch::BoundingVolume *> &frozenItems,
+                                 const FrozenTreeNode * const nodes, const size_t numNodes,
+                                 const FrozenWideNode * const wideNodes, const size_t numWideNodes,
+                                 const FrozenCompactNode * const compactNodes, const size_t numCompactNodes)
+{
+    unfreeze();
+    
+    frozenNodeVector_.assign(nodes, nodes+numNodes);
+    frozenItemVector_=frozenItems;
+    updateFrozenStackSize();
+    
+    frozenWideNodeVector_.assign(wideNodes, wideNodes+numWideNodes);
+    frozenCompactNodeVector_.assign(compactNodes, compactNodes+numCompactNodes);
+    updateFrozenWideStackSize();
+    
+    if (numCompactNodes==0)
+    {//The compact form only keeps the item references to save memory.
+        frozenTriangles_.assign(frozenItemVector_);
+    }
+    
+    updateFrozenVisibilityMasks();
+}
+
+void stitch::BallTree::freezeMesh(const TriangleMesh * const mesh)
+{
+    if (((!isFrozen())&&(!isFrozenCompact()))||(frozenMesh_!=nullptr))
+    {
+        return;
+    }
+    
+    std::vector<uint32_t> frozenTriangles;
+    frozenTriangles.reserve(frozenItemVector_.size());
+    
+    for (const auto itemPtr : frozenItemVector_)
+    {//The items of the tree are all triangles of the mesh.
+        frozenTriangles.push_back(static_cast<const MeshTriangle *>(itemPtr)->triangleIndex_);
+    }
+    
+    //=== Keep the nodes since setFrozen clears the tree ===
+    std::vector<FrozenTreeNode> nodes;
+    nodes.swap(frozenNodeVector_);
+    
+    std::vector<FrozenWideNode> wideNodes;
+    wideNodes.swap(frozenWideNodeVector_);
+    
+    std::vector<FrozenCompactNode> compactNodes;
+    compactNodes.swap(frozenCompactNodeVector_);
+    //===
+    
+    //=== Release the MeshTriangles without deleting them, they belong to whoever allocated them ===
+    linearise();
+    std::vector<stitch::BoundingVolume *>().swap(itemVector_);
+    //===
+    
+    setFrozen(mesh, frozenTriangles, nodes.data(), nodes.size(), wideNodes.data(), wideNodes.size(), compactNodes.data(), compactNodes.size());
+}
+
+void stitch::BallTree::setFrozen(const TriangleMesh * const mesh, const std::vector<uint32_t> &frozenTriangles,
+                                 const FrozenTreeNode * const nodes, const size_t numNodes,
+                                 const FrozenWideNode * const wideNodes, const size_t numWideNodes,
+                                 const FrozenCompactNode * const compactNodes, const size_t numCompactNodes)
+{
+    clear();
+    
+    frozenNodeVector_.assign(nodes, nodes+numNodes);
+    frozenMesh_=mesh;
+    frozenTriangleVector_=frozenTriangles;
+    updateFrozenStackSize();
+    
+    frozenWideNodeVector_.assign(wideNodes, wideNodes+numWideNodes);
+    frozenCompactNodeVector_.assign(compactNodes, compactNodes+numCompactNodes);
+    updateFrozenWideStackSize();
+    
+    if (numCompactNodes==0)
+    {//The compact form only keeps the triangle indices to save memory.
+        frozenTriangles_.assign(*frozenMesh_, frozenTriangleVector_);
+    }
+    
+    //The triangles of a mesh are visible to all rays so no visibility masks are kept.
+    updateFrozenMeshBV();
+}
+
+void stitch::BallTree::updateFrozenMeshBV()
+{
+    const AABB box=BallTree::getAABB();
+    
+    if (!box.isEmpty())
+    {
+        centre_=box.centroid();
+        radiusBV_=box.boundingSphereRadius();
+    } else
+    {
+        centre_.setZeros();
+        radiusBV_=0.0f;
+    }
+    
+    visibilityMask_=RAY_VISIBILITY_ALL;
+}
+
+uint32_t stitch::BallTree::freezeBallTreeNode(const BallTree * const ballTree)
+{
+    if (ballTree->ballTreeVector_.empty())
+    {
+        frozenItemVector_.insert(frozenItemVector_.end(), ballTree->itemVector_.begin(), ballTree->itemVector_.end());
+        
+        return addFrozenLeaf(frozenItemVector_.size()-ballTree->itemVector_.size(), frozenItemVector_.size());
+    }
+    
+    const uint32_t nodeIndex=frozenNodeVector_.size();
+    frozenNodeVector_.push_back(FrozenTreeNode());
+    
+    AABB bounds;
+    
+    if (!ballTree->itemVector_.empty())
+    {//The items of an interior node become a leaf child.
+        frozenItemVector_.insert(frozenItemVector_.end(), ballTree->itemVector_.begin(), ballTree->itemVector_.end());
+        
+        const uint32_t leafIndex=addFrozenLeaf(frozenItemVector_.size()-ballTree->itemVector_.size(), frozenItemVector_.size());
+        bounds.expand(frozenNodeVector_[leafIndex].bounds_);
+    }
+    
+    for (const auto childBallTree : ballTree->ballTreeVector_)
+    {
+        const uint32_t childIndex=freezeBallTreeNode(childBallTree);
+        bounds.expand(frozenNodeVector_[childIndex].bounds_);
+    }
+    
+    //Note: frozenNodeVector_ might have been reallocated by the children.
+    frozenNodeVector_[nodeIndex].bounds_=bounds;
+    frozenNodeVector_[nodeIndex].offset_=frozenNodeVector_.size();
+    
+    return nodeIndex;
+}
+
+uint32_t stitch::BallTree::addFrozenLeaf(const size_t firstItem, const size_t endItem)
+{
+    FrozenTreeNode node;
+    
+    for (size_t itemNum=firstItem; itemNum<endItem; ++itemNum)
+    {
+        node.bounds_.expand(frozenItemVector_[itemNum]->getAABB());
+    }
+    
+    if (endItem>firstItem)
+    {
+        node.offset_=firstItem;
+        node.numItems_=endItem-firstItem;
+    } else
+    {//An empty leaf is stored as an interior node without children.
+        node.offset_=frozenNodeVector_.size()+1;
+    }
+    
+    frozenNodeVector_.push_back(node);
+    
+    return frozenNodeVector_.size()-1;
+}
+
+void stitch::BallTree::updateFrozenStackSize()
+{//A node's children are pushed together so the stack needs at most the sum of the number of children along a path.
+    const uint32_t numNodes=frozenNodeVector_.size();
+    std::vector<size_t> subtreeStackSizes(numNodes, 0);
+    
+    for (uint32_t nodeIndex=numNodes; nodeIndex>0; --nodeIndex)
+    {//Children follow their parent so the nodes are processed in reverse.
+        const FrozenTreeNode &node=frozenNodeVector_[nodeIndex-1];
+        
+        if (!node.isLeaf())
+        {
+            size_t numChildren=0;
+            size_t maxChildStackSize=0;
+            
+            for (uint32_t childIndex=nodeIndex; childIndex<node.offset_; childIndex=frozenNodeVector_[childIndex].getSkipIndex(childIndex))
+            {
+                ++numChildren;
+                maxChildStackSize=std::max(maxChildStackSize, subtreeStackSizes[childIndex]);
+            }
+            
+            subtreeStackSizes[nodeIndex-1]=numChildren+maxChildStackSize;
+        }
+    }
+    
+    frozenStackSize_=(numNodes>0) ? (subtreeStackSizes[0]+1) : 0;
+}
+
+namespace {
+    //! The traversal stack size of wide (or compact) nodes whose interior children follow their parent.
+    template <class WideNode>
+    size_t calcWideStackSize(const std::vector<WideNode> &wideNodes)
+    {
+        const size_t numNodes=wideNodes.size();
+        std::vector<size_t> subtreeStackSizes(numNodes, 0);
+        
+        for (size_t nodeIndex=numNodes; nodeIndex>0; --nodeIndex)
+        {
+            const WideNode &wideNode=wideNodes[nodeIndex-1];
+            
+            size_t numChildren=0;
+            size_t maxChildStackSize=0;
+            
+            for (size_t childNum=0; childNum<BALLTREE_WIDE_NODE_WIDTH; ++childNum)
+            {
+                if ((wideNode.offset_[childNum]|wideNode.numItems_[childNum])!=0)
+                {
+                    ++numChildren;
+                    
+                    if ((wideNode.numItems_[childNum]==0)&&(wideNode.offset_[childNum]>=nodeIndex)&&(wideNode.offset_[childNum]<numNodes))
+                    {
+                        maxChildStackSize=std::max(maxChildStackSize, subtreeStackSizes[wideNode.offset_[childNum]]);
+                    }
+                }
+            }
+            
+            subtreeStackSizes[nodeIndex-1]=numChildren+maxChildStackSize;
+        }
+        
+        return (numNodes>0) ? (subtreeStackSizes[0]+1) : 0;
+    }
+}
+
+void stitch::BallTree::updateFrozenWideStackSize()
+{//All the used child slots of a node are pushed together.
+    frozenWideStackSize_=std::max(calcWideStackSize(frozenWideNodeVector_), calcWideStackSize(frozenCompactNodeVector_));
+}
+
+void stitch::BallTree::freezeWide()
+{
+    if (!isFrozen())
+    {
+        freeze();
+    }
+    
+    std::vector<FrozenWideNode>().swap(frozenWideNodeVector_);
+    
+    if (isFrozen())
+    {
+        const std::vector<uint32_t> rootNodes(1, 0);
+        
+        addFrozenWideNode(rootNodes, frozenWideStackSize_);
+        ++frozenWideStackSize_;//The root entry.
+        
+        relayoutFrozenWideNodes();
+        updateFrozenVisibilityMasks();
+    }
+}
+
+void stitch::BallTree::relayoutFrozenWideNodes()
+{
+    const auto getChildren=[this](const uint32_t wideNodeIndex, std::vector<uint32_t> &children)
+    {
+        const FrozenWideNode &wideNode=frozenWideNodeVector_[wideNodeIndex];
+        
+        for (size_t slotNum=0; slotNum<BALLTREE_WIDE_NODE_WIDTH; ++slotNum)
+        {
+            if ((wideNode.numItems_[slotNum]==0)&&(wideNode.offset_[slotNum]!=0))
+            {
+                children.push_back(wideNode.offset_[slotNum]);
+            }
+        }
+    };
+    
+    const uint32_t rootIndex=0;
+    std::vector<uint32_t> order;
+    order.reserve(frozenWideNodeVector_.size());
+    
+    appendVanEmdeBoasOrder(rootIndex, getTreeHeight(rootIndex, getChildren), getChildren, order);
+    
+    //=== Move the nodes to their new indices and update the indices of the interior children ===
+    std::vector<uint32_t> newIndices(order.size());
+    for (size_t newIndex=0; newIndex<order.size(); ++newIndex)
+    {
+        newIndices[order[newIndex]]=newIndex;
+    }
+    
+    std::vector<FrozenWideNode> wideNodes;
+    wideNodes.reserve(order.size());
+    
+    for (const auto wideNodeIndex : order)
+    {
+        wideNodes.push_back(frozenWideNodeVector_[wideNodeIndex]);
+        FrozenWideNode &wideNode=wideNodes.back();
+        
+        for (size_t slotNum=0; slotNum<BALLTREE_WIDE_NODE_WIDTH; ++slotNum)
+        {
+            if ((wideNode.numItems_[slotNum]==0)&&(wideNode.offset_[slotNum]!=0))
+            {
+                wideNode.offset_[slotNum]=newIndices[wideNode.offset_[slotNum]];
+            }
+        }
+    }
+    
+    frozenWideNodeVector_.swap(wideNodes);
+    //===
+}
+
+bool stitch::BallTree::freezeCompact()
+{
+    if (isFrozenCompact())
+    {
+        return true;
+    }
+    
+    if (!isFrozenWide())
+    {
+        freezeWide();
+    }
+    
+    if (!isFrozenWide())
+    {//Empty tree.
+        return false;
+    }
+    
+    //=== Quantise each wide node into the compact node at the same index ===
+    const size_t numWideNodes=frozenWideNodeVector_.size();
+    std::vector<FrozenCompactNode> compactNodes(numWideNodes);
+    
+    for (size_t wideNodeIndex=0; wideNodeIndex<numWideNodes; ++wideNodeIndex)
+    {
+        const FrozenWideNode &wideNode=frozenWideNodeVector_[wideNodeIndex];
+        FrozenCompactNode &compactNode=compactNodes[wideNodeIndex];
+        AABB childBounds[BALLTREE_WIDE_NODE_WIDTH];
+        
+        for (size_t slotNum=0; slotNum<BALLTREE_WIDE_NODE_WIDTH; ++slotNum)
+        {
+            if (wideNode.numItems_[slotNum]>BALLTREE_COMPACT_NODE_MAX_LEAF_ITEMS)
+            {
+                return false;
+            }
+            
+            compactNode.offset_[slotNum]=wideNode.offset_[slotNum];
+            compactNode.numItems_[slotNum]=wideNode.numItems_[slotNum];
+            
+            childBounds[slotNum]=AABB(Vec3(wideNode.minX_[slotNum], wideNode.minY_[slotNum], wideNode.minZ_[slotNum]),
+                                      Vec3(wideNode.maxX_[slotNum], wideNode.maxY_[slotNum], wideNode.maxZ_[slotNum]));
+        }
+        
+        if (!compactNode.quantise(childBounds))
+        {
+            return false;
+        }
+    }
+    //===
+    
+    //=== Release everything but the compact nodes and the frozen items (or mesh triangles). Linearising would also unfreeze the tree ===
+    std::vector<const stitch::BoundingVolume *> frozenItems;
+    frozenItems.swap(frozenItemVector_);
+    
+    const TriangleMesh * const frozenMesh=frozenMesh_;
+    std::vector<uint32_t> frozenTriangles;
+    frozenTriangles.swap(frozenTriangleVector_);
+    
+    const size_t wideStackSize=frozenWideStackSize_;
+    const size_t chunkSize=chunkSize_;
+    
+    linearise();
+    
+    compactChunkSize_=chunkSize;
+    frozenItemVector_.swap(frozenItems);
+    frozenMesh_=frozenMesh;
+    frozenTriangleVector_.swap(frozenTriangles);
+    frozenCompactNodeVector_.swap(compactNodes);
+    frozenWideStackSize_=wideStackSize;
+    //===
+    
+    updateFrozenVisibilityMasks();
+    
+    return true;
+}
+
+void stitch::BallTree::getFrozenChildren(const uint32_t nodeIndex, std::vector<uint32_t> &children) const
+{
+    const FrozenTreeNode &node=frozenNodeVector_[nodeIndex];
+    
+    for (uint32_t childIndex=nodeIndex+1; childIndex<node.offset_; childIndex=frozenNodeVector_[childIndex].getSkipIndex(childIndex))
+    {
+        const FrozenTreeNode &child=frozenNodeVector_[childIndex];
+        
+        if (child.isLeaf() || (child.offset_>(childIndex+1)))
+        {
+            children.push_back(childIndex);
+        }
+    }
+}
+
+uint32_t stitch::BallTree::addFrozenWideNode(const std::vector<uint32_t> &frozenNodes, size_t &stackSize)
+{
+    const uint32_t wideNodeIndex=frozenWideNodeVector_.size();
+    frozenWideNodeVector_.push_back(FrozenWideNode());
+    
+    //=== Assign the frozen nodes to the child slots ===
+    std::vector<std::vector<uint32_t> > slots;
+    
+    if (frozenNodes.size()>BALLTREE_WIDE_NODE_WIDTH)
+    {//Group consecutive nodes. Each group becomes a new wide node.
+        for (size_t slotNum=0; slotNum<BALLTREE_WIDE_NODE_WIDTH; ++slotNum)
+        {
+            slots.push_back(std::vector<uint32_t>(frozenNodes.begin()+(slotNum*frozenNodes.size())/BALLTREE_WIDE_NODE_WIDTH,
+                                                  frozenNodes.begin()+((slotNum+1)*frozenNodes.size())/BALLTREE_WIDE_NODE_WIDTH));
+        }
+    } else
+    {
+        std::vector<uint32_t> slotNodes;
+        
+        for (const auto nodeIndex : frozenNodes)
+        {
+            if (frozenNodeVector_[nodeIndex].isLeaf())
+            {
+                slotNodes.push_back(nodeIndex);
+            } else
+            {//The node itself is replaced by its children.
+                getFrozenChildren(nodeIndex, slotNodes);
+            }
+        }
+        
+        bool opened=true;
+        
+        while (opened)
+        {//Open the interior node with the largest surface area while its children still fit.
+            opened=false;
+            
+            size_t bestSlot=0;
+            float bestArea=-1.0f;
+            std::vector<uint32_t> bestChildren;
+            
+            for (size_t slotNum=0; slotNum<slotNodes.size(); ++slotNum)
+            {
+                const FrozenTreeNode &node=frozenNodeVector_[slotNodes[slotNum]];
+                
+                if ((!node.isLeaf())&&(node.bounds_.surfaceArea()>bestArea))
+                {
+                    std::vector<uint32_t> children;
+                    getFrozenChildren(slotNodes[slotNum], children);
+                    
+                    if ((slotNodes.size()-1+children.size())<=BALLTREE_WIDE_NODE_WIDTH)
+                    {
+                        bestSlot=slotNum;
+                        bestArea=node.bounds_.surfaceArea();
+                        bestChildren.swap(children);
+                        opened=true;
+                    }
+                }
+            }
+            
+            if (opened)
+            {
+                slotNodes.erase(slotNodes.begin()+bestSlot);
+                slotNodes.insert(slotNodes.end(), bestChildren.begin(), bestChildren.end());
+            }
+        }
+        
+        for (const auto nodeIndex : slotNodes)
+        {
+            slots.push_back(std::vector<uint32_t>(1, nodeIndex));
+        }
+    }
+    //===
+    
+    //=== Fill in the child slots ===
+    size_t maxChildStackSize=0;
+    
+    for (size_t slotNum=0; slotNum<slots.size(); ++slotNum)
+    {
+        const std::vector<uint32_t> &slot=slots[slotNum];
+        
+        AABB bounds;
+        for (const auto nodeIndex : slot)
+        {
+            bounds.expand(frozenNodeVector_[nodeIndex].bounds_);
+        }
+        
+        uint32_t offset=0;
+        uint32_t numItems=0;
+        
+        if ((slot.size()==1)&&(frozenNodeVector_[slot[0]].isLeaf()))
+        {
+            offset=frozenNodeVector_[slot[0]].offset_;
+            numItems=frozenNodeVector_[slot[0]].numItems_;
+        } else
+        {
+            size_t childStackSize=0;
+            offset=addFrozenWideNode(slot, childStackSize);
+            maxChildStackSize=std::max(maxChildStackSize, childStackSize);
+        }
+        
+        //Note: frozenWideNodeVector_ might have been reallocated by the children.
+        FrozenWideNode &wideNode=frozenWideNodeVector_[wideNodeIndex];
+        
+        wideNode.minX_[slotNum]=bounds.min_.x();
+        wideNode.minY_[slotNum]=bounds.min_.y();
+        wideNode.minZ_[slotNum]=bounds.min_.z();
+        wideNode.maxX_[slotNum]=bounds.max_.x();
+        wideNode.maxY_[slotNum]=bounds.max_.y();
+        wideNode.maxZ_[slotNum]=bounds.max_.z();
+        wideNode.offset_[slotNum]=offset;
+        wideNode.numItems_[slotNum]=numItems;
+    }
+    //===
+    
+    //All the children are pushed together so the stack needs at most their number plus that of the deepest child.
+    stackSize=slots.size()+maxChildStackSize;
+    
+    return wideNodeIndex;
+}
+
+namespace {
+    //! Load the boxes of a wide node's children as minX, minY, minZ, maxX, maxY and maxZ.
+    inline void loadChildBounds(const stitch::FrozenWideNode &wideNode, __m128 * const bounds)
+    {
+        bounds[0]=_mm_loadu_ps(wideNode.minX_);
+        bounds[1]=_mm_loadu_ps(wideNode.minY_);
+        bounds[2]=_mm_loadu_ps(wideNode.minZ_);
+        bounds[3]=_mm_loadu_ps(wideNode.maxX_);
+        bounds[4]=_mm_loadu_ps(wideNode.maxY_);
+        bounds[5]=_mm_loadu_ps(wideNode.maxZ_);
+    }
+    
+    //! Whether a ray with the visibility mask sees the frozen node. A tree without node masks is visible to all rays.
+    inline bool isNodeVisible(const uint32_t * const nodeMasks, const uint32_t nodeIndex, const uint32_t visibilityMask)
+    {
+        return (nodeMasks==nullptr)||((nodeMasks[nodeIndex]&visibilityMask)!=0);
+    }
+    
+    //! The mask of the child slots of a wide (or compact) node that a ray with the visibility mask sees.
+    inline uint32_t getVisibleChildren(const uint32_t * const slotMasks, const uint32_t visibilityMask)
+    {
+        const __m128i visible=_mm_and_si128(_mm_loadu_si128((const __m128i *)slotMasks), _mm_set1_epi32(visibilityMask));
+        
+        return (~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(visible, _mm_setzero_si128()))))&0xF;
+    }
+    
+    //! Decode four quantised bounds as origin+q*scale.
+    inline __m128 decodeBounds(const uint8_t * const quantised, const __m128 origin, const __m128 scale)
+    {
+        int32_t packed;
+        memcpy(&packed, quantised, sizeof(int32_t));
+        
+        const __m128i zero=_mm_setzero_si128();
+        const __m128i widened=_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+        
+        return _mm_add_ps(origin, _mm_mul_ps(_mm_cvtepi32_ps(widened), scale));
+    }
+    
+    //! Decode the boxes of a compact node's children in the same order as those of a wide node.
+    inline void loadChildBounds(const stitch::FrozenCompactNode &compactNode, __m128 * const bounds)
+    {
+        const __m128 originX=_mm_set1_ps(compactNode.origin_[0]);
+        const __m128 originY=_mm_set1_ps(compactNode.origin_[1]);
+        const __m128 originZ=_mm_set1_ps(compactNode.origin_[2]);
+        const __m128 scaleX=_mm_set1_ps(compactNode.getScale(0));
+        const __m128 scaleY=_mm_set1_ps(compactNode.getScale(1));
+        const __m128 scaleZ=_mm_set1_ps(compactNode.getScale(2));
+        
+        bounds[0]=decodeBounds(compactNode.minX_, originX, scaleX);
+        bounds[1]=decodeBounds(compactNode.minY_, originY, scaleY);
+        bounds[2]=decodeBounds(compactNode.minZ_, originZ, scaleZ);
+        bounds[3]=decodeBounds(compactNode.maxX_, originX, scaleX);
+        bounds[4]=decodeBounds(compactNode.maxY_, originY, scaleY);
+        bounds[5]=decodeBounds(compactNode.maxZ_, originZ, scaleZ);
+    }
+}
+
+inline void stitch::BallTree::setFrozenMeshIntersection(const uint32_t triangleIndex, const float distance, const float b1, const float b2, Intersection &intersect) const
+{
+    intersect.distance_=distance;
+    intersect.itemID_=frozenMesh_->getItemID(triangleIndex);
+    intersect.itemPtr_=this;
+    intersect.primitiveID_=triangleIndex;
+    intersect.b1_=b1;
+    intersect.b2_=b2;
+}
+
+inline void stitch::BallTree::calcFrozenMeshIntersection(const uint32_t firstItem, const uint32_t endItem, const Ray &ray, Intersection &intersect) const
+{
+    if (!frozenTriangles_.empty())
+    {
+        uint32_t hitItem=0;
+        float distance=0.0f, b1=0.0f, b2=0.0f;
+        
+        if (frozenTriangles_.intersect(firstItem, endItem, ray, intersect.distance_, hitItem, distance, b1, b2))
+        {
+            setFrozenMeshIntersection(frozenTriangleVector_[hitItem], distance, b1, b2, intersect);
+        }
+    } else
+    {//Compact trees test the triangles one at a time.
+        for (uint32_t itemNum=firstItem; itemNum<endItem; ++itemNum)
+        {
+            const uint32_t triangleIndex=frozenTriangleVector_[itemNum];
+            float distance=0.0f, b1=0.0f, b2=0.0f;
+            
+            if (frozenMesh_->intersect(triangleIndex, ray, intersect.distance_, distance, b1, b2))
+            {
+                setFrozenMeshIntersection(triangleIndex, distance, b1, b2, intersect);
+            }
+        }
+    }
+}
+
+inline bool stitch::BallTree::calcFrozenMeshOcclusion(const uint32_t firstItem, const uint32_t endItem, const Ray &ray, const float tMax) const
+{
+    if (!frozenTriangles_.empty())
+    {
+        return frozenTriangles_.occluded(firstItem, endItem, ray, tMax);
+    }
+    
+    for (uint32_t itemNum=firstItem; itemNum<endItem; ++itemNum)
+    {
+        if (frozenMesh_->occluded(frozenTriangleVector_[itemNum], ray, tMax))
+        {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+template <class WideNode>
+void stitch::BallTree::calcFrozenWideIntersection(const WideNode * const wideNodes, const Ray &ray, Intersection &intersect) const
+{
+    const stitch::BoundingVolume * const * const items=frozenItemVector_.data();
+    
+    const __m128 origX=_mm_set1_ps(ray.origin_.x());
+    const __m128 origY=_mm_set1_ps(ray.origin_.y());
+    const __m128 origZ=_mm_set1_ps(ray.origin_.z());
+    const __m128 recipDirX=_mm_set1_ps(1.0f/ray.direction_.x());
+    const __m128 recipDirY=_mm_set1_ps(1.0f/ray.direction_.y());
+    const __m128 recipDirZ=_mm_set1_ps(1.0f/ray.direction_.z());
+    const __m128 start=_mm_set1_ps(ray.tMin_);
+    
+    const uint32_t * const slotMasks=frozenWideMaskVector_.empty() ? nullptr : frozenWideMaskVector_.data();
+    
+    //=== Set up the traversal stack ===
+    struct StackEntry
+    {
+        uint32_t offset_;
+        uint32_t numItems_;
+        float entry_;
+    };
+    
+    StackEntry localStack[BALLTREE_FROZEN_STACK_SIZE];
+    std::vector<StackEntry> heapStack;
+    StackEntry *stack=localStack;
+    
+    if (frozenWideStackSize_>BALLTREE_FROZEN_STACK_SIZE)
+    {
+        heapStack.resize(frozenWideStackSize_);
+        stack=heapStack.data();
+    }
+    
+    size_t stackSize=0;
+    //===
+    
+    stack[stackSize].offset_=0;
+    stack[stackSize].numItems_=0;
+    stack[stackSize].entry_=0.0f;
+    ++stackSize;
+    
+    while (stackSize>0)
+    {
+        --stackSize;
+        
+        if (stack[stackSize].entry_>intersect.distance_)
+        {//A closer intersection was found after the node was pushed.
+            continue;
+        }
+        
+        const uint32_t offset=stack[stackSize].offset_;
+        const uint32_t numItems=stack[stackSize].numItems_;
+        
+        if (numItems>0)
+        {
+            const uint32_t endItem=offset+numItems;
+            
+            if (frozenMesh_!=nullptr)
+            {
+                calcFrozenMeshIntersection(offset, endItem, ray, intersect);
+            } else
+                if (!frozenTriangles_.empty())
+                {
+                    uint32_t hitItem=0;
+                    float distance=0.0f, b1=0.0f, b2=0.0f;
+                    
+                    if (frozenTriangles_.intersect(offset, endItem, ray, intersect.distance_, hitItem, distance, b1, b2))
+                    {
+                        items[hitItem]->setTriangleIntersection(ray, distance, b1, b2, intersect);
+                    }
+                } else
+                {
+                    for (uint32_t itemNum=offset; itemNum<endItem; ++itemNum)
+                    {
+                        const stitch::BoundingVolume * const itemPtr=items[itemNum];
+                        
+                        if ((itemPtr->isVisibleTo(ray))&&(itemPtr->BVIntersected(ray)))
+                        {
+                            itemPtr->calcIntersection(ray, intersect);
+                        }
+                    }
+                }
+        } else
+        {
+            const WideNode &wideNode=wideNodes[offset];
+            
+            __m128 bounds[6];
+            loadChildBounds(wideNode, bounds);
+            
+            //=== Slab test of the ray against all the children. See RayPacket::intersectBox for the NaN handling ===
+            const __m128 tx0=_mm_mul_ps(_mm_sub_ps(bounds[0], origX), recipDirX);
+            const __m128 tx1=_mm_mul_ps(_mm_sub_ps(bounds[3], origX), recipDirX);
+            __m128 t0=_mm_max_ps(_mm_min_ps(tx0, tx1), start);
+            __m128 t1=_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_set1_ps(MathUtil::min(intersect.distance_, ray.tMax_)));
+            
+            const __m128 ty0=_mm_mul_ps(_mm_sub_ps(bounds[1], origY), recipDirY);
+            const __m128 ty1=_mm_mul_ps(_mm_sub_ps(bounds[4], origY), recipDirY);
+            t0=_mm_max_ps(_mm_min_ps(ty0, ty1), t0);
+            t1=_mm_min_ps(_mm_max_ps(ty0, ty1), t1);
+            
+            const __m128 tz0=_mm_mul_ps(_mm_sub_ps(bounds[2], origZ), recipDirZ);
+            const __m128 tz1=_mm_mul_ps(_mm_sub_ps(bounds[5], origZ), recipDirZ);
+            t0=_mm_max_ps(_mm_min_ps(tz0, tz1), t0);
+            t1=_mm_min_ps(_mm_max_ps(tz0, tz1), t1);
+            
+            uint32_t hitMask=_mm_movemask_ps(_mm_cmple_ps(t0, t1));
+            //===
+            
+            if (slotMasks!=nullptr)
+            {//Cull the children that the ray does not see.
+                hitMask&=getVisibleChildren(slotMasks+offset*BALLTREE_WIDE_NODE_WIDTH, ray.visibilityMask_);
+            }
+            
+            if (hitMask)
+            {
+                float entries[BALLTREE_WIDE_NODE_WIDTH];
+                _mm_storeu_ps(entries, t0);
+                
+                //=== Push the intersected children sorted so that the nearest child is on top of the stack ===
+                const size_t firstPushed=stackSize;
+                
+                for (; hitMask; hitMask&=hitMask-1)
+                {
+                    const size_t childNum=RayPacket::lowestLane(hitMask);
+                    
+                    if ((wideNode.offset_[childNum]|wideNode.numItems_[childNum])==0)
+                    {//Unused child slot.
+                        continue;
+                    }
+                    
+                    const float entry=entries[childNum];
+                    size_t insertPos=stackSize;
+                    
+                    while ((insertPos>firstPushed)&&(stack[insertPos-1].entry_<entry))
+                    {//Insertion sort on decreasing entry distance.
+                        stack[insertPos]=stack[insertPos-1];
+                        --insertPos;
+                    }
+                    
+                    stack[insertPos].offset_=wideNode.offset_[childNum];
+                    stack[insertPos].numItems_=wideNode.numItems_[childNum];
+                    stack[insertPos].entry_=entry;
+                    ++stackSize;
+                }
+                //===
+                
+                if ((stackSize>0)&&(stack[stackSize-1].numItems_==0))
+                {
+                    _mm_prefetch((const char *)(wideNodes+stack[stackSize-1].offset_), _MM_HINT_T0);
+                }
+            }
+        }
+    }
+}
+
+template <class WideNode>
+bool stitch::BallTree::calcFrozenWideOcclusion(const WideNode * const wideNodes, const Ray &ray, const float tMax) const
+{
+    const stitch::BoundingVolume * const * const items=frozenItemVector_.data();
+    
+    const __m128 origX=_mm_set1_ps(ray.origin_.x());
+    const __m128 origY=_mm_set1_ps(ray.origin_.y());
+    const __m128 origZ=_mm_set1_ps(ray.origin_.z());
+    const __m128 recipDirX=_mm_set1_ps(1.0f/ray.direction_.x());
+    const __m128 recipDirY=_mm_set1_ps(1.0f/ray.direction_.y());
+    const __m128 recipDirZ=_mm_set1_ps(1.0f/ray.direction_.z());
+    const __m128 start=_mm_set1_ps(ray.tMin_);
+    const __m128 end=_mm_set1_ps(tMax);
+    
+    const uint32_t * const slotMasks=frozenWideMaskVector_.empty() ? nullptr : frozenWideMaskVector_.data();
+    
+    //=== Set up the traversal stack ===
+    struct StackEntry
+    {
+        uint32_t offset_;
+        uint32_t numItems_;
+    };
+    
+    StackEntry localStack[BALLTREE_FROZEN_STACK_SIZE];
+    std::vector<StackEntry> heapStack;
+    StackEntry *stack=localStack;
+    
+    if (frozenWideStackSize_>BALLTREE_FROZEN_STACK_SIZE)
+    {
+        heapStack.resize(frozenWideStackSize_);
+        stack=heapStack.data();
+    }
+    
+    size_t stackSize=0;
+    //===
+    
+    stack[stackSize].offset_=0;
+    stack[stackSize].numItems_=0;
+    ++stackSize;
+    
+    while (stackSize>0)
+    {
+        --stackSize;
+        
+        const uint32_t offset=stack[stackSize].offset_;
+        const uint32_t numItems=stack[stackSize].numItems_;
+        
+        if (numItems>0)
+        {
+            const uint32_t endItem=offset+numItems;
+            
+            if (frozenMesh_!=nullptr)
+            {
+                if (calcFrozenMeshOcclusion(offset, endItem, ray, tMax))
+                {
+                    return true;
+                }
+            } else
+                if (!frozenTriangles_.empty())
+                {
+                    if (frozenTriangles_.occluded(offset, endItem, ray, tMax))
+                    {
+                        return true;
+                    }
+                } else
+                {
+                    for (uint32_t itemNum=offset; itemNum<endItem; ++itemNum)
+                    {
+                        const stitch::BoundingVolume * const itemPtr=items[itemNum];
+                        
+                        if ((itemPtr->isVisibleTo(ray))&&(itemPtr->BVIntersected(ray))&&(itemPtr->occluded(ray, tMax)))
+                        {
+                            return true;
+                        }
+                    }
+                }
+        } else
+        {
+            const WideNode &wideNode=wideNodes[offset];
+            
+            __m128 bounds[6];
+            loadChildBounds(wideNode, bounds);
+            
+            //=== Slab test of the ray against all the children. Same as in calcFrozenWideIntersection ===
+            const __m128 tx0=_mm_mul_ps(_mm_sub_ps(bounds[0], origX), recipDirX);
+            const __m128 tx1=_mm_mul_ps(_mm_sub_ps(bounds[3], origX), recipDirX);
+            __m128 t0=_mm_max_ps(_mm_min_ps(tx0, tx1), start);
+            __m128 t1=_mm_min_ps(_mm_max_ps(tx0, tx1), end);
+            
+            const __m128 ty0=_mm_mul_ps(_mm_sub_ps(bounds[1], origY), recipDirY);
+            const __m128 ty1=_mm_mul_ps(_mm_sub_ps(bounds[4], origY), recipDirY);
+            t0=_mm_max_ps(_mm_min_ps(ty0, ty1), t0);
+            t1=_mm_min_ps(_mm_max_ps(ty0, ty1), t1);
+            
+            const __m128 tz0=_mm_mul_ps(_mm_sub_ps(bounds[2], origZ), recipDirZ);
+            const __m128 tz1=_mm_mul_ps(_mm_sub_ps(bounds[5], origZ), recipDirZ);
+            t0=_mm_max_ps(_mm_min_ps(tz0, tz1), t0);
+            t1=_mm_min_ps(_mm_max_ps(tz0, tz1), t1);
+            
+            uint32_t hitMask=_mm_movemask_ps(_mm_cmple_ps(t0, t1));
+            //===
+            
+            if (slotMasks!=nullptr)
+            {//Cull the children that the ray does not see.
+                hitMask&=getVisibleChildren(slotMasks+offset*BALLTREE_WIDE_NODE_WIDTH, ray.visibilityMask_);
+            }
+            
+            for (; hitMask; hitMask&=hitMask-1)
+            {
+                const size_t childNum=RayPacket::lowestLane(hitMask);
+                
+                if ((wideNode.offset_[childNum]|wideNode.numItems_[childNum])!=0)
+                {//Skip unused child slots.
+                    stack[stackSize].offset_=wideNode.offset_[childNum];
+                    stack[stackSize].numItems_=wideNode.numItems_[childNum];
+                    ++stackSize;
+                }
+            }
+            
+            if ((stackSize>0)&&(stack[stackSize-1].numItems_==0))
+            {
+                _mm_prefetch((const char *)(wideNodes+stack[stackSize-1].offset_), _MM_HINT_T0);
+            }
+        }
+    }
+    
+    return false;
+}
+
+bool stitch::BallTree::calcFrozenOcclusion(const Ray &ray, const float tMax) const
+{
+    const Vec3 recipDir(1.0f/ray.direction_.x(), 1.0f/ray.direction_.y(), 1.0f/ray.direction_.z());
+    
+    const FrozenTreeNode * const nodes=frozenNodeVector_.data();
+    const stitch::BoundingVolume * const * const items=frozenItemVector_.data();
+    const uint32_t * const nodeMasks=frozenNodeMaskVector_.empty() ? nullptr : frozenNodeMaskVector_.data();
+    
+    //=== Set up the traversal stack ===
+    uint32_t localStack[BALLTREE_FROZEN_STACK_SIZE];
+    std::vector<uint32_t> heapStack;
+    uint32_t *stack=localStack;
+    
+    if (frozenStackSize_>BALLTREE_FROZEN_STACK_SIZE)
+    {
+        heapStack.resize(frozenStackSize_);
+        stack=heapStack.data();
+    }
+    
+    size_t stackSize=0;
+    //===
+    
+    {
+        float entry=0.0f;
+        
+        if ((isNodeVisible(nodeMasks, 0, ray.visibilityMask_))&&(nodes[0].bounds_.intersect(ray.origin_, recipDir, ray.tMin_, tMax, entry)))
+        {
+            stack[stackSize++]=0;
+        }
+    }
+    
+    while (stackSize>0)
+    {
+        const uint32_t nodeIndex=stack[--stackSize];
+        const FrozenTreeNode &node=nodes[nodeIndex];
+        
+        if (node.isLeaf())
+        {
+            const uint32_t endItem=node.offset_+node.numItems_;
+            
+            if (frozenMesh_!=nullptr)
+            {
+                if (calcFrozenMeshOcclusion(node.offset_, endItem, ray, tMax))
+                {
+                    return true;
+                }
+            } else
+                if (!frozenTriangles_.empty())
+                {
+                    if (frozenTriangles_.occluded(node.offset_, endItem, ray, tMax))
+                    {
+                        return true;
+                    }
+                } else
+                {
+                    for (uint32_t itemNum=node.offset_; itemNum<endItem; ++itemNum)
+                    {
+                        const stitch::BoundingVolume * const itemPtr=items[itemNum];
+                        
+                        if ((itemPtr->isVisibleTo(ray))&&(itemPtr->BVIntersected(ray))&&(itemPtr->occluded(ray, tMax)))
+                        {
+                            return true;
+                        }
+                    }
+                }
+        } else
+        {
+            for (uint32_t childIndex=nodeIndex+1; childIndex<node.offset_; childIndex=nodes[childIndex].getSkipIndex(childIndex))
+            {
+                float entry=0.0f;
+                
+                if ((isNodeVisible(nodeMasks, childIndex, ray.visibilityMask_))&&(nodes[childIndex].bounds_.intersect(ray.origin_, recipDir, ray.tMin_, tMax, entry)))
+                {
+                    stack[stackSize++]=childIndex;
+                }
+            }
+            
+            if (stackSize>0)
+            {
+                _mm_prefetch((const char *)(nodes+stack[stackSize-1]), _MM_HINT_T0);
+            }
+        }
+    }
+    
+    return false;
+}
+
+void stitch::BallTree::calcFrozenIntersection(const Ray &ray, Intersection &intersect) const
+{
+    const Vec3 recipDir(1.0f/ray.direction_.x(), 1.0f/ray.direction_.y(), 1.0f/ray.direction_.z());
+    
+    const FrozenTreeNode * const nodes=frozenNodeVector_.data();
+    const stitch::BoundingVolume * const * const items=frozenItemVector_.data();
+    const uint32_t * const nodeMasks=frozenNodeMaskVector_.empty() ? nullptr : frozenNodeMaskVector_.data();
+    
+    //=== Set up the traversal stack ===
+    struct StackEntry
+    {
+        uint32_t nodeIndex_;
+        float entry_;
+    };
+    
+    StackEntry localStack[BALLTREE_FROZEN_STACK_SIZE];
+    std::vector<StackEntry> heapStack;
+    StackEntry *stack=localStack;
+    
+    if (frozenStackSize_>BALLTREE_FROZEN_STACK_SIZE)
+    {
+        heapStack.resize(frozenStackSize_);
+        stack=heapStack.data();
+    }
+    
+    size_t stackSize=0;
+    //===
+    
+    {
+        float entry=0.0f;
+        
+        if ((isNodeVisible(nodeMasks, 0, ray.visibilityMask_))&&
+            (nodes[0].bounds_.intersect(ray.origin_, recipDir, ray.tMin_, MathUtil::min(intersect.distance_, ray.tMax_), entry)))
+        {
+            stack[stackSize].nodeIndex_=0;
+            stack[stackSize].entry_=entry;
+            ++stackSize;
+        }
+    }
+    
+    while (stackSize>0)
+    {
+        --stackSize;
+        
+        if (stack[stackSize].entry_>intersect.distance_)
+        {//A closer intersection was found after the node was pushed.
+            continue;
+        }
+        
+        const uint32_t nodeIndex=stack[stackSize].nodeIndex_;
+        const FrozenTreeNode &node=nodes[nodeIndex];
+        
+        if (node.isLeaf())
+        {
+            const uint32_t endItem=node.offset_+node.numItems_;
+            
+            if (frozenMesh_!=nullptr)
+            {
+                calcFrozenMeshIntersection(node.offset_, endItem, ray, intersect);
+            } else
+                if (!frozenTriangles_.empty())
+                {
+                    uint32_t hitItem=0;
+                    float distance=0.0f, b1=0.0f, b2=0.0f;
+                    
+                    if (frozenTriangles_.intersect(node.offset_, endItem, ray, intersect.distance_, hitItem, distance, b1, b2))
+                    {
+                        items[hitItem]->setTriangleIntersection(ray, distance, b1, b2, intersect);
+                    }
+                } else
+                {
+                    for (uint32_t itemNum=node.offset_; itemNum<endItem; ++itemNum)
+                    {
+                        const stitch::BoundingVolume * const itemPtr=items[itemNum];
+                        
+                        if ((itemPtr->isVisibleTo(ray))&&(itemPtr->BVIntersected(ray)))
+                        {
+                            itemPtr->calcIntersection(ray, intersect);
+                        }
+                    }
+                }
+        } else
+        {
+            //=== Push the intersected children sorted so that the nearest child is on top of the stack ===
+            const size_t firstPushed=stackSize;
+            
+            for (uint32_t childIndex=nodeIndex+1; childIndex<node.offset_; childIndex=nodes[childIndex].getSkipIndex(childIndex))
+            {
+                float entry=0.0f;
+                
+                if ((isNodeVisible(nodeMasks, childIndex, ray.visibilityMask_))&&
+                    (nodes[childIndex].bounds_.intersect(ray.origin_, recipDir, ray.tMin_, MathUtil::min(intersect.distance_, ray.tMax_), entry)))
+                {
+                    size_t insertPos=stackSize;
+                    
+                    while ((insertPos>firstPushed)&&(stack[insertPos-1].entry_<entry))
+                    {//Insertion sort on decreasing entry distance.
+                        stack[insertPos]=stack[insertPos-1];
+                        --insertPos;
+                    }
+                    
+                    stack[insertPos].nodeIndex_=childIndex;
+                    stack[insertPos].entry_=entry;
+                    ++stackSize;
+                }
+            }
+            //===
+            
+            if (stackSize>0)
+            {
+                _mm_prefetch((const char *)(nodes+stack[stackSize-1].nodeIndex_), _MM_HINT_T0);
+            }
+        }
+    }
+}
+
+void stitch::BallTree::calcFrozenPacketIntersection(const RayPacket &packet, Intersection * const intersects, const uint32_t mask) const
+{
+    const FrozenTreeNode * const nodes=frozenNodeVector_.data();
+    const stitch::BoundingVolume * const * const items=frozenItemVector_.data();
+    const uint32_t * const nodeMasks=frozenNodeMaskVector_.empty() ? nullptr : frozenNodeMaskVector_.data();
+    
+    //=== Set up the traversal stack ===
+    struct StackEntry
+    {
+        uint32_t nodeIndex_;
+        uint32_t mask_;
+        float entry_;
+    };
+    
+    StackEntry localStack[BALLTREE_FROZEN_STACK_SIZE];
+    std::vector<StackEntry> heapStack;
+    StackEntry *stack=localStack;
+    
+    if (frozenStackSize_>BALLTREE_FROZEN_STACK_SIZE)
+    {
+        heapStack.resize(frozenStackSize_);
+        stack=heapStack.data();
+    }
+    
+    size_t stackSize=0;
+    //===
+    
+    //=== The closest intersection distance so far of each ray ===
+    RayPacketLanes tMax;
+    
+    for (size_t laneNum=0; laneNum<RAYPACKET_MAX_SIZE; ++laneNum)
+    {
+        tMax.f_[laneNum]=(laneNum<packet.getNumRays()) ? MathUtil::min(intersects[laneNum].distance_, packet.getRay(laneNum).tMax_) : 0.0f;
+    }
+    //===
+    
+    {
+        float entry=0.0f;
+        const uint32_t visibleMask=(nodeMasks!=nullptr) ? packet.getVisibleMask(nodeMasks[0], mask) : mask;
+        const uint32_t hitMask=packet.intersectBox(nodes[0].bounds_, tMax, visibleMask, entry);
+        
+        if (hitMask)
+        {
+            stack[stackSize].nodeIndex_=0;
+            stack[stackSize].mask_=hitMask;
+            stack[stackSize].entry_=entry;
+            ++stackSize;
+        }
+    }
+    
+    while (stackSize>0)
+    {
+        --stackSize;
+        
+        //Drop the rays that found a closer intersection after the node was pushed.
+        const uint32_t activeMask=RayPacket::greaterEqualMask(tMax, stack[stackSize].entry_, stack[stackSize].mask_);
+        
+        if (activeMask==0)
+        {
+            continue;
+        }
+        
+        const uint32_t nodeIndex=stack[stackSize].nodeIndex_;
+        const FrozenTreeNode &node=nodes[nodeIndex];
+        
+        if (node.isLeaf())
+        {
+            const uint32_t endItem=node.offset_+node.numItems_;
+            
+            if (frozenMesh_!=nullptr)
+            {//The leaf's triangles are tested together for one ray at a time.
+                for (uint32_t laneMask=activeMask; laneMask; laneMask&=laneMask-1)
+                {
+                    const size_t laneNum=RayPacket::lowestLane(laneMask);
+                    
+                    calcFrozenMeshIntersection(node.offset_, endItem, packet.getRay(laneNum), intersects[laneNum]);
+                    tMax.f_[laneNum]=MathUtil::min(tMax.f_[laneNum], intersects[laneNum].distance_);
+                }
+            } else
+            {
+                for (uint32_t itemNum=node.offset_; itemNum<endItem; ++itemNum)
+                {
+                    const stitch::BoundingVolume * const itemPtr=items[itemNum];
+                    const uint32_t itemMask=packet.intersectSphere(itemPtr->centre_, itemPtr->radiusBV_, packet.getVisibleMask(itemPtr->visibilityMask_, activeMask));
+                    
+                    if (itemMask)
+                    {
+                        itemPtr->calcPacketIntersection(packet, intersects, itemMask);
+                        
+                        for (uint32_t laneMask=itemMask; laneMask; laneMask&=laneMask-1)
+                        {
+                            const size_t laneNum=RayPacket::lowestLane(laneMask);
+                            tMax.f_[laneNum]=intersects[laneNum].distance_;
+                        }
+                    }
+                }
+            }
+        } else
+        {
+            //=== Push the intersected children sorted so that the nearest child is on top of the stack ===
+            const size_t firstPushed=stackSize;
+            
+            for (uint32_t childIndex=nodeIndex+1; childIndex<node.offset_; childIndex=nodes[childIndex].getSkipIndex(childIndex))
+            {
+                float entry=0.0f;
+                const uint32_t visibleMask=(nodeMasks!=nullptr) ? packet.getVisibleMask(nodeMasks[childIndex], activeMask) : activeMask;
+                const uint32_t hitMask=packet.intersectBox(nodes[childIndex].bounds_, tMax, visibleMask, entry);
+                
+                if (hitMask)
+                {
+                    size_t insertPos=stackSize;
+                    
+                    while ((insertPos>firstPushed)&&(stack[insertPos-1].entry_<entry))
+                    {//Insertion sort on decreasing entry distance.
+                        stack[insertPos]=stack[insertPos-1];
+                        --insertPos;
+                    }
+                    
+                    stack[insertPos].nodeIndex_=childIndex;
+                    stack[insertPos].mask_=hitMask;
+                    stack[insertPos].entry_=entry;
+                    ++stackSize;
+                }
+            }
+            //===
+            
+            if (stackSize>0)
+            {
+                _mm_prefetch((const char *)(nodes+stack[stackSize-1].nodeIndex_), _MM_HINT_T0);
+            }
+        }
+    }
+}
+
+void stitch::BallTree::calcPacketIntersection(const RayPacket &packet, Intersection * const intersects, const uint32_t mask) const
+{
+    if (isFrozen())
+    {
+        calcFrozenPacketIntersection(packet, intersects, mask);
+    } else
+    {
+        BoundingVolume::calcPacketIntersection(packet, intersects, mask);
+    }
+}
+
+void stitch::BallTree::calcIntersection(const Ray &ray, Intersection &intersect) const
+{
+    if (isFrozenCompact())
+    {
+        calcFrozenWideIntersection(frozenCompactNodeVector_.data(), ray, intersect);
+        return;
+    }
+    
+    if (isFrozenWide())
+    {
+        calcFrozenWideIntersection(frozenWideNodeVector_.data(), ray, intersect);
+        return;
+    }
+    
+    if (isFrozen())
+    {
+        calcFrozenIntersection(ray, intersect);
+        return;
+    }
+    
+    //if (BVIntersected(orig, normDir)) This is currently executed by the calling code!
+    {
+        //=== 1) Find closest ray-item intersection. ===
+        for (const auto itemPtr : itemVector_)
+        {//Do a linear search through the items stored in this tree node.
+            if ((itemPtr->isVisibleTo(ray))&&(itemPtr->BVIntersected(ray)))
+            {
+                itemPtr->calcIntersection(ray, intersect);
+            }
+        }
+        //============================================
+        
+        //=== 2) Continue closest ray-item intersection to the items stored in the tree children. ===
+        for (const auto balltreePtr : ballTreeVector_)
+        {//Do a linear search through the child trees.
+            if ((balltreePtr->isVisibleTo(ray))&&(balltreePtr->BVIntersected(ray)))
+            {
+                balltreePtr->calcIntersection(ray, intersect);
+            }
+        }
+        //============================================
+    }
+}
+
+
+bool stitch::BallTree::occluded(const Ray &ray, const float tMax) const
+{
+    if (isFrozenCompact())
+    {
+        return calcFrozenWideOcclusion(frozenCompactNodeVector_.data(), ray, tMax);
+    }
+    
+    if (isFrozenWide())
+    {
+        return calcFrozenWideOcclusion(frozenWideNodeVector_.data(), ray, tMax);
+    }
+    
+    if (isFrozen())
+    {
+        return calcFrozenOcclusion(ray, tMax);
+    }
+    
+    //if (BVIntersected(orig, normDir)) This is currently executed by the calling code!
+    {
+        for (const auto itemPtr : itemVector_)
+        {
+            if ((itemPtr->isVisibleTo(ray))&&(itemPtr->BVIntersected(ray))&&(itemPtr->occluded(ray, tMax)))
+            {
+                return true;
+            }
+        }
+        
+        for (const auto balltreePtr : ballTreeVector_)
+        {
+            if ((balltreePtr->isVisibleTo(ray))&&(balltreePtr->BVIntersected(ray))&&(balltreePtr->occluded(ray, tMax)))
+            {
+                return true;
+            }
+        }
+    }
+    
+    return false;
+}
+
+
+void stitch::BallTree::calcShadingNormal(const Ray &ray, Intersection &intersect) const
+{
+    if (frozenMesh_!=nullptr)
+    {//Only called for the hits that setFrozenMeshIntersection recorded with the tree as the item hit.
+        frozenMesh_->interpolateNormal(intersect.primitiveID_, intersect.b1_, intersect.b2_, intersect.normal_);
+        intersect.itemID_|=(intersect.normal_*ray.direction_>0.0f)?0:1;//back surface gets even ID, front surface gets odd ID.
+    }
+}
 
 #ifdef USE_OSG
 osg::ref_ptr<osg::Node> stitch::BallTree::constructOSGNode(const bool createOSGLineGeometry, const bool createOSGNormalGeometry, const bool wireframe, const uintptr_t key) const
@@ -31,20 +31,143 @@
 
 //#define USE_AXIS_ALIGNED_ITEM_SPLIT_PLANES 1
 
+#define BALLTREE_FROZEN_STACK_SIZE 128 //Traversal stack entries kept on the call stack. Deeper trees use a heap allocated stack.
+#define BALLTREE_WIDE_NODE_WIDTH 4 //The number of children of a wide node. One SSE register per bound.
+#define BALLTREE_COMPACT_NODE_MAX_LEAF_ITEMS 0xFFFF //The item count of a compact node's leaf child is stored in 16 bits.
+#define BALLTREE_REBUILD_RADIUS_RATIO 1.5f //A node is rebuilt once a child's sphere grows beyond this factor of its radius when built.
+
 namespace stitch {
 	class BallTree;
+    struct FrozenTreeNode;
+    struct FrozenWideNode;
+    struct FrozenCompactNode;
+    class TriangleMesh;
 }
 
 #include "BoundingVolume.h"
+#include "FrozenTriangles.h"
+#include "Math/AABB.h"
 #include "Math/Ray.h"
 #include "OSGUtils/StitchOSG.h"
 
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+
 namespace stitch {
 	
+    /*! \brief A node of the frozen (flattened) form of a tree. 32 bytes so that two nodes fit in a cache line.
+     
+     The nodes are stored contiguously in depth-first order so the first child of an interior node directly follows it and
+     the next sibling of a node is found at the index following the node's subtree. A leaf references a range of the frozen item array. */
+    struct FrozenTreeNode
+    {
+        FrozenTreeNode() :
+        offset_(0),
+        numItems_(0)
+        {}
+        
+        inline bool isLeaf() const
+        {
+            return numItems_!=0;
+        }
+        
+        //! Index of the node following this node's subtree.
+        inline uint32_t getSkipIndex(const uint32_t nodeIndex) const
+        {
+            return isLeaf() ? (nodeIndex+1) : offset_;
+        }
+        
+        AABB bounds_;
+        
+        //! For a leaf the index of the first item in the frozen item array. For an interior node the index of the node following its subtree.
+        uint32_t offset_;
+        
+        //! The number of items in a leaf. Zero for an interior node.
+        uint32_t numItems_;
+    };
+    
+    /*! \brief A 4-wide node collapsed from the binary frozen tree. 128 bytes i.e. two cache lines.
+     
+     The children's boxes are stored as structure of arrays so that a ray is tested against all of them with one SSE
+     sequence. A child is either a leaf that references a range of the frozen item array or another wide node. Unused
+     child slots have both offset_ and numItems_ zero. The root is never a child so its index can not be confused with an unused slot. */
+    struct FrozenWideNode
+    {
+        FrozenWideNode()
+        {
+            for (size_t childNum=0; childNum<BALLTREE_WIDE_NODE_WIDTH; ++childNum)
+            {
+                minX_[childNum]=minY_[childNum]=minZ_[childNum]=0.0f;
+                maxX_[childNum]=maxY_[childNum]=maxZ_[childNum]=0.0f;
+                offset_[childNum]=0;
+                numItems_[childNum]=0;
+            }
+        }
+        
+        float minX_[BALLTREE_WIDE_NODE_WIDTH], minY_[BALLTREE_WIDE_NODE_WIDTH], minZ_[BALLTREE_WIDE_NODE_WIDTH];
+        float maxX_[BALLTREE_WIDE_NODE_WIDTH], maxY_[BALLTREE_WIDE_NODE_WIDTH], maxZ_[BALLTREE_WIDE_NODE_WIDTH];
+        
+        //! For a leaf child the index of its first item in the frozen item array. For an interior child the index of its wide node.
+        uint32_t offset_[BALLTREE_WIDE_NODE_WIDTH];
+        
+        //! The number of items of a leaf child. Zero for an interior child.
+        uint32_t numItems_[BALLTREE_WIDE_NODE_WIDTH];
+    };
+    
+    /*! \brief A wide node with its children's boxes quantised to 8 bits relative to the node's box. 64 bytes i.e. one cache line.
+     
+     A child's bound along an axis is decoded as origin_+q*2^exponent_ where q is the stored 8 bit value. The boxes are
+     rounded outwards when quantised so that the decoded boxes still contain the children. The offsets and unused slots
+     are the same as those of the FrozenWideNode that the node is quantised from. */
+    struct FrozenCompactNode
+    {
+        FrozenCompactNode()
+        {
+            memset(this, 0, sizeof(FrozenCompactNode));
+        }
+        
+        //! The scale of the quantised bounds along the axis.
+        inline float getScale(const size_t axis) const
+        {
+            const uint32_t scaleBits=((uint32_t)(exponent_[axis]+127))<<23;
+            float scale;
+            memcpy(&scale, &scaleBits, sizeof(float));
+            return scale;
+        }
+        
+        //! The decoded box of a child slot.
+        AABB getChildBounds(const size_t childNum) const;
+        
+        /*! Quantise the children's boxes. Unused slots are skipped.
+         @return False if the boxes can not be quantised, e.g. because they are unbounded. */
+        bool quantise(const AABB * const childBounds);
+        
+        float origin_[3];
+        int8_t exponent_[3];
+        uint8_t padding_;
+        
+        uint8_t minX_[BALLTREE_WIDE_NODE_WIDTH], minY_[BALLTREE_WIDE_NODE_WIDTH], minZ_[BALLTREE_WIDE_NODE_WIDTH];
+        uint8_t maxX_[BALLTREE_WIDE_NODE_WIDTH], maxY_[BALLTREE_WIDE_NODE_WIDTH], maxZ_[BALLTREE_WIDE_NODE_WIDTH];
+        
+        //! For a leaf child the index of its first item in the frozen item array. For an interior child the index of its compact node.
+        uint32_t offset_[BALLTREE_WIDE_NODE_WIDTH];
+        
+        //! The number of items of a leaf child. Zero for an interior child.
+        uint16_t numItems_[BALLTREE_WIDE_NODE_WIDTH];
+    };
+    
 	//! Implements a ball tree acceleration structure of BoundingVolumes.
 	class BallTree : public BoundingVolume
 	{
 	public:
+        /*! The type of acceleration structure built over the items. Used to select the tree of the scene and of the object models. */
+        enum TreeType {
+            BALL_TREE,
+            SAH_BVH_TREE,
+            SAH_SBVH_TREE
+        };
+        
 		BallTree();
         
         BallTree(const BallTree &lValue);
@@ -54,12 +177,29 @@ namespace stitch {
         /*! Virtual constructor idiom. Clone operator. */
         virtual BallTree * clone() const//Uses the copy constructor.
         {
-            return new BallTree(*this);
+            BallTree *ballTree=new BallTree(*this);
+            ballTree->refreezeLike(*this);//The copy constructor does not copy the frozen form which references the original items.
+            
+            return ballTree;
+        }
+        
+        /*! Factory method to create an empty tree of the given type. */
+        static BallTree * create(const TreeType treeType);
+        
+        virtual TreeType getTreeType() const
+        {
+            return BALL_TREE;
         }
         
 		inline void addItem(BoundingVolume * const item)
         {
+            unfreeze();
             itemVector_.push_back(item);
+            
+            if (itemIndex_!=nullptr)
+            {
+                (*itemIndex_)[item]=this;
+            }
         }
         
         inline bool empty() const
@@ -70,17 +210,190 @@ namespace stitch {
         /*! Get the number of items in the tree. */
         size_t getNumItems() const;
         
-        void clear();
+        virtual void clear();
+        
+        /*! Collect all items into the root's itemVector and delete the tree structure. The items are not deleted. */
+        virtual void linearise();
+        
+        /*! Build/update the tree structure with the items in the itemVector. The tree is not split if there are chunkSize items or less.
+         The bounding volumes of the new nodes are calculated during the build so updateBV need not be called afterwards. */
+        virtual void build(const size_t chunkSize, const uint8_t splitAxis);
+        
+        /*! Recursively update the bounding volumes of the tree, e.g. after the items have moved. */
+        virtual void updateBV();
+        
+        /*! Update the bounding volumes of the tree after its items have moved, e.g. for the next frame of an animation, without
+         rebuilding it. Nodes whose children's spheres grew beyond BALLTREE_REBUILD_RADIUS_RATIO of their radius when built are
+         rebuilt, as after insertItem, and the tree is then frozen again. Otherwise the frozen and wide nodes are refitted in
+         place. The items' own bounding volumes must be up to date.
+         A compact tree whose refitted boxes can not be quantised is built and frozen compact again (see rebuildCompact).
+         @return The number of subtrees that were rebuilt because refitting degraded them, counting the rebuild of a compact tree as one. */
+        virtual size_t refit();
+        
+        /*! Whether the tree has a build hierarchy that insertItem and removeItem can update. A tree that was never built, was
+         linearised (e.g. when it was frozen compact) or was set up frozen from a cache has none and has to be built again. */
+        virtual bool hasBuildHierarchy() const
+        {
+            return chunkSize_!=0;
+        }
+        
+        /*! Insert an item into the built tree without rebuilding it, e.g. an object added while laying out a scene. The item
+         goes down to the leaf whose bounding sphere grows the least. The leaf is split again (see build) once it holds more
+         than the build's chunkSize items, and only the spheres on the path to it are updated. A node whose child's sphere grew
+         beyond BALLTREE_REBUILD_RADIUS_RATIO of its radius when built is rebuilt over its own items so that repeated insertions
+         do not degrade the tree. The tree is then frozen again the way that it was frozen, unless the edit is part of a batch
+         (see beginEdits). Without a build hierarchy the item is only added (see addItem). */
+        virtual void insertItem(BoundingVolume * const item);
+        
+        /*! Remove an item from the built tree without deleting it or rebuilding the tree. The item's leaf is found through an
+         item index that the first removal makes and later edits keep up to date (see findItemNode). Emptied nodes are dropped
+         and only the spheres on the path from the leaf up are updated, with the same rebuild of degraded nodes as insertItem.
+         The tree is then frozen again the way that it was frozen, unless the edit is part of a batch (see beginEdits). Without
+         a build hierarchy the item is only taken out of the item list and the tree is left unfrozen.
+         @return False if the item is not in the tree. */
+        virtual bool removeItem(BoundingVolume * const item);
+        
+        /*! Start a batch of insertItem and removeItem calls, e.g. the objects added and removed for the next frame. Freezing
+         the tree is linear in its size so the tree is unfrozen once here and frozen again once by endEdits instead of after
+         every edit. Rays traverse the build hierarchy in between. A compact tree keeps no build hierarchy, so it is frozen
+         compact again by a full build in endEdits if it was edited. */
+        void beginEdits();
+        
+        /*! Freeze the tree again the way that it was frozen before beginEdits. A tree without a build hierarchy is left as
+         the edits left it, as after addItem. */
+        void endEdits();
+        
+        /*! Whether a batch of edits was started by beginEdits and not yet ended. */
+        inline bool isEditing() const
+        {
+            return editing_;
+        }
+        
+        virtual AABB getAABB() const;
+        
+        /*! Flatten the built tree into the frozen form that calcIntersection then uses. Should be called once building is done.
+         Adding items, clearing, linearising or (re)building the tree unfreezes it again. */
+        virtual void freeze();
+        
+        /*! Freeze the tree if needed and collapse the binary frozen nodes into 4-wide nodes. calcIntersection then uses the
+         wide nodes which test four child boxes per step with SSE, which suits incoherent rays (e.g. photons and path
+         traced bounces). Ray packets still use the binary frozen nodes. */
+        void freezeWide();
+        
+        /*! Freeze the tree wide if needed and quantise the wide nodes into compact nodes (see FrozenCompactNode) to save
+         memory. The binary and wide nodes and the build hierarchy are released so only the compact nodes and the frozen
+         item references remain. Refitting then refits the compact nodes but no longer rebuilds degraded subtrees. The tree
+         stays frozen wide if its boxes can not be quantised (e.g. unbounded items) or a leaf has too many items.
+         @return True if the tree is now frozen compact. */
+        bool freezeCompact();
+        
+        /*! Discard the frozen form of the tree. */
+        void unfreeze();
+        
+        inline bool isFrozen() const
+        {
+            return !frozenNodeVector_.empty();
+        }
+        
+        inline bool isFrozenWide() const
+        {
+            return !frozenWideNodeVector_.empty();
+        }
+        
+        inline bool isFrozenCompact() const
+        {
+            return !frozenCompactNodeVector_.empty();
+        }
+        
+        size_t getNumFrozenNodes() const
+        {
+            return frozenNodeVector_.size();
+        }
+        
+        size_t getNumFrozenWideNodes() const
+        {
+            return frozenWideNodeVector_.size();
+        }
+        
+        const std::vector<FrozenTreeNode> &getFrozenNodes() const
+        {
+            return frozenNodeVector_;
+        }
+        
+        const std::vector<const stitch::BoundingVolume *> &getFrozenItems() const
+        {
+            return frozenItemVector_;
+        }
+        
+        const std::vector<FrozenWideNode> &getFrozenWideNodes() const
+        {
+            return frozenWideNodeVector_;
+        }
+        
+        size_t getNumFrozenCompactNodes() const
+        {
+            return frozenCompactNodeVector_.size();
+        }
+        
+        const std::vector<FrozenCompactNode> &getFrozenCompactNodes() const
+        {
+            return frozenCompactNodeVector_;
+        }
+        
+        /*! The mesh that the frozen leaves reference triangles of, see freezeMesh. Null if they reference items. */
+        const TriangleMesh *getFrozenMesh() const
+        {
+            return frozenMesh_;
+        }
         
-        void linearise();
+        /*! The indices of the mesh's triangles in the order that the frozen leaves reference them. */
+        const std::vector<uint32_t> &getFrozenTriangles() const
+        {
+            return frozenTriangleVector_;
+        }
         
-        /*! Build/update the tree structure with the items in the itemVector. */
-        void build(const size_t chunkSize, const uint8_t splitAxis);
+        /*! The number of bytes used by the tree: the build hierarchy, the frozen nodes and the item references, plus the trees
+         inside the items (e.g. of the models). The items themselves are not counted. */
+        virtual size_t getTreeMemorySize() const;
         
-        void updateBV();
+        virtual size_t getNumPrimitives() const;
+        
+        /*! Set up the frozen (and wide) form from existing nodes, e.g. from a cache, instead of building and freezing the tree.
+         The tree has no build hierarchy so unfreezing it leaves a linear list of items.
+         The traversal stack sizes are calculated from the nodes, in which an interior child always follows its parent.
+         @param frozenItems The tree's items in the order that the frozen leaves reference them. An item may be referenced more than once. */
+        void setFrozen(const std::vector<const stitch::BoundingVolume *> &frozenItems,
+                       const FrozenTreeNode * const nodes, const size_t numNodes,
+                       const FrozenWideNode * const wideNodes, const size_t numWideNodes,
+                       const FrozenCompactNode * const compactNodes=nullptr, const size_t numCompactNodes=0);
+        
+        /*! Replace the items of the frozen tree, which must all be MeshTriangles of the mesh, by the indices of their
+         triangles. The leaves then reference the triangles of the mesh directly and the build hierarchy is deleted, so the
+         tree only keeps its frozen nodes and one index per triangle reference. The MeshTriangles are released but not
+         deleted, since they belong to whoever allocated them (e.g. the arena of a PolygonModel). The mesh is not owned and
+         can not change, so refitting the tree does nothing. Freezing the tree again or unfreezing it (e.g. by adding an
+         item) leaves it empty; the triangles then have to be added again to rebuild it. */
+        void freezeMesh(const TriangleMesh * const mesh);
+        
+        /*! Set up the frozen form over the triangles of a mesh from existing nodes (see freezeMesh), e.g. from a cache.
+         Any items and build hierarchy of the tree are deleted.
+         @param frozenTriangles The indices of the mesh's triangles in the order that the frozen leaves reference them. */
+        void setFrozen(const TriangleMesh * const mesh, const std::vector<uint32_t> &frozenTriangles,
+                       const FrozenTreeNode * const nodes, const size_t numNodes,
+                       const FrozenWideNode * const wideNodes, const size_t numWideNodes,
+                       const FrozenCompactNode * const compactNodes=nullptr, const size_t numCompactNodes=0);
         
         virtual void calcIntersection(const Ray &ray, Intersection &intersect) const;
         
+        /*! Trace the packet through the frozen form of the tree. Falls back to one ray at a time if the tree is not frozen. */
+        virtual void calcPacketIntersection(const RayPacket &packet, Intersection * const intersects, const uint32_t mask) const;
+        
+        /*! Any-hit traversal that returns as soon as an item is found closer than tMax. Nodes beyond tMax are not visited. */
+        virtual bool occluded(const Ray &ray, const float tMax) const;
+        
+        /*! Interpolate the vertex normals of the mesh triangle hit if the tree is frozen over a mesh (see freezeMesh). */
+        virtual void calcShadingNormal(const Ray &ray, Intersection &intersect) const;
+        
 #ifdef USE_OSG
 		virtual osg::ref_ptr<osg::Node> constructOSGNode(const bool createOSGLineGeometry, const bool createOSGNormalGeometry, const bool wireframe, const uintptr_t key=0) const;
                 
@@ -88,10 +401,194 @@ namespace stitch {
 #endif// USE_OSG
         
         
+    protected:
+        /*! Update this node's bounding sphere from its items and child trees without updating the child trees. */
+        void updateNodeBV();
+        
+        /*! Append a leaf for the frozen items in [firstItem, endItem) and return its node index. */
+        uint32_t addFrozenLeaf(const size_t firstItem, const size_t endItem);
+        
+        /*! Calculate the traversal stack size that the frozen nodes require. To be called once the frozen nodes are complete. */
+        void updateFrozenStackSize();
+        
+        /*! Calculate the traversal stack size that the wide (or compact) nodes require. */
+        void updateFrozenWideStackSize();
+        
+        /*! Intersect the ray with the frozen form of the tree. Uses an explicit stack, visits the nearer children first and
+         skips the subtrees that are entered beyond the closest intersection found so far. */
+        void calcFrozenIntersection(const Ray &ray, Intersection &intersect) const;
+        
+        /*! Intersect the packet with the frozen form of the tree. A node is visited once for all the rays in the packet that
+         intersect its box. Same traversal order and culling as calcFrozenIntersection using the nearest entry of the rays. */
+        void calcFrozenPacketIntersection(const RayPacket &packet, Intersection * const intersects, const uint32_t mask) const;
+        
+        /*! Intersect the ray with the wide (FrozenWideNode) or compact (FrozenCompactNode) nodes. Same traversal order and
+         culling as calcFrozenIntersection. */
+        template <class WideNode>
+        void calcFrozenWideIntersection(const WideNode * const wideNodes, const Ray &ray, Intersection &intersect) const;
+        
+        /*! Any-hit query through the frozen form of the tree. The children are visited in stored order since any blocker will do. */
+        bool calcFrozenOcclusion(const Ray &ray, const float tMax) const;
+        
+        /*! Any-hit query through the wide or compact nodes. */
+        template <class WideNode>
+        bool calcFrozenWideOcclusion(const WideNode * const wideNodes, const Ray &ray, const float tMax) const;
+        
+        /*! Record a hit on a triangle of the frozen mesh with the tree as the item hit. The normal is left to calcShadingNormal. */
+        void setFrozenMeshIntersection(const uint32_t triangleIndex, const float distance, const float b1, const float b2, Intersection &intersect) const;
+        
+        /*! Intersect the ray with the mesh triangles that the frozen items [firstItem, endItem) reference. */
+        void calcFrozenMeshIntersection(const uint32_t firstItem, const uint32_t endItem, const Ray &ray, Intersection &intersect) const;
+        
+        /*! Any-hit query against the mesh triangles that the frozen items [firstItem, endItem) reference. */
+        bool calcFrozenMeshOcclusion(const uint32_t firstItem, const uint32_t endItem, const Ray &ray, const float tMax) const;
+        
+        /*! Set the bounding sphere of a tree frozen over a mesh around the triangles that it references. */
+        void updateFrozenMeshBV();
+        
+        /*! Refit the boxes of the frozen, wide and compact nodes to the current boxes of their items. Children are stored after
+         their parents so the nodes are refitted in reverse order.
+         @return False if the items moved out of the range that the compact nodes can represent. The tree is then unfrozen. */
+        bool refitFrozen();
+        
+        /*! Build the tree again over its items with the chunkSize that it was frozen compact from and freeze it compact again,
+         e.g. after refitFrozen failed. A compact tree keeps no build hierarchy so the whole tree is built. The tree stays frozen
+         wide with its build hierarchy if its boxes still can not be quantised (see freezeCompact). */
+        void rebuildCompact();
+        
+        /*! Collect the visibility masks of the frozen, wide and compact nodes from their items (see BoundingVolume::visibilityMask_).
+         To be called once the frozen form is complete. No masks are kept if all the items are visible to all rays, which is
+         the usual case, and the traversals then skip the mask tests. The pre-transposed triangles keep their own masks (see
+         FrozenTriangles). */
+        void updateFrozenVisibilityMasks();
+        
+        /*! Freeze the tree again after it was edited, the way that it was frozen before. A compact tree has no build hierarchy to edit. */
+        void refreeze(const bool frozen, const bool wide);
+        
+        /*! Freeze (or freeze wide or compact) the tree like the other tree. Used by clone. The other tree's frozen
+         nodes are copied if all its items are in its own itemVector (e.g. the SAH BVH) since the clone's items are in the same order. */
+        void refreezeLike(const BallTree &other);
+        
+    private:
+        /*! Recursively append the frozen nodes of ballTree's subtree and return the index of its node. */
+        uint32_t freezeBallTreeNode(const BallTree * const ballTree);
+        
+        /*! Add the item to this node if it is a leaf, else to the child whose sphere grows the least, and update the spheres on the way back up. */
+        void insertNodeItem(BoundingVolume * const item);
+        
+        /*! Build the node's subtree, see build. */
+        void buildSubtree(const size_t chunkSize, const uint8_t splitAxis);
+        
+        /*! Remove the item from the node that holds it. Emptied nodes are deleted and a node left with only one child takes
+         over the child's content on the way up to the root. Only called on the root. @return False if the item is not in the tree. */
+        bool removeNodeItem(const BoundingVolume * const item);
+        
+        /*! Update the node after an item was removed from the child's subtree: drop the child if it was emptied, rebuild the
+         node if the child degraded (see rebuildDegradedNode) and take over the content of an only child. */
+        void updateRemovedChild(BallTree * const child);
+        
+        /*! Take over the items and children of the node's only child. */
+        void collapseChild();
+        
+        /*! The root of the tree that the node belongs to. */
+        BallTree *getRoot();
+        
+        /*! Find the node that holds the item. Only called on the root. The item index is made on the first call and kept up
+         to date by the edits until the tree is cleared, linearised or built again. @return Null if the item is not in the tree. */
+        BallTree *findItemNode(const BoundingVolume * const item);
+        
+        /*! Record the nodes of the items of the subtree in the item index. */
+        void indexItems(std::unordered_map<const stitch::BoundingVolume *, BallTree *> &itemIndex);
+        
+        /*! Record the nodes of the items of the subtree in the item index of the root if the root keeps one. */
+        void reindexItems();
+        
+        /*! Release the item index of the root. */
+        void clearItemIndex();
+        
+        /*! Rebuild the node over its own items if the child's sphere grew beyond BALLTREE_REBUILD_RADIUS_RATIO of its radius when built.
+         The node keeps its own built radius so that its parent still sees the growth. @return True if the node was rebuilt. */
+        bool rebuildDegradedNode(const BallTree * const child);
+        
+        /*! Rebuild the nodes of the subtree that have a child whose sphere grew beyond BALLTREE_REBUILD_RADIUS_RATIO of its
+         radius when built (see rebuildDegradedNode), e.g. after the items moved. The highest such nodes are rebuilt first and
+         the spheres on the way back up are updated. @return The number of nodes that were rebuilt. */
+        size_t rebuildDegradedNodes();
+        
+        /*! Append the binary frozen children of a frozen node to the vector. Empty nodes are skipped. */
+        void getFrozenChildren(const uint32_t nodeIndex, std::vector<uint32_t> &children) const;
+        
+        /*! Recursively append a wide node over the given binary frozen nodes and return its index. More than four nodes are
+         grouped under new wide nodes. Interior nodes are opened, largest surface area first, while their children fit.
+         @param stackSize Set to the traversal stack size that the wide node's subtree requires. */
+        uint32_t addFrozenWideNode(const std::vector<uint32_t> &frozenNodes, size_t &stackSize);
+        
+        /*! Reorder the wide nodes from depth-first into the van Emde Boas layout (see appendVanEmdeBoasOrder) so that the
+         nodes near each other in the tree are near each other in memory for any cache line or page size. */
+        void relayoutFrozenWideNodes();
+        
+        /*! Collect the visibility masks of the child slots of the wide (or compact) nodes. Parents precede their children so the nodes are processed in reverse order. */
+        template <class WideNode>
+        void updateFrozenWideVisibilityMasks(const std::vector<WideNode> &wideNodes);
+        
     public:
         std::vector<stitch::BoundingVolume *> itemVector_;
         std::vector<stitch::BallTree *> ballTreeVector_;
         
+    protected:
+        //! Frozen nodes in depth-first order. Empty if the tree is not frozen.
+        std::vector<FrozenTreeNode> frozenNodeVector_;
+        
+        //! The items in the order that the frozen leaves reference them. The items are not owned.
+        std::vector<const stitch::BoundingVolume *> frozenItemVector_;
+        
+        //! The mesh whose triangles the frozen leaves reference instead of items, see freezeMesh. Not owned. Null otherwise.
+        const TriangleMesh *frozenMesh_;
+        
+        //! The indices of the frozen mesh's triangles in the order that the frozen leaves reference them. Empty without a frozen mesh.
+        std::vector<uint32_t> frozenTriangleVector_;
+        
+        //! The frozen items (or mesh triangles) pre-transposed for SSE if they are all triangles. Empty otherwise and if the tree is frozen compact.
+        FrozenTriangles frozenTriangles_;
+        
+        //! The maximum number of entries on the frozen traversal stack.
+        size_t frozenStackSize_;
+        
+        //! Wide nodes in van Emde Boas order with the root first and children after their parents. Empty if the tree is not frozen wide.
+        std::vector<FrozenWideNode> frozenWideNodeVector_;
+        
+        //! The maximum number of entries on the wide (or compact) traversal stack.
+        size_t frozenWideStackSize_;
+        
+        //! Compact nodes with the same layout as the wide nodes that they were quantised from. Empty if the tree is not frozen compact.
+        std::vector<FrozenCompactNode> frozenCompactNodeVector_;
+        
+        //! The union of the visibility masks of each frozen node's items. Empty if all the items are visible to all rays.
+        std::vector<uint32_t> frozenNodeMaskVector_;
+        
+        //! The union of the visibility masks of the items of each child slot of the wide (or compact) nodes, BALLTREE_WIDE_NODE_WIDTH per node.
+        std::vector<uint32_t> frozenWideMaskVector_;
+        
+        //! The chunkSize of the build that made this node. Zero if the node was not built, see hasBuildHierarchy.
+        size_t chunkSize_;
+        
+        //! The chunkSize of the build that the tree was frozen compact from. Kept when freezeCompact releases the build hierarchy, see rebuildCompact.
+        size_t compactChunkSize_;
+        
+        //! The radius of the node's sphere when it was built. Its growth bounds the quality of insertItem, removeItem and refit.
+        float builtRadius_;
+        
+        //! The node's parent in the build hierarchy. Null for the root.
+        BallTree *parent_;
+        
+        //! The node that holds each item. Only kept by the root, see findItemNode. Null if not made or out of date.
+        std::unordered_map<const stitch::BoundingVolume *, BallTree *> *itemIndex_;
+        
+        //! Whether a batch of edits is in progress, see beginEdits.
+        bool editing_;
+        
+        //! How the tree was frozen when the batch of edits began, see endEdits.
+        bool editFrozen_, editWide_, editCompact_;
 	};
 	
 }
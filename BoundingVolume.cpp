@@ -28,7 +28,11 @@
 
 #include "BoundingVolume.h"
 
+#ifdef USE_CXX11
+std::atomic<uint32_t> stitch::BoundingVolume::staticItemID_(2);
+#else
 uint32_t stitch::BoundingVolume::staticItemID_=2;
+#endif
 
 #ifdef USE_OSG
 osg::ref_ptr<osg::Node> stitch::BoundingVolume::constructOSGNode(const bool createOSGLineGeometry, const bool createOSGNormalGeometry, const bool wireframe, const uintptr_t key) const
@@ -52,9 +56,9 @@ void stitch::BoundingVolume::calcIntersection(const Ray &ray, Intersection &inte
         const float entry=(-b-sqrtD)/(2.0f*a);
         const float exit=(-b+sqrtD)/(2.0f*a);
         
-        if (entry>0.0f)
+        if (entry>ray.tMin_)
         {
-            if (entry<intersect.distance_)
+            if ((entry<intersect.distance_)&&(entry<ray.tMax_))
             {
                 intersect.distance_=entry;
                 intersect.normal_=(ray.direction_*entry + origD);
@@ -63,9 +67,9 @@ void stitch::BoundingVolume::calcIntersection(const Ray &ray, Intersection &inte
                 intersect.itemPtr_=this;
             }
         } else
-            if (exit>0.0f)
+            if (exit>ray.tMin_)
             {
-                if (exit<intersect.distance_)
+                if ((exit<intersect.distance_)&&(exit<ray.tMax_))
                 {
                     intersect.distance_=exit;
                     intersect.normal_=Vec3(origD, ray.direction_, exit);
@@ -76,3 +80,20 @@ void stitch::BoundingVolume::calcIntersection(const Ray &ray, Intersection &inte
             }
     }
 }
+
+void stitch::BoundingVolume::calcPacketIntersection(const RayPacket &packet, Intersection * const intersects, const uint32_t mask) const
+{
+    for (uint32_t laneMask=mask; laneMask; laneMask&=laneMask-1)
+    {
+        const size_t laneNum=RayPacket::lowestLane(laneMask);
+        calcIntersection(packet.getRay(laneNum), intersects[laneNum]);
+    }
+}
+
+bool stitch::BoundingVolume::occluded(const Ray &ray, const float tMax) const
+{
+    Intersection intersect(ray.id0_, ray.id1_, tMax);
+    calcIntersection(ray, intersect);
+    
+    return intersect.distance_<tMax;
+}
@@ -35,13 +35,16 @@ namespace stitch {
 
 #include "Math/MathUtil.h"
 #include "Math/Vec3.h"
+#include "Math/AABB.h"
 #include "Math/Ray.h"
+#include "Math/RayPacket.h"
 #include "Intersection.h"
 
 #include "OSGUtils/StitchOSG.h"
 
 #ifdef USE_CXX11
 #include <cstdint>
+#include <atomic>
 #else
 #include <stdint.h>
 #endif
@@ -57,9 +60,9 @@ namespace stitch {
         radiusBV_(((float)FLT_MAX)),
         userIndex_(0),
         userGroupID_(0),
-        itemID_(staticItemID_)
+        visibilityMask_(RAY_VISIBILITY_ALL),
+        itemID_(allocateItemID())
         {
-            staticItemID_+=2;
         }
         
         BoundingVolume(const Vec3 &centre, const float radiusBV=((float)FLT_MAX), const uint32_t userIndex=0, const uint32_t userGroupID=0):
@@ -67,9 +70,9 @@ namespace stitch {
         radiusBV_(radiusBV),
         userIndex_(userIndex),
         userGroupID_(userGroupID),
-        itemID_(staticItemID_)
+        visibilityMask_(RAY_VISIBILITY_ALL),
+        itemID_(allocateItemID())
         {
-            staticItemID_+=2;
         }
         
 #ifdef USE_CXX11
@@ -79,9 +82,9 @@ namespace stitch {
         radiusBV_(radiusBV),
         userIndex_(userIndex),
         userGroupID_(userGroupID),
-        itemID_(staticItemID_)
+        visibilityMask_(RAY_VISIBILITY_ALL),
+        itemID_(allocateItemID())
         {
-            staticItemID_+=2;
         }
 #endif// USE_CXX11
         
@@ -90,6 +93,7 @@ namespace stitch {
         radiusBV_(lValue.radiusBV_),
         userIndex_(lValue.userIndex_),
         userGroupID_(lValue.userGroupID_),
+        visibilityMask_(lValue.visibilityMask_),
         itemID_(lValue.itemID_)
         {
         }
@@ -100,6 +104,7 @@ namespace stitch {
         radiusBV_(rValue.radiusBV_),
         userIndex_(rValue.userIndex_),
         userGroupID_(rValue.userGroupID_),
+        visibilityMask_(rValue.visibilityMask_),
         itemID_(rValue.itemID_)
         {
         }
@@ -114,6 +119,7 @@ namespace stitch {
             radiusBV_=lValue.radiusBV_;
             userIndex_=lValue.userIndex_;
             userGroupID_=lValue.userGroupID_;
+            visibilityMask_=lValue.visibilityMask_;
             
             itemID_=lValue.itemID_;
             
@@ -127,6 +133,7 @@ namespace stitch {
             radiusBV_=rValue.radiusBV_;
             userIndex_=rValue.userIndex_;
             userGroupID_=rValue.userGroupID_;
+            visibilityMask_=rValue.visibilityMask_;
 
             itemID_=rValue.itemID_;
             
@@ -135,10 +142,23 @@ namespace stitch {
 #endif //USE_CXX11
         
         //=======================================================================//
-        /*! Check whether a ray intersects the spherical bounding volume. */
+        /*! Whether the object belongs to one of the categories that the ray sees. */
+        inline bool isVisibleTo(const Ray &ray) const
+        {
+            return (visibilityMask_&ray.visibilityMask_)!=0;
+        }
+        
+        /*! Check whether a ray intersects the spherical bounding volume within the ray's [tMin_, tMax_) interval. */
         virtual bool BVIntersected(const Ray &ray) const final
         {
             const stitch::Vec3 A(ray.origin_, centre_);
+            const float B = stitch::Vec3::dot(A, ray.direction_);
+            
+            if (((B+radiusBV_)<ray.tMin_) || ((B-radiusBV_)>=ray.tMax_))
+            {//The sphere lies outside of the ray interval.
+                return false;
+            }
+            
             const float ADSq=A.lengthSq() - radiusBV_*radiusBV_;
             
             if (ADSq<=0.0f)
@@ -146,8 +166,6 @@ namespace stitch {
                 return true;
             } else
             {
-                const float B = stitch::Vec3::dot(A, ray.direction_);
-                
                 if (B<0.0f)
                 {
                     return false;
@@ -165,6 +183,36 @@ namespace stitch {
             return new BoundingVolume(*this);
         }        
         
+        /*! Get the axis aligned bounding box of the item. Defaults to the box around the bounding sphere. Sub-classes may provide a tighter box. */
+        virtual AABB getAABB() const
+        {
+            return AABB(centre_, radiusBV_);
+        }
+        
+        /*! The number of bytes used by the acceleration structures inside the item, e.g. a model's tree. Zero for a primitive. */
+        virtual size_t getTreeMemorySize() const
+        {
+            return 0;
+        }
+        
+        /*! The number of primitives (e.g. polygons or brushes) that the item consists of. */
+        virtual size_t getNumPrimitives() const
+        {
+            return 1;
+        }
+        
+        /*! Split the bounds of the part of the item inside box by the plane at position along axis, e.g. for spatial splits.
+         Defaults to cutting the box itself. Sub-classes may split the item itself for tighter bounds.
+         Either side is empty if the item does not reach it. */
+        virtual void splitAABB(const AABB &box, const uint8_t axis, const float position, AABB &leftBox, AABB &rightBox) const
+        {
+            leftBox=box;
+            leftBox.max_.v_[axis]=MathUtil::min(box.max_.v_[axis], position);
+            
+            rightBox=box;
+            rightBox.min_.v_[axis]=MathUtil::max(box.min_.v_[axis], position);
+        }
+        
 #ifdef USE_OSG
         /*! Creates an OSG node that may be used to create a preview of the object.
          @param createOSGLineGeometry Boolean flag to indicate whether or not line geometry in addition to the polygon geometry should be created.
@@ -176,6 +224,55 @@ namespace stitch {
         
         virtual void calcIntersection(const Ray &ray, Intersection &intersect) const;
         
+        /*! Intersect the rays of a packet. The calling code has already done the bounding volume test of each ray in the mask.
+         The default intersects the rays one at a time. Sub-classes that contain a tree override this to trace the packet through the tree.
+         @param intersects The closest intersection so far of each ray of the packet.
+         @param mask The lanes of the packet to intersect. */
+        virtual void calcPacketIntersection(const RayPacket &packet, Intersection * const intersects, const uint32_t mask) const;
+        
+        /*! Any-hit query for shadow and visibility rays. Check whether the item is intersected closer than tMax along the ray.
+         The calling code has already done the bounding volume test. The default runs calcIntersection bounded to tMax.
+         Sub-classes override this to skip the normal calculation and to stop their traversal at the first blocker.
+         @param tMax The end of the ray interval. Intersections at or beyond it are ignored. */
+        virtual bool occluded(const Ray &ray, const float tMax) const;
+        
+        /*! Calculate the shading normal (and the front/back bit of the item id) of the closest hit, which this item reported
+         as intersect.itemPtr_. Items that interpolate their normal record only the distance, primitiveID_ and barycentrics in
+         calcIntersection and do the interpolation here, because most of the candidate hits found during a traversal are
+         replaced by closer ones. Called once per ray by the Scene after the traversal. The default does nothing, for items
+         that set the normal in calcIntersection. */
+        virtual void calcShadingNormal(const Ray &ray, Intersection &intersect) const
+        {
+        }
+        
+        /*! Get the vertices of the item if it is a triangle, e.g. so that a tree can test its triangles together (see FrozenTriangles).
+         @return False, the default, if the item is not a triangle. */
+        virtual bool getTriangle(Vec3 &v0, Vec3 &v1, Vec3 &v2) const
+        {
+            return false;
+        }
+        
+        /*! Record a hit on the triangle that was found by testing several triangles together in the intersection, the same as
+         calcIntersection would. Only called on items whose getTriangle returns true.
+         @param b1 The barycentric coordinate of the hit with respect to the triangle's second vertex.
+         @param b2 The barycentric coordinate of the hit with respect to the triangle's third vertex. */
+        virtual void setTriangleIntersection(const Ray &ray, const float distance, const float b1, const float b2, Intersection &intersect) const
+        {
+        }
+        
+        /*! Allocate the IDs of numItems items that are not objects themselves, e.g. the triangles of a mesh, in one go.
+         @return The first ID. The IDs of the items follow it two apart like those of objects. */
+        static inline uint32_t allocateItemIDs(const uint32_t numItems)
+        {
+#ifdef USE_CXX11
+            return staticItemID_.fetch_add(numItems*2, std::memory_order_relaxed);
+#else
+            const uint32_t itemID=staticItemID_;
+            staticItemID_+=numItems*2;
+            return itemID;
+#endif
+        }
+        
         virtual bool pointInBV(const Vec3 &point) const
         {
             return centre_.calcDistToPointSq(point) <= (radiusBV_*radiusBV_);
@@ -188,12 +285,35 @@ namespace stitch {
         uint32_t userIndex_;
         uint32_t userGroupID_;
         
+        /*! The categories that the object belongs to, e.g. RAY_VISIBILITY_CAMERA only for a light proxy that should not cast
+         shadows. Rays whose visibility mask has no bit in common with it skip the object. Trees keep the union of the masks
+         of each node's items so that subtrees invisible to a ray are culled; a tree updates them when it is frozen, refitted
+         or built. */
+        uint32_t visibilityMask_;
+        
         //!Automatically allocated ID. The first two IDs (0 and 1) are reserved. Then objects are allocated even IDs with the lsb used to indicate front-face/back-face during intersection.
         uint32_t itemID_;
         
     protected:
+        /*! Allocate the next free item ID. The allocation is atomic so that objects, e.g. the triangles of several models, may be constructed from multiple threads.
+         The IDs are then unique, but the order in which concurrently constructed objects receive them is not fixed. */
+        static inline uint32_t allocateItemID()
+        {
+#ifdef USE_CXX11
+            return staticItemID_.fetch_add(2, std::memory_order_relaxed);
+#else
+            const uint32_t itemID=staticItemID_;
+            staticItemID_+=2;
+            return itemID;
+#endif
+        }
+        
         //!The static object ID used to assign IDs to new objects. The first two IDs (0 and 1) are reserved. Then objects are allocated even IDs with the lsb used to indicate front-face/back-face during intersection.
+#ifdef USE_CXX11
+        static std::atomic<uint32_t> staticItemID_;
+#else
         static uint32_t staticItemID_;
+#endif
     };
 }
 
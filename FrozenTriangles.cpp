@@ -0,0 +1,108 @@
+/*
+ *  FrozenTriangles.cpp
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "FrozenTriangles.h"
+#include "TriangleMesh.h"
+
+//=======================================================================//
+void stitch::FrozenTriangles::assign(const std::vector<const BoundingVolume *> &frozenItems)
+{
+    clear();
+    
+    const size_t numItems=frozenItems.size();
+    const size_t stride=numItems+FROZENTRIANGLES_WIDTH-1;
+    
+    std::vector<float> components(stride*NUM_COMPONENTS, 0.0f);
+    std::vector<uint32_t> visibilityMasks(stride, 0);
+    bool allVisible=true;
+    
+    for (size_t itemNum=0; itemNum<numItems; ++itemNum)
+    {
+        Vec3 v0, v1, v2;
+        
+        if (!frozenItems[itemNum]->getTriangle(v0, v1, v2))
+        {
+            return;
+        }
+        
+        setTriangle(&components[itemNum], stride, v0, v1, v2);
+        
+        visibilityMasks[itemNum]=frozenItems[itemNum]->visibilityMask_;
+        allVisible=allVisible&&(visibilityMasks[itemNum]==RAY_VISIBILITY_ALL);
+    }
+    
+    components_.swap(components);
+    stride_=stride;
+    
+    if (!allVisible)
+    {
+        visibilityMasks_.swap(visibilityMasks);
+    }
+}
+
+void stitch::FrozenTriangles::assign(const TriangleMesh &mesh, const std::vector<uint32_t> &triangleIndices)
+{
+    clear();
+    
+    const size_t numItems=triangleIndices.size();
+    const size_t stride=numItems+FROZENTRIANGLES_WIDTH-1;
+    
+    components_.assign(stride*NUM_COMPONENTS, 0.0f);
+    stride_=stride;
+    
+    for (size_t itemNum=0; itemNum<numItems; ++itemNum)
+    {
+        Vec3 v0, v1, v2;
+        mesh.getTriangle(triangleIndices[itemNum], v0, v1, v2);
+        
+        setTriangle(&components_[itemNum], stride, v0, v1, v2);
+    }
+}
+
+void stitch::FrozenTriangles::setTriangle(float * const itemComponents, const size_t stride, const Vec3 &v0, const Vec3 &v1, const Vec3 &v2)
+{
+    const Vec3 e1(v0, v1);//v1 - v0
+    const Vec3 e2(v0, v2);//v2 - v0
+    
+    itemComponents[V0X*stride]=v0.x();
+    itemComponents[V0Y*stride]=v0.y();
+    itemComponents[V0Z*stride]=v0.z();
+    itemComponents[E1X*stride]=e1.x();
+    itemComponents[E1Y*stride]=e1.y();
+    itemComponents[E1Z*stride]=e1.z();
+    itemComponents[E2X*stride]=e2.x();
+    itemComponents[E2Y*stride]=e2.y();
+    itemComponents[E2Z*stride]=e2.z();
+}
+
+//=======================================================================//
+void stitch::FrozenTriangles::clear()
+{
+    std::vector<float>().swap(components_);
+    stride_=0;
+    std::vector<uint32_t>().swap(visibilityMasks_);
+}
+
+//=======================================================================//
+size_t stitch::FrozenTriangles::getMemorySize() const
+{
+    return components_.capacity()*sizeof(float) + visibilityMasks_.capacity()*sizeof(uint32_t);
+}
@@ -0,0 +1,224 @@
+/*
+ *  FrozenTriangles.h
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STITCH_FROZEN_TRIANGLES_H
+#define STITCH_FROZEN_TRIANGLES_H
+
+#define FROZENTRIANGLES_WIDTH 4 //The number of triangles tested together with SSE.
+
+namespace stitch {
+    class FrozenTriangles;
+    class TriangleMesh;
+}
+
+#include "BoundingVolume.h"
+#include "Math/MathUtil.h"
+#include "Math/Ray.h"
+
+#include <xmmintrin.h> //for __m128
+#include <emmintrin.h> //SSE2 for the visibility masks.
+#include <vector>
+
+#ifdef USE_CXX11
+#include <cstdint>
+#else
+#include <stdint.h>
+#endif
+
+namespace stitch {
+    
+    /*! \brief The triangles that a frozen tree's leaves reference, pre-transposed for SSE.
+     
+     The first vertex and the two edges from it of each frozen item are stored as structure of arrays in the order of
+     the frozen item array. The triangles of a leaf are therefore contiguous and four of them are loaded with one load per
+     component. A leaf's triangles are then tested together with Moller and Trumbore's test (see TriangleMesh::intersect)
+     instead of with one virtual call per item. Only set up if all the items are triangles (see BoundingVolume::getTriangle).
+     The items' visibility masks are kept alongside if any item is not visible to all rays, and the lanes of triangles that
+     a ray does not see are then masked out of the same test. */
+    class FrozenTriangles
+    {
+    public:
+        FrozenTriangles() :
+        stride_(0)
+        {}
+        
+        /*! Set up from the frozen items and their visibility masks. Stays empty if any of the items is not a triangle. */
+        void assign(const std::vector<const BoundingVolume *> &frozenItems);
+        
+        /*! Set up from the triangles of the mesh that a tree frozen over the mesh references (see BallTree::freezeMesh). */
+        void assign(const TriangleMesh &mesh, const std::vector<uint32_t> &triangleIndices);
+        
+        void clear();
+        
+        inline bool empty() const
+        {
+            return components_.empty();
+        }
+        
+        /*! The number of bytes used by the vertex and edge arrays. */
+        size_t getMemorySize() const;
+        
+        /*! Find the closest of the triangles [firstItem, endItem) that the ray hits within its interval and closer than maxDistance.
+         @param hitItem Set to the index of the closest triangle hit.
+         @param distance Set to the distance to the hit.
+         @param b1 Set to the barycentric coordinate of the hit with respect to the triangle's second vertex.
+         @param b2 Set to the barycentric coordinate of the hit with respect to the triangle's third vertex.
+         @return True if a triangle was hit. The output parameters are only set then. */
+        inline bool intersect(const uint32_t firstItem, const uint32_t endItem, const Ray &ray, const float maxDistance,
+                              uint32_t &hitItem, float &distance, float &b1, float &b2) const
+        {
+            float closest=MathUtil::min(maxDistance, ray.tMax_);
+            bool hit=false;
+            
+            for (uint32_t item=firstItem; item<endItem; item+=FROZENTRIANGLES_WIDTH)
+            {
+                __m128 t, u, v;
+                int hitMask=testTriangles(item, endItem, ray, t, u, v);
+                hitMask&=_mm_movemask_ps(_mm_cmplt_ps(t, _mm_set1_ps(closest)));
+                
+                if (hitMask)
+                {//The closest of the lanes hit. The first lane wins a tie like the first item would.
+                    float tLanes[FROZENTRIANGLES_WIDTH], uLanes[FROZENTRIANGLES_WIDTH], vLanes[FROZENTRIANGLES_WIDTH];
+                    _mm_storeu_ps(tLanes, t);
+                    _mm_storeu_ps(uLanes, u);
+                    _mm_storeu_ps(vLanes, v);
+                    
+                    for (uint32_t laneNum=0; laneNum<FROZENTRIANGLES_WIDTH; ++laneNum)
+                    {
+                        if (((hitMask>>laneNum)&1)&&(tLanes[laneNum]<closest))
+                        {
+                            closest=tLanes[laneNum];
+                            hitItem=item+laneNum;
+                            b1=uLanes[laneNum];
+                            b2=vLanes[laneNum];
+                            hit=true;
+                        }
+                    }
+                }
+            }
+            
+            if (hit)
+            {
+                distance=closest;
+            }
+            
+            return hit;
+        }
+        
+        /*! Check whether any of the triangles [firstItem, endItem) is hit after the ray's tMin_ and before tMax. */
+        inline bool occluded(const uint32_t firstItem, const uint32_t endItem, const Ray &ray, const float tMax) const
+        {
+            for (uint32_t item=firstItem; item<endItem; item+=FROZENTRIANGLES_WIDTH)
+            {
+                __m128 t, u, v;
+                const int hitMask=testTriangles(item, endItem, ray, t, u, v);
+                
+                if (hitMask&_mm_movemask_ps(_mm_cmplt_ps(t, _mm_set1_ps(tMax))))
+                {
+                    return true;
+                }
+            }
+            
+            return false;
+        }
+        
+    private:
+        /*! Moller and Trumbore's test of the ray against the triangles from item, up to endItem. The operations are in the same
+         order as in TriangleMesh::intersect so that the results are the same.
+         @return The mask of the lanes that hit their triangle after the ray's tMin_. The distance limit is left to the caller. */
+        inline int testTriangles(const uint32_t item, const uint32_t endItem, const Ray &ray, __m128 &t, __m128 &b1, __m128 &b2) const
+        {
+            const __m128 dirX=_mm_set1_ps(ray.direction_.x());
+            const __m128 dirY=_mm_set1_ps(ray.direction_.y());
+            const __m128 dirZ=_mm_set1_ps(ray.direction_.z());
+            
+            const float * const components=&components_[item];
+            
+            const __m128 e1X=_mm_loadu_ps(components+E1X*stride_);
+            const __m128 e1Y=_mm_loadu_ps(components+E1Y*stride_);
+            const __m128 e1Z=_mm_loadu_ps(components+E1Z*stride_);
+            const __m128 e2X=_mm_loadu_ps(components+E2X*stride_);
+            const __m128 e2Y=_mm_loadu_ps(components+E2Y*stride_);
+            const __m128 e2Z=_mm_loadu_ps(components+E2Z*stride_);
+            
+            //s1=direction x e2
+            const __m128 s1X=_mm_sub_ps(_mm_mul_ps(dirY, e2Z), _mm_mul_ps(dirZ, e2Y));
+            const __m128 s1Y=_mm_sub_ps(_mm_mul_ps(dirZ, e2X), _mm_mul_ps(dirX, e2Z));
+            const __m128 s1Z=_mm_sub_ps(_mm_mul_ps(dirX, e2Y), _mm_mul_ps(dirY, e2X));
+            
+            const __m128 divisor=_mm_add_ps(_mm_add_ps(_mm_mul_ps(s1X, e1X), _mm_mul_ps(s1Y, e1Y)), _mm_mul_ps(s1Z, e1Z));
+            const __m128 recipDivisor=_mm_div_ps(_mm_set1_ps(1.0f), divisor);
+            
+            //d=origin - v0
+            const __m128 dX=_mm_sub_ps(_mm_set1_ps(ray.origin_.x()), _mm_loadu_ps(components+V0X*stride_));
+            const __m128 dY=_mm_sub_ps(_mm_set1_ps(ray.origin_.y()), _mm_loadu_ps(components+V0Y*stride_));
+            const __m128 dZ=_mm_sub_ps(_mm_set1_ps(ray.origin_.z()), _mm_loadu_ps(components+V0Z*stride_));
+            
+            b1=_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dX, s1X), _mm_mul_ps(dY, s1Y)), _mm_mul_ps(dZ, s1Z)), recipDivisor);
+            
+            //s2=d x e1
+            const __m128 s2X=_mm_sub_ps(_mm_mul_ps(dY, e1Z), _mm_mul_ps(dZ, e1Y));
+            const __m128 s2Y=_mm_sub_ps(_mm_mul_ps(dZ, e1X), _mm_mul_ps(dX, e1Z));
+            const __m128 s2Z=_mm_sub_ps(_mm_mul_ps(dX, e1Y), _mm_mul_ps(dY, e1X));
+            
+            b2=_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, s2X), _mm_mul_ps(dirY, s2Y)), _mm_mul_ps(dirZ, s2Z)), recipDivisor);
+            t=_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2X, s2X), _mm_mul_ps(e2Y, s2Y)), _mm_mul_ps(e2Z, s2Z)), recipDivisor);
+            
+            const __m128 zero=_mm_setzero_ps();
+            const __m128 one=_mm_set1_ps(1.0f);
+            
+            __m128 valid=_mm_cmpneq_ps(divisor, zero);
+            valid=_mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(b1, zero), _mm_cmple_ps(b1, one)));
+            valid=_mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(b2, zero), _mm_cmple_ps(_mm_add_ps(b1, b2), one)));
+            valid=_mm_and_ps(valid, _mm_cmpgt_ps(t, _mm_set1_ps(ray.tMin_)));
+            
+            const uint32_t numLanes=endItem-item;
+            int laneMask=(numLanes>=FROZENTRIANGLES_WIDTH) ? ((1<<FROZENTRIANGLES_WIDTH)-1) : ((1<<numLanes)-1);
+            
+            if (!visibilityMasks_.empty())
+            {//Drop the lanes whose triangles have no visibility bit in common with the ray.
+                const __m128i masks=_mm_and_si128(_mm_loadu_si128((const __m128i *)&visibilityMasks_[item]), _mm_set1_epi32(ray.visibilityMask_));
+                laneMask&=~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(masks, _mm_setzero_si128())));
+            }
+            
+            return _mm_movemask_ps(valid)&laneMask;
+        }
+        
+    private:
+        /*! Store the first vertex and the edges of a triangle at the item's position in the component arrays. */
+        static void setTriangle(float * const itemComponents, const size_t stride, const Vec3 &v0, const Vec3 &v1, const Vec3 &v2);
+        
+    private:
+        //! The components of the first vertex and of the edges from it to the second (e1) and third (e2) vertices.
+        enum Component {V0X=0, V0Y, V0Z, E1X, E1Y, E1Z, E2X, E2Y, E2Z, NUM_COMPONENTS};
+        
+        //! The arrays of each component one after the other, stride_ floats apart, in one allocation so that an unused
+        //! instance (e.g. in each node of a ball tree) stays small. Each array is padded with FROZENTRIANGLES_WIDTH-1
+        //! degenerate triangles so that the loads of the last leaf stay in bounds.
+        std::vector<float> components_;
+        size_t stride_;
+        
+        //! The visibility masks of the items, padded like the component arrays. Empty if all the items are visible to all rays.
+        std::vector<uint32_t> visibilityMasks_;
+    };
+}
+
+#endif// STITCH_FROZEN_TRIANGLES_H
@@ -0,0 +1,173 @@
+/*
+ *  DecimalParser.h
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STITCH_DECIMAL_PARSER_H
+#define STITCH_DECIMAL_PARSER_H
+
+#define DECIMALPARSER_MAX_SIZE 64 //Longer numbers are rejected.
+
+namespace stitch {
+    class DecimalParser;
+}
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef USE_CXX11
+#include <cstdint>
+#else
+#include <stdint.h>
+#endif
+
+namespace stitch {
+    
+    /*! \brief Converts numbers in the text of memory mapped model files, which are not null terminated. */
+    class DecimalParser
+    {
+    public:
+        /*! Convert the number in [begin, end).
+         A plain decimal with at most 15 significant digits and a power of ten of at most 22 is converted directly: both the
+         digits and the power are exact doubles so the one rounding of their product or quotient gives the same value as
+         strtod, without its cost. Other numbers (e.g. longer ones, inf and nan) are handed to strtod.
+         @return False if [begin, end) is not a number. */
+        static inline bool parse(const char * const begin, const char * const end, double &value)
+        {
+            static const double powersOfTen[23]={1.0e0, 1.0e1, 1.0e2, 1.0e3, 1.0e4, 1.0e5, 1.0e6, 1.0e7, 1.0e8, 1.0e9, 1.0e10, 1.0e11,
+                1.0e12, 1.0e13, 1.0e14, 1.0e15, 1.0e16, 1.0e17, 1.0e18, 1.0e19, 1.0e20, 1.0e21, 1.0e22};
+            
+            const size_t size=end-begin;
+            
+            if ((size==0)||(size>=DECIMALPARSER_MAX_SIZE))
+            {
+                return false;
+            }
+            
+            //=== Plain decimals ===
+            const char *digit=begin;
+            const bool negative=(*digit=='-');
+            if ((negative)||(*digit=='+')) ++digit;
+            
+            uint64_t mantissa=0;
+            int numSignificantDigits=0;
+            int exponent=0;
+            bool hasDigits=false;
+            
+            for (; (digit<end)&&(*digit>='0')&&(*digit<='9'); ++digit)
+            {
+                if ((mantissa!=0)||(*digit!='0'))
+                {
+                    mantissa=mantissa*10+(*digit-'0');
+                    ++numSignificantDigits;
+                }
+                hasDigits=true;
+                
+                if (numSignificantDigits>15) break;
+            }
+            
+            if ((digit<end)&&(*digit=='.')&&(numSignificantDigits<=15))
+            {
+                for (++digit; (digit<end)&&(*digit>='0')&&(*digit<='9'); ++digit)
+                {
+                    if ((mantissa!=0)||(*digit!='0'))
+                    {
+                        mantissa=mantissa*10+(*digit-'0');
+                        ++numSignificantDigits;
+                    }
+                    hasDigits=true;
+                    --exponent;
+                    
+                    if (numSignificantDigits>15) break;
+                }
+            }
+            
+            if ((digit<end)&&((*digit=='e')||(*digit=='E'))&&(hasDigits))
+            {
+                ++digit;
+                const bool negativeExponent=(digit<end)&&(*digit=='-');
+                if ((digit<end)&&((*digit=='-')||(*digit=='+'))) ++digit;
+                
+                int explicitExponent=0;
+                const char * const exponentStart=digit;
+                for (; (digit<end)&&(*digit>='0')&&(*digit<='9')&&(explicitExponent<1000); ++digit)
+                {
+                    explicitExponent=explicitExponent*10+(*digit-'0');
+                }
+                
+                if (digit==exponentStart)
+                {
+                    hasDigits=false;//Let strtod decide.
+                }
+                
+                exponent+=negativeExponent ? -explicitExponent : explicitExponent;
+            }
+            
+            if ((digit==end)&&(hasDigits)&&(numSignificantDigits<=15)&&(exponent>=-22)&&(exponent<=22))
+            {
+                value=(exponent<0) ? (((double)mantissa)/powersOfTen[-exponent]) : (((double)mantissa)*powersOfTen[exponent]);
+                if (negative) value=-value;
+                
+                return true;
+            }
+            //===
+            
+            //Copy the number out so that strtod is not handed the unterminated end of the mapping.
+            char token[DECIMALPARSER_MAX_SIZE];
+            memcpy(token, begin, size);
+            token[size]='\0';
+            
+            char *tokenEnd=nullptr;
+            value=strtod(token, &tokenEnd);
+            
+            return tokenEnd==(token+size);
+        }
+        
+        /*! Convert an integer in [begin, end), e.g. a vertex index.
+         @return False if [begin, end) is not an integer of at most 18 digits. */
+        static inline bool parseInteger(const char * const begin, const char * const end, int64_t &value)
+        {
+            const char *digit=begin;
+            const bool negative=(digit<end)&&(*digit=='-');
+            if ((digit<end)&&((*digit=='-')||(*digit=='+'))) ++digit;
+            
+            if ((digit==end)||((end-digit)>18))
+            {
+                return false;
+            }
+            
+            value=0;
+            for (; digit<end; ++digit)
+            {
+                if ((*digit<'0')||(*digit>'9'))
+                {
+                    return false;
+                }
+                
+                value=value*10+(*digit-'0');
+            }
+            
+            if (negative) value=-value;
+            
+            return true;
+        }
+    };
+}
+
+#endif// STITCH_DECIMAL_PARSER_H
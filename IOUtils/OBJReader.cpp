@@ -0,0 +1,496 @@
+/*
+ *  OBJReader.cpp
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "OBJReader.h"
+#include "DecimalParser.h"
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//=======================================================================//
+stitch::OBJReader::OBJReader() :
+mapping_(nullptr),
+mappingEnd_(nullptr)
+{
+}
+
+stitch::OBJReader::~OBJReader()
+{
+    close();
+}
+
+//=======================================================================//
+bool stitch::OBJReader::open(const std::string &fileName)
+{
+    close();
+    
+    const int fd=::open(fileName.c_str(), O_RDONLY);
+    if (fd<0)
+    {
+        return false;
+    }
+    
+    struct stat fileStat;
+    if ((fstat(fd, &fileStat)!=0)||(fileStat.st_size==0))
+    {
+        ::close(fd);
+        return false;
+    }
+    
+    const size_t fileSize=fileStat.st_size;
+    void * const mapping=mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);//The mapping stays valid.
+    
+    if (mapping==MAP_FAILED)
+    {
+        return false;
+    }
+    
+    mapping_=(const char *)mapping;
+    mappingEnd_=mapping_+fileSize;
+    
+    return true;
+}
+
+void stitch::OBJReader::close()
+{
+    if (mapping_!=nullptr)
+    {
+        munmap((void *)mapping_, mappingEnd_-mapping_);
+    }
+    
+    mapping_=nullptr;
+    mappingEnd_=nullptr;
+}
+
+//=======================================================================//
+bool stitch::OBJReader::read(std::vector<Vec3> &vertCoords, std::vector<Vec3> &vertNormals, std::vector<size_t> &indices,
+                             const Vec3 &centre, const float scale, const bool invertWinding, bool &hasNormals) const
+{
+    vertCoords.clear();
+    vertNormals.clear();
+    indices.clear();
+    hasNormals=false;
+    
+    if (mapping_==nullptr)
+    {
+        return false;
+    }
+    
+    //=== Split the file into chunks of whole lines ===
+    const size_t fileSize=mappingEnd_-mapping_;
+    size_t numChunks=1;
+    
+    if (fileSize>=OBJREADER_PARALLEL_MIN_BYTES)
+    {
+        numChunks=std::thread::hardware_concurrency();
+        if (numChunks==0) numChunks=2;//Setup numChunks in case system reports 0.
+    }
+    
+    std::vector<Chunk> chunks;
+    chunks.reserve(numChunks);
+    
+    const char *chunkBegin=mapping_;
+    for (size_t chunkNum=0; (chunkNum<numChunks)&&(chunkBegin<mappingEnd_); ++chunkNum)
+    {
+        const char *chunkEnd=mappingEnd_;
+        
+        if (chunkNum<(numChunks-1))
+        {//End the chunk after the line that reaches its share of the file.
+            chunkEnd=mapping_+(fileSize*(chunkNum+1))/numChunks;
+            
+            if (chunkEnd<chunkBegin)
+            {
+                chunkEnd=chunkBegin;
+            }
+            
+            const char * const lineEnd=(const char *)memchr(chunkEnd, '\n', mappingEnd_-chunkEnd);
+            chunkEnd=(lineEnd!=nullptr) ? (lineEnd+1) : mappingEnd_;
+        }
+        
+        Chunk chunk;
+        chunk.begin_=chunkBegin;
+        chunk.end_=chunkEnd;
+        chunk.numVertices_=0;
+        chunk.numNormals_=0;
+        chunk.vertexOffset_=0;
+        chunk.normalOffset_=0;
+        chunks.push_back(chunk);
+        
+        chunkBegin=chunkEnd;
+    }
+    //===
+    
+    //=== Count the vertices and normals of each chunk to find where each chunk's go ===
+    runChunks(chunks, [this](Chunk &chunk)
+              {
+                  countChunk(chunk);
+                  return true;
+              });
+    
+    size_t numVertices=0, numNormals=0;
+    for (size_t chunkNum=0; chunkNum<chunks.size(); ++chunkNum)
+    {
+        chunks[chunkNum].vertexOffset_=numVertices;
+        chunks[chunkNum].normalOffset_=numNormals;
+        
+        numVertices+=chunks[chunkNum].numVertices_;
+        numNormals+=chunks[chunkNum].numNormals_;
+    }
+    //===
+    
+    //=== Parse the chunks ===
+    vertCoords.resize(numVertices);
+    std::vector<Vec3> normals(numNormals);
+    
+    const bool valid=runChunks(chunks, [this, &vertCoords, &normals, &centre, scale, invertWinding](Chunk &chunk)
+                               {
+                                   return parseChunk(chunk, vertCoords, normals, centre, scale, invertWinding);
+                               });
+    
+    if (!valid)
+    {
+        vertCoords.clear();
+        return false;
+    }
+    //===
+    
+    //=== Join the triangles of the chunks ===
+    size_t numIndices=0;
+    for (size_t chunkNum=0; chunkNum<chunks.size(); ++chunkNum)
+    {
+        numIndices+=chunks[chunkNum].indices_.size();
+    }
+    
+    std::vector<size_t> normalIndices;
+    
+    if (chunks.size()==1)
+    {
+        indices.swap(chunks[0].indices_);
+        normalIndices.swap(chunks[0].normalIndices_);
+    } else
+    {
+        indices.reserve(numIndices);
+        normalIndices.reserve(numIndices);
+        
+        for (size_t chunkNum=0; chunkNum<chunks.size(); ++chunkNum)
+        {
+            indices.insert(indices.end(), chunks[chunkNum].indices_.begin(), chunks[chunkNum].indices_.end());
+            normalIndices.insert(normalIndices.end(), chunks[chunkNum].normalIndices_.begin(), chunks[chunkNum].normalIndices_.end());
+        }
+    }
+    //===
+    
+    //=== Give each vertex the normal of its face vertices, duplicating vertices used with different normals ===
+    hasNormals=(numNormals>0)&&(!indices.empty());
+    for (size_t indexNum=0; (hasNormals)&&(indexNum<numIndices); ++indexNum)
+    {
+        hasNormals=(normalIndices[indexNum]!=OBJREADER_NO_NORMAL);
+    }
+    
+    if (hasNormals)
+    {
+        std::vector<size_t> vertexNormalIndices(numVertices, OBJREADER_NO_NORMAL);
+        std::unordered_map<uint64_t, size_t> duplicates;
+        
+        for (size_t indexNum=0; indexNum<numIndices; ++indexNum)
+        {
+            const size_t vertexIndex=indices[indexNum];
+            const size_t normalIndex=normalIndices[indexNum];
+            
+            if (vertexNormalIndices[vertexIndex]==OBJREADER_NO_NORMAL)
+            {
+                vertexNormalIndices[vertexIndex]=normalIndex;
+            } else
+                if (vertexNormalIndices[vertexIndex]!=normalIndex)
+                {
+                    const uint64_t key=(((uint64_t)vertexIndex)*numNormals)+normalIndex;
+                    const auto duplicate=duplicates.find(key);
+                    
+                    if (duplicate!=duplicates.end())
+                    {
+                        indices[indexNum]=duplicate->second;
+                    } else
+                    {
+                        const size_t duplicateIndex=vertCoords.size();
+                        
+                        vertCoords.push_back(Vec3(vertCoords[vertexIndex]));
+                        vertexNormalIndices.push_back(normalIndex);
+                        
+                        duplicates[key]=duplicateIndex;
+                        indices[indexNum]=duplicateIndex;
+                    }
+                }
+        }
+        
+        vertNormals.resize(vertCoords.size(), Vec3(1.0f, 0.0f, 0.0f));
+        
+        for (size_t vertexIndex=0; vertexIndex<vertCoords.size(); ++vertexIndex)
+        {
+            if (vertexNormalIndices[vertexIndex]!=OBJREADER_NO_NORMAL)
+            {
+                Vec3 normal=normals[vertexNormalIndices[vertexIndex]];
+                
+                if (normal.lengthSq()!=0.0f)
+                {
+                    normal.normalise();
+                }
+                
+                vertNormals[vertexIndex]=invertWinding ? (normal*(-1.0f)) : normal;
+            }
+        }
+    } else
+    {
+        vertNormals.assign(vertCoords.size(), Vec3(1.0f, 0.0f, 0.0f));
+    }
+    //===
+    
+    return true;
+}
+
+//=======================================================================//
+stitch::OBJReader::LineType stitch::OBJReader::getLineType(const char *&data, const char * const lineEnd)
+{
+    while ((data<lineEnd)&&((*data==' ')||(*data=='\t')))
+    {
+        ++data;
+    }
+    
+    const size_t lineSize=lineEnd-data;
+    
+    if ((lineSize>=2)&&(data[0]=='v')&&((data[1]==' ')||(data[1]=='\t')))
+    {
+        data+=2;
+        return LINE_VERTEX;
+    } else
+        if ((lineSize>=3)&&(data[0]=='v')&&(data[1]=='n')&&((data[2]==' ')||(data[2]=='\t')))
+        {
+            data+=3;
+            return LINE_NORMAL;
+        } else
+            if ((lineSize>=2)&&(data[0]=='f')&&((data[1]==' ')||(data[1]=='\t')))
+            {
+                data+=2;
+                return LINE_FACE;
+            }
+    
+    return LINE_OTHER;
+}
+
+bool stitch::OBJReader::nextToken(const char *&data, const char * const lineEnd, const char *&tokenBegin, const char *&tokenEnd)
+{
+    while ((data<lineEnd)&&((*data==' ')||(*data=='\t')||(*data=='\r')))
+    {
+        ++data;
+    }
+    
+    tokenBegin=data;
+    
+    while ((data<lineEnd)&&(*data!=' ')&&(*data!='\t')&&(*data!='\r'))
+    {
+        ++data;
+    }
+    
+    tokenEnd=data;
+    
+    return tokenEnd!=tokenBegin;
+}
+
+void stitch::OBJReader::countChunk(Chunk &chunk) const
+{
+    const char *lineBegin=chunk.begin_;
+    
+    while (lineBegin<chunk.end_)
+    {
+        const char *lineEnd=(const char *)memchr(lineBegin, '\n', chunk.end_-lineBegin);
+        if (lineEnd==nullptr) lineEnd=chunk.end_;
+        
+        const char *data=lineBegin;
+        const LineType lineType=getLineType(data, lineEnd);
+        
+        if (lineType==LINE_VERTEX)
+        {
+            ++chunk.numVertices_;
+        } else
+            if (lineType==LINE_NORMAL)
+            {
+                ++chunk.numNormals_;
+            }
+        
+        lineBegin=lineEnd+1;
+    }
+}
+
+bool stitch::OBJReader::parseChunk(Chunk &chunk, std::vector<Vec3> &vertCoords, std::vector<Vec3> &normals,
+                                   const Vec3 &centre, const float scale, const bool invertWinding) const
+{
+    const size_t numVertices=vertCoords.size();
+    const size_t numNormals=normals.size();
+    
+    size_t vertexIndex=chunk.vertexOffset_;
+    size_t normalIndex=chunk.normalOffset_;
+    
+    //The face vertices of the current face.
+    std::vector<size_t> faceIndices;
+    std::vector<size_t> faceNormalIndices;
+    
+    chunk.indices_.clear();
+    chunk.normalIndices_.clear();
+    
+    const char *lineBegin=chunk.begin_;
+    
+    while (lineBegin<chunk.end_)
+    {
+        const char *lineEnd=(const char *)memchr(lineBegin, '\n', chunk.end_-lineBegin);
+        if (lineEnd==nullptr) lineEnd=chunk.end_;
+        
+        const char *data=lineBegin;
+        const LineType lineType=getLineType(data, lineEnd);
+        
+        //A trailing comment ends the data of any line type.
+        const char *dataEnd=(const char *)memchr(data, '#', lineEnd-data);
+        if (dataEnd==nullptr) dataEnd=lineEnd;
+        
+        if ((lineType==LINE_VERTEX)||(lineType==LINE_NORMAL))
+        {
+            double coords[3];
+            
+            for (size_t coordNum=0; coordNum<3; ++coordNum)
+            {
+                const char *tokenBegin=nullptr, *tokenEnd=nullptr;
+                
+                if ((!nextToken(data, dataEnd, tokenBegin, tokenEnd)) ||
+                    (!DecimalParser::parse(tokenBegin, tokenEnd, coords[coordNum])))
+                {
+                    return false;
+                }
+            }
+            //Note: An optional fourth (w) value or vertex colours are ignored.
+            
+            if (lineType==LINE_VERTEX)
+            {
+                vertCoords[vertexIndex++]=Vec3(coords[0], coords[1], coords[2])*scale+centre;
+            } else
+            {
+                normals[normalIndex++]=Vec3(coords[0], coords[1], coords[2]);
+            }
+        } else
+            if (lineType==LINE_FACE)
+            {
+                faceIndices.clear();
+                faceNormalIndices.clear();
+                
+                const char *tokenBegin=nullptr, *tokenEnd=nullptr;
+                
+                while (nextToken(data, dataEnd, tokenBegin, tokenEnd))
+                {//A face vertex is v, v/vt, v//vn or v/vt/vn.
+                    const char *firstSlash=(const char *)memchr(tokenBegin, '/', tokenEnd-tokenBegin);
+                    if (firstSlash==nullptr) firstSlash=tokenEnd;
+                    
+                    int64_t objIndex=0;
+                    size_t index=0;
+                    
+                    if ((!DecimalParser::parseInteger(tokenBegin, firstSlash, objIndex)) ||
+                        (!resolveIndex(objIndex, vertexIndex, numVertices, index)))
+                    {
+                        return false;
+                    }
+                    
+                    faceIndices.push_back(index);
+                    
+                    const char *secondSlash=(firstSlash<tokenEnd) ? ((const char *)memchr(firstSlash+1, '/', tokenEnd-(firstSlash+1))) : nullptr;
+                    
+                    if ((secondSlash!=nullptr)&&((secondSlash+1)<tokenEnd))
+                    {
+                        if ((!DecimalParser::parseInteger(secondSlash+1, tokenEnd, objIndex)) ||
+                            (!resolveIndex(objIndex, normalIndex, numNormals, index)))
+                        {
+                            return false;
+                        }
+                        
+                        faceNormalIndices.push_back(index);
+                    } else
+                    {
+                        faceNormalIndices.push_back(OBJREADER_NO_NORMAL);
+                    }
+                }
+                
+                for (size_t faceVertexNum=2; faceVertexNum<faceIndices.size(); ++faceVertexNum)
+                {
+                    const size_t v1=invertWinding ? (faceVertexNum-1) : faceVertexNum;
+                    const size_t v2=invertWinding ? faceVertexNum : (faceVertexNum-1);
+                    
+                    chunk.indices_.push_back(faceIndices[0]);
+                    chunk.indices_.push_back(faceIndices[v1]);
+                    chunk.indices_.push_back(faceIndices[v2]);
+                    
+                    chunk.normalIndices_.push_back(faceNormalIndices[0]);
+                    chunk.normalIndices_.push_back(faceNormalIndices[v1]);
+                    chunk.normalIndices_.push_back(faceNormalIndices[v2]);
+                }
+            }
+        //Other lines (comments, texture coordinates, groups, materials, ...) are skipped.
+        
+        lineBegin=lineEnd+1;
+    }
+    
+    return true;
+}
+
+//=======================================================================//
+template <class Task>
+bool stitch::OBJReader::runChunks(std::vector<Chunk> &chunks, const Task &task)
+{
+    if (chunks.size()==1)
+    {
+        return task(chunks[0]);
+    }
+    
+    std::atomic<bool> valid(true);
+    
+    std::vector<std::thread> threadVect;
+    threadVect.reserve(chunks.size());
+    
+    for (size_t chunkNum=0; chunkNum<chunks.size(); ++chunkNum)
+    {
+        threadVect.emplace_back([&task, &chunks, &valid, chunkNum]()
+                                {
+                                    if (!task(chunks[chunkNum]))
+                                    {
+                                        valid=false;
+                                    }
+                                });
+    }
+    
+    for (auto &thread : threadVect)
+    {
+        thread.join();
+    }
+    
+    return valid;
+}
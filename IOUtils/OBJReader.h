@@ -0,0 +1,138 @@
+/*
+ *  OBJReader.h
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STITCH_OBJ_READER_H
+#define STITCH_OBJ_READER_H
+
+#define OBJREADER_PARALLEL_MIN_BYTES 1048576 //Smaller files are parsed by the calling thread only.
+#define OBJREADER_NO_NORMAL ((size_t)-1) //The normal index of a face vertex without a normal.
+
+namespace stitch {
+    class OBJReader;
+}
+
+#include "Math/Vec3.h"
+
+#include <string>
+#include <vector>
+
+#ifdef USE_CXX11
+#include <cstdint>
+#else
+#include <stdint.h>
+#endif
+
+namespace stitch {
+    
+    /*! \brief Reads the vertex positions, the vertex normals and the faces of a memory mapped Wavefront OBJ file.
+     
+     The file is split into chunks on line starts that are parsed in parallel. A first pass counts the vertices and normals of
+     each chunk so that each chunk knows the number defined before it. The positions are then written straight into the
+     output and negative (relative) indices are resolved while parsing. The triangles of the chunks are joined afterwards.
+     Texture coordinates, groups and materials are ignored. */
+    class OBJReader
+    {
+    public:
+        OBJReader();
+        
+        ~OBJReader();
+        
+        /*! Map the file. @return False if the file could not be mapped. */
+        bool open(const std::string &fileName);
+        
+        /*! Unmap the file. */
+        void close();
+        
+        /*! Parse the file and split its faces into triangle fans.
+         The file's normals are kept only if every face vertex has one. A vertex that is used with different normals (e.g. on
+         a hard edge) is then duplicated for each of them, because the normals are stored per vertex.
+         @param vertCoords The positions, scaled and then offset by centre.
+         @param vertNormals The normals of the vertices if hasNormals, else placeholders to be calculated.
+         @param indices Three vertex indices per triangle. The default winding is v0, vk, vk-1 for a face's kth triangle.
+         @param invertWinding Reverse the order of the vertices of each triangle and the normals to flip the surface.
+         @param hasNormals Set to whether the normals were read from the file.
+         @return False if a line can not be parsed or if a face refers to a vertex or normal that is not in the file. */
+        bool read(std::vector<Vec3> &vertCoords, std::vector<Vec3> &vertNormals, std::vector<size_t> &indices,
+                  const Vec3 &centre, const float scale, const bool invertWinding, bool &hasNormals) const;
+    
+    private:
+        /*! A range of whole lines of the file and what was parsed from it. */
+        struct Chunk
+        {
+            const char *begin_;
+            const char *end_;
+            
+            //! The number of vertices and normals in the chunk and in the chunks before it.
+            size_t numVertices_, numNormals_;
+            size_t vertexOffset_, normalOffset_;
+            
+            //! Three vertex indices per triangle and the normal index of each, or OBJREADER_NO_NORMAL.
+            std::vector<size_t> indices_;
+            std::vector<size_t> normalIndices_;
+        };
+        
+        enum LineType {
+            LINE_VERTEX,
+            LINE_NORMAL,
+            LINE_FACE,
+            LINE_OTHER
+        };
+        
+        /*! Classify the line at data and step data past its keyword. */
+        static LineType getLineType(const char *&data, const char * const lineEnd);
+        
+        /*! Find the next whitespace separated token of a line. @return False at the end of the line. */
+        static bool nextToken(const char *&data, const char * const lineEnd, const char *&tokenBegin, const char *&tokenEnd);
+        
+        /*! Count the vertex and normal lines of a chunk. */
+        void countChunk(Chunk &chunk) const;
+        
+        /*! Parse the lines of a chunk. The positions and normals are written at the chunk's offsets. */
+        bool parseChunk(Chunk &chunk, std::vector<Vec3> &vertCoords, std::vector<Vec3> &normals,
+                        const Vec3 &centre, const float scale, const bool invertWinding) const;
+        
+        /*! Resolve a 1-based or negative (relative to the last one defined) OBJ index to a 0-based index.
+         @return False if the index is zero or does not refer to one of the count elements. */
+        static inline bool resolveIndex(const int64_t objIndex, const size_t numDefined, const size_t count, size_t &index)
+        {
+            const int64_t resolved=(objIndex>0) ? (objIndex-1) : (((int64_t)numDefined)+objIndex);
+            
+            if ((objIndex==0)||(resolved<0)||(resolved>=((int64_t)count)))
+            {
+                return false;
+            }
+            
+            index=resolved;
+            return true;
+        }
+        
+        /*! Run task on each chunk, in parallel if there is more than one chunk.
+         @return False if task failed on any of the chunks. */
+        template <class Task>
+        static bool runChunks(std::vector<Chunk> &chunks, const Task &task);
+        
+        //! The mapped file.
+        const char *mapping_;
+        const char *mappingEnd_;
+    };
+}
+
+#endif// STITCH_OBJ_READER_H
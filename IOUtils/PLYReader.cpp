@@ -0,0 +1,945 @@
+/*
+ *  PLYReader.cpp
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "PLYReader.h"
+#include "DecimalParser.h"
+
+#include <atomic>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//=======================================================================//
+stitch::PLYReader::PLYReader() :
+mapping_(nullptr),
+mappingEnd_(nullptr),
+body_(nullptr),
+format_(ASCII),
+swapBytes_(false),
+vertexElement_(-1),
+xProperty_(-1), yProperty_(-1), zProperty_(-1),
+faceElement_(-1),
+indicesProperty_(-1)
+{
+}
+
+stitch::PLYReader::~PLYReader()
+{
+    close();
+}
+
+//=======================================================================//
+bool stitch::PLYReader::open(const std::string &fileName)
+{
+    close();
+    
+    const int fd=::open(fileName.c_str(), O_RDONLY);
+    if (fd<0)
+    {
+        return false;
+    }
+    
+    struct stat fileStat;
+    if ((fstat(fd, &fileStat)!=0)||(fileStat.st_size==0))
+    {
+        ::close(fd);
+        return false;
+    }
+    
+    const size_t fileSize=fileStat.st_size;
+    void * const mapping=mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);//The mapping stays valid.
+    
+    if (mapping==MAP_FAILED)
+    {
+        return false;
+    }
+    
+    mapping_=(const char *)mapping;
+    mappingEnd_=mapping_+fileSize;
+    
+    //=== Parse the header ===
+    const uint16_t byteOrderProbe=1;
+    const bool littleEndianHost=(*((const uint8_t *)&byteOrderProbe))==1;
+    
+    bool validFormat=false;
+    bool validHeader=false;
+    bool firstLine=true;
+    const char *lineStart=mapping_;
+    
+    while ((lineStart<mappingEnd_)&&(!validHeader))
+    {
+        const char *lineEnd=(const char *)memchr(lineStart, '\n', mappingEnd_-lineStart);
+        if (lineEnd==nullptr)
+        {
+            break;//The file ends within the header.
+        }
+        
+        std::string line(lineStart, lineEnd);
+        lineStart=lineEnd+1;
+        
+        if ((!line.empty())&&(line[line.size()-1]=='\r'))
+        {
+            line.resize(line.size()-1);
+        }
+        
+        std::istringstream lineStream(line);
+        std::string keyword;
+        lineStream >> keyword;
+        
+        if (firstLine)
+        {
+            if (keyword!="ply")
+            {
+                break;
+            }
+            
+            firstLine=false;
+        } else
+            if (keyword=="format")
+            {
+                std::string formatName;
+                lineStream >> formatName;
+                
+                validFormat=true;
+                if (formatName=="ascii")
+                {
+                    format_=ASCII;
+                } else
+                    if (formatName=="binary_little_endian")
+                    {
+                        format_=BINARY_LITTLE_ENDIAN;
+                    } else
+                        if (formatName=="binary_big_endian")
+                        {
+                            format_=BINARY_BIG_ENDIAN;
+                        } else
+                        {
+                            validFormat=false;
+                        }
+                
+                swapBytes_=(format_==BINARY_LITTLE_ENDIAN) ? (!littleEndianHost) : ((format_==BINARY_BIG_ENDIAN) && littleEndianHost);
+            } else
+                if (keyword=="element")
+                {
+                    Element element;
+                    lineStream >> element.name_ >> element.count_;
+                    element.recordSize_=0;
+                    
+                    if (!lineStream)
+                    {
+                        break;
+                    }
+                    
+                    elements_.push_back(element);
+                } else
+                    if (keyword=="property")
+                    {
+                        if (elements_.empty())
+                        {
+                            break;
+                        }
+                        
+                        Property property;
+                        std::string typeName;
+                        lineStream >> typeName;
+                        
+                        if (typeName=="list")
+                        {
+                            std::string countTypeName;
+                            lineStream >> countTypeName >> typeName;
+                            property.countType_=parseType(countTypeName);
+                            
+                            if (property.countType_==TYPE_NONE)
+                            {
+                                break;
+                            }
+                        } else
+                        {
+                            property.countType_=TYPE_NONE;
+                        }
+                        
+                        property.type_=parseType(typeName);
+                        lineStream >> property.name_;
+                        
+                        if ((property.type_==TYPE_NONE)||(!lineStream))
+                        {
+                            break;
+                        }
+                        
+                        elements_.back().properties_.push_back(property);
+                    } else
+                        if (keyword=="end_header")
+                        {
+                            validHeader=validFormat;
+                            body_=lineStart;
+                        }
+        //Comments, obj_info and unknown lines are ignored.
+    }
+    //===
+    
+    //=== Find the vertex positions and the face indices ===
+    for (size_t elementNum=0; elementNum<elements_.size(); ++elementNum)
+    {
+        Element &element=elements_[elementNum];
+        
+        element.recordSize_=0;
+        bool fixedSize=true;
+        int xProperty=-1, yProperty=-1, zProperty=-1, indicesProperty=-1;
+        
+        for (size_t propertyNum=0; propertyNum<element.properties_.size(); ++propertyNum)
+        {
+            const Property &property=element.properties_[propertyNum];
+            
+            if (property.countType_!=TYPE_NONE)
+            {
+                fixedSize=false;
+                
+                if ((property.name_=="vertex_indices")||(property.name_=="vertex_index"))
+                {
+                    indicesProperty=propertyNum;
+                }
+            } else
+            {
+                element.recordSize_+=getTypeSize(property.type_);
+                
+                if (property.name_=="x") xProperty=propertyNum;
+                if (property.name_=="y") yProperty=propertyNum;
+                if (property.name_=="z") zProperty=propertyNum;
+            }
+        }
+        
+        if (!fixedSize)
+        {
+            element.recordSize_=0;
+        }
+        
+        if ((element.name_=="vertex")&&(vertexElement_<0)&&(xProperty>=0)&&(yProperty>=0)&&(zProperty>=0))
+        {
+            vertexElement_=elementNum;
+            xProperty_=xProperty;
+            yProperty_=yProperty;
+            zProperty_=zProperty;
+        } else
+            if ((element.name_=="face")&&(faceElement_<0)&&(indicesProperty>=0))
+            {
+                faceElement_=elementNum;
+                indicesProperty_=indicesProperty;
+            }
+    }
+    //===
+    
+    if ((!validHeader)||(vertexElement_<0))
+    {
+        close();
+        return false;
+    }
+    
+    return true;
+}
+
+void stitch::PLYReader::close()
+{
+    if (mapping_!=nullptr)
+    {
+        munmap((void *)mapping_, mappingEnd_-mapping_);
+    }
+    
+    mapping_=nullptr;
+    mappingEnd_=nullptr;
+    body_=nullptr;
+    format_=ASCII;
+    swapBytes_=false;
+    
+    elements_.clear();
+    
+    vertexElement_=-1;
+    xProperty_=-1;
+    yProperty_=-1;
+    zProperty_=-1;
+    faceElement_=-1;
+    indicesProperty_=-1;
+}
+
+//=======================================================================//
+bool stitch::PLYReader::readVertices(std::vector<Vec3> &vertCoords, const Vec3 &centre, const float scale) const
+{
+    vertCoords.clear();
+    
+    const char *start=nullptr;
+    std::vector<Block> blocks;
+    
+    if ((vertexElement_<0) ||
+        (!findElementStart(vertexElement_, start)) ||
+        (!splitRecords(elements_[vertexElement_], start, elements_[vertexElement_].recordSize_, blocks)))
+    {
+        return false;
+    }
+    
+    const Element &element=elements_[vertexElement_];
+    vertCoords.resize(element.count_);
+    
+    auto decodeBlock=[this, &element, &vertCoords, &centre, scale](const Block &block)
+    {
+        const size_t numProperties=element.properties_.size();
+        const char *data=block.begin_;
+        
+        for (uint64_t recordNum=0; recordNum<block.numRecords_; ++recordNum)
+        {
+            float coords[3]={0.0f, 0.0f, 0.0f};
+            
+            for (size_t propertyNum=0; propertyNum<numProperties; ++propertyNum)
+            {
+                const Property &property=element.properties_[propertyNum];
+                double value=0.0;
+                
+                if (property.countType_!=TYPE_NONE)
+                {//Skip the list.
+                    if (!readValue(data, property.countType_, value))
+                    {
+                        return false;
+                    }
+                    
+                    const uint64_t listSize=(uint64_t)value;
+                    for (uint64_t listNum=0; listNum<listSize; ++listNum)
+                    {
+                        if (!skipValue(data, property.type_))
+                        {
+                            return false;
+                        }
+                    }
+                } else
+                    if ((((int)propertyNum)==xProperty_)||(((int)propertyNum)==yProperty_)||(((int)propertyNum)==zProperty_))
+                    {
+                        if (!readValue(data, property.type_, value))
+                        {
+                            return false;
+                        }
+                        
+                        //The values are rounded to float first, like the old reader did.
+                        if (((int)propertyNum)==xProperty_) coords[0]=value;
+                        if (((int)propertyNum)==yProperty_) coords[1]=value;
+                        if (((int)propertyNum)==zProperty_) coords[2]=value;
+                    } else
+                    {//Other properties, e.g. colours, are skipped without converting them.
+                        if (!skipValue(data, property.type_))
+                        {
+                            return false;
+                        }
+                    }
+            }
+            
+            endRecord(data);
+            
+            vertCoords[block.firstRecord_+recordNum]=Vec3(coords[0], coords[1], coords[2])*scale+centre;
+        }
+        
+        return true;
+    };
+    
+    if (!runBlocks(blocks, decodeBlock))
+    {
+        vertCoords.clear();
+        return false;
+    }
+    
+    return true;
+}
+
+bool stitch::PLYReader::readTriangles(std::vector<size_t> &indices, const bool invertWinding) const
+{
+    indices.clear();
+    
+    if (faceElement_<0)
+    {
+        return true;//No faces.
+    }
+    
+    const Element &element=elements_[faceElement_];
+    
+    const char *start=nullptr;
+    if (!findElementStart(faceElement_, start))
+    {
+        return false;
+    }
+    
+    if (element.count_==0)
+    {
+        return true;
+    }
+    
+    if (format_!=ASCII)
+    {//=== Try the fixed record size of a face block in which all the faces have the same number of vertices ===
+        bool otherLists=false;
+        for (size_t propertyNum=0; propertyNum<element.properties_.size(); ++propertyNum)
+        {
+            otherLists|=(((int)propertyNum)!=indicesProperty_)&&(element.properties_[propertyNum].countType_!=TYPE_NONE);
+        }
+        
+        if (!otherLists)
+        {
+            const char *data=start;
+            double faceSize=0.0;
+            
+            for (int propertyNum=0; propertyNum<indicesProperty_; ++propertyNum)
+            {
+                data+=getTypeSize(element.properties_[propertyNum].type_);
+            }
+            
+            if ((!readValue(data, element.properties_[indicesProperty_].countType_, faceSize))||(faceSize<3.0))
+            {//The file ends within the first face or the face has fewer than three vertices.
+                return false;
+            }
+            
+            if (readUniformTriangles(start, (size_t)faceSize, indices, invertWinding))
+            {
+                return true;
+            }
+            
+            indices.clear();
+        }
+    }//===
+    
+    //=== Decode the faces block by block and join the triangles ===
+    std::vector<Block> blocks;
+    if (!splitRecords(element, start, 0, blocks))
+    {
+        return false;
+    }
+    
+    std::vector<std::vector<size_t> > blockIndices(blocks.size());
+    for (size_t blockNum=0; blockNum<blocks.size(); ++blockNum)
+    {
+        blockIndices[blockNum].reserve(blocks[blockNum].numRecords_*3);
+    }
+    
+    const Block * const firstBlock=blocks.data();
+    auto decodeBlock=[this, firstBlock, &blockIndices, invertWinding](const Block &block)
+    {
+        return appendTriangles(block, blockIndices[&block-firstBlock], invertWinding);
+    };
+    
+    if (!runBlocks(blocks, decodeBlock))
+    {
+        return false;
+    }
+    
+    if (blockIndices.size()==1)
+    {
+        indices.swap(blockIndices[0]);
+    } else
+    {
+        size_t numIndices=0;
+        for (size_t blockNum=0; blockNum<blockIndices.size(); ++blockNum)
+        {
+            numIndices+=blockIndices[blockNum].size();
+        }
+        
+        indices.reserve(numIndices);
+        for (size_t blockNum=0; blockNum<blockIndices.size(); ++blockNum)
+        {
+            indices.insert(indices.end(), blockIndices[blockNum].begin(), blockIndices[blockNum].end());
+        }
+    }
+    //===
+    
+    return true;
+}
+
+//=======================================================================//
+stitch::PLYReader::Type stitch::PLYReader::parseType(const std::string &typeName)
+{
+    if ((typeName=="char")||(typeName=="int8")) return TYPE_INT8;
+    if ((typeName=="uchar")||(typeName=="uint8")) return TYPE_UINT8;
+    if ((typeName=="short")||(typeName=="int16")) return TYPE_INT16;
+    if ((typeName=="ushort")||(typeName=="uint16")) return TYPE_UINT16;
+    if ((typeName=="int")||(typeName=="int32")) return TYPE_INT32;
+    if ((typeName=="uint")||(typeName=="uint32")) return TYPE_UINT32;
+    if ((typeName=="float")||(typeName=="float32")) return TYPE_FLOAT32;
+    if ((typeName=="double")||(typeName=="float64")) return TYPE_FLOAT64;
+    
+    return TYPE_NONE;
+}
+
+size_t stitch::PLYReader::getTypeSize(const Type type)
+{
+    switch (type)
+    {
+        case TYPE_INT8:
+        case TYPE_UINT8:
+            return 1;
+        case TYPE_INT16:
+        case TYPE_UINT16:
+            return 2;
+        case TYPE_INT32:
+        case TYPE_UINT32:
+        case TYPE_FLOAT32:
+            return 4;
+        case TYPE_FLOAT64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+double stitch::PLYReader::readBinary(const char * const data, const Type type) const
+{
+    const size_t typeSize=getTypeSize(type);
+    
+    char bytes[8];
+    if (swapBytes_)
+    {
+        for (size_t byteNum=0; byteNum<typeSize; ++byteNum)
+        {
+            bytes[byteNum]=data[typeSize-1-byteNum];
+        }
+    } else
+    {
+        memcpy(bytes, data, typeSize);
+    }
+    
+    switch (type)
+    {
+        case TYPE_INT8: {int8_t value; memcpy(&value, bytes, 1); return value;}
+        case TYPE_UINT8: {uint8_t value; memcpy(&value, bytes, 1); return value;}
+        case TYPE_INT16: {int16_t value; memcpy(&value, bytes, 2); return value;}
+        case TYPE_UINT16: {uint16_t value; memcpy(&value, bytes, 2); return value;}
+        case TYPE_INT32: {int32_t value; memcpy(&value, bytes, 4); return value;}
+        case TYPE_UINT32: {uint32_t value; memcpy(&value, bytes, 4); return value;}
+        case TYPE_FLOAT32: {float value; memcpy(&value, bytes, 4); return value;}
+        case TYPE_FLOAT64: {double value; memcpy(&value, bytes, 8); return value;}
+        default: return 0.0;
+    }
+}
+
+bool stitch::PLYReader::readASCII(const char *&data, double &value) const
+{
+    while ((data<mappingEnd_)&&((*data==' ')||(*data=='\t')||(*data=='\r')))
+    {
+        ++data;
+    }
+    
+    const char * const tokenStart=data;
+    
+    while ((data<mappingEnd_)&&(*data!=' ')&&(*data!='\t')&&(*data!='\r')&&(*data!='\n'))
+    {
+        ++data;
+    }
+    
+    return DecimalParser::parse(tokenStart, data, value);
+}
+
+bool stitch::PLYReader::skipValue(const char *&data, const Type type) const
+{
+    if (format_==ASCII)
+    {
+        while ((data<mappingEnd_)&&((*data==' ')||(*data=='\t')||(*data=='\r')))
+        {
+            ++data;
+        }
+        
+        const char * const tokenStart=data;
+        
+        while ((data<mappingEnd_)&&(*data!=' ')&&(*data!='\t')&&(*data!='\r')&&(*data!='\n'))
+        {
+            ++data;
+        }
+        
+        return data!=tokenStart;
+    } else
+    {
+        const size_t typeSize=getTypeSize(type);
+        
+        if (((size_t)(mappingEnd_-data))<typeSize)
+        {
+            return false;
+        }
+        
+        data+=typeSize;
+        return true;
+    }
+}
+
+void stitch::PLYReader::endRecord(const char *&data) const
+{
+    if (format_==ASCII)
+    {
+        const char * const lineEnd=(const char *)memchr(data, '\n', mappingEnd_-data);
+        data=(lineEnd!=nullptr) ? (lineEnd+1) : mappingEnd_;
+    }
+}
+
+bool stitch::PLYReader::skipRecord(const Element &element, const char *&data) const
+{
+    if (format_==ASCII)
+    {
+        if (data>=mappingEnd_)
+        {
+            return false;
+        }
+        
+        endRecord(data);
+        return true;
+    }
+    
+    if (element.recordSize_!=0)
+    {
+        if (((size_t)(mappingEnd_-data))<element.recordSize_)
+        {
+            return false;
+        }
+        
+        data+=element.recordSize_;
+        return true;
+    }
+    
+    for (size_t propertyNum=0; propertyNum<element.properties_.size(); ++propertyNum)
+    {
+        const Property &property=element.properties_[propertyNum];
+        
+        if (property.countType_!=TYPE_NONE)
+        {
+            double listSize=0.0;
+            if (!readValue(data, property.countType_, listSize))
+            {
+                return false;
+            }
+            
+            const uint64_t listBytes=((uint64_t)listSize)*getTypeSize(property.type_);
+            if (((uint64_t)(mappingEnd_-data))<listBytes)
+            {
+                return false;
+            }
+            
+            data+=listBytes;
+        } else
+        {
+            const size_t typeSize=getTypeSize(property.type_);
+            if (((size_t)(mappingEnd_-data))<typeSize)
+            {
+                return false;
+            }
+            
+            data+=typeSize;
+        }
+    }
+    
+    return true;
+}
+
+bool stitch::PLYReader::findElementStart(const int elementNum, const char *&start) const
+{
+    start=body_;
+    
+    for (int precedingNum=0; precedingNum<elementNum; ++precedingNum)
+    {
+        const Element &element=elements_[precedingNum];
+        
+        if ((format_!=ASCII)&&(element.recordSize_!=0))
+        {
+            if (element.count_>(((uint64_t)(mappingEnd_-start))/element.recordSize_))
+            {
+                return false;
+            }
+            
+            start+=element.count_*element.recordSize_;
+        } else
+        {
+            for (uint64_t recordNum=0; recordNum<element.count_; ++recordNum)
+            {
+                if (!skipRecord(element, start))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    
+    return true;
+}
+
+bool stitch::PLYReader::splitRecords(const Element &element, const char * const start, const size_t recordSize, std::vector<Block> &blocks) const
+{
+    blocks.clear();
+    
+    const size_t numBlocks=(element.count_<PLYREADER_PARALLEL_MIN_ELEMENTS) ? 1 : getNumThreads();
+    const uint64_t blockSize=(element.count_+numBlocks-1)/numBlocks;
+    
+    Block block;
+    block.begin_=start;
+    block.firstRecord_=0;
+    block.numRecords_=0;
+    
+    if (format_==ASCII)
+    {//Step over the lines to find the block starts.
+        const char *data=start;
+        
+        for (uint64_t recordNum=0; recordNum<element.count_; ++recordNum)
+        {
+            if (block.numRecords_==blockSize)
+            {
+                blocks.push_back(block);
+                
+                block.begin_=data;
+                block.firstRecord_=recordNum;
+                block.numRecords_=0;
+            }
+            
+            if (!skipRecord(element, data))
+            {
+                return false;
+            }
+            
+            ++block.numRecords_;
+        }
+        
+        blocks.push_back(block);
+    } else
+        if (recordSize!=0)
+        {
+            if (element.count_>(((uint64_t)(mappingEnd_-start))/recordSize))
+            {
+                return false;
+            }
+            
+            for (uint64_t recordNum=0; recordNum<element.count_; recordNum+=blockSize)
+            {
+                block.begin_=start+recordNum*recordSize;
+                block.firstRecord_=recordNum;
+                block.numRecords_=std::min(blockSize, element.count_-recordNum);
+                blocks.push_back(block);
+            }
+            
+            if (blocks.empty())
+            {
+                blocks.push_back(block);
+            }
+        } else
+        {//The records differ in size so the block starts are only known by decoding.
+            block.numRecords_=element.count_;
+            blocks.push_back(block);
+        }
+    
+    return true;
+}
+
+//=======================================================================//
+bool stitch::PLYReader::appendTriangles(const Block &block, std::vector<size_t> &indices, const bool invertWinding) const
+{
+    const Element &element=elements_[faceElement_];
+    const size_t numProperties=element.properties_.size();
+    const uint64_t numVertices=getNumVertices();
+    
+    const char *data=block.begin_;
+    std::vector<size_t> faceIndices;
+    
+    for (uint64_t recordNum=0; recordNum<block.numRecords_; ++recordNum)
+    {
+        faceIndices.clear();
+        
+        for (size_t propertyNum=0; propertyNum<numProperties; ++propertyNum)
+        {
+            const Property &property=element.properties_[propertyNum];
+            double value=0.0;
+            
+            if (!readValue(data, (property.countType_!=TYPE_NONE) ? property.countType_ : property.type_, value))
+            {
+                return false;
+            }
+            
+            if (property.countType_!=TYPE_NONE)
+            {
+                const uint64_t listSize=(uint64_t)value;
+                
+                for (uint64_t listNum=0; listNum<listSize; ++listNum)
+                {
+                    if (!readValue(data, property.type_, value))
+                    {
+                        return false;
+                    }
+                    
+                    if (((int)propertyNum)==indicesProperty_)
+                    {
+                        if ((value<0.0)||(value>=numVertices))
+                        {
+                            return false;
+                        }
+                        
+                        faceIndices.push_back((size_t)value);
+                    }
+                }
+            }
+        }
+        
+        endRecord(data);
+        
+        for (size_t vertexNum=2; vertexNum<faceIndices.size(); ++vertexNum)
+        {
+            indices.push_back(faceIndices[0]);
+            
+            if (invertWinding)
+            {
+                indices.push_back(faceIndices[vertexNum]);
+                indices.push_back(faceIndices[vertexNum-1]);
+            } else
+            {
+                indices.push_back(faceIndices[vertexNum-1]);
+                indices.push_back(faceIndices[vertexNum]);
+            }
+        }
+    }
+    
+    return true;
+}
+
+bool stitch::PLYReader::readUniformTriangles(const char * const start, const size_t faceSize, std::vector<size_t> &indices, const bool invertWinding) const
+{
+    const Element &element=elements_[faceElement_];
+    const Property &indicesProperty=element.properties_[indicesProperty_];
+    
+    //=== The layout of a record ===
+    size_t countOffset=0;
+    for (int propertyNum=0; propertyNum<indicesProperty_; ++propertyNum)
+    {
+        countOffset+=getTypeSize(element.properties_[propertyNum].type_);
+    }
+    
+    const size_t indexSize=getTypeSize(indicesProperty.type_);
+    const size_t listOffset=countOffset+getTypeSize(indicesProperty.countType_);
+    
+    if ((faceSize<3)||(faceSize>(((size_t)(mappingEnd_-start))/indexSize)))
+    {
+        return false;
+    }
+    
+    size_t uniformRecordSize=getTypeSize(indicesProperty.countType_)+faceSize*indexSize;
+    for (size_t propertyNum=0; propertyNum<element.properties_.size(); ++propertyNum)
+    {
+        if (((int)propertyNum)!=indicesProperty_)
+        {
+            uniformRecordSize+=getTypeSize(element.properties_[propertyNum].type_);
+        }
+    }
+    //===
+    
+    std::vector<Block> blocks;
+    if (!splitRecords(element, start, uniformRecordSize, blocks))
+    {
+        return false;
+    }
+    
+    const size_t numFaceTriangles=faceSize-2;
+    indices.resize(element.count_*numFaceTriangles*3);
+    
+    const uint64_t numVertices=getNumVertices();
+    
+    auto decodeBlock=[this, &indicesProperty, &indices, faceSize, numFaceTriangles, countOffset, listOffset, indexSize,
+                      uniformRecordSize, numVertices, invertWinding](const Block &block)
+    {
+        const char *record=block.begin_;
+        size_t *output=indices.data()+block.firstRecord_*numFaceTriangles*3;
+        
+        for (uint64_t recordNum=0; recordNum<block.numRecords_; ++recordNum)
+        {
+            if (((size_t)readBinary(record+countOffset, indicesProperty.countType_))!=faceSize)
+            {
+                return false;
+            }
+            
+            const char * const list=record+listOffset;
+            const double firstIndex=readBinary(list, indicesProperty.type_);
+            double previousIndex=readBinary(list+indexSize, indicesProperty.type_);
+            
+            if ((firstIndex<0.0)||(firstIndex>=numVertices)||(previousIndex<0.0)||(previousIndex>=numVertices))
+            {
+                return false;
+            }
+            
+            for (size_t vertexNum=2; vertexNum<faceSize; ++vertexNum)
+            {
+                const double index=readBinary(list+vertexNum*indexSize, indicesProperty.type_);
+                
+                if ((index<0.0)||(index>=numVertices))
+                {
+                    return false;
+                }
+                
+                *(output++)=(size_t)firstIndex;
+                *(output++)=(size_t)(invertWinding ? index : previousIndex);
+                *(output++)=(size_t)(invertWinding ? previousIndex : index);
+                
+                previousIndex=index;
+            }
+            
+            record+=uniformRecordSize;
+        }
+        
+        return true;
+    };
+    
+    return runBlocks(blocks, decodeBlock);
+}
+
+//=======================================================================//
+template <class Task>
+bool stitch::PLYReader::runBlocks(const std::vector<Block> &blocks, const Task &task)
+{
+    if (blocks.size()==1)
+    {
+        return task(blocks[0]);
+    }
+    
+    std::atomic<bool> valid(true);
+    
+    std::vector<std::thread> threadVect;
+    threadVect.reserve(blocks.size());
+    
+    for (size_t blockNum=0; blockNum<blocks.size(); ++blockNum)
+    {
+        threadVect.emplace_back([&task, &blocks, &valid, blockNum]()
+                                {
+                                    if (!task(blocks[blockNum]))
+                                    {
+                                        valid=false;
+                                    }
+                                });
+    }
+    
+    for (auto &thread : threadVect)
+    {
+        thread.join();
+    }
+    
+    return valid;
+}
+
+size_t stitch::PLYReader::getNumThreads()
+{
+    size_t numThreads=std::thread::hardware_concurrency();
+    if (numThreads==0) numThreads=2;//Setup numThreads in case system reports 0.
+    
+    return numThreads;
+}
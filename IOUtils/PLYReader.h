@@ -0,0 +1,217 @@
+/*
+ *  PLYReader.h
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STITCH_PLY_READER_H
+#define STITCH_PLY_READER_H
+
+#define PLYREADER_PARALLEL_MIN_ELEMENTS 32768 //Smaller element blocks are decoded by the calling thread only.
+
+namespace stitch {
+    class PLYReader;
+}
+
+#include "Math/Vec3.h"
+
+#include <string>
+#include <vector>
+
+#ifdef USE_CXX11
+#include <cstdint>
+#else
+#include <stdint.h>
+#endif
+
+namespace stitch {
+    
+    /*! \brief Reads the vertex positions and faces of a memory mapped PLY file.
+     
+     The header is parsed once when the file is opened. The element blocks are then decoded straight from the mapping into
+     presized arrays, split over several threads for large files. Binary (either byte order) and ASCII files are read. A binary
+     face block in which all the faces have the same number of vertices has a fixed record size and is decoded in parallel
+     directly; other face blocks are decoded by one thread. */
+    class PLYReader
+    {
+    public:
+        PLYReader();
+        
+        ~PLYReader();
+        
+        /*! Map the file and parse its header.
+         @return False if the file could not be mapped or if it has no vertex element with x, y and z properties. */
+        bool open(const std::string &fileName);
+        
+        /*! Unmap the file. */
+        void close();
+        
+        inline uint64_t getNumVertices() const
+        {
+            return (vertexElement_>=0) ? elements_[vertexElement_].count_ : 0;
+        }
+        
+        inline uint64_t getNumFaces() const
+        {
+            return (faceElement_>=0) ? elements_[faceElement_].count_ : 0;
+        }
+        
+        /*! Decode the vertex positions, scaled and then offset by centre.
+         @return False if the file ends within the vertex block. */
+        bool readVertices(std::vector<Vec3> &vertCoords, const Vec3 &centre, const float scale) const;
+        
+        /*! Decode the faces and split them into triangle fans, three vertex indices per triangle. Faces with fewer than three
+         vertices are skipped.
+         @param invertWinding Reverse the order of the vertices of each triangle, e.g. to flip the normals.
+         @return False if the file ends within the face block or if a face refers to a vertex that is not in the file. */
+        bool readTriangles(std::vector<size_t> &indices, const bool invertWinding) const;
+        
+    private:
+        enum Format {
+            ASCII,
+            BINARY_LITTLE_ENDIAN,
+            BINARY_BIG_ENDIAN
+        };
+        
+        enum Type {
+            TYPE_NONE,
+            TYPE_INT8,
+            TYPE_UINT8,
+            TYPE_INT16,
+            TYPE_UINT16,
+            TYPE_INT32,
+            TYPE_UINT32,
+            TYPE_FLOAT32,
+            TYPE_FLOAT64
+        };
+        
+        struct Property
+        {
+            std::string name_;
+        
+            //! The type of the values.
+            Type type_;
+        
+            //! The type of the value count if the property is a list, else TYPE_NONE.
+            Type countType_;
+        };
+        
+        struct Element
+        {
+            std::string name_;
+            uint64_t count_;
+            std::vector<Property> properties_;
+        
+            //! The size of a binary record, or zero if the element has lists and so its records differ in size.
+            size_t recordSize_;
+        };
+        
+        /*! A run of consecutive records of an element, e.g. a thread's share of them. */
+        struct Block
+        {
+            const char *begin_;
+            uint64_t firstRecord_;
+            uint64_t numRecords_;
+        };
+        
+        static Type parseType(const std::string &typeName);
+        
+        static size_t getTypeSize(const Type type);
+        
+        /*! Read a binary value and convert it to double. */
+        double readBinary(const char * const data, const Type type) const;
+        
+        /*! Parse the next ASCII value on the current line and step data past it.
+         @return False at the end of the line or of the file, or if the value is not a number. */
+        bool readASCII(const char *&data, double &value) const;
+        
+        /*! Step over the next value of a record without converting it. */
+        bool skipValue(const char *&data, const Type type) const;
+        
+        /*! Read the next value of a record in the file's format and step data past it. */
+        inline bool readValue(const char *&data, const Type type, double &value) const
+        {
+            if (format_==ASCII)
+            {
+                return readASCII(data, value);
+            } else
+            {
+                const size_t typeSize=getTypeSize(type);
+                
+                if (((size_t)(mappingEnd_-data))<typeSize)
+                {
+                    return false;
+                }
+                
+                value=readBinary(data, type);
+                data+=typeSize;
+                return true;
+            }
+        }
+        
+        /*! Step past the rest of the current line of an ASCII file. Binary records need no terminating. */
+        void endRecord(const char *&data) const;
+        
+        /*! Step over a record. @return False if the file ends within it. */
+        bool skipRecord(const Element &element, const char *&data) const;
+        
+        /*! Find the first record of an element by stepping over the records of the elements before it. */
+        bool findElementStart(const int elementNum, const char *&start) const;
+        
+        /*! Split the records of an element into blocks for the decoding threads. ASCII records are split on line starts
+         and binary records of a fixed size are split arithmetically. Other binary elements stay one block.
+         @return False if the file ends within the element. */
+        bool splitRecords(const Element &element, const char * const start, const size_t recordSize, std::vector<Block> &blocks) const;
+        
+        /*! Decode the faces of a block and append their triangles. */
+        bool appendTriangles(const Block &block, std::vector<size_t> &indices, const bool invertWinding) const;
+        
+        /*! Decode a binary face block in which every face has faceSize (at least three) vertices straight into the presized indices.
+         @return False if a face has a different number of vertices or refers to a vertex that is not in the file. */
+        bool readUniformTriangles(const char * const start, const size_t faceSize, std::vector<size_t> &indices, const bool invertWinding) const;
+        
+        /*! Run task on each block, in parallel if there is more than one block.
+         @return False if task failed on any of the blocks. */
+        template <class Task>
+        static bool runBlocks(const std::vector<Block> &blocks, const Task &task);
+        
+        static size_t getNumThreads();
+        
+        //! The mapped file.
+        const char *mapping_;
+        const char *mappingEnd_;
+        
+        //! The first byte after the header.
+        const char *body_;
+        
+        Format format_;
+        
+        //! Whether the byte order of the binary values differs from that of this machine.
+        bool swapBytes_;
+        
+        std::vector<Element> elements_;
+        
+        //! The indices of the vertex and face elements and of their properties, or -1 if the file has none.
+        int vertexElement_;
+        int xProperty_, yProperty_, zProperty_;
+        int faceElement_;
+        int indicesProperty_;
+    };
+}
+
+#endif// STITCH_PLY_READER_H
@@ -60,7 +60,9 @@ namespace stitch {
         rayID1_(rayID1),
 		distance_(distance), normal_(),
         itemID_(0),
-        itemPtr_(nullptr)
+        itemPtr_(nullptr),
+        primitiveID_(0),
+        b1_(0.0f), b2_(0.0f)
 		{}
         
         /*! Destructor */
@@ -72,7 +74,9 @@ namespace stitch {
         rayID1_(lValue.rayID1_),
 		distance_(lValue.distance_), normal_(lValue.normal_),
         itemID_(lValue.itemID_),
-        itemPtr_(lValue.itemPtr_)
+        itemPtr_(lValue.itemPtr_),
+        primitiveID_(lValue.primitiveID_),
+        b1_(lValue.b1_), b2_(lValue.b2_)
 		{}
         
 #ifdef USE_CXX11
@@ -82,7 +86,9 @@ namespace stitch {
         rayID1_(rValue.rayID1_),
 		distance_(rValue.distance_), normal_(std::move(rValue.normal_)),
         itemID_(rValue.itemID_),
-        itemPtr_(rValue.itemPtr_)
+        itemPtr_(rValue.itemPtr_),
+        primitiveID_(rValue.primitiveID_),
+        b1_(rValue.b1_), b2_(rValue.b2_)
 		{}
 #endif// USE_CXX11
         
@@ -95,6 +101,9 @@ namespace stitch {
 			normal_=lValue.normal_;
             itemID_=lValue.itemID_;
             itemPtr_=lValue.itemPtr_;
+            primitiveID_=lValue.primitiveID_;
+            b1_=lValue.b1_;
+            b2_=lValue.b2_;
 			return (*this);
 		}
 		
@@ -108,6 +117,9 @@ namespace stitch {
 			normal_=std::move(rValue.normal_);
             itemID_=rValue.itemID_;
             itemPtr_=rValue.itemPtr_;
+            primitiveID_=rValue.primitiveID_;
+            b1_=rValue.b1_;
+            b2_=rValue.b2_;
 			return (*this);
 		}
 #endif// USE_CXX11
@@ -120,7 +132,7 @@ namespace stitch {
         /*! The distance to the intersection */
 		float distance_;
         
-        /*! The surface normal at the intersection */
+        /*! The surface normal at the intersection. Items may defer it to BoundingVolume::calcShadingNormal. */
 		Vec3 normal_;
 		
         /*! The id of the item intersected */
@@ -128,6 +140,12 @@ namespace stitch {
         
         /*! The pointer to the item intersected */
         BoundingVolume const * itemPtr_;
+        
+        /*! The primitive of the item intersected, e.g. the triangle of a PolygonModel or the face of a Brush */
+        uint32_t primitiveID_;
+        
+        /*! The barycentric coordinates of the intersection on a triangle primitive */
+        float b1_, b2_;
 	};
 }
 
@@ -27,13 +27,21 @@
  */
 
 #include "KDTree.h"
+#include "TreeLayout.h"
+
+#include <functional>
 
 //=======================================================================//
 stitch::KDTree::KDTree() :
 binarySpacePartition_(Vec3(0.0f, 0.0f, 0.0f), 0.0f),
 left_(nullptr),
 right_(nullptr),
-totalItems_(0)
+totalItems_(0),
+nodePool_(nullptr),
+numPoolNodes_(0),
+ownsChildren_(true),
+itemArena_(nullptr),
+ownsItems_(true)
 {
 }
 
@@ -43,27 +51,46 @@ void stitch::KDTree::clear()
 {
     binarySpacePartition_=Plane(Vec3(0.0f, 0.0f, 0.0f), 0.0f);
     
-    std::vector<stitch::BoundingVolume *>::const_iterator itemIter=itemVector_.begin();
-    const std::vector<stitch::BoundingVolume *>::const_iterator itemIterEnd=itemVector_.end();
-    for (; itemIter!=itemIterEnd; ++itemIter)
+    if (ownsItems_)
     {
-        delete (*itemIter);
+        std::vector<stitch::BoundingVolume *>::const_iterator itemIter=itemVector_.begin();
+        const std::vector<stitch::BoundingVolume *>::const_iterator itemIterEnd=itemVector_.end();
+        for (; itemIter!=itemIterEnd; ++itemIter)
+        {
+            delete (*itemIter);
+        }
     }
     
     itemVector_.clear();
     
     if (left_)
     {
-        delete left_;
+        if (ownsChildren_)
+        {
+            delete left_;
+        }
         left_=nullptr;
     }
     
     if (right_)
     {
-        delete right_;
+        if (ownsChildren_)
+        {
+            delete right_;
+        }
         right_=nullptr;
     }
     
+    ownsChildren_=true;
+    
+    delete [] nodePool_;
+    nodePool_=nullptr;
+    numPoolNodes_=0;
+    
+    delete itemArena_;//After the nodes below, which do not delete the items in it.
+    itemArena_=nullptr;
+    ownsItems_=true;
+    
     totalItems_=0;
 }
 
@@ -80,6 +107,9 @@ void stitch::KDTree::build(const size_t chunkSize,
         {//No tree below this node yet. Let's add.
             left_=new KDTree;
             right_=new KDTree;
+            ownsChildren_=true;
+            left_->ownsItems_=ownsItems_;
+            right_->ownsItems_=ownsItems_;
             
             Vec3 centre;//Set to zero.
             for (size_t i=0; i<itemVectorSize; ++i)
@@ -136,6 +166,92 @@ void stitch::KDTree::build(const size_t chunkSize,
 }
 
 
+//=======================================================================//
+void stitch::KDTree::relayout()
+{
+    if (!left_)
+    {
+        return;
+    }
+    
+    const auto getChildren=[](KDTree * const node, std::vector<KDTree *> &children)
+    {
+        if (node->left_)
+        {
+            children.push_back(node->left_);
+            children.push_back(node->right_);
+        }
+    };
+    
+    KDTree * const root=this;
+    std::vector<KDTree *> order;
+    appendVanEmdeBoasOrder(root, getTreeHeight(root, getChildren), getChildren, order);
+    
+    //=== Copy the nodes below the root into the new pool and link them up. order[0] is the root which stays in place ===
+    const size_t numPoolNodes=order.size()-1;
+    KDTree * const nodePool=new KDTree[numPoolNodes];
+    
+#ifdef _LIBCPP_VERSION
+    std::unordered_map<KDTree *, KDTree *> newNodes;
+#else
+    std::tr1::unordered_map<KDTree *, KDTree *> newNodes;
+#endif
+    newNodes[root]=root;
+    for (size_t poolNum=0; poolNum<numPoolNodes; ++poolNum)
+    {
+        newNodes[order[poolNum+1]]=&nodePool[poolNum];
+    }
+    
+    for (size_t orderNum=0; orderNum<order.size(); ++orderNum)
+    {
+        KDTree * const node=order[orderNum];
+        KDTree * const newNode=newNodes[node];
+        
+        if (newNode!=node)
+        {
+            newNode->binarySpacePartition_=node->binarySpacePartition_;
+            newNode->itemVector_.swap(node->itemVector_);
+            newNode->totalItems_=node->totalItems_;
+            newNode->ownsItems_=node->ownsItems_;
+        }
+        
+        if (node->left_)
+        {
+            newNode->left_=newNodes[node->left_];
+            newNode->right_=newNodes[node->right_];
+            newNode->ownsChildren_=false;
+        }
+    }
+    //===
+    
+    //=== Delete the old nodes that were allocated one by one and then the previous pool ===
+    const std::less<KDTree *> lessThan;
+    
+    for (size_t orderNum=1; orderNum<order.size(); ++orderNum)
+    {
+        KDTree * const node=order[orderNum];
+        
+        //The items have been moved to the new node.
+        node->left_=nullptr;
+        node->right_=nullptr;
+        node->totalItems_=0;
+        
+        const bool inOldPool=(nodePool_!=nullptr) && (!lessThan(node, nodePool_)) && lessThan(node, nodePool_+numPoolNodes_);
+        
+        if (!inOldPool)
+        {
+            delete node;
+        }
+    }
+    
+    delete [] nodePool_;
+    //===
+    
+    nodePool_=nodePool;
+    numPoolNodes_=numPoolNodes;
+}
+
+
 //=======================================================================//
 stitch::BoundingVolume *stitch::KDTree::getNearest(const Vec3 &centre, float &searchRadiusSq) const
 {
@@ -39,6 +39,7 @@ namespace stitch {
 #include "Math/Plane.h"
 #include "Photon.h"
 #include "KNearestItems.h"
+#include "Arena.h"
 
 #ifdef _LIBCPP_VERSION
 #include <unordered_map>
@@ -69,8 +70,13 @@ namespace stitch {
         
         KDTree(const KDTree &lvalue) :
         binarySpacePartition_(lvalue.binarySpacePartition_),
-        totalItems_(lvalue.totalItems_)
-        {
+        totalItems_(lvalue.totalItems_),
+        nodePool_(nullptr),
+        numPoolNodes_(0),
+        ownsChildren_(true),
+        itemArena_(nullptr),
+        ownsItems_(true)
+        {//The cloned items are on the heap.
             if (lvalue.left_)
             {
                 left_ = lvalue.left_->clone();
@@ -101,13 +107,24 @@ namespace stitch {
         KDTree(KDTree &&rvalue) noexcept:
         binarySpacePartition_(std::move(rvalue.binarySpacePartition_)),
         itemVector_(std::move(rvalue.itemVector_)),
-        totalItems_(std::move(rvalue.totalItems_))
+        totalItems_(std::move(rvalue.totalItems_)),
+        nodePool_(rvalue.nodePool_),
+        numPoolNodes_(rvalue.numPoolNodes_),
+        ownsChildren_(rvalue.ownsChildren_),
+        itemArena_(rvalue.itemArena_),
+        ownsItems_(rvalue.ownsItems_)
         {
             left_ = rvalue.left_;
             rvalue.left_=nullptr;
             
             right_ = rvalue.right_;
             rvalue.right_=nullptr;
+            
+            rvalue.nodePool_=nullptr;
+            rvalue.numPoolNodes_=0;
+            rvalue.ownsChildren_=true;
+            rvalue.itemArena_=nullptr;
+            rvalue.ownsItems_=true;
         }
 #endif
         
@@ -153,6 +170,8 @@ namespace stitch {
 #ifdef USE_CXX11
         KDTree & operator = (KDTree &&rvalue) noexcept
         {
+            clear();
+            
             binarySpacePartition_=std::move(rvalue.binarySpacePartition_);
             itemVector_=std::move(rvalue.itemVector_);
             
@@ -164,6 +183,17 @@ namespace stitch {
             
             totalItems_=rvalue.totalItems_;
             
+            nodePool_=rvalue.nodePool_;
+            numPoolNodes_=rvalue.numPoolNodes_;
+            ownsChildren_=rvalue.ownsChildren_;
+            itemArena_=rvalue.itemArena_;
+            ownsItems_=rvalue.ownsItems_;
+            rvalue.nodePool_=nullptr;
+            rvalue.numPoolNodes_=0;
+            rvalue.ownsChildren_=true;
+            rvalue.itemArena_=nullptr;
+            rvalue.ownsItems_=true;
+            
             return (*this);
         }
 #endif
@@ -197,8 +227,23 @@ namespace stitch {
             return (getNumItems() == 0);
         }
         
+        /*! Delete the items and the tree structure. Items from the item arena are freed all at once with the arena. */
         void clear();
         
+        /*! The arena of the root that the items may be allocated from, e.g. the photons of a photon map, so that clearing
+         the tree frees them all at once instead of one by one. Once it is used the tree must only hold items from it until
+         it is cleared, since they are then no longer deleted individually. */
+        Arena & getItemArena()
+        {
+            if (!itemArena_)
+            {
+                itemArena_=new Arena();
+                ownsItems_=false;
+            }
+            
+            return *itemArena_;
+        }
+        
         /*! Collect all items into a linear list and delete the tree structure. */
         inline void linearise()
         {
@@ -214,6 +259,11 @@ namespace stitch {
         
         void balance();
         
+        /*! Move the nodes below the root into one contiguous pool in the cache oblivious van Emde Boas order (see
+         appendVanEmdeBoasOrder) so that the nodes visited together by the nearest neighbour searches are near each other in
+         memory. Call after build; a later build may still grow the tree from the pooled leaves. */
+        void relayout();
+        
         BoundingVolume *getNearest(const Vec3 &centre, float &searchRadiusSq) const;
         
         void getNearestK(KNearestItems * const kNearestItems) const;
@@ -232,6 +282,20 @@ namespace stitch {
         KDTree * right_;
         
         size_t totalItems_;
+        
+    private:
+        //! The nodes below this root after a relayout. Owned by the root.
+        KDTree *nodePool_;
+        size_t numPoolNodes_;
+        
+        //! False if left_ and right_ live in the root's node pool and must not be deleted individually.
+        bool ownsChildren_;
+        
+        //! The arena that the items are allocated from, see getItemArena. Owned by the root. Null until it is first used.
+        Arena *itemArena_;
+        
+        //! False if the items live in the root's item arena and must not be deleted individually.
+        bool ownsItems_;
     };
     
 }
@@ -44,14 +44,17 @@ namespace stitch {
 	class Light : public Object
 	{
 	public:
-        /*! Constructor given a SPD and material; to be used by child class.
+        /*! Constructor given a SPD and material; to be used by child class. The light's geometry is only a proxy for the
+         camera to see so it is made visible to RAY_VISIBILITY_CAMERA rays only. Shadow rays and photons pass through it.
          @param SPD Spectral power distribution of light source.
          @param pMaterial Pointer to material object of light that is setup to match the SPD. Object takes ownership of object that pMaterial points to. */
 		Light(const Colour_t &SPD, Material * const pMaterial) :
         Object(pMaterial),
 		SPD_(SPD),
         normalisedSPD_(SPD.cnormalised())
-		{}
+		{
+            visibilityMask_=RAY_VISIBILITY_CAMERA;
+        }
 		
         /*! Copy constructor. */
 		Light(const Light &lValue) :
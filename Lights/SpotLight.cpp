@@ -54,9 +54,9 @@ void stitch::SpotLight::calcIntersection(const Ray &ray, Intersection &intersect
         const float entry=(-b-sqrtD)/(2.0f*a);
         const float exit=(-b+sqrtD)/(2.0f*a);
         
-        if (entry>0.0f)
+        if (entry>ray.tMin_)
         {
-            if (entry<intersect.distance_)
+            if ((entry<intersect.distance_)&&(entry<ray.tMax_))
             {
                 intersect.distance_=entry;
                 
@@ -67,9 +67,9 @@ void stitch::SpotLight::calcIntersection(const Ray &ray, Intersection &intersect
                 intersect.itemPtr_=this;
             }
         } else
-            if (exit>0.0f)
+            if (exit>ray.tMin_)
             {
-                if (exit<intersect.distance_)
+                if ((exit<intersect.distance_)&&(exit<ray.tMax_))
                 {
                     intersect.distance_=exit;
 
@@ -0,0 +1,186 @@
+/*
+ *  AABB.h
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STITCH_AABB_H
+#define STITCH_AABB_H
+
+namespace stitch {
+	struct AABB;
+}
+
+#include "Vec3.h"
+#include "MathUtil.h"
+
+#include <utility> // for std::swap
+
+namespace stitch {
+
+    //! Axis aligned bounding box defined by its min_ and max_ corners. A default constructed box is empty.
+	struct AABB
+	{
+	public:
+        //!Constructor of an empty box.
+		AABB() :
+        min_(((float)FLT_MAX)),
+        max_(-((float)FLT_MAX))
+        {}
+
+        //!Constructor from the min and max corners.
+		explicit AABB(const Vec3 &min, const Vec3 &max) :
+        min_(min),
+        max_(max)
+        {}
+
+        //!Constructor of the box around a sphere.
+		explicit AABB(const Vec3 &centre, const float radius) :
+        min_(centre.x()-radius, centre.y()-radius, centre.z()-radius),
+        max_(centre.x()+radius, centre.y()+radius, centre.z()+radius)
+        {}
+
+        //!Grow the box to include the point.
+        inline void expand(const Vec3 &point)
+        {
+            min_.v_[0]=MathUtil::min(min_.v_[0], point.v_[0]);
+            min_.v_[1]=MathUtil::min(min_.v_[1], point.v_[1]);
+            min_.v_[2]=MathUtil::min(min_.v_[2], point.v_[2]);
+
+            max_.v_[0]=MathUtil::max(max_.v_[0], point.v_[0]);
+            max_.v_[1]=MathUtil::max(max_.v_[1], point.v_[1]);
+            max_.v_[2]=MathUtil::max(max_.v_[2], point.v_[2]);
+        }
+
+        //!Grow the box to include another box.
+        inline void expand(const AABB &box)
+        {
+            min_.v_[0]=MathUtil::min(min_.v_[0], box.min_.v_[0]);
+            min_.v_[1]=MathUtil::min(min_.v_[1], box.min_.v_[1]);
+            min_.v_[2]=MathUtil::min(min_.v_[2], box.min_.v_[2]);
+
+            max_.v_[0]=MathUtil::max(max_.v_[0], box.max_.v_[0]);
+            max_.v_[1]=MathUtil::max(max_.v_[1], box.max_.v_[1]);
+            max_.v_[2]=MathUtil::max(max_.v_[2], box.max_.v_[2]);
+        }
+
+        //!The overlap of the two boxes. Empty if they do not overlap.
+        inline AABB intersection(const AABB &box) const
+        {
+            return AABB(Vec3(MathUtil::max(min_.v_[0], box.min_.v_[0]), MathUtil::max(min_.v_[1], box.min_.v_[1]), MathUtil::max(min_.v_[2], box.min_.v_[2])),
+                        Vec3(MathUtil::min(max_.v_[0], box.max_.v_[0]), MathUtil::min(max_.v_[1], box.max_.v_[1]), MathUtil::min(max_.v_[2], box.max_.v_[2])));
+        }
+
+        inline bool isEmpty() const
+        {
+            return (min_.v_[0]>max_.v_[0]) || (min_.v_[1]>max_.v_[1]) || (min_.v_[2]>max_.v_[2]);
+        }
+
+        inline Vec3 centroid() const
+        {
+            return Vec3((min_.v_[0]+max_.v_[0])*0.5f, (min_.v_[1]+max_.v_[1])*0.5f, (min_.v_[2]+max_.v_[2])*0.5f);
+        }
+
+        inline Vec3 extent() const
+        {
+            return Vec3(max_.v_[0]-min_.v_[0], max_.v_[1]-min_.v_[1], max_.v_[2]-min_.v_[2]);
+        }
+
+        //!The surface area of the box. Zero for an empty box.
+        inline float surfaceArea() const
+        {
+            if (isEmpty())
+            {
+                return 0.0f;
+            }
+
+            const Vec3 e=extent();
+            return 2.0f*(e.v_[0]*e.v_[1] + e.v_[0]*e.v_[2] + e.v_[1]*e.v_[2]);
+        }
+
+        //!The axis (0, 1 or 2) along which the box is the longest.
+        inline uint8_t maxExtentAxis() const
+        {
+            const Vec3 e=extent();
+
+            if ((e.v_[0]>=e.v_[1])&&(e.v_[0]>=e.v_[2]))
+            {
+                return 0;
+            } else
+                if (e.v_[1]>=e.v_[2])
+                {
+                    return 1;
+                } else
+                {
+                    return 2;
+                }
+        }
+
+        //!The radius of the bounding sphere centred on the box's centroid.
+        inline float boundingSphereRadius() const
+        {
+            return extent().length()*0.5f;
+        }
+
+        /*! Slab test of the ray (orig + t*dir) against the box. The reciprocal of the ray direction is passed in.
+         @param entry The distance at which the ray enters the box (clamped to tMin). Only valid if the box is hit.
+         @return True if the box is intersected within [tMin, tMax]. */
+        inline bool intersect(const Vec3 &orig, const Vec3 &recipDir, const float tMin, const float tMax, float &entry) const
+        {
+            float t0=tMin;
+            float t1=tMax;
+
+            for (size_t axis=0; axis<3; ++axis)
+            {
+                float tNear=(min_.v_[axis]-orig.v_[axis])*recipDir.v_[axis];
+                float tFar=(max_.v_[axis]-orig.v_[axis])*recipDir.v_[axis];
+
+                if (tNear>tFar)
+                {
+                    std::swap(tNear, tFar);
+                }
+
+                //NaN (0*inf) compares false and then leaves t0/t1 unchanged.
+                t0=(tNear>t0) ? tNear : t0;
+                t1=(tFar<t1) ? tFar : t1;
+
+                if (t0>t1)
+                {
+                    return false;
+                }
+            }
+
+            entry=t0;
+            return true;
+        }
+
+        inline bool pointInBox(const Vec3 &point) const
+        {
+            return (point.v_[0]>=min_.v_[0]) && (point.v_[0]<=max_.v_[0]) &&
+            (point.v_[1]>=min_.v_[1]) && (point.v_[1]<=max_.v_[1]) &&
+            (point.v_[2]>=min_.v_[2]) && (point.v_[2]<=max_.v_[2]);
+        }
+
+	public:
+        Vec3 min_;
+        Vec3 max_;
+	};
+
+}
+
+#endif// STITCH_AABB_H
@@ -27,6 +27,11 @@
 #ifndef stitchEngine_Ray_h
 #define stitchEngine_Ray_h
 
+#define RAY_VISIBILITY_ALL 0xFFFFFFFF //The default visibility mask of rays and objects.
+#define RAY_VISIBILITY_CAMERA 0x1 //Camera and other radiance gathering rays.
+#define RAY_VISIBILITY_SHADOW 0x2 //Shadow and other visibility test rays.
+#define RAY_VISIBILITY_PHOTON 0x4 //Rays that carry photons or light beams from the lights.
+
 namespace stitch
 {
     class Ray;
@@ -36,6 +41,7 @@ namespace stitch
 #include "Colour.h"
 
 #include <utility> // for std::move
+#include <cfloat>
 
 #ifdef USE_CXX11
 #include <cstdint>
@@ -57,7 +63,9 @@ namespace stitch {
                 ) :
         id0_(rayID0),
         id1_(rayID1),
-        direction_(direction), origin_(origin)
+        direction_(direction), origin_(origin),
+        tMin_(0.0f), tMax_(((float)FLT_MAX)),
+        visibilityMask_(RAY_VISIBILITY_ALL)
 #ifdef STITCH_RAY_RADIANCE_PAYLOAD
         , gatherDepth_(gatherDepth),
         returnRadiance_()
@@ -71,7 +79,9 @@ namespace stitch {
             const uint8_t gatherDepth=0) :
         id0_(rayID0),
         id1_(rayID1),
-        direction_(std::move(direction)), origin_(origin)
+        direction_(std::move(direction)), origin_(origin),
+        tMin_(0.0f), tMax_(((float)FLT_MAX)),
+        visibilityMask_(RAY_VISIBILITY_ALL)
 #ifdef STITCH_RAY_RADIANCE_PAYLOAD
         , gatherDepth_(gatherDepth),
         returnRadiance_()
@@ -84,7 +94,9 @@ namespace stitch {
             const uint8_t gatherDepth=0) :
         id0_(rayID0),
         id1_(rayID1),
-        direction_(direction), origin_(std::move(origin))
+        direction_(direction), origin_(std::move(origin)),
+        tMin_(0.0f), tMax_(((float)FLT_MAX)),
+        visibilityMask_(RAY_VISIBILITY_ALL)
 #ifdef STITCH_RAY_RADIANCE_PAYLOAD
         , gatherDepth_(gatherDepth),
         returnRadiance_()
@@ -97,7 +109,9 @@ namespace stitch {
             const uint8_t gatherDepth=0) :
         id0_(rayID0),
         id1_(rayID1),
-        direction_(std::move(direction)), origin_(std::move(origin))
+        direction_(std::move(direction)), origin_(std::move(origin)),
+        tMin_(0.0f), tMax_(((float)FLT_MAX)),
+        visibilityMask_(RAY_VISIBILITY_ALL)
   #ifdef STITCH_RAY_RADIANCE_PAYLOAD
         , gatherDepth_(gatherDepth),
         returnRadiance_()
@@ -108,7 +122,9 @@ namespace stitch {
 		Ray(const Ray &lValue) :
         id0_(lValue.id0_),
         id1_(lValue.id1_),
-        direction_(lValue.direction_), origin_(lValue.origin_)
+        direction_(lValue.direction_), origin_(lValue.origin_),
+        tMin_(lValue.tMin_), tMax_(lValue.tMax_),
+        visibilityMask_(lValue.visibilityMask_)
 #ifdef STITCH_RAY_RADIANCE_PAYLOAD
         , gatherDepth_(lValue.gatherDepth_),
         returnRadiance_(lValue.returnRadiance_)
@@ -119,7 +135,9 @@ namespace stitch {
 		Ray(Ray &&rValue) noexcept:
         id0_(rValue.id0_),
         id1_(rValue.id1_),
-        direction_(std::move(rValue.direction_)), origin_(std::move(rValue.origin_))
+        direction_(std::move(rValue.direction_)), origin_(std::move(rValue.origin_)),
+        tMin_(rValue.tMin_), tMax_(rValue.tMax_),
+        visibilityMask_(rValue.visibilityMask_)
 #ifdef STITCH_RAY_RADIANCE_PAYLOAD
         , gatherDepth_(rValue.gatherDepth_),
         returnRadiance_(std::move(rValue.returnRadiance_))
@@ -133,6 +151,9 @@ namespace stitch {
             id1_=lValue.id1_;
             direction_=lValue.direction_;
             origin_=lValue.origin_;
+            tMin_=lValue.tMin_;
+            tMax_=lValue.tMax_;
+            visibilityMask_=lValue.visibilityMask_;
 #ifdef STITCH_RAY_RADIANCE_PAYLOAD
             gatherDepth_=lValue.gatherDepth_;
             returnRadiance_=lValue.returnRadiance_;
@@ -147,6 +168,9 @@ namespace stitch {
             id1_=rValue.id1_;
             direction_=std::move(rValue.direction_);
             origin_=std::move(rValue.origin_);
+            tMin_=rValue.tMin_;
+            tMax_=rValue.tMax_;
+            visibilityMask_=rValue.visibilityMask_;
 #ifdef STITCH_RAY_RADIANCE_PAYLOAD
             gatherDepth_=rValue.gatherDepth_;
             returnRadiance_=std::move(rValue.returnRadiance_);
@@ -162,6 +186,15 @@ namespace stitch {
         uint16_t id1_;
         Vec3 direction_;
         Vec3 origin_;
+        
+        /*! The interval [tMin_, tMax_) along the ray in which intersections are reported. Defaults to [0, FLT_MAX).
+         tMin_ replaces offsetting the origin off the surface that a secondary ray leaves and tMax_ bounds e.g. a shadow ray at the light. */
+        float tMin_;
+        float tMax_;
+        
+        /*! The categories of objects that the ray sees (see BoundingVolume::visibilityMask_). An object is skipped if its mask
+         and the ray's mask have no bit in common. Defaults to RAY_VISIBILITY_ALL. */
+        uint32_t visibilityMask_;
 
 #ifdef STITCH_RAY_RADIANCE_PAYLOAD
         uint8_t gatherDepth_;
@@ -0,0 +1,276 @@
+/*
+ *  RayPacket.h
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STITCH_RAY_PACKET_H
+#define STITCH_RAY_PACKET_H
+
+#define RAYPACKET_MAX_SIZE 16 //Must be a multiple of 4 and at most 32 so that a lane mask fits in an uint32_t.
+#define RAYPACKET_NUM_GROUPS (RAYPACKET_MAX_SIZE/4) //The rays are processed in SSE groups of four lanes.
+
+namespace stitch {
+	class RayPacket;
+    union RayPacketLanes;
+}
+
+#include "Vec3.h"
+#include "AABB.h"
+#include "Ray.h"
+
+#include <xmmintrin.h> //for __m128
+
+#ifdef USE_CXX11
+#include <cstdint>
+#else
+#include <stdint.h>
+#endif
+
+namespace stitch {
+
+    //! One float per ray of a packet. The lanes are grouped by four for SSE.
+    union RayPacketLanes
+    {
+        __m128 m128_[RAYPACKET_NUM_GROUPS];
+        float f_[RAYPACKET_MAX_SIZE];
+    };
+
+
+    /*! \brief A packet of up to RAYPACKET_MAX_SIZE coherent rays (e.g. the primary rays of a pixel tile) that is traced together.
+
+     The rays' origins, directions and reciprocal directions are stored per lane (structure of arrays) so that the
+     box and bounding sphere tests of a tree node are done with SSE for four rays at a time. A mask with one bit per
+     lane selects the rays that are still active in a subtree. The packet references, but does not own, the rays.*/
+    class RayPacket
+    {
+    public:
+        /*! Constructor.
+         @param rays Array of numRays rays. Must outlive the packet.
+         @param numRays The number of rays in the packet. At most RAYPACKET_MAX_SIZE. */
+        RayPacket(const Ray * const rays, const size_t numRays) :
+        rays_(rays),
+        numRays_(numRays),
+        uniformVisibility_(true)
+        {
+            for (size_t laneNum=0; laneNum<RAYPACKET_MAX_SIZE; ++laneNum)
+            {//Unused lanes repeat the first ray so that they hold finite values. They are masked out anyway.
+                const Ray &ray=rays_[(laneNum<numRays_) ? laneNum : 0];
+
+                origX_.f_[laneNum]=ray.origin_.x();
+                origY_.f_[laneNum]=ray.origin_.y();
+                origZ_.f_[laneNum]=ray.origin_.z();
+
+                dirX_.f_[laneNum]=ray.direction_.x();
+                dirY_.f_[laneNum]=ray.direction_.y();
+                dirZ_.f_[laneNum]=ray.direction_.z();
+
+                recipDirX_.f_[laneNum]=1.0f/ray.direction_.x();
+                recipDirY_.f_[laneNum]=1.0f/ray.direction_.y();
+                recipDirZ_.f_[laneNum]=1.0f/ray.direction_.z();
+
+                tMin_.f_[laneNum]=ray.tMin_;
+                tMax_.f_[laneNum]=ray.tMax_;
+
+                visibilityMasks_[laneNum]=ray.visibilityMask_;
+                uniformVisibility_=uniformVisibility_&&(ray.visibilityMask_==rays_[0].visibilityMask_);
+            }
+        }
+
+        inline size_t getNumRays() const
+        {
+            return numRays_;
+        }
+
+        inline const Ray &getRay(const size_t laneNum) const
+        {
+            return rays_[laneNum];
+        }
+
+        //! The lane mask with a bit set for every ray in the packet.
+        inline uint32_t getFullMask() const
+        {
+            return (numRays_<32) ? ((((uint32_t)1)<<numRays_)-1) : 0xFFFFFFFF;
+        }
+
+        /*! SSE slab test of the box against the rays in the mask. Same as AABB::intersect per ray with the ray's tMin_.
+         @param tMax The per lane maximum distance (typically the closest hit so far clipped to the ray's tMax_).
+         @param minEntry The smallest entry distance of the rays that hit the box. Only valid if the returned mask is not zero.
+         @return The mask of the rays that intersect the box within [tMin_, tMax]. */
+        inline uint32_t intersectBox(const AABB &box, const RayPacketLanes &tMax, const uint32_t mask, float &minEntry) const
+        {
+            uint32_t hitMask=0;
+            RayPacketLanes entry;
+
+            const __m128 minX=_mm_set1_ps(box.min_.x());
+            const __m128 minY=_mm_set1_ps(box.min_.y());
+            const __m128 minZ=_mm_set1_ps(box.min_.z());
+            const __m128 maxX=_mm_set1_ps(box.max_.x());
+            const __m128 maxY=_mm_set1_ps(box.max_.y());
+            const __m128 maxZ=_mm_set1_ps(box.max_.z());
+
+            for (size_t groupNum=0; groupNum<RAYPACKET_NUM_GROUPS; ++groupNum)
+            {
+                const uint32_t groupMask=(mask>>(groupNum*4))&0xF;
+
+                if (groupMask)
+                {
+                    //Note: _mm_max_ps/_mm_min_ps return the second operand if either is NaN (0*inf) so NaNs leave t0/t1 unchanged.
+                    const __m128 tx0=_mm_mul_ps(_mm_sub_ps(minX, origX_.m128_[groupNum]), recipDirX_.m128_[groupNum]);
+                    const __m128 tx1=_mm_mul_ps(_mm_sub_ps(maxX, origX_.m128_[groupNum]), recipDirX_.m128_[groupNum]);
+                    __m128 t0=_mm_max_ps(_mm_min_ps(tx0, tx1), tMin_.m128_[groupNum]);
+                    __m128 t1=_mm_min_ps(_mm_max_ps(tx0, tx1), tMax.m128_[groupNum]);
+
+                    const __m128 ty0=_mm_mul_ps(_mm_sub_ps(minY, origY_.m128_[groupNum]), recipDirY_.m128_[groupNum]);
+                    const __m128 ty1=_mm_mul_ps(_mm_sub_ps(maxY, origY_.m128_[groupNum]), recipDirY_.m128_[groupNum]);
+                    t0=_mm_max_ps(_mm_min_ps(ty0, ty1), t0);
+                    t1=_mm_min_ps(_mm_max_ps(ty0, ty1), t1);
+
+                    const __m128 tz0=_mm_mul_ps(_mm_sub_ps(minZ, origZ_.m128_[groupNum]), recipDirZ_.m128_[groupNum]);
+                    const __m128 tz1=_mm_mul_ps(_mm_sub_ps(maxZ, origZ_.m128_[groupNum]), recipDirZ_.m128_[groupNum]);
+                    t0=_mm_max_ps(_mm_min_ps(tz0, tz1), t0);
+                    t1=_mm_min_ps(_mm_max_ps(tz0, tz1), t1);
+
+                    entry.m128_[groupNum]=t0;
+                    hitMask|=(((uint32_t)_mm_movemask_ps(_mm_cmple_ps(t0, t1)))&groupMask)<<(groupNum*4);
+                }
+            }
+
+            if (hitMask)
+            {
+                minEntry=((float)FLT_MAX);
+
+                for (uint32_t laneMask=hitMask; laneMask; laneMask&=laneMask-1)
+                {
+                    const size_t laneNum=lowestLane(laneMask);
+                    minEntry=(entry.f_[laneNum]<minEntry) ? entry.f_[laneNum] : minEntry;
+                }
+            }
+
+            return hitMask;
+        }
+
+        /*! SSE test of a bounding sphere against the rays in the mask. Same as BoundingVolume::BVIntersected per ray.
+         @return The mask of the rays that intersect the sphere. */
+        inline uint32_t intersectSphere(const Vec3 &centre, const float radius, const uint32_t mask) const
+        {
+            uint32_t hitMask=0;
+
+            const __m128 cX=_mm_set1_ps(centre.x());
+            const __m128 cY=_mm_set1_ps(centre.y());
+            const __m128 cZ=_mm_set1_ps(centre.z());
+            const __m128 radiusM128=_mm_set1_ps(radius);
+            const __m128 radiusSq=_mm_set1_ps(radius*radius);
+            const __m128 zero=_mm_setzero_ps();
+
+            for (size_t groupNum=0; groupNum<RAYPACKET_NUM_GROUPS; ++groupNum)
+            {
+                const uint32_t groupMask=(mask>>(groupNum*4))&0xF;
+
+                if (groupMask)
+                {
+                    const __m128 aX=_mm_sub_ps(cX, origX_.m128_[groupNum]);
+                    const __m128 aY=_mm_sub_ps(cY, origY_.m128_[groupNum]);
+                    const __m128 aZ=_mm_sub_ps(cZ, origZ_.m128_[groupNum]);
+
+                    const __m128 ADSq=_mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(aX, aX), _mm_mul_ps(aY, aY)), _mm_mul_ps(aZ, aZ)), radiusSq);
+                    const __m128 B=_mm_add_ps(_mm_add_ps(_mm_mul_ps(aX, dirX_.m128_[groupNum]), _mm_mul_ps(aY, dirY_.m128_[groupNum])), _mm_mul_ps(aZ, dirZ_.m128_[groupNum]));
+
+                    //Origin inside the sphere or (sphere in front of the origin and the closest approach within the radius).
+                    __m128 hit=_mm_or_ps(_mm_cmple_ps(ADSq, zero),
+                                         _mm_and_ps(_mm_cmpge_ps(B, zero), _mm_cmple_ps(_mm_sub_ps(ADSq, _mm_mul_ps(B, B)), zero)));
+
+                    //And the sphere overlaps the ray interval.
+                    hit=_mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(B, radiusM128), tMin_.m128_[groupNum]),
+                                                   _mm_cmplt_ps(_mm_sub_ps(B, radiusM128), tMax_.m128_[groupNum])));
+
+                    hitMask|=(((uint32_t)_mm_movemask_ps(hit))&groupMask)<<(groupNum*4);
+                }
+            }
+
+            return hitMask;
+        }
+
+        /*! @return The mask of the lanes in the mask whose rays see an object (or tree node) with the visibility mask, see Ray::visibilityMask_. */
+        inline uint32_t getVisibleMask(const uint32_t visibilityMask, const uint32_t mask) const
+        {
+            if (uniformVisibility_)
+            {//E.g. a packet of primary rays.
+                return ((visibilityMask&visibilityMasks_[0])!=0) ? mask : 0;
+            }
+
+            uint32_t visibleMask=0;
+
+            for (uint32_t laneMask=mask; laneMask; laneMask&=laneMask-1)
+            {
+                const size_t laneNum=lowestLane(laneMask);
+
+                if ((visibilityMask&visibilityMasks_[laneNum])!=0)
+                {
+                    visibleMask|=((uint32_t)1)<<laneNum;
+                }
+            }
+
+            return visibleMask;
+        }
+
+        /*! @return The mask of the lanes in the mask for which lanes is greater or equal to the value. */
+        static inline uint32_t greaterEqualMask(const RayPacketLanes &lanes, const float value, const uint32_t mask)
+        {
+            uint32_t resultMask=0;
+            const __m128 valueM128=_mm_set1_ps(value);
+
+            for (size_t groupNum=0; groupNum<RAYPACKET_NUM_GROUPS; ++groupNum)
+            {
+                resultMask|=((uint32_t)_mm_movemask_ps(_mm_cmpge_ps(lanes.m128_[groupNum], valueM128)))<<(groupNum*4);
+            }
+
+            return resultMask&mask;
+        }
+
+        //! The index of the lowest set bit of a non-zero lane mask.
+        static inline size_t lowestLane(const uint32_t laneMask)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return __builtin_ctz(laneMask);
+#else
+            size_t laneNum=0;
+            while (((laneMask>>laneNum)&1)==0) ++laneNum;
+            return laneNum;
+#endif
+        }
+
+    private:
+        const Ray * const rays_;
+        const size_t numRays_;
+
+        RayPacketLanes origX_, origY_, origZ_;
+        RayPacketLanes dirX_, dirY_, dirZ_;
+        RayPacketLanes recipDirX_, recipDirY_, recipDirZ_;
+
+        //! The rays' intervals.
+        RayPacketLanes tMin_, tMax_;
+
+        //! The rays' visibility masks and whether all the rays have the same mask.
+        uint32_t visibilityMasks_[RAYPACKET_MAX_SIZE];
+        bool uniformVisibility_;
+    };
+
+}
+
+#endif// STITCH_RAY_PACKET_H
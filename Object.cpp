@@ -154,9 +154,9 @@ void stitch::Sphere::calcIntersection(const Ray &ray, Intersection &intersect) c
         const float entry=(-b-sqrtD)/(2.0f*a);
         const float exit=(-b+sqrtD)/(2.0f*a);
         
-        if (entry>0.0f)
+        if (entry>ray.tMin_)
         {
-            if (entry<intersect.distance_)
+            if ((entry<intersect.distance_)&&(entry<ray.tMax_))
             {
                 intersect.distance_=entry;
                 intersect.normal_=stitch::Vec3(origD, ray.direction_, entry);
@@ -165,9 +165,9 @@ void stitch::Sphere::calcIntersection(const Ray &ray, Intersection &intersect) c
                 intersect.itemPtr_=this;
             }
         } else
-            if (exit>0.0f)
+            if (exit>ray.tMin_)
             {
-                if (exit<intersect.distance_)
+                if ((exit<intersect.distance_)&&(exit<ray.tMax_))
                 {
                     intersect.distance_=exit;
                     intersect.normal_=stitch::Vec3(origD, ray.direction_, exit);
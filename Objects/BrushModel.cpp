@@ -115,13 +115,15 @@ Object(pMaterial)
 //=======================================================================//
 stitch::Brush::Brush(const Brush &lValue) :
 Object(lValue),
-faceVector_(lValue.faceVector_)
+faceVector_(lValue.faceVector_),
+packedPlanes_(lValue.packedPlanes_)
 {}
 
 #ifdef USE_CXX11
 stitch::Brush::Brush(Brush &&rValue) noexcept:
 Object(rValue),
-faceVector_(std::move(rValue.faceVector_))
+faceVector_(std::move(rValue.faceVector_)),
+packedPlanes_(std::move(rValue.packedPlanes_))
 {}
 #endif// USE_CXX11
 
@@ -130,6 +132,7 @@ stitch::Brush & stitch::Brush::operator=(const Brush &lValue)
 {
     Object::operator=(lValue);
     faceVector_=lValue.faceVector_;
+    packedPlanes_=lValue.packedPlanes_;
     
     return *this;
 }
@@ -139,6 +142,7 @@ stitch::Brush & stitch::Brush::operator=(Brush &&rValue) noexcept
 {
     Object::operator=(rValue);
     faceVector_=std::move(rValue.faceVector_);
+    packedPlanes_=std::move(rValue.packedPlanes_);
     
     return *this;
 }
@@ -153,6 +157,40 @@ stitch::Brush::~Brush()
 void stitch::Brush::addFace(const BrushFace &face)
 {
     faceVector_.push_back(face);
+    packPlane(faceVector_.size()-1);
+}
+
+//=======================================================================//
+void stitch::Brush::packPlanes()
+{
+    packedPlanes_.clear();
+    
+    const size_t numFaces=faceVector_.size();
+    
+    for (size_t faceNum=0; faceNum<numFaces; ++faceNum)
+    {
+        packPlane(faceNum);
+    }
+}
+
+//=======================================================================//
+void stitch::Brush::packPlane(const size_t faceNum)
+{
+    const size_t blockStart=(faceNum/BRUSH_PLANE_BLOCK_SIZE)*BRUSH_PLANE_BLOCK_SIZE*4;
+    
+    if (packedPlanes_.size()<=blockStart)
+    {//Start the face's block with planes that bound nothing. Their normals are zero so no line or point is outside of them.
+        packedPlanes_.resize(blockStart+BRUSH_PLANE_BLOCK_SIZE*3, 0.0f);
+        packedPlanes_.resize(blockStart+BRUSH_PLANE_BLOCK_SIZE*4, ((float)FLT_MAX));
+    }
+    
+    float * const lane=&packedPlanes_[blockStart+(faceNum%BRUSH_PLANE_BLOCK_SIZE)];
+    const Plane &plane=faceVector_[faceNum].plane_;
+    
+    lane[0]=plane.normal_.x();
+    lane[BRUSH_PLANE_BLOCK_SIZE]=plane.normal_.y();
+    lane[BRUSH_PLANE_BLOCK_SIZE*2]=plane.normal_.z();
+    lane[BRUSH_PLANE_BLOCK_SIZE*3]=plane.d_;
 }
 
 //=======================================================================//
@@ -187,6 +225,8 @@ void stitch::Brush::optimiseFaceOrder()
         
         std::swap(faceVector_[i],faceVector_[optimalFace]);
     }
+    
+    packPlanes();
 }
 
 //=======================================================================//
@@ -389,6 +429,8 @@ void stitch::Brush::updateLinesVerticesAndBoundingVolume(const bool trashLineGeo
         
     }
     //====================================//
+    
+    packPlanes();//Degenerate faces might have been removed.
 }
 
 
@@ -786,192 +828,240 @@ osg::ref_ptr<osg::Node> stitch::Brush::constructOSGNormalNode() const
 #endif// USE_OSG
 
 //=======================================================================//
-void stitch::Brush::calcIntersection(const Ray &ray, Intersection &intersect) const
+bool stitch::Brush::clipLine(const Ray &ray, const float entryLimit,
+                             float &entryDistance, ssize_t &entryFaceNum, float &exitDistance, ssize_t &exitFaceNum) const
 {
-    //if (BVIntersected(orig, normDir)) This is currently executed by the calling code!
+    entryDistance=-((float)FLT_MAX);
+    exitDistance=((float)FLT_MAX);
+    entryFaceNum=-1;
+    exitFaceNum=-1;
+    
+    const __m128 directionX=_mm_set1_ps(ray.direction_.x());
+    const __m128 directionY=_mm_set1_ps(ray.direction_.y());
+    const __m128 directionZ=_mm_set1_ps(ray.direction_.z());
+    const __m128 originX=_mm_set1_ps(ray.origin_.x());
+    const __m128 originY=_mm_set1_ps(ray.origin_.y());
+    const __m128 originZ=_mm_set1_ps(ray.origin_.z());
+    const __m128 zero=_mm_setzero_ps();
+    
+    const size_t numFaces=faceVector_.size();
+    
+    for (size_t blockFaceNum=0; blockFaceNum<numFaces; blockFaceNum+=BRUSH_PLANE_BLOCK_SIZE)
     {
-        EntryExit entryExit(-((float)FLT_MAX), ((float)FLT_MAX));
-        bool brushIntersected=true;
+        const float * const block=&packedPlanes_[blockFaceNum*4];
         
-        bool entryHidden=false;
-        bool exitHidden=false;
-        ssize_t entryFaceNum=-1;
-        ssize_t exitFaceNum=-1;
+        const __m128 normalX=_mm_loadu_ps(block);
+        const __m128 normalY=_mm_loadu_ps(block+BRUSH_PLANE_BLOCK_SIZE);
+        const __m128 normalZ=_mm_loadu_ps(block+BRUSH_PLANE_BLOCK_SIZE*2);
+        const __m128 d=_mm_loadu_ps(block+BRUSH_PLANE_BLOCK_SIZE*3);
         
-        const size_t numFaces=faceVector_.size();
+        const __m128 cosTheta=_mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, normalX), _mm_mul_ps(directionY, normalY)), _mm_mul_ps(directionZ, normalZ));
+        const __m128 normalDotOrigin=_mm_add_ps(_mm_add_ps(_mm_mul_ps(normalX, originX), _mm_mul_ps(normalY, originY)), _mm_mul_ps(normalZ, originZ));
         
-        for (size_t faceNum=0; faceNum<numFaces; ++faceNum)
-        {
-            const Plane *plane=&(faceVector_[faceNum].plane_);
-            const bool planeHidden=faceVector_[faceNum].hidden_;
-            
-            const float cosTheta=ray.direction_*plane->normal_;
+        if (_mm_movemask_ps(_mm_and_ps(_mm_cmpeq_ps(cosTheta, zero), _mm_cmpgt_ps(normalDotOrigin, d))))
+        {//Line is travelling alongside and outside of a plane. No intersection.
+            return false;
+        }
+        
+        const __m128 dist=_mm_div_ps(_mm_sub_ps(d, normalDotOrigin), cosTheta);
+        
+        //Entry planes face the ray and exit planes face away from it. Only lanes that move the entry or exit are looked at.
+        const int entryMask=_mm_movemask_ps(_mm_and_ps(_mm_cmplt_ps(cosTheta, zero), _mm_cmpgt_ps(dist, _mm_set1_ps(entryDistance))));
+        const int exitMask=_mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(cosTheta, zero), _mm_cmplt_ps(dist, _mm_set1_ps(exitDistance))));
+        
+        if (entryMask|exitMask)
+        {//The first lane wins a tie like the first face would.
+            float distLanes[BRUSH_PLANE_BLOCK_SIZE];
+            _mm_storeu_ps(distLanes, dist);
             
-            if (cosTheta!=0.0f)
+            for (size_t laneNum=0; laneNum<BRUSH_PLANE_BLOCK_SIZE; ++laneNum)
             {
-                const float dist=(plane->d_-plane->normal_*ray.origin_)/cosTheta;
-                
-                if (cosTheta<=0.0f)
-                {//entry plane...
-                    if (dist>entryExit.entryDistance_)
-                    {
-                        entryExit.entryDistance_=dist;
-                        entryExit.entryNormal_=plane->normal_;
-                        entryHidden=planeHidden;
-                        entryFaceNum=faceNum;
-                    }
+                if (((entryMask>>laneNum)&1)&&(distLanes[laneNum]>entryDistance))
+                {
+                    entryDistance=distLanes[laneNum];
+                    entryFaceNum=blockFaceNum+laneNum;
                 } else
-                {//exit plane...
-                    if (dist<entryExit.exitDistance_)
+                    if (((exitMask>>laneNum)&1)&&(distLanes[laneNum]<exitDistance))
                     {
-                        entryExit.exitDistance_=dist;
-                        entryExit.exitNormal_=plane->normal_;
-                        exitHidden=planeHidden;
-                        exitFaceNum=faceNum;
+                        exitDistance=distLanes[laneNum];
+                        exitFaceNum=blockFaceNum+laneNum;
                     }
-                }
-                
-                if (entryExit.entryDistance_>entryExit.exitDistance_)
-                {//No intersection.
-                    brushIntersected=false;
-                    break;//No intersection! Break from for loop.
-                }
-            } else
-            {//Line is travelling alongside the plane. On which side of the plane?
-                if ((ray.origin_*plane->normal_)>plane->d_)
-                {//Line is travelling outside of brush. No intersection.
-                    brushIntersected=false;
-                    break;//No intersection! Break from for loop.
-                }
+            }
+            
+            if ((entryDistance>exitDistance)||(entryDistance>=entryLimit))
+            {//No intersection or the brush is entered beyond the limit.
+                return false;
             }
         }
+    }
+    
+    return true;
+}
+
+//=======================================================================//
+void stitch::Brush::calcIntersection(const Ray &ray, Intersection &intersect) const
+{
+    //if (BVIntersected(orig, normDir)) This is currently executed by the calling code!
+    {
+        float entryDistance, exitDistance;
+        ssize_t entryFaceNum, exitFaceNum;
         
-        if (brushIntersected)
+        //The exit is beyond the entry, so neither is closer than the closest hit so far if the entry is not.
+        if (clipLine(ray, MathUtil::min(intersect.distance_, ray.tMax_), entryDistance, entryFaceNum, exitDistance, exitFaceNum))
         {
-            entryExit.object_=this;
-            ssize_t faceNum=-1;
-            const uint32_t incomingObjectID=intersect.itemID_;
+            //A side that no face bounds (an open brush) has no surface to hit.
+            const bool entryHidden=(entryFaceNum<0)||(faceVector_[entryFaceNum].hidden_);
+            const bool exitHidden=(exitFaceNum<0)||(faceVector_[exitFaceNum].hidden_);
             
-            if ((entryExit.entryDistance_>0.0f)&&(!entryHidden))
+            if ((entryDistance>ray.tMin_)&&(!entryHidden))
             {
-                if (entryExit.entryDistance_<intersect.distance_)
+                if ((entryDistance<intersect.distance_)&&(entryDistance<ray.tMax_))
                 {
-                    intersect.distance_=entryExit.entryDistance_;
-                    intersect.normal_=entryExit.entryNormal_;
+                    intersect.distance_=entryDistance;
+                    intersect.normal_=faceVector_[entryFaceNum].plane_.normal_;
                     intersect.itemID_=this->itemID_ | ((intersect.normal_*ray.direction_>0.0f)?0:1);//back surface gets even ID, front surface gets odd ID.
                     intersect.itemPtr_=this;
+                    intersect.primitiveID_=entryFaceNum;
                 }
-                
-                faceNum=entryFaceNum;
             } else
-                if ((entryExit.exitDistance_>0.0f)&&(!exitHidden))
+                if ((exitDistance>ray.tMin_)&&(!exitHidden))
                 {
-                    if (entryExit.exitDistance_<intersect.distance_)
+                    if ((exitDistance<intersect.distance_)&&(exitDistance<ray.tMax_))
                     {
-                        intersect.distance_=entryExit.exitDistance_;
-                        intersect.normal_=entryExit.exitNormal_;
+                        intersect.distance_=exitDistance;
+                        intersect.normal_=faceVector_[exitFaceNum].plane_.normal_;
                         intersect.itemID_=this->itemID_ | ((intersect.normal_*ray.direction_>0.0f)?0:1);//back surface gets even ID, front surface gets odd ID.
                         intersect.itemPtr_=this;
+                        intersect.primitiveID_=exitFaceNum;
                     }
-                    
-                    faceNum=exitFaceNum;
                 }
+        }
+    }
+}
+
+
+//=======================================================================//
+void stitch::Brush::calcShadingNormal(const Ray &ray, Intersection &intersect) const
+{
+    Vec3 P=ray.origin_;
+    P.addScaled(ray.direction_, intersect.distance_);
+    //Use the recorded face (primitiveID_) and worldPos of the intersection to calculate the interpolated normal at the intersection.
+    //The face's centre normal has been modified to be the smooth centre normal.
+    
+    //1) Find the two outside face vertices that along with the centre vertex encircle the intersection worldPos.
+    //2) === Find the barycentric coords of the intersection worldPos relative to the three encircling vertices. ===
+    //3) === Calculate the interpolated normal based on the barycentric coordinates of the intersection. ===
+    
+    const BrushFace *brushFace=&(faceVector_[intersect.primitiveID_]);
+    const size_t numVertices=brushFace->vertexCoordVector_.size();
+    
+    
+    //===
+    Vec3 const * const v0=&(brushFace->vertexCoordVector_[0]); //At centre of brush face.
+    
+    //Vec3 const * const n0=&(brushFace->vertexNormalVector_[0]);
+    Vec3 const * const n0=&(brushFace->plane_.normal_);
+    
+    
+    Vec3 v0P=P;
+    v0P-=*v0;
+    const float v0PLengthSq=v0P.lengthSq();
+    //===
+    
+    
+    //=== 01 ===
+    Vec3 const *v1=&(brushFace->vertexCoordVector_[numVertices-1]);
+    
+    //Vec3 const *n1=&(brushFace->vertexNormalVector_[numVertices-1]);
+    Vec3 const *n1=&(brushFace->plane_.normal_);
+    
+    Vec3 v1P=P;
+    v1P-=*v1;
+    
+    stitch::Vec3 v01_norm_temp=*v1;
+    v01_norm_temp-=*v0;
+    
+    const float v01_length_temp=v01_norm_temp.normalise_rt();
+    float A01=0.5f * (sqrtf(v0PLengthSq - powf(v0P*v01_norm_temp,2.0f))) * v01_length_temp;
+    //=== ===
+    
+    
+    Vec3 v2P, v02_norm_temp, v12_norm_temp;
+    for (size_t vertexNum=1; vertexNum<numVertices; ++vertexNum)
+    {
+        //=== 02 ===
+        Vec3 const * const v2=&(brushFace->vertexCoordVector_[vertexNum]);
+        
+        //Vec3 const * const n2=&(brushFace->vertexNormalVector_[vertexNum]);
+        Vec3 const * const n2=&(brushFace->plane_.normal_);
+        
+        v2P=P;
+        v2P-=*v2;
+        
+        v02_norm_temp=*v2;
+        v02_norm_temp-=*v0;
+        
+        const float v02_length_temp=v02_norm_temp.normalise_rt();
+        const float A02=0.5f * (sqrtf(v0PLengthSq - powf(v0P*v02_norm_temp,2.0f))) * v02_length_temp;
+        //=== ===
+        
+        
+        //=== 12 ===
+        v12_norm_temp=*v2;
+        v12_norm_temp-=*v1;
+        
+        const float v12_length_temp=v12_norm_temp.normalise_rt();
+        const float A12=0.5f * (sqrtf(v1P.lengthSq() - powf(v1P*v12_norm_temp,2.0f))) * v12_length_temp;
+        //=== ===
+        
+        
+        //===
+        const float A=stitch::Vec3::crossLength(*v0, *v1, *v2)*0.5f;
+        
+        if ((A01+A12+A02)<=(A*1.00001f))
+        {
+            intersect.normal_.setToSumScaleAndNormalise(*n0, A12, *n1, A02, *n2, A01);
+            break;
+        }
+        //===
+        
+        
+        //v02 will become v01 in next iteration. Reuse calculations.
+        v1=v2;
+        n1=n2;
+        A01=A02;
+    }
+    // === ===
+}
+
+
+//=======================================================================//
+bool stitch::Brush::occluded(const Ray &ray, const float tMax) const
+{
+    //if (BVIntersected(orig, normDir)) This is currently executed by the calling code!
+    {
+        float entryDistance, exitDistance;
+        ssize_t entryFaceNum, exitFaceNum;
+        
+        if (clipLine(ray, tMax, entryDistance, entryFaceNum, exitDistance, exitFaceNum))
+        {
+            //A side that no face bounds (an open brush) has no surface to hit.
+            const bool entryHidden=(entryFaceNum<0)||(faceVector_[entryFaceNum].hidden_);
+            const bool exitHidden=(exitFaceNum<0)||(faceVector_[exitFaceNum].hidden_);
             
-            if (intersect.itemID_!=incomingObjectID)
+            //Same choice of surface as calcIntersection.
+            if ((entryDistance>ray.tMin_)&&(!entryHidden))
             {
-                Vec3 P=ray.origin_;
-                P.addScaled(ray.direction_, intersect.distance_);
-                //Use the recorded faceNum and worldPos of the intersection to calculate the interpolated normal at the intersection.
-                //The face's centre normal has been modified to be the smooth centre normal.
-                
-                //1) Find the two outside face vertices that along with the centre vertex encircle the intersection worldPos.
-                //2) === Find the barycentric coords of the intersection worldPos relative to the three encircling vertices. ===
-                //3) === Calculate the interpolated normal based on the barycentric coordinates of the intersection. ===
-                
-                const BrushFace *brushFace=&(faceVector_[faceNum]);
-                const size_t numVertices=brushFace->vertexCoordVector_.size();
-                
-                
-                //===
-                Vec3 const * const v0=&(brushFace->vertexCoordVector_[0]); //At centre of brush face.
-                
-                //Vec3 const * const n0=&(brushFace->vertexNormalVector_[0]);
-                Vec3 const * const n0=&(brushFace->plane_.normal_);
-                
-                
-                Vec3 v0P=P;
-                v0P-=*v0;
-                const float v0PLengthSq=v0P.lengthSq();
-                //===
-                
-                
-                //=== 01 ===
-                Vec3 const *v1=&(brushFace->vertexCoordVector_[numVertices-1]);
-                
-                //Vec3 const *n1=&(brushFace->vertexNormalVector_[numVertices-1]);
-                Vec3 const *n1=&(brushFace->plane_.normal_);
-                
-                Vec3 v1P=P;
-                v1P-=*v1;
-                
-                stitch::Vec3 v01_norm_temp=*v1;
-                v01_norm_temp-=*v0;
-                
-                const float v01_length_temp=v01_norm_temp.normalise_rt();
-                float A01=0.5f * (sqrtf(v0PLengthSq - powf(v0P*v01_norm_temp,2.0f))) * v01_length_temp;
-                //=== ===
-                
-                
-                Vec3 v2P, v02_norm_temp, v12_norm_temp;
-                for (size_t vertexNum=1; vertexNum<numVertices; ++vertexNum)
+                return entryDistance<tMax;
+            } else
+                if ((exitDistance>ray.tMin_)&&(!exitHidden))
                 {
-                    //=== 02 ===
-                    Vec3 const * const v2=&(brushFace->vertexCoordVector_[vertexNum]);
-                    
-                    //Vec3 const * const n2=&(brushFace->vertexNormalVector_[vertexNum]);
-                    Vec3 const * const n2=&(brushFace->plane_.normal_);
-                    
-                    v2P=P;
-                    v2P-=*v2;
-                    
-                    v02_norm_temp=*v2;
-                    v02_norm_temp-=*v0;
-                    
-                    const float v02_length_temp=v02_norm_temp.normalise_rt();
-                    const float A02=0.5f * (sqrtf(v0PLengthSq - powf(v0P*v02_norm_temp,2.0f))) * v02_length_temp;
-                    //=== ===
-                    
-                    
-                    //=== 12 ===
-                    v12_norm_temp=*v2;
-                    v12_norm_temp-=*v1;
-                    
-                    const float v12_length_temp=v12_norm_temp.normalise_rt();
-                    const float A12=0.5f * (sqrtf(v1P.lengthSq() - powf(v1P*v12_norm_temp,2.0f))) * v12_length_temp;
-                    //=== ===
-                    
-                    
-                    //===
-                    const float A=stitch::Vec3::crossLength(*v0, *v1, *v2)*0.5f;
-                    
-                    if ((A01+A12+A02)<=(A*1.00001f))
-                    {
-                        intersect.normal_.setToSumScaleAndNormalise(*n0, A12, *n1, A02, *n2, A01);
-                        break;
-                    }
-                    //===
-                    
-                    
-                    //v02 will become v01 in next iteration. Reuse calculations.
-                    v1=v2;
-                    n1=n2;
-                    A01=A02;
+                    return exitDistance<tMax;
                 }
-                // === ===
-                
-            }
         }
     }
+    
+    return false;
 }
 
 
@@ -983,10 +1073,46 @@ osg::ref_ptr<osg::Node> stitch::BrushModel::constructOSGNode(const bool createOS
 }
 #endif// USE_OSG
 
+//=======================================================================//
+stitch::AABB stitch::Brush::getAABB() const
+{
+    AABB box;
+    
+    std::vector<BrushFace>::const_iterator faceIter=faceVector_.begin();
+    for (; faceIter!=faceVector_.end(); ++faceIter)
+    {//Iterate over all planes in brush.
+        std::vector<Vec3>::const_iterator vertexIter=faceIter->vertexCoordVector_.begin();
+        for (; vertexIter!=faceIter->vertexCoordVector_.end(); ++vertexIter)
+        {
+            box.expand(*vertexIter);
+        }
+    }
+    
+    if (box.isEmpty())
+    {//No vertices (yet). Fall back to the box around the bounding sphere.
+        return BoundingVolume::getAABB();
+    }
+    
+    return box;
+}
+
+
 //=======================================================================//
 void stitch::BrushModel::calcIntersection(const Ray &ray, Intersection &intersect) const
 {
     ballTree_->calcIntersection(ray, intersect);
 }
 
+//=======================================================================//
+void stitch::BrushModel::calcPacketIntersection(const RayPacket &packet, Intersection * const intersects, const uint32_t mask) const
+{
+    ballTree_->calcPacketIntersection(packet, intersects, mask);
+}
+
+//=======================================================================//
+bool stitch::BrushModel::occluded(const Ray &ray, const float tMax) const
+{
+    return ballTree_->occluded(ray, tMax);
+}
+
 
@@ -29,6 +29,8 @@
 #ifndef STITCH_BRUSH_H
 #define STITCH_BRUSH_H
 
+#define BRUSH_PLANE_BLOCK_SIZE 4 //The number of brush planes tested together with SSE.
+
 namespace stitch {
 	class Brush;
 }
@@ -41,6 +43,8 @@ namespace stitch {
 #include "Object.h"
 #include "BallTree.h"
 
+#include <xmmintrin.h> //for __m128
+
 namespace stitch {
     
     //! One face of a k-DOP brush.
@@ -139,6 +143,10 @@ namespace stitch {
 		virtual ~Brush();
 		
 		void addFace(const BrushFace &face);
+        
+        /*! Update the packed copy of the face planes that the intersection and point tests use, e.g. after changing a face's
+         plane through getFaceByRef. The brush's own methods that change the faces do this themselves. */
+        void packPlanes();
 		
         /*! Merge brush A and B into one Brush. Use material from brushA.*/
         static Brush mergeBrush(const Brush &brushA, const Brush &brushB, const bool trashLineGeometry);
@@ -166,6 +174,14 @@ namespace stitch {
 #endif// USE_OSG
         
 		virtual void calcIntersection(const Ray &ray, Intersection &intersect) const;
+        
+        /*! Same entry/exit test as calcIntersection without the normal interpolation. */
+        virtual bool occluded(const Ray &ray, const float tMax) const;
+        
+        /*! Interpolate the normal across the face that calcIntersection recorded as the primitive hit. */
+        virtual void calcShadingNormal(const Ray &ray, Intersection &intersect) const;
+        
+        virtual AABB getAABB() const;
 		
         /*! Optimise the face order for pointInBrush and intersection operations. */
         void optimiseFaceOrder();
@@ -175,33 +191,34 @@ namespace stitch {
         {
             if (pointInBV(point))//This initial ball BV check possibly does not contribute much towards performance.
             {
-                bool inBrush=true;
+                const __m128 pointX=_mm_set1_ps(point.x());
+                const __m128 pointY=_mm_set1_ps(point.y());
+                const __m128 pointZ=_mm_set1_ps(point.z());
                 
-#ifdef USE_CXX11
-                    for (const auto &face : faceVector_)
-                    {
-                        const stitch::Plane &plane=face.plane_;
-#else
-                    const size_t numFaces=faceVector_.size();
-                    for (size_t faceNum=0; faceNum<numFaces; ++faceNum)
+                const size_t numPackedFloats=packedPlanes_.size();
+                
+                for (size_t blockStart=0; blockStart<numPackedFloats; blockStart+=BRUSH_PLANE_BLOCK_SIZE*4)
+                {
+                    const float * const block=&packedPlanes_[blockStart];
+                    
+                    const __m128 normalDotPoint=_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(block), pointX),
+                                                                      _mm_mul_ps(_mm_loadu_ps(block+BRUSH_PLANE_BLOCK_SIZE), pointY)),
+                                                           _mm_mul_ps(_mm_loadu_ps(block+BRUSH_PLANE_BLOCK_SIZE*2), pointZ));
+                    
+                    if (_mm_movemask_ps(_mm_cmpgt_ps(normalDotPoint, _mm_loadu_ps(block+BRUSH_PLANE_BLOCK_SIZE*3))))
                     {
-                        const stitch::Plane &plane=(faceVector_[faceNum].plane_);
-#endif
-                        if ((plane.normal_ * point) > plane.d_)
-                        {
-                            inBrush=false;
-                            break;//from for-loop
-                        }
+                        return false;
                     }
-                    
-                    return inBrush;
-                } else
-                {
-                    return false;
                 }
+                
+                return true;
+            } else
+            {
+                return false;
             }
-            
-            
+        }
+        
+        
             const BrushFace & getFaceByConstRef(const size_t faceNum) const
             {
                 return faceVector_[faceNum];
@@ -221,6 +238,22 @@ namespace stitch {
             //!
             std::vector<BrushFace> faceVector_;
             
+            /*! The face planes in blocks of BRUSH_PLANE_BLOCK_SIZE faces: the x, y and z components of the block's normals
+             followed by its plane distances. The last block is padded with planes that bound nothing. */
+            std::vector<float> packedPlanes_;
+            
+            /*! Write the plane of a face to its lane of packedPlanes_, adding the face's block if needed. */
+            void packPlane(const size_t faceNum);
+            
+            /*! Clip the ray's line to the brush by testing BRUSH_PLANE_BLOCK_SIZE planes at a time. Gives the same faces as
+             testing them one at a time in order: the first face with the farthest entry and the first with the nearest exit.
+             @param entryLimit Give up once the line enters the brush at or beyond this, e.g. at the closest hit so far.
+             @param entryFaceNum Set to the face through which the line enters, or -1 if no face bounds that side.
+             @param exitFaceNum Set to the face through which the line exits, or -1 if no face bounds that side.
+             @return False if the line misses the brush or enters it at or beyond entryLimit. */
+            bool clipLine(const Ray &ray, const float entryLimit,
+                          float &entryDistance, ssize_t &entryFaceNum, float &exitDistance, ssize_t &exitFaceNum) const;
+            
         private:
 #ifdef USE_OSG
             virtual osg::ref_ptr<osg::Node> constructOSGLineNode() const;
@@ -244,7 +277,7 @@ namespace stitch {
             
             BrushModel(const BrushModel &lValue) :
             Object(lValue),
-            ballTree_(new BallTree(*lValue.ballTree_))
+            ballTree_(lValue.ballTree_->clone())
             {}
             
 #ifdef USE_CXX11
@@ -269,7 +302,7 @@ namespace stitch {
                     Object::operator=(lValue);
                     
                     delete ballTree_;
-                    ballTree_=new BallTree(*lValue.ballTree_);
+                    ballTree_=lValue.ballTree_->clone();
                 }
                 return *this;
             }
@@ -293,15 +326,37 @@ namespace stitch {
                 updateBoundingVolume();
             }
             
-            void buildBallTree(size_t chunkSize)
+            /*! Build the internal tree of brushes. The chunkSize is only used by the BallTree; the SAH BVH picks its own leaf sizes. The tree is frozen with wide nodes if wideNodes is set
+             and with quantised wide nodes if compactNodes is set (see BallTree::freezeCompact). */
+            void buildBallTree(size_t chunkSize, const BallTree::TreeType treeType=BallTree::BALL_TREE, const bool wideNodes=false, const bool compactNodes=false)
             {
-                if (ballTree_->itemVector_.size()>chunkSize)
-                {
-                    ballTree_->build(chunkSize, 0);
+                if (ballTree_->getTreeType()!=treeType)
+                {//Move the brushes over to a tree of the requested type.
+                    BallTree *tree=BallTree::create(treeType);
+                    
+                    ballTree_->linearise();
+                    tree->itemVector_.swap(ballTree_->itemVector_);
+                    
+                    delete ballTree_;
+                    ballTree_=tree;
                 }
                 
-                ballTree_->updateBV();
-                updateBoundingVolume();
+                ballTree_->build(chunkSize, 0);//Also calculates the tree's bounding volume.
+                
+                if (compactNodes)
+                {
+                    ballTree_->freezeCompact();
+                } else
+                    if (wideNodes)
+                    {
+                        ballTree_->freezeWide();
+                    } else
+                    {
+                        ballTree_->freeze();
+                    }
+                
+                this->centre_=ballTree_->centre_;
+                this->radiusBV_=ballTree_->radiusBV_;
             }
             
             virtual ~BrushModel()
@@ -316,6 +371,27 @@ namespace stitch {
             
             virtual void calcIntersection(const Ray &ray, Intersection &intersect) const;
             
+            /*! Trace the packet through the model's tree. */
+            virtual void calcPacketIntersection(const RayPacket &packet, Intersection * const intersects, const uint32_t mask) const;
+            
+            /*! Any-hit query through the model's tree. */
+            virtual bool occluded(const Ray &ray, const float tMax) const;
+            
+            virtual AABB getAABB() const
+            {
+                return ballTree_->getAABB();
+            }
+            
+            virtual size_t getTreeMemorySize() const
+            {
+                return ballTree_->getTreeMemorySize();
+            }
+            
+            virtual size_t getNumPrimitives() const
+            {
+                return ballTree_->getNumPrimitives();
+            }
+            
         private:
             BallTree *ballTree_;
             
@@ -0,0 +1,173 @@
+/*
+ *  ObjectInstance.cpp
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ObjectInstance.h"
+
+#include "OSGUtils/StitchOSG.h"
+
+#ifdef USE_OSG
+#include <osg/MatrixTransform>
+#endif// USE_OSG
+
+
+//=======================================================================//
+stitch::ObjectInstance::ObjectInstance(Material * const pMaterial, const std::shared_ptr<const Object> &object,
+                                       const Vec3 &centre, const float scale, const Vec3 &upVector) :
+Object(pMaterial),
+object_(object)
+{
+    setTransform(centre, scale, upVector);
+}
+
+//=======================================================================//
+stitch::ObjectInstance::ObjectInstance(const ObjectInstance &lValue) :
+Object(lValue),
+object_(lValue.object_),
+axisX_(lValue.axisX_),
+axisY_(lValue.axisY_),
+axisZ_(lValue.axisZ_),
+origin_(lValue.origin_),
+scale_(lValue.scale_)
+{}
+
+//=======================================================================//
+stitch::ObjectInstance::~ObjectInstance()
+{}
+
+//=======================================================================//
+stitch::ObjectInstance & stitch::ObjectInstance::operator = (const ObjectInstance &lValue)
+{
+    if (&lValue!=this)
+    {
+        Object::operator=(lValue);
+
+        object_=lValue.object_;
+        axisX_=lValue.axisX_;
+        axisY_=lValue.axisY_;
+        axisZ_=lValue.axisZ_;
+        origin_=lValue.origin_;
+        scale_=lValue.scale_;
+    }
+
+    return *this;
+}
+
+//=======================================================================//
+void stitch::ObjectInstance::setTransform(const Vec3 &centre, const float scale, const Vec3 &upVector)
+{
+    origin_=centre;
+    scale_=scale;
+
+    //Same orientation as the rotation matrix of PolygonModel::loadVectorsAndIndices.
+    axisZ_=upVector.normalised();
+    axisX_=(axisZ_.orthVec()).normalised();
+    axisY_=stitch::Vec3::crossNormalised(axisZ_, axisX_);
+
+    updateBoundingVolume();
+}
+
+//=======================================================================//
+void stitch::ObjectInstance::updateBoundingVolume()
+{
+    centre_=objectToWorldPoint(object_->centre_);
+    radiusBV_=object_->radiusBV_*scale_;
+}
+
+//=======================================================================//
+stitch::AABB stitch::ObjectInstance::getAABB() const
+{
+    const AABB objectBox=object_->getAABB();
+    AABB box;
+
+    if (!objectBox.isEmpty())
+    {
+        for (size_t cornerNum=0; cornerNum<8; ++cornerNum)
+        {
+            const Vec3 corner((cornerNum&1) ? objectBox.max_.x() : objectBox.min_.x(),
+                              (cornerNum&2) ? objectBox.max_.y() : objectBox.min_.y(),
+                              (cornerNum&4) ? objectBox.max_.z() : objectBox.min_.z());
+
+            box.expand(objectToWorldPoint(corner));
+        }
+    }
+
+    return box;
+}
+
+//=======================================================================//
+#ifdef USE_OSG
+osg::ref_ptr<osg::Node> stitch::ObjectInstance::constructOSGNode(const bool createOSGLineGeometry, const bool createOSGNormalGeometry, const bool wireframe, const uintptr_t key) const
+{
+    //osg::Matrix uses row vectors so each row holds a transformed basis vector.
+    const osg::Matrix matrix(axisX_.x()*scale_, axisX_.y()*scale_, axisX_.z()*scale_, 0.0,
+                             axisY_.x()*scale_, axisY_.y()*scale_, axisY_.z()*scale_, 0.0,
+                             axisZ_.x()*scale_, axisZ_.y()*scale_, axisZ_.z()*scale_, 0.0,
+                             origin_.x(), origin_.y(), origin_.z(), 1.0);
+
+    osg::ref_ptr<osg::MatrixTransform> osgTransform=new osg::MatrixTransform(matrix);
+    osgTransform->addChild(object_->constructOSGNode(createOSGLineGeometry, createOSGNormalGeometry, wireframe, key==0 ? ((uintptr_t)this) : key));
+
+    return osgTransform;
+}
+#endif// USE_OSG
+
+//=======================================================================//
+void stitch::ObjectInstance::calcIntersection(const Ray &ray, Intersection &intersect) const
+{
+    //if (BVIntersected(orig, normDir)) This is currently executed by the calling code!
+    {
+        //The rotation keeps the direction normalised and object space distances are world distances divided by the scale.
+        const Ray objectRay=worldToObjectRay(ray);
+        Intersection objectIntersect(intersect.rayID0_, intersect.rayID1_, intersect.distance_*(1.0f/scale_));
+
+        if (object_->BVIntersected(objectRay))
+        {
+            object_->calcIntersection(objectRay, objectIntersect);
+        }
+
+        if (objectIntersect.itemPtr_!=nullptr)
+        {
+            objectIntersect.itemPtr_->calcShadingNormal(objectRay, objectIntersect);//Needed in object space to transform it.
+            
+            intersect.distance_=objectIntersect.distance_*scale_;
+            intersect.normal_=objectToWorldDir(objectIntersect.normal_);
+
+            //The items of the shared object are the same in every instance, so the instance's ID tells the instances apart and the primitive ID the primitives within it.
+            intersect.itemID_=this->itemID_|(objectIntersect.itemID_&1);
+            intersect.primitiveID_=objectIntersect.primitiveID_;
+            intersect.b1_=objectIntersect.b1_;
+            intersect.b2_=objectIntersect.b2_;
+
+            intersect.itemPtr_=this;
+        }
+    }
+}
+
+//=======================================================================//
+bool stitch::ObjectInstance::occluded(const Ray &ray, const float tMax) const
+{
+    //if (BVIntersected(orig, normDir)) This is currently executed by the calling code!
+    {
+        const Ray objectRay=worldToObjectRay(ray);
+
+        return (object_->BVIntersected(objectRay))&&(object_->occluded(objectRay, tMax*(1.0f/scale_)));
+    }
+}
@@ -0,0 +1,143 @@
+/*
+ *  ObjectInstance.h
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STITCH_OBJECT_INSTANCE_H
+#define STITCH_OBJECT_INSTANCE_H
+
+namespace stitch {
+	class ObjectInstance;
+}
+
+#include "Math/Vec3.h"
+#include "Math/AABB.h"
+#include "Object.h"
+
+#include <memory>
+
+namespace stitch {
+
+    /*! \brief An instance of a shared object (typically a built PolygonModel or BrushModel) placed with its own transform and material.
+
+     The scene's tree references the instances while each instance references the shared object and its internal tree.
+     Geometry that is repeated in a scene is therefore stored and built once. The transform is a rotation, a uniform
+     scale and a translation, parameterised the same as PolygonModel::loadVectorsAndIndices. The shared object must
+     not be changed while it is instanced.*/
+    class ObjectInstance : public Object
+    {
+    public:
+        /*! Constructor.
+         @param pMaterial The material of the instance. Used instead of the shared object's material.
+         @param object The shared object in its own object space.
+         @param centre The world position of the object space origin.
+         @param scale The uniform scale from object space to world space.
+         @param upVector The world direction of the object space z-axis. */
+        ObjectInstance(Material * const pMaterial, const std::shared_ptr<const Object> &object,
+                       const Vec3 &centre, const float scale, const Vec3 &upVector);
+
+        /*! Copy constructor. The copy shares the object. */
+        ObjectInstance(const ObjectInstance &lValue);
+
+        /*! Virtual constructor idiom. Clone operator. */
+        virtual ObjectInstance * clone() const
+        {
+            return new ObjectInstance(*this);
+        }
+
+        virtual ~ObjectInstance();
+
+        /*! Assignment operator. */
+		virtual ObjectInstance & operator = (const ObjectInstance &lValue);
+
+        /*! Move the instance, e.g. between the frames of an animation. Same parameters as the constructor. The tree that
+         contains the instance should be refitted afterwards (see BallTree::refit). */
+        void setTransform(const Vec3 &centre, const float scale, const Vec3 &upVector);
+
+        const std::shared_ptr<const Object> &getObject() const
+        {
+            return object_;
+        }
+
+        inline Vec3 objectToWorldDir(const Vec3 &dir) const
+        {
+            return Vec3(axisX_.x()*dir.x() + axisY_.x()*dir.y() + axisZ_.x()*dir.z(),
+                        axisX_.y()*dir.x() + axisY_.y()*dir.y() + axisZ_.y()*dir.z(),
+                        axisX_.z()*dir.x() + axisY_.z()*dir.y() + axisZ_.z()*dir.z());
+        }
+
+        inline Vec3 worldToObjectDir(const Vec3 &dir) const
+        {
+            return Vec3(axisX_*dir, axisY_*dir, axisZ_*dir);
+        }
+
+        inline Vec3 objectToWorldPoint(const Vec3 &point) const
+        {
+            return objectToWorldDir(point)*scale_ + origin_;
+        }
+
+        inline Vec3 worldToObjectPoint(const Vec3 &point) const
+        {
+            return worldToObjectDir(point-origin_)*(1.0f/scale_);
+        }
+
+        /*! Transform the ray to object space. The rotation keeps the direction normalised and the ray interval is scaled with the distances. */
+        inline Ray worldToObjectRay(const Ray &ray) const
+        {
+            Ray objectRay(ray.id0_, ray.id1_, worldToObjectDir(ray.direction_), worldToObjectPoint(ray.origin_));
+            objectRay.tMin_=ray.tMin_*(1.0f/scale_);
+            objectRay.tMax_=ray.tMax_*(1.0f/scale_);
+            objectRay.visibilityMask_=ray.visibilityMask_;
+
+            return objectRay;
+        }
+
+        /*! Update the bounding sphere from the shared object's bounding sphere and the transform. */
+        void updateBoundingVolume();
+
+        virtual AABB getAABB() const;
+
+#ifdef USE_OSG
+		virtual osg::ref_ptr<osg::Node> constructOSGNode(const bool createOSGLineGeometry, const bool createOSGNormalGeometry, const bool wireframe, const uintptr_t key=0) const;
+#endif// USE_OSG
+
+        /*! Intersect the shared object with the ray transformed to object space. The instance is reported as the
+         intersected item so that its material is used. The item ID is that of the instance with the front/back bit of the hit,
+         and the primitive ID and barycentrics are those of the hit within the shared object. */
+		virtual void calcIntersection(const Ray &ray, Intersection &intersect) const;
+
+        /*! Any-hit query of the shared object with the ray transformed to object space. */
+        virtual bool occluded(const Ray &ray, const float tMax) const;
+
+    private:
+        std::shared_ptr<const Object> object_;
+
+        //! The world space directions of the object space axes.
+        Vec3 axisX_, axisY_, axisZ_;
+
+        //! World position of the object space origin.
+        Vec3 origin_;
+
+        float scale_;
+    };
+
+}
+
+
+#endif// STITCH_OBJECT_INSTANCE_H
@@ -30,168 +30,227 @@
 #include "Math/MathUtil.h"
 //#include "Beam.h"
 #include "Math/Mat4.h"
+#include "Timer.h"
 
-#include "IOUtils/ply.h"
-#include "IOUtils/obj.h"
+#include "IOUtils/PLYReader.h"
+#include "IOUtils/OBJReader.h"
 
 #include <iostream>
-#include <fstream>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "OSGUtils/StitchOSG.h"
 
-#ifdef USE_OSG
-osg::ref_ptr<osg::Node> stitch::Polygon::constructOSGNode(const bool createOSGLineGeometry, const bool createOSGNormalGeometry, const bool wireframe, const uintptr_t key) const
+//=======================================================================//
+/*! Run task(start, end, chunkNum) on numChunks contiguous chunks of [0, numItems), on a thread each if numChunks>1. */
+template <class Task>
+static void runPolygonModelChunks(const size_t numItems, const size_t numChunks, const Task &task)
 {
-    Vec3 colour(stitch::Vec3::uniqueValue(key==0 ? ((uintptr_t)this) : key));
-    colour.positivise();
-    
-    osg::ref_ptr<osg::Geode> osgGeode=new osg::Geode();
+    if (numChunks<=1)
+    {
+        task(0, numItems, 0);
+        return;
+    }
     
-    osg::ref_ptr<osg::Vec3Array> osgTriangleVertices=new osg::Vec3Array();
-    osg::ref_ptr<osg::Vec3Array> osgTriangleNormals=new osg::Vec3Array();
+    std::vector<std::thread> threadVect;
+    threadVect.reserve(numChunks);
     
+    const size_t chunkSize=(numItems+numChunks-1)/numChunks;
     
-    //=== Construct triangle geometry ===
+    for (size_t chunkNum=0; chunkNum<numChunks; ++chunkNum)
+    {
+        const size_t start=std::min(chunkNum*chunkSize, numItems);
+        threadVect.emplace_back(task, start, std::min(start+chunkSize, numItems), chunkNum);
+    }
     
+    for (auto &thread : threadVect)
     {
-        osgTriangleVertices->push_back(osg::Vec3f(v0_.x(), v0_.y(), v0_.z()));
-        osgTriangleVertices->push_back(osg::Vec3f(v1_.x(), v1_.y(), v1_.z()));
-        osgTriangleVertices->push_back(osg::Vec3f(v2_.x(), v2_.y(), v2_.z()));
-        
-        osgTriangleNormals->push_back(osg::Vec3f(n0_.x(), n0_.y(), n0_.z()));
-        osgTriangleNormals->push_back(osg::Vec3f(n1_.x(), n1_.y(), n1_.z()));
-        osgTriangleNormals->push_back(osg::Vec3f(n2_.x(), n2_.y(), n2_.z()));
+        thread.join();
+    }
+}
+
+/*! The number of chunks to split the preprocessing of numTriangles triangles into. */
+static size_t calcPolygonModelNumChunks(const size_t numTriangles)
+{
+    if (numTriangles<POLYGONMODEL_PARALLEL_MIN_TRIANGLES)
+    {
+        return 1;
     }
     
-    osg::ref_ptr<osg::Geometry> osgTriangleGeometry=new osg::Geometry();
-    osgTriangleGeometry->setVertexArray(osgTriangleVertices.get());
-    osgTriangleGeometry->setNormalArray(osgTriangleNormals.get());
-    osgTriangleGeometry->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
-    //osgTriangleGeometry->setUseVertexBufferObjects(true);
-    osgTriangleGeometry->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::TRIANGLES,0,osgTriangleVertices->size()));
+    size_t numThreads=std::thread::hardware_concurrency();
+    if (numThreads==0) numThreads=2;//Setup numThreads in case system reports 0.
     
-    osg::ref_ptr<osg::StateSet> osgTriangleStateset=osgTriangleGeometry->getOrCreateStateSet();
-    osgTriangleStateset->setMode(GL_CULL_FACE, osg::StateAttribute::OFF);
-    //osgTriangleStateset->setMode(GL_RESCALE_NORMAL, osg::StateAttribute::ON);//Re-normalise scaled normal vectors.
-    osgTriangleStateset->setMode(GL_LIGHTING, osg::StateAttribute::ON);
-    //osgTriangleStateset->setMode(GL_LIGHT_MODEL_TWO_SIDE, osg::StateAttribute::ON);
+    return numThreads;
+}
+
+//=======================================================================//
+void stitch::PolygonModel::calculateVertexNormals()
+{
+    stitch::Timer timer;
+    const stitch::Timer_t startTick=timer.tick();
     
-    {//Solid or wireframe?
-        osg::PolygonMode* pm = dynamic_cast<osg::PolygonMode*>(osgTriangleStateset->getAttribute(osg::StateAttribute::POLYGONMODE));
-        if (!pm)
-        {
-            pm = new osg::PolygonMode;
-        }
-        
-        if (wireframe)
-        {
-            pm->setMode(osg::PolygonMode::FRONT_AND_BACK, osg::PolygonMode::LINE);
-        } else
-        {
-            pm->setMode(osg::PolygonMode::FRONT_AND_BACK, osg::PolygonMode::FILL);
-        }
-        
-        osgTriangleStateset->setAttribute(pm);
-    }
+    smoothSurface_=true;
     
-    osg::Depth* depth = new osg::Depth();
-    osgTriangleStateset->setAttributeAndModes(depth, osg::StateAttribute::ON);
+    const size_t numVertices=vertNormals_.size();
+    const size_t numTriangles=indices_.size()/3;
+    const size_t numChunks=calcPolygonModelNumChunks(numTriangles);
+    
+    //=== Sum the face normals of each chunk of triangles. The first chunk sums straight into the vertex normals ===
+    std::vector<std::vector<stitch::Vec3> > partialNormals(numChunks-1);
+    
+    runPolygonModelChunks(numTriangles, numChunks, [this, &partialNormals, numVertices](const size_t start, const size_t end, const size_t chunkNum)
+                          {
+                              std::vector<stitch::Vec3> &vertNormals=(chunkNum==0) ? vertNormals_ : partialNormals[chunkNum-1];
+                              vertNormals.assign(numVertices, stitch::Vec3(0.0f, 0.0f, 0.0f));
+                              
+                              for (size_t triangleNum=start; triangleNum<end; ++triangleNum)
+                              {
+                                  const size_t * const triangle=&indices_[triangleNum*3];
+                                  
+                                  const stitch::Vec3 &v0=vertCoords_[triangle[0]];
+                                  const stitch::Vec3 &v1=vertCoords_[triangle[1]];
+                                  const stitch::Vec3 &v2=vertCoords_[triangle[2]];
+                                  
+                                  if ( ((v2-v0).lengthSq()!=0.0f) && ((v1-v0).lengthSq()!=0.0f) && ((v1-v2).lengthSq()!=0.0f) )
+                                  {//Protect against needle or point polygons.
+                                      const stitch::Vec3 planeNormal=stitch::Vec3::crossNormalised(v2, v1, v0);
+                                      
+                                      vertNormals[triangle[0]]+=planeNormal;
+                                      vertNormals[triangle[1]]+=planeNormal;
+                                      vertNormals[triangle[2]]+=planeNormal;
+                                  }
+                              }
+                          });
+    //===
+    
+    //=== Add up the partial sums of each vertex in chunk order and normalise ===
+    runPolygonModelChunks(numVertices, numChunks, [this, &partialNormals](const size_t start, const size_t end, const size_t chunkNum)
+                          {
+                              for (size_t vertexNum=start; vertexNum<end; ++vertexNum)
+                              {
+                                  for (const auto &partial : partialNormals)
+                                  {
+                                      vertNormals_[vertexNum]+=partial[vertexNum];
+                                  }
+                                  
+                                  vertNormals_[vertexNum].normalise();
+                              }
+                          });
+    //===
+    
+    const stitch::Timer_t endTick=timer.tick();
+    std::cout << "Calculated the vertex normals of " << numTriangles << " triangles in " << timer.delta_m(startTick, endTick) << " ms.\n";
+    std::cout.flush();
+}
+
+//=======================================================================//
+void stitch::PolygonModel::generatePolygonObjectsFromVertices()
+{
+    stitch::Timer timer;
+    const stitch::Timer_t startTick=timer.tick();
     
-    osg::Material *material = new osg::Material();
-    material->setColorMode(osg::Material::DIFFUSE);
+    releaseMeshTriangles();
+    delete ballTree_;
+    ballTree_=new BallTree();
     
-    material->setDiffuse(osg::Material::FRONT_AND_BACK, osg::Vec4(colour.x(), colour.y(), colour.z(), 1.0));
-    osgTriangleStateset->setAttributeAndModes(material, osg::StateAttribute::ON);
+    if (!vertCoords_.empty())
+    {//The mesh is then the only copy of the loaded vertices, normals and indices.
+        mesh_=std::make_shared<const TriangleMesh>(vertCoords_, vertNormals_, indices_);
+        
+        std::vector<Vec3>().swap(vertCoords_);
+        std::vector<Vec3>().swap(vertNormals_);
+        std::vector<size_t>().swap(indices_);
+    }
     
-    osgGeode->addDrawable(osgTriangleGeometry.get());
+    addMeshTriangles();
     
-    //=======
+    ballTree_->updateBV();
+    updateBoundingVolume();
     
-    return osgGeode;
+    const stitch::Timer_t endTick=timer.tick();
+    std::cout << "Set up " << ballTree_->itemVector_.size() << " triangles in " << timer.delta_m(startTick, endTick) << " ms.\n";
+    std::cout.flush();
 }
-#endif// USE_OSG
-
 
 //=======================================================================//
-void stitch::Polygon::calcIntersection(const Ray &ray, Intersection &intersect) const
+void stitch::PolygonModel::addMeshTriangles()
 {
-    //if (BVIntersected(orig, normDir)) This is currently executed by the calling code!
-    {//Moller and Trumbore - 1997, "Fast, minimum storage ray-triangle intersection.", Journal of Graphics Tools 2(1), 21-28.
-        //Coded from PBRT Book, Second Ed, p140.
-        const Vec3 e1(v0_,v1_);//v1_ - v0_
-        const Vec3 e2(v0_,v2_);//v2_ - v0_
-        const Vec3 s1=stitch::Vec3::cross(ray.direction_, e2);
-        
-        const float divisor=stitch::Vec3::dot(s1, e1);
-        
-        if (divisor!=0.0f)
+    triangleArena_.reset(new Arena());
+    
+    if (!mesh_)
+    {
+        return;
+    }
+    
+    const TriangleMesh * const mesh=mesh_.get();
+    const uint32_t numTriangles=mesh->getNumTriangles();
+    const size_t numChunks=calcPolygonModelNumChunks(numTriangles);
+    
+    //=== Check and bound the triangles ===
+    std::vector<stitch::Vec3> centres(numTriangles);
+    std::vector<float> radii(numTriangles);
+    std::vector<uint8_t> valid(numTriangles);
+    
+    runPolygonModelChunks(numTriangles, numChunks, [mesh, &centres, &radii, &valid](const size_t start, const size_t end, const size_t chunkNum)
+                          {
+                              for (size_t triangleIndex=start; triangleIndex<end; ++triangleIndex)
+                              {
+                                  valid[triangleIndex]=(mesh->calcArea(triangleIndex)!=0.0f);//Protect against needle and point polygons.
+                                  
+                                  if (valid[triangleIndex])
+                                  {
+                                      MeshTriangle::calcBoundingSphere(mesh, triangleIndex, centres[triangleIndex], radii[triangleIndex]);
+                                  }
+                              }
+                          });
+    //===
+    
+    //=== Create the triangles in order ===
+    ballTree_->itemVector_.reserve(numTriangles);
+    
+    for (uint32_t triangleIndex=0; triangleIndex<numTriangles; ++triangleIndex)
+    {
+        if (valid[triangleIndex])
         {
-            const float recipDivisor=1.0f/divisor;
-            
-            const Vec3 d(v0_, ray.origin_);//ray.origin_ - v0_
-            
-            const float b1 = stitch::Vec3::dotscale(d, s1, recipDivisor);
-            
-            if ((b1>=0.0f) && (b1<=1.0f))
-            {
-                const Vec3 s2 = stitch::Vec3::cross(d, e1);
-                const float b2 = stitch::Vec3::dotscale(ray.direction_, s2, recipDivisor);
-                
-                if ((b2>=0.0f) && ((b1+b2)<=1.0f))
-                {
-                    const float intersectDist=stitch::Vec3::dotscale(e2, s2, recipDivisor);
-                    
-                    if ((intersectDist>0.0f)&&(intersectDist<intersect.distance_))
-                    {
-                        intersect.distance_=intersectDist;
-                        intersect.normal_.setToSumScaleAndNormalise(n0_, 1.0f-b1-b2, n1_, b1, n2_, b2);
-                        intersect.itemID_=this->itemID_ | ((intersect.normal_*ray.direction_>0.0f)?0:1);//back surface gets even ID, front surface gets odd ID.
-                        intersect.itemPtr_=this;
-                    }
-                }
-            }
+            ballTree_->addItem(new (*triangleArena_) MeshTriangle(mesh, triangleIndex, centres[triangleIndex], radii[triangleIndex]));
         }
     }
+    //===
 }
 
-
-
-
-
 //=======================================================================//
-void stitch::PolygonModel::calculateVertexNormals()
+void stitch::PolygonModel::releaseMeshTriangles()
 {
-    smoothSurface_=true;
-    
-    std::vector<stitch::Vec3>::iterator vertexNormalIter=vertNormals_.begin();
-    for (; vertexNormalIter!=vertNormals_.end(); ++vertexNormalIter)
+    if (!triangleArena_)
     {
-        (*vertexNormalIter)=stitch::Vec3(0.0f, 0.0f, 0.0f);
+        return;
     }
     
-    std::vector<size_t>::const_iterator faceIndexIter=indices_.begin();
-    for (; faceIndexIter!=indices_.end(); faceIndexIter+=3)
-    {
-        stitch::Vec3 v0(vertCoords_[*(faceIndexIter+0)]);
-        stitch::Vec3 v1(vertCoords_[*(faceIndexIter+1)]);
-        stitch::Vec3 v2(vertCoords_[*(faceIndexIter+2)]);
-        
-        stitch::Vec3 planeNormal;
-        
-        if ( ((v2-v0).lengthSq()!=0.0f) && ((v1-v0).lengthSq()!=0.0f) && ((v1-v2).lengthSq()!=0.0f) )
-        {//Protect against needle or point polygons.
-            planeNormal=stitch::Vec3::crossNormalised(v2, v1, v0);
-            
-            vertNormals_[*(faceIndexIter+0)]+=planeNormal;
-            vertNormals_[*(faceIndexIter+1)]+=planeNormal;
-            vertNormals_[*(faceIndexIter+2)]+=planeNormal;
-        }
+    if ((ballTree_!=nullptr)&&(!ballTree_->empty()))
+    {//The items are all MeshTriangles in the arena. A tree frozen over the mesh has already let go of them.
+        ballTree_->linearise();
+        std::vector<BoundingVolume *>().swap(ballTree_->itemVector_);
     }
     
-    vertexNormalIter=vertNormals_.begin();
-    for (; vertexNormalIter!=vertNormals_.end(); ++vertexNormalIter)
+    triangleArena_.reset();
+}
+
+//=======================================================================//
+void stitch::PolygonModel::copyBallTree(const PolygonModel &lValue)
+{
+    if (lValue.triangleArena_)
+    {//The tree is not built yet, so only its MeshTriangles are needed.
+        ballTree_=BallTree::create(lValue.ballTree_->getTreeType());
+        addMeshTriangles();
+        ballTree_->updateBV();
+    } else
     {
-        vertexNormalIter->normalise();
+        ballTree_=lValue.ballTree_->clone();
     }
 }
 
@@ -203,7 +262,10 @@ osg::ref_ptr<osg::Node> stitch::PolygonModel::constructOSGNode(const bool create
     Vec3 colour(stitch::Vec3::uniqueValue(key==0 ? ((uintptr_t)this) : key));
     colour.positivise();
     
-    return ballTree_->constructOSGNode(createOSGLineGeometry, createOSGNormalGeometry, wireframe, key==0 ? (smoothSurface_ ? ((uintptr_t)this) : ((uintptr_t)0)) : key); //This method generates way too many drawables for OSG!
+    if (!ballTree_->empty())
+    {//The tree only has items until it is frozen over the mesh.
+        return ballTree_->constructOSGNode(createOSGLineGeometry, createOSGNormalGeometry, wireframe, key==0 ? (smoothSurface_ ? ((uintptr_t)this) : ((uintptr_t)0)) : key); //This method generates way too many drawables for OSG!
+    }
     
     osg::ref_ptr<osg::Geode> osgGeode=new osg::Geode();
     
@@ -213,16 +275,18 @@ osg::ref_ptr<osg::Node> stitch::PolygonModel::constructOSGNode(const bool create
     
     //=== Construct triangle geometry ===
     
-    std::vector<size_t>::const_iterator faceIndexIter=indices_.begin();
-    for (; faceIndexIter!=indices_.end(); faceIndexIter+=3)
+    const size_t numTriangles=mesh_ ? mesh_->getNumTriangles() : 0;
+    for (size_t triangleIndex=0; triangleIndex<numTriangles; ++triangleIndex)
     {
-        stitch::VecN v0(vertCoords_[*(faceIndexIter+0)]);
-        stitch::VecN v1(vertCoords_[*(faceIndexIter+1)]);
-        stitch::VecN v2(vertCoords_[*(faceIndexIter+2)]);
+        const uint32_t * const triangle=&mesh_->indices_[triangleIndex*3];
+        
+        stitch::VecN v0(mesh_->getVertex(triangle[0]));
+        stitch::VecN v1(mesh_->getVertex(triangle[1]));
+        stitch::VecN v2(mesh_->getVertex(triangle[2]));
         
-        stitch::VecN n0(vertNormals_[*(faceIndexIter+0)]);
-        stitch::VecN n1(vertNormals_[*(faceIndexIter+1)]);
-        stitch::VecN n2(vertNormals_[*(faceIndexIter+2)]);
+        stitch::VecN n0(mesh_->getNormal(triangle[0]));
+        stitch::VecN n1(mesh_->getNormal(triangle[1]));
+        stitch::VecN n2(mesh_->getNormal(triangle[2]));
         
         osgTriangleVertices->push_back(osg::Vec3f(v0.x(), v0.y(), v0.z()));
         osgTriangleVertices->push_back(osg::Vec3f(v1.x(), v1.y(), v1.z()));
@@ -282,154 +346,34 @@ osg::ref_ptr<osg::Node> stitch::PolygonModel::constructOSGNode(const bool create
 
 
 //=======================================================================//
-typedef struct Vertex {
-    float x,y,z;             /* the usual 3-space position of a vertex */
-} Vertex;
-
-typedef struct Face {
-    unsigned char intensity; /* this user attaches intensity to faces */
-    unsigned char nverts;    /* number of vertex indices in list */
-    int *verts;              /* vertex index list */
-} Face;
-
-PlyProperty vert_props[] = { /* list of property information for a vertex */
-    {"x", PLY_FLOAT, PLY_FLOAT, offsetof(Vertex,x), 0, 0, 0, 0},
-    {"y", PLY_FLOAT, PLY_FLOAT, offsetof(Vertex,y), 0, 0, 0, 0},
-    {"z", PLY_FLOAT, PLY_FLOAT, offsetof(Vertex,z), 0, 0, 0, 0},
-};
-
-PlyProperty face_props[] = { /* list of property information for a vertex */
-    {"intensity", PLY_UCHAR, PLY_UCHAR, offsetof(Face,intensity), 0, 0, 0, 0},
-    {"vertex_indices", PLY_INT, PLY_INT, offsetof(Face,verts),
-        1, PLY_UCHAR, PLY_UCHAR, offsetof(Face,nverts)},
-};
-
 bool stitch::PolygonModel::loadPLYVertices(const std::string fileName, const stitch::Vec3 &centre, const float scale, const bool invertNormals)
 {
     vertNormals_.clear();
     vertCoords_.clear();
     indices_.clear();
     
-    std::cout << "Loading PLY file" << fileName << "...\n";
+    std::cout << "Loading PLY file " << fileName << "...";
     std::cout.flush();
     
-    //=== Read PLY file ===
-    
-    /* open a PLY file for reading */
-    int file_type=0;
-    float version=0;
-    int nelems=0;
-    char **elist=nullptr;
+    PLYReader reader;
     
-    PlyFile *ply = ply_open_for_reading(fileName.c_str(), &nelems, &elist, &file_type, &version);
-    std::cout << "   PLY version " << version << "\n";
-    std::cout << "   PLY type " << file_type << "\n";
-    std::cout.flush();
-    
-    /* go through each kind of element that we learned is in the file */
-    /* and read them */
-    
-    for (int i = 0; i < nelems; i++)
+    if ((!reader.open(fileName)) ||
+        (!reader.readVertices(vertCoords_, centre, scale)) ||
+        (!reader.readTriangles(indices_, invertNormals)))
     {
-        /* get the description of the first element */
-        int num_elems;
-        char *elem_name = elist[i];
-        int nprops;
-        PlyProperty **plist = ply_get_element_description (ply, elem_name, &num_elems, &nprops);
-        
-        /* print the name of the element, for debugging */
-        std::cout << "   Element " << elem_name << " " << num_elems << "\n";
+        std::cout << "failed.\n";
         std::cout.flush();
         
-        /* if we're on vertex elements, read them in */
-        if (equal_strings ("vertex", elem_name))
-        {
-            ply_get_property (ply, elem_name, &vert_props[0]);
-            ply_get_property (ply, elem_name, &vert_props[1]);
-            ply_get_property (ply, elem_name, &vert_props[2]);
-            
-            for (int j = 0; j < num_elems; j++)
-            {
-                Vertex vertex;
-                ply_get_element (ply, (void *) &vertex);
-                
-                vertCoords_.push_back(stitch::Vec3(vertex.x, vertex.y, vertex.z)*scale+centre);
-                
-#ifdef USE_CXX11
-                vertNormals_.emplace_back(0.0, 0.0, 1.0);
-#else
-                vertNormals_.push_back(stitch::Vec3(0.0, 0.0, 1.0));
-#endif
-            }
-        }
-        
-        
-        /* if we're on face elements, read them in */
-        if (equal_strings("face", elem_name)) {
-            
-            ply_get_property (ply, elem_name, &face_props[0]);
-            ply_get_property (ply, elem_name, &face_props[1]);
-            
-            for (int j = 0; j < num_elems; j++) {
-                Face face;
-                ply_get_element (ply, (void *) &face);
-                
-                if (face.nverts>=3)
-                {
-                    for (int k = 2; k < face.nverts; k++)
-                    {
-                        indices_.push_back(face.verts[0]);
-                        
-                        if (invertNormals)
-                        {
-                            indices_.push_back(face.verts[k]);
-                            indices_.push_back(face.verts[k-1]);
-                        } else
-                        {
-                            indices_.push_back(face.verts[k-1]);
-                            indices_.push_back(face.verts[k]);
-                        }
-                    }
-                }
-                
-            }
-        }
-        
-        /* print out the properties we got, for debugging */
-        for (int j = 0; j < nprops; j++)
-        {
-            std::cout << "   Property " << plist[j]->name << "\n";
-            std::cout.flush();
-        }
-    }
-    
-    /* grab and print out the comments in the file */
-    int num_comments;
-    char **comments = ply_get_comments (ply, &num_comments);
-    for (int i = 0; i < num_comments; i++)
-    {
-        std::cout << "   Comment = " << comments[i] << "\n";
-        std::cout.flush();
-    }
-    
-    /* grab and print out the object information */
-    int num_obj_info;
-    char **obj_info = ply_get_obj_info (ply, &num_obj_info);
-    for (int i = 0; i < num_obj_info; i++)
-    {
-        std::cout << "   Obj_info " << obj_info[i] << "\n";
-        std::cout.flush();
+        vertCoords_.clear();
+        indices_.clear();
+        return false;
     }
     
-    /* close the PLY file */
-    ply_close (ply);
-    //==============================
-    
-    
+    vertNormals_.assign(vertCoords_.size(), stitch::Vec3(0.0, 0.0, 1.0));
     
     updateBoundingVolume();
     
-    std::cout << "done.\n";
+    std::cout << "done (" << reader.getNumVertices() << " vertices, " << reader.getNumFaces() << " faces).\n";
     std::cout.flush();
     return true;
 }
@@ -442,111 +386,25 @@ bool stitch::PolygonModel::loadOBJVertices(const std::string fileName, const sti
     vertCoords_.clear();
     indices_.clear();
     
-    std::cout << "Loading OBJ file" << fileName << "...\n";
+    std::cout << "Loading OBJ file " << fileName << "...";
     std::cout.flush();
     
-    //=== Read OBJ file ===//
-    std::ifstream fin(fileName.c_str(), std::ios::in);
+    OBJReader reader;
+    bool hasNormals=false;
     
-    while (!fin.eof())
+    if ((!reader.open(fileName)) ||
+        (!reader.read(vertCoords_, vertNormals_, indices_, centre, scale, invertNormals, hasNormals)))
     {
-        std::string keyword;
-        
-        //read the keyword and then the data.
-        fin >> keyword;
-        
-        if (keyword=="v")
-        {
-            double x,y,z;
-            fin >> x >> y >> z;
-            //std::cout << "V: (" << x << ", " << y << ", " << z << ")\n";
-            //std::cout.flush();
-            
-            Vec3 vert(x,y,z);
-            vertCoords_.push_back(vert*scale + centre);
-#ifdef USE_CXX11
-            vertNormals_.emplace_back(1.0, 0.0, 0.0);
-#else
-            vertNormals_.push_back(stitch::Vec3(1.0, 0.0, 0.0));
-#endif
-        } else
-            if (keyword=="vt")
-            {
-                char data[1024]; //Could be 2D.
-                fin.getline(data,1024);
-            } else
-                if (keyword=="vn")
-                {
-                    char data[1024];
-                    fin.getline(data,1024);
-                } else
-                    if (keyword=="f")
-                    {
-                        char data[1024];
-                        fin.getline(data,1024);
-                        
-                        std::vector<size_t> vIndexVec;
-                        
-                        char *fDesc=data;
-                        char *vDesc=nullptr;
-                        
-                        do
-                        {//Read a vertex.
-                            vDesc=strsep(&fDesc, " \t\n\r");
-                            
-                            if ((*vDesc)!=0)
-                            {//There is a vertex to process.
-                                char *ptr=nullptr;
-                                long vertIndex=strtol(vDesc, &ptr, 10);
-                                if (vertIndex<1) vertIndex=((int)vertCoords_.size())+vertIndex;
-                                
-                                vIndexVec.push_back(vertIndex-1);
-                                
-                                while (*ptr!=0)
-                                {//Read the rest of the vertex attrbs.
-                                    /*long attrb=*/strtol(ptr+1, &ptr, 10);
-                                    
-                                }
-                            }
-                            
-                        } while (fDesc!=0);
-                        
-                        size_t v0=vIndexVec[0];
-                        
-                        for (size_t i=2; i<vIndexVec.size(); i++)
-                        {
-                            size_t v1=vIndexVec[i-1];
-                            size_t v2=vIndexVec[i];
-                            
-                            indices_.push_back(v0);
-                            if (!invertNormals)
-                            {
-                                indices_.push_back(v2);
-                                indices_.push_back(v1);
-                            } else
-                            {
-                                indices_.push_back(v1);
-                                indices_.push_back(v2);
-                            }
-                        }
-                        
-                    } else
-                    {
-                        char data[1024];
-                        fin.getline(data,1024);
-                        
-                        std::cout << keyword << " " << data << "\n";
-                        std::cout.flush();
-                    }
-        
+        std::cout << "failed.\n";
+        std::cout.flush();
+        return false;
     }
     
-    fin.close();
-    //=====================//
+    smoothSurface_=hasNormals;
     
     updateBoundingVolume();
     
-    std::cout << "done.\n";
+    std::cout << "done (" << vertCoords_.size() << " vertices, " << (indices_.size()/3) << " triangles" << (hasNormals ? ", with normals" : "") << ").\n";
     std::cout.flush();
     return true;
 }
@@ -701,24 +559,328 @@ bool stitch::PolygonModel::loadIcosahedronBasedSphere(const size_t minimumNumVer
     return loadVectorsAndIndices(vectors, binIndices, centre, scale, Vec3(0.0f, 1.0f, 0.0f), smoothNormals);
 }
 
+namespace {
+    const char polygonModelCacheMagic[8]={'S', 'T', 'I', 'T', 'C', 'H', 'P', 'M'};
+    
+    //! The vertex arrays of a mesh in the order of their sections: x, y, z, normalX, normalY and normalZ.
+    const size_t polygonModelCacheNumVertexArrays=6;
+    
+    /*! Header of a PolygonModel cache file. The structure sizes guard against a cache written by a build with other
+     structure layouts. The key, the mesh arrays, the frozen triangle indices and the frozen nodes follow the header. */
+    struct PolygonModelCacheHeader
+    {
+        char magic_[8];
+        uint32_t version_;
+        uint32_t frozenNodeSize_;
+        uint32_t frozenWideNodeSize_;
+        uint32_t frozenCompactNodeSize_;
+        uint32_t treeType_;
+        uint32_t smoothSurface_;
+        uint32_t keySize_;
+        
+        uint64_t numVertices_;
+        uint64_t numTriangles_;
+        uint64_t numFrozenTriangles_;//The indices of the triangles in the order that the frozen leaves reference them.
+        uint64_t numFrozenNodes_;
+        uint64_t numFrozenWideNodes_;
+        uint64_t numFrozenCompactNodes_;
+    };
+    
+    /*! The byte offsets of the sections of a cache file. Each array starts on a 16 byte boundary. The counts of the header are
+     checked against the file size before they are multiplied out so that a corrupt header can not wrap the offsets around. */
+    struct PolygonModelCacheLayout
+    {
+        PolygonModelCacheLayout(const PolygonModelCacheHeader &header, const uint64_t maxFileSize) :
+        fileSize_(sizeof(PolygonModelCacheHeader)),
+        valid_(true)
+        {
+            keyOffset_=addSection(header.keySize_, 1, maxFileSize);
+            
+            for (size_t arrayNum=0; arrayNum<polygonModelCacheNumVertexArrays; ++arrayNum)
+            {
+                vertexArrayOffsets_[arrayNum]=addSection(header.numVertices_, sizeof(float), maxFileSize);
+            }
+            
+            indicesOffset_=addSection(header.numTriangles_, 3*sizeof(uint32_t), maxFileSize);
+            frozenTrianglesOffset_=addSection(header.numFrozenTriangles_, sizeof(uint32_t), maxFileSize);
+            frozenNodesOffset_=addSection(header.numFrozenNodes_, header.frozenNodeSize_, maxFileSize);
+            frozenWideNodesOffset_=addSection(header.numFrozenWideNodes_, header.frozenWideNodeSize_, maxFileSize);
+            frozenCompactNodesOffset_=addSection(header.numFrozenCompactNodes_, header.frozenCompactNodeSize_, maxFileSize);
+        }
+        
+        //! Append a section of count elements of elementSize bytes. @return The offset of the section.
+        uint64_t addSection(const uint64_t count, const uint64_t elementSize, const uint64_t maxFileSize)
+        {
+            const uint64_t offset=align(fileSize_);
+            
+            if ((!valid_)||(offset>maxFileSize)||((elementSize!=0)&&(count>((maxFileSize-offset)/elementSize))))
+            {
+                valid_=false;
+                return 0;
+            }
+            
+            fileSize_=offset+count*elementSize;
+            
+            return offset;
+        }
+        
+        static inline uint64_t align(const uint64_t offset)
+        {
+            return (offset+15) & ~((uint64_t)15);
+        }
+        
+        uint64_t keyOffset_;
+        uint64_t vertexArrayOffsets_[polygonModelCacheNumVertexArrays];
+        uint64_t indicesOffset_;
+        uint64_t frozenTrianglesOffset_;
+        uint64_t frozenNodesOffset_;
+        uint64_t frozenWideNodesOffset_;
+        uint64_t frozenCompactNodesOffset_;
+        uint64_t fileSize_;
+        
+        //! False if a section does not fit in the maximum file size.
+        bool valid_;
+    };
+}
+
+//=======================================================================//
+bool stitch::PolygonModel::saveCache(const std::string &fileName, const std::string &key) const
+{
+    const TriangleMesh * const mesh=ballTree_->getFrozenMesh();
+    
+    if ((mesh==nullptr)||(mesh!=mesh_.get()))
+    {//The tree is not built.
+        return false;
+    }
+    
+    const std::vector<uint32_t> &frozenTriangles=ballTree_->getFrozenTriangles();
+    const std::vector<float> * const vertexArrays[polygonModelCacheNumVertexArrays]={&mesh->x_, &mesh->y_, &mesh->z_, &mesh->normalX_, &mesh->normalY_, &mesh->normalZ_};
+    
+    PolygonModelCacheHeader header;
+    memset(&header, 0, sizeof(PolygonModelCacheHeader));
+    
+    memcpy(header.magic_, polygonModelCacheMagic, sizeof(polygonModelCacheMagic));
+    header.version_=POLYGONMODEL_CACHE_VERSION;
+    header.frozenNodeSize_=sizeof(FrozenTreeNode);
+    header.frozenWideNodeSize_=sizeof(FrozenWideNode);
+    header.frozenCompactNodeSize_=sizeof(FrozenCompactNode);
+    header.treeType_=ballTree_->getTreeType();
+    header.smoothSurface_=smoothSurface_ ? 1 : 0;
+    header.keySize_=key.size();
+    
+    header.numVertices_=mesh->getNumVertices();
+    header.numTriangles_=mesh->getNumTriangles();
+    header.numFrozenTriangles_=frozenTriangles.size();
+    header.numFrozenNodes_=ballTree_->getNumFrozenNodes();
+    header.numFrozenWideNodes_=ballTree_->getNumFrozenWideNodes();
+    header.numFrozenCompactNodes_=ballTree_->getNumFrozenCompactNodes();
+    
+    const PolygonModelCacheLayout layout(header, UINT64_MAX);
+    
+    //=== Write to a temporary file that replaces the cache once complete ===
+    const std::string tempFileName=fileName+".tmp";
+    
+    FILE *fp=fopen(tempFileName.c_str(), "wb");
+    if (fp==nullptr)
+    {
+        return false;
+    }
+    
+    bool ok=true;
+    uint64_t position=0;
+    
+    auto writeSection=[&fp, &ok, &position](const uint64_t offset, const void * const data, const uint64_t size)
+    {
+        const char padding[16]={0};
+        
+        if ((ok)&&(offset>position))
+        {
+            ok=(fwrite(padding, 1, offset-position, fp)==(offset-position));
+        }
+        
+        if ((ok)&&(size>0))
+        {
+            ok=(fwrite(data, 1, size, fp)==size);
+        }
+        
+        position=offset+size;
+    };
+    
+    writeSection(0, &header, sizeof(PolygonModelCacheHeader));
+    writeSection(layout.keyOffset_, key.data(), key.size());
+    
+    for (size_t arrayNum=0; arrayNum<polygonModelCacheNumVertexArrays; ++arrayNum)
+    {
+        writeSection(layout.vertexArrayOffsets_[arrayNum], vertexArrays[arrayNum]->data(), vertexArrays[arrayNum]->size()*sizeof(float));
+    }
+    
+    writeSection(layout.indicesOffset_, mesh->indices_.data(), mesh->indices_.size()*sizeof(uint32_t));
+    writeSection(layout.frozenTrianglesOffset_, frozenTriangles.data(), frozenTriangles.size()*sizeof(uint32_t));
+    writeSection(layout.frozenNodesOffset_, ballTree_->getFrozenNodes().data(), ballTree_->getNumFrozenNodes()*sizeof(FrozenTreeNode));
+    writeSection(layout.frozenWideNodesOffset_, ballTree_->getFrozenWideNodes().data(), ballTree_->getNumFrozenWideNodes()*sizeof(FrozenWideNode));
+    writeSection(layout.frozenCompactNodesOffset_, ballTree_->getFrozenCompactNodes().data(), ballTree_->getNumFrozenCompactNodes()*sizeof(FrozenCompactNode));
+    
+    ok=(fclose(fp)==0) && ok;
+    
+    if ((!ok)||(std::rename(tempFileName.c_str(), fileName.c_str())!=0))
+    {
+        std::remove(tempFileName.c_str());
+        return false;
+    }
+    //===
+    
+    return true;
+}
+
+//=======================================================================//
+bool stitch::PolygonModel::loadCache(const std::string &fileName, const std::string &key)
+{
+    const int fd=open(fileName.c_str(), O_RDONLY);
+    if (fd<0)
+    {
+        return false;
+    }
+    
+    struct stat fileStat;
+    if ((fstat(fd, &fileStat)!=0)||(fileStat.st_size<((off_t)sizeof(PolygonModelCacheHeader))))
+    {
+        close(fd);
+        return false;
+    }
+    
+    const size_t fileSize=fileStat.st_size;
+    void * const mapping=mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);//The mapping stays valid.
+    
+    if (mapping==MAP_FAILED)
+    {
+        return false;
+    }
+    
+    const char * const data=(const char *)mapping;
+    const PolygonModelCacheHeader &header=*((const PolygonModelCacheHeader *)data);
+    const PolygonModelCacheLayout layout(header, fileSize);
+    
+    //=== Check that the cache matches this build and the key ===
+    bool valid=(memcmp(header.magic_, polygonModelCacheMagic, sizeof(polygonModelCacheMagic))==0) &&
+    (header.version_==POLYGONMODEL_CACHE_VERSION) &&
+    (header.frozenNodeSize_==sizeof(FrozenTreeNode)) &&
+    (header.frozenWideNodeSize_==sizeof(FrozenWideNode)) &&
+    (header.frozenCompactNodeSize_==sizeof(FrozenCompactNode)) &&
+    (header.treeType_<=BallTree::SAH_SBVH_TREE) &&
+    (header.keySize_==key.size()) &&
+    (layout.valid_) &&
+    (layout.fileSize_==fileSize) &&
+    (memcmp(data+layout.keyOffset_, key.data(), key.size())==0) &&
+    (header.numVertices_<=UINT32_MAX) &&//The mesh uses 32-bit vertex indices.
+    (header.numTriangles_<=UINT32_MAX);//The frozen leaves use 32-bit triangle indices.
+    
+    const uint32_t * const indices=(const uint32_t *)(data+layout.indicesOffset_);
+    const uint32_t * const frozenTriangles=(const uint32_t *)(data+layout.frozenTrianglesOffset_);
+    const FrozenTreeNode * const frozenNodes=(const FrozenTreeNode *)(data+layout.frozenNodesOffset_);
+    const FrozenWideNode * const frozenWideNodes=(const FrozenWideNode *)(data+layout.frozenWideNodesOffset_);
+    const FrozenCompactNode * const frozenCompactNodes=(const FrozenCompactNode *)(data+layout.frozenCompactNodesOffset_);
+    
+    for (uint64_t indexNum=0; (valid)&&(indexNum<header.numTriangles_*3); ++indexNum)
+    {
+        valid=(indices[indexNum]<header.numVertices_);
+    }
+    
+    for (uint64_t frozenTriangleNum=0; (valid)&&(frozenTriangleNum<header.numFrozenTriangles_); ++frozenTriangleNum)
+    {
+        valid=(frozenTriangles[frozenTriangleNum]<header.numTriangles_);
+    }
+    
+    for (uint64_t nodeIndex=0; (valid)&&(nodeIndex<header.numFrozenNodes_); ++nodeIndex)
+    {
+        const FrozenTreeNode &node=frozenNodes[nodeIndex];
+        
+        valid=node.isLeaf() ? ((((uint64_t)node.offset_)+node.numItems_)<=header.numFrozenTriangles_) :
+        ((node.offset_>nodeIndex)&&(node.offset_<=header.numFrozenNodes_));
+    }
+    
+    for (uint64_t wideNodeIndex=0; (valid)&&(wideNodeIndex<header.numFrozenWideNodes_); ++wideNodeIndex)
+    {
+        const FrozenWideNode &wideNode=frozenWideNodes[wideNodeIndex];
+        
+        for (size_t slotNum=0; (valid)&&(slotNum<BALLTREE_WIDE_NODE_WIDTH); ++slotNum)
+        {
+            valid=(wideNode.numItems_[slotNum]!=0) ? ((((uint64_t)wideNode.offset_[slotNum])+wideNode.numItems_[slotNum])<=header.numFrozenTriangles_) :
+            ((wideNode.offset_[slotNum]==0)||((wideNode.offset_[slotNum]>wideNodeIndex)&&(wideNode.offset_[slotNum]<header.numFrozenWideNodes_)));
+        }
+    }
+    
+    for (uint64_t compactNodeIndex=0; (valid)&&(compactNodeIndex<header.numFrozenCompactNodes_); ++compactNodeIndex)
+    {
+        const FrozenCompactNode &compactNode=frozenCompactNodes[compactNodeIndex];
+        
+        for (size_t slotNum=0; (valid)&&(slotNum<BALLTREE_WIDE_NODE_WIDTH); ++slotNum)
+        {
+            valid=(compactNode.numItems_[slotNum]!=0) ? ((((uint64_t)compactNode.offset_[slotNum])+compactNode.numItems_[slotNum])<=header.numFrozenTriangles_) :
+            ((compactNode.offset_[slotNum]==0)||((compactNode.offset_[slotNum]>compactNodeIndex)&&(compactNode.offset_[slotNum]<header.numFrozenCompactNodes_)));
+        }
+    }
+    //===
+    
+    if (valid)
+    {
+        //=== Copy the mesh and set the tree up frozen over it ===
+        const std::shared_ptr<TriangleMesh> mesh=std::make_shared<TriangleMesh>(header.numVertices_, header.numTriangles_);
+        std::vector<float> * const vertexArrays[polygonModelCacheNumVertexArrays]={&mesh->x_, &mesh->y_, &mesh->z_, &mesh->normalX_, &mesh->normalY_, &mesh->normalZ_};
+        
+        for (size_t arrayNum=0; arrayNum<polygonModelCacheNumVertexArrays; ++arrayNum)
+        {
+            const float * const vertexArray=(const float *)(data+layout.vertexArrayOffsets_[arrayNum]);
+            std::copy(vertexArray, vertexArray+header.numVertices_, vertexArrays[arrayNum]->begin());
+        }
+        
+        std::copy(indices, indices+header.numTriangles_*3, mesh->indices_.begin());
+        
+        BallTree *tree=BallTree::create((BallTree::TreeType)header.treeType_);
+        tree->setFrozen(mesh.get(), std::vector<uint32_t>(frozenTriangles, frozenTriangles+header.numFrozenTriangles_),
+                        frozenNodes, header.numFrozenNodes_, frozenWideNodes, header.numFrozenWideNodes_,
+                        frozenCompactNodes, header.numFrozenCompactNodes_);
+        
+        releaseMeshTriangles();
+        delete ballTree_;
+        ballTree_=tree;
+        mesh_=mesh;
+        //===
+        
+        std::vector<Vec3>().swap(vertCoords_);
+        std::vector<Vec3>().swap(vertNormals_);
+        std::vector<size_t>().swap(indices_);
+        smoothSurface_=(header.smoothSurface_!=0);
+        
+        updateBoundingVolume();
+    }
+    
+    munmap(mapping, fileSize);
+    
+    return valid;
+}
+
+//=======================================================================//
 void stitch::PolygonModel::updateBoundingVolume()
 {
-    //=== Update bounding volume ===
-    if (vertCoords_.size()!=0)
+    //=== Update bounding volume from the loaded vertices or, once they were moved into it, from the mesh ===
+    const bool loaded=!vertCoords_.empty();
+    const size_t numVertices=loaded ? vertCoords_.size() : (mesh_ ? mesh_->getNumVertices() : 0);
+    
+    if (numVertices!=0)
     {
         centre_=Vec3(0.0f, 0.0f, 0.0f);
         radiusBV_=0.0f;
-        std::vector<Vec3>::const_iterator vertexIter=vertCoords_.begin();
-        for (; vertexIter!=vertCoords_.end(); ++vertexIter)
+        for (size_t vertexNum=0; vertexNum<numVertices; ++vertexNum)
         {
-            centre_+=*vertexIter;
+            centre_+=loaded ? vertCoords_[vertexNum] : mesh_->getVertex(vertexNum);
         }
-        centre_*=1.0f/vertCoords_.size();
+        centre_*=1.0f/numVertices;
         
         float maxRadiusSq=0.0f;
-        for (vertexIter=vertCoords_.begin(); vertexIter!=vertCoords_.end(); ++vertexIter)
+        for (size_t vertexNum=0; vertexNum<numVertices; ++vertexNum)
         {
-            float radiusSq=Vec3::calcDistToPointSq((*vertexIter), centre_);
+            float radiusSq=Vec3::calcDistToPointSq(loaded ? vertCoords_[vertexNum] : mesh_->getVertex(vertexNum), centre_);
             
             if (radiusSq > maxRadiusSq)
             {
@@ -730,9 +892,33 @@ void stitch::PolygonModel::updateBoundingVolume()
     //==============================
 }
 
+stitch::AABB stitch::PolygonModel::getAABB() const
+{
+    AABB box;
+    
+    if (!vertCoords_.empty())
+    {
+        for (const auto &vertex : vertCoords_)
+        {
+            box.expand(vertex);
+        }
+    } else
+        if (mesh_)
+        {//The vertices were moved into the mesh.
+            const size_t numVertices=mesh_->getNumVertices();
+            
+            for (size_t vertexNum=0; vertexNum<numVertices; ++vertexNum)
+            {
+                box.expand(mesh_->getVertex(vertexNum));
+            }
+        }
+    
+    return box;
+}
+
 void stitch::PolygonModel::calcIntersection(const stitch::Ray &ray, Intersection &intersect) const
 {
-    uint32_t incomingObectID=intersect.itemID_; //Store the incoming ObjectID to ...
+    const float incomingDistance=intersect.distance_;//Store the incoming distance to detect a hit on the model.
     
     if (ballTree_!=nullptr)
     {
@@ -741,14 +927,14 @@ void stitch::PolygonModel::calcIntersection(const stitch::Ray &ray, Intersection
     {
         //if (BVIntersected(orig, normDir)) This is currently executed by the calling code!
         {
-            std::vector<size_t>::const_iterator faceIndexIter=indices_.begin();
-            const std::vector<size_t>::const_iterator faceIndexIterEnd=indices_.end();
+            const size_t numTriangles=mesh_ ? mesh_->getNumTriangles() : 0;
             
-            for (; faceIndexIter!=faceIndexIterEnd; faceIndexIter+=3)
+            for (size_t triangleIndex=0; triangleIndex<numTriangles; ++triangleIndex)
             {
-                const Vec3 &v0=vertCoords_[*(faceIndexIter+0)];
-                const Vec3 &v1=vertCoords_[*(faceIndexIter+1)];
-                const Vec3 &v2=vertCoords_[*(faceIndexIter+2)];
+                const uint32_t * const triangle=&mesh_->indices_[triangleIndex*3];
+                
+                Vec3 v0, v1, v2;
+                mesh_->getTriangle(triangleIndex, v0, v1, v2);
                 
                 const Vec3 planeNormal_unnormalised=stitch::Vec3::cross(v2, v1, v0);
                 const float d=v0 * planeNormal_unnormalised;
@@ -759,7 +945,7 @@ void stitch::PolygonModel::calcIntersection(const stitch::Ray &ray, Intersection
                 {
                     const float intersectDist=(d-planeNormal_unnormalised*ray.origin_)/dotp;
                     
-                    if ((intersectDist>0.0f)&&(intersectDist<intersect.distance_))
+                    if ((intersectDist>ray.tMin_)&&(intersectDist<intersect.distance_)&&(intersectDist<ray.tMax_))
                     {
                         const Vec3 p=ray.origin_ + ray.direction_*intersectDist;
                         
@@ -785,7 +971,7 @@ void stitch::PolygonModel::calcIntersection(const stitch::Ray &ray, Intersection
                         {
                             intersect.distance_=intersectDist;
                             
-                            intersect.normal_.setToSumScaleAndNormalise(vertNormals_[*(faceIndexIter+0)], Aa, vertNormals_[*(faceIndexIter+1)], Ab, vertNormals_[*(faceIndexIter+2)], Ac);
+                            intersect.normal_.setToSumScaleAndNormalise(mesh_->getNormal(triangle[0]), Aa, mesh_->getNormal(triangle[1]), Ab, mesh_->getNormal(triangle[2]), Ac);
                             
                             intersect.itemID_=this->itemID_ | ((intersect.normal_*ray.direction_>0.0f)?0:1);//back surface gets even ID, front surface gets odd ID.
                             intersect.itemPtr_=this;
@@ -797,10 +983,71 @@ void stitch::PolygonModel::calcIntersection(const stitch::Ray &ray, Intersection
         
     }
     
-    if ((smoothSurface_)&&(intersect.itemID_!=incomingObectID))
-    {//Override the polygon's object id to that of the polygonModel if it is a smoothed surface and therefore one primitive!!!
-        intersect.itemID_=this->itemID_|(intersect.itemID_&1);
+    if (intersect.distance_<incomingDistance)
+    {//The triangles are not objects, so report the model as the item hit.
+        if (smoothSurface_)
+        {//Override the polygon's object id to that of the polygonModel if it is a smoothed surface and therefore one primitive!!!
+            intersect.itemID_=this->itemID_|(intersect.itemID_&1);
+        }
+        
         intersect.itemPtr_=this;
     }
 }
 
+//=======================================================================//
+void stitch::PolygonModel::calcPacketIntersection(const RayPacket &packet, Intersection * const intersects, const uint32_t mask) const
+{
+    if (ballTree_==nullptr)
+    {
+        Object::calcPacketIntersection(packet, intersects, mask);
+        return;
+    }
+    
+    float incomingDistances[RAYPACKET_MAX_SIZE];
+    
+    for (uint32_t laneMask=mask; laneMask; laneMask&=laneMask-1)
+    {
+        const size_t laneNum=RayPacket::lowestLane(laneMask);
+        incomingDistances[laneNum]=intersects[laneNum].distance_;
+    }
+    
+    ballTree_->calcPacketIntersection(packet, intersects, mask);
+    
+    for (uint32_t laneMask=mask; laneMask; laneMask&=laneMask-1)
+    {//The triangles are not objects, so report the model as the item hit.
+        const size_t laneNum=RayPacket::lowestLane(laneMask);
+        Intersection &intersect=intersects[laneNum];
+        
+        if (intersect.distance_<incomingDistances[laneNum])
+        {
+            if (smoothSurface_)
+            {//Override the polygon's object id to that of the polygonModel if it is a smoothed surface and therefore one primitive!!!
+                intersect.itemID_=this->itemID_|(intersect.itemID_&1);
+            }
+            
+            intersect.itemPtr_=this;
+        }
+    }
+}
+
+//=======================================================================//
+bool stitch::PolygonModel::occluded(const Ray &ray, const float tMax) const
+{
+    if (ballTree_!=nullptr)
+    {
+        return ballTree_->occluded(ray, tMax);
+    }
+    
+    return Object::occluded(ray, tMax);
+}
+
+//=======================================================================//
+void stitch::PolygonModel::calcShadingNormal(const Ray &ray, Intersection &intersect) const
+{
+    if (ballTree_!=nullptr)
+    {//Without the tree calcIntersection tests the polygons itself and sets the normal straight away.
+        mesh_->interpolateNormal(intersect.primitiveID_, intersect.b1_, intersect.b2_, intersect.normal_);
+        intersect.itemID_|=(intersect.normal_*ray.direction_>0.0f)?0:1;//back surface gets even ID, front surface gets odd ID.
+    }
+}
+
@@ -29,150 +29,29 @@
 #ifndef STITCH_POLYGON_MODEL_H
 #define STITCH_POLYGON_MODEL_H
 
+#define POLYGONMODEL_CACHE_VERSION 5 //Increment when the layout of the cache file or the output of a model loader changes.
+#define POLYGONMODEL_PARALLEL_MIN_TRIANGLES 16384 //Smaller meshes are preprocessed by the calling thread only.
+
 namespace stitch {
 	class PolygonModel;
 }
 
 #include "BallTree.h"
+#include "TriangleMesh.h"
 #include "Math/Line.h"
 #include "Math/Plane.h"
 #include "Math/VecN.h"
 #include "Math/Colour.h"
 #include "Materials/DiffuseMaterial.h"
+#include "Arena.h"
 
 #include <iostream>
 #include <cstdio>
+#include <memory>
 
 
 namespace stitch {
     
-    //! One polygon with own vertices, vertex normals and plane.
-    class Polygon : public Object
-    {
-    public:
-        
-		Polygon(Material * const pMaterial/*, NormalDescriptor * const pNormalDescriptor*/,
-                size_t index0,
-                std::vector<Vec3> *vertCoords,
-                std::vector<Vec3> *vertNormals,
-                std::vector<size_t> *indices) :
-        Object(pMaterial/*, pNormalDescriptor*/),
-        v0_((*vertCoords)[(*indices)[index0+0]]),
-        v1_((*vertCoords)[(*indices)[index0+1]]),
-        v2_((*vertCoords)[(*indices)[index0+2]]),
-        n0_((*vertNormals)[(*indices)[index0+0]]),
-        n1_((*vertNormals)[(*indices)[index0+1]]),
-        n2_((*vertNormals)[(*indices)[index0+2]]),
-        plane_(v0_,v1_,v2_),
-        area_(stitch::Vec3::crossLength(v2_, v1_, v0_)*0.5f)
-		{
-            updateBoundingVolume();
-        }
-		
-		Polygon(const Polygon &lValue) :
-        Object(lValue),
-        v0_(lValue.v0_),
-        v1_(lValue.v1_),
-        v2_(lValue.v2_),
-        n0_(lValue.n0_),
-        n1_(lValue.n1_),
-        n2_(lValue.n2_),
-        plane_(lValue.plane_),
-        area_(lValue.area_)
-		{}
-        
-#ifdef USE_CXX11
-		Polygon(Polygon &&rValue) noexcept:
-        Object(rValue),
-        v0_(std::move(rValue.v0_)),
-        v1_(std::move(rValue.v1_)),
-        v2_(std::move(rValue.v2_)),
-        n0_(std::move(rValue.n0_)),
-        n1_(std::move(rValue.n1_)),
-        n2_(std::move(rValue.n2_)),
-        plane_(std::move(rValue.plane_)),
-        area_(rValue.area_)
-		{}
-#endif// USE_CXX11
-        
-        virtual Polygon * clone() const
-        {
-            return new Polygon(*this);
-        }
-        
-		virtual Polygon & operator = (const Polygon &lValue)
-		{
-            Object::operator=(lValue);
-            
-            v0_=lValue.v0_;
-            v1_=lValue.v1_;
-            v2_=lValue.v2_;
-            
-            n0_=lValue.n0_;
-            n1_=lValue.n1_;
-            n2_=lValue.n2_;
-            
-            plane_=lValue.plane_;
-            area_=lValue.area_;
-            
-			return *this;
-		}
-        
-#ifdef USE_CXX11
-		virtual Polygon & operator = (Polygon &&rValue) noexcept
-		{
-            Object::operator=(rValue);
-            
-            v0_=std::move(rValue.v0_);
-            v1_=std::move(rValue.v1_);
-            v2_=std::move(rValue.v2_);
-            
-            n0_=std::move(rValue.n0_);
-            n1_=std::move(rValue.n1_);
-            n2_=std::move(rValue.n2_);
-            
-            plane_=std::move(rValue.plane_);
-            area_=rValue.area_;
-            
-			return *this;
-		}
-#endif// USE_CXX11
-        
-        virtual ~Polygon()
-		{
-        }
-		
-#ifdef USE_OSG
-		virtual osg::ref_ptr<osg::Node> constructOSGNode(const bool createOSGLineGeometry, const bool createOSGNormalGeometry, const bool wireframe, const uintptr_t key=0) const;
-#endif// USE_OSG
-        
-		virtual void calcIntersection(const Ray &ray, Intersection &intersect) const;
-        
-        void updateBoundingVolume()
-        {
-            centre_=(v0_+v1_+v2_)/3.0f;
-            
-            radiusBV_=Vec3::calcDistToPointSq(v0_, centre_);
-            radiusBV_=MathUtil::max(radiusBV_, Vec3::calcDistToPointSq(v1_, centre_));
-            radiusBV_=MathUtil::max(radiusBV_, Vec3::calcDistToPointSq(v2_, centre_));
-            radiusBV_=sqrtf(radiusBV_)*1.001f;//1% bigger to ensure rendering of full poly.
-        }
-        
-        
-    public:
-        Vec3 v0_;
-        Vec3 v1_;
-        Vec3 v2_;
-        
-        Vec3 n0_;
-        Vec3 n1_;
-        Vec3 n2_;
-        
-        Plane plane_;
-        float area_;
-    };
-    
-    
     //! A ball tree of polygons PLUS fused list of vertices and indices.
 	class PolygonModel : public Object
 	{
@@ -197,9 +76,12 @@ namespace stitch {
         vertCoords_(lValue.vertCoords_),
         vertNormals_(lValue.vertNormals_),
         indices_(lValue.indices_),
-        ballTree_(new BallTree(*lValue.ballTree_)),
+        mesh_(lValue.mesh_),
+        ballTree_(nullptr),
         smoothSurface_(lValue.smoothSurface_)
-        {}
+        {
+            copyBallTree(lValue);
+        }
         
 #ifdef USE_CXX11
         PolygonModel(PolygonModel &&rValue) noexcept:
@@ -207,6 +89,8 @@ namespace stitch {
         vertCoords_(std::move(rValue.vertCoords_)),
         vertNormals_(std::move(rValue.vertNormals_)),
         indices_(std::move(rValue.indices_)),
+        mesh_(std::move(rValue.mesh_)),
+        triangleArena_(std::move(rValue.triangleArena_)),
         ballTree_(rValue.ballTree_),
         smoothSurface_(rValue.smoothSurface_)
         {
@@ -228,8 +112,11 @@ namespace stitch {
                 vertNormals_=lValue.vertNormals_;
                 indices_=lValue.indices_;
                 
+                releaseMeshTriangles();
                 delete ballTree_;
-                ballTree_=new BallTree(*lValue.ballTree_);
+                
+                mesh_=lValue.mesh_;
+                copyBallTree(lValue);
                 
                 smoothSurface_=lValue.smoothSurface_;
             }
@@ -245,10 +132,14 @@ namespace stitch {
             vertNormals_=std::move(rValue.vertNormals_);
             indices_=std::move(rValue.indices_);
             
+            releaseMeshTriangles();
             delete ballTree_;
             ballTree_=rValue.ballTree_;
             rValue.ballTree_=nullptr;
             
+            triangleArena_=std::move(rValue.triangleArena_);
+            mesh_=std::move(rValue.mesh_);
+            
             smoothSurface_=rValue.smoothSurface_;
             
             return *this;
@@ -279,8 +170,18 @@ namespace stitch {
         
         bool loadIcosahedronBasedSphere(const size_t minimumNumVertices, const stitch::Vec3 &centre, const float scale, bool smoothNormals);
         
+        /*! Set each vertex normal to the normalised sum of the normals of the triangles around it. Large meshes are split
+         over threads that each sum the normals of their triangles into their own partial vertex normals. The partials
+         are then added up per vertex in parallel. */
         void calculateVertexNormals();
         
+        /*! Whether the vertex normals are smooth normals, e.g. calculated by calculateVertexNormals or read from the normals
+         of an OBJ file. calculateVertexNormals may then be skipped. */
+        bool hasSmoothNormals() const
+        {
+            return smoothSurface_;
+        }
+        
 #ifdef USE_OSG
         virtual osg::ref_ptr<osg::Node> constructOSGNode(const bool createOSGLineGeometry, const bool createOSGNormalGeometry, const bool wireframe, const uintptr_t key=0) const;
 #endif// USE_OSG
@@ -289,60 +190,138 @@ namespace stitch {
         
         
         //=== PolygonObject representation stuff ===//
-        void generatePolygonObjectsFromVertices()
+        /*! Move the loaded vertices, normals and indices into the model's triangle mesh, which is then their only copy, and
+         fill the model's tree with one MeshTriangle per triangle for buildBallTree. Without newly loaded vertices the
+         triangles of the current mesh are generated again. */
+        void generatePolygonObjectsFromVertices();
+        
+        
+        
+        /*! Build the internal tree of polygons. The chunkSize is only used by the BallTree; the SAH BVH picks its own leaf sizes. The tree is frozen with wide nodes if wideNodes is set
+         and with quantised wide nodes if compactNodes is set (see BallTree::freezeCompact). The frozen leaves then reference the triangles of the
+         mesh by index (see BallTree::freezeMesh) and the MeshTriangles are released. */
+        void buildBallTree(size_t chunkSize, const BallTree::TreeType treeType=BallTree::BALL_TREE, const bool wideNodes=false, const bool compactNodes=false)
         {
-            for (size_t index0=0; index0<indices_.size(); index0+=3)
-            {
-                Polygon *polygon=new Polygon(pMaterial_->clone()/*, pNormalDescriptor_->clone()*/, index0, &vertCoords_, &vertNormals_, &indices_);
+            if (ballTree_->empty())
+            {//A tree that was frozen over the mesh keeps no triangles to build with.
+                addMeshTriangles();
+            }
+            
+            if (ballTree_->getTreeType()!=treeType)
+            {//Move the polygons over to a tree of the requested type.
+                BallTree *tree=BallTree::create(treeType);
+                
+                ballTree_->linearise();
+                tree->itemVector_.swap(ballTree_->itemVector_);
                 
-                if (polygon->area_!=0.0f)
-                {//Protect against needle and point polygons.
-                    ballTree_->addItem(polygon);
+                delete ballTree_;
+                ballTree_=tree;
+            }
+            
+            //std::cout << "Building ball tree...";
+            //std::cout.flush();
+            ballTree_->build(chunkSize, 0);//Also calculates the tree's bounding volume.
+            //std::cout << "done.\n";
+            //std::cout.flush();
+            
+            if (compactNodes)
+            {
+                ballTree_->freezeCompact();
+            } else
+                if (wideNodes)
+                {
+                    ballTree_->freezeWide();
                 } else
                 {
-                    delete polygon;
+                    ballTree_->freeze();
                 }
-            }
             
-            ballTree_->updateBV();
-            updateBoundingVolume();
-        }
-        
-        
-        
-        void buildBallTree(size_t chunkSize)
-        {
-            if (ballTree_->itemVector_.size()>chunkSize)
+            if (mesh_)
             {
-                //std::cout << "Building ball tree...";
-                //std::cout.flush();
-                ballTree_->build(chunkSize, 0);
-                //std::cout << "done.\n";
-                //std::cout.flush();
+                ballTree_->freezeMesh(mesh_.get());
             }
             
-            ballTree_->updateBV();
+            releaseMeshTriangles();
+            
             updateBoundingVolume();
         }
         
+        /*! Write the triangle mesh and the frozen tree of the built model to a binary cache file.
+         @param key Describes what the model was prepared from (e.g. the source file's size and time and the load and build
+         parameters). A cache is only loaded with the same key.
+         @return False if the tree is not frozen or the file could not be written. */
+        bool saveCache(const std::string &fileName, const std::string &key) const;
+        
+        /*! Memory map a cache written by saveCache and set the model up from it instead of loading, calculating the vertex
+         normals, generating the polygons and building the tree. The mesh arrays and nodes are copied straight out of the mapping.
+         @return False, with the model unchanged, if the file is missing, invalid, of another version or layout, or has another key. */
+        bool loadCache(const std::string &fileName, const std::string &key);
+        
         virtual ~PolygonModel()
         {
+            releaseMeshTriangles();
             delete ballTree_;
         }
         
         virtual void calcIntersection(const Ray &ray, Intersection &intersect) const;
         
+        /*! Trace the packet through the model's tree. */
+        virtual void calcPacketIntersection(const RayPacket &packet, Intersection * const intersects, const uint32_t mask) const;
+        
+        /*! Any-hit query through the model's tree. */
+        virtual bool occluded(const Ray &ray, const float tMax) const;
+        
+        /*! Interpolate the vertex normals of the triangle hit, which the model's tree only recorded (see BallTree::freezeMesh). */
+        virtual void calcShadingNormal(const Ray &ray, Intersection &intersect) const;
+        
+        virtual AABB getAABB() const;
+        
+        virtual size_t getTreeMemorySize() const
+        {
+            return ballTree_->getTreeMemorySize();
+        }
+        
+        virtual size_t getNumPrimitives() const
+        {
+            return ballTree_->getNumPrimitives();
+        }
+        
+        /*! The number of bytes used by the triangle mesh's shared vertex and index arrays, plus the model's MeshTriangles until its tree is built. */
+        size_t getMeshMemorySize() const
+        {
+            return (mesh_ ? mesh_->getMemorySize() : 0) + (triangleArena_ ? triangleArena_->getMemorySize() : 0);
+        }
+        
         
     public:
+        //! The vertices, normals and indices as loaded. Released once generatePolygonObjectsFromVertices moved them into the mesh.
         std::vector<Vec3> vertCoords_;
         std::vector<Vec3> vertNormals_;
         std::vector<size_t> indices_;
         
     private:
+        //! The triangles of the model. Shared by copies of the model whose cloned trees refer to it too.
+        std::shared_ptr<const TriangleMesh> mesh_;
+        
+        //! The MeshTriangles that the tree is built over. Released once the tree references the triangles of the mesh by index.
+        //! The tree never deletes them, see releaseMeshTriangles.
+        std::unique_ptr<Arena> triangleArena_;
+        
         BallTree *ballTree_;//Internal ball tree for polygons.
         bool smoothSurface_;
         
         void updateBoundingVolume();
+        
+        /*! Add one MeshTriangle per triangle of the mesh to the tree, allocated from a new arena. The triangles are checked
+         and bounded in parallel for large meshes and then created in triangle order. */
+        void addMeshTriangles();
+        
+        /*! Take any MeshTriangles out of the tree without deleting them and free them all with their arena. */
+        void releaseMeshTriangles();
+        
+        /*! Set the tree up as a copy of lValue's, after the mesh was copied. MeshTriangles are generated again in an arena of
+         this model's own instead of being cloned onto the heap. */
+        void copyBallTree(const PolygonModel &lValue);
     };
     
 }
@@ -38,6 +38,7 @@ namespace stitch {
 #include "Math/Colour.h"
 #include "BoundingVolume.h"
 #include "Object.h"
+#include "Arena.h"
 
 namespace stitch
 {
@@ -95,9 +96,32 @@ namespace stitch
     
     
     //! Models a single photon.
+    //! The photons stored in a photon map may be allocated from the map's arena, e.g. new (photonMap->getItemArena()) Photon(...).
+    //! Those are freed with the arena without running their destructors, so they must not have a payload.
 	class Photon : public BoundingVolume
 	{
 	public:
+        static void *operator new(size_t size)
+        {
+            return ::operator new(size);
+        }
+        
+        static void *operator new(size_t size, Arena &arena)
+        {
+            return arena.allocate(size, alignof(Photon));
+        }
+        
+        /*! Only for photons on the heap. */
+        static void operator delete(void *memory)
+        {
+            ::operator delete(memory);
+        }
+        
+        /*! Only called if a constructor throws. The memory stays in the arena. */
+        static void operator delete(void *memory, Arena &arena)
+        {
+        }
+        
 		Photon(const Vec3 &orig, const Vec3 &normDir, const Colour_t &energy, uint8_t scatterCount) :
 		BoundingVolume(orig, 0.0f),
 		normDir_(normDir),
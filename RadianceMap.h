@@ -360,6 +360,7 @@ namespace stitch {
             splitAxisVec.push_back(Vec3(0.0f, 1.0f, 0.0f));
             
             mapFrontKDTree_.build(8, 0, 1000, splitAxisVec);//Ensure kdTree is optimised for search.
+            mapFrontKDTree_.relayout();
             
             //endTick=timer.tick();
             //std::cout << " RadianceMap::updateVoronoiDisplayBuffer::build_mapFrontKDTree_ " << timer.delta_m(startTick, endTick) << " ms.\n";
@@ -400,6 +401,22 @@ namespace stitch {
             oX=oOffset-oY*width_;
         }
         
+        /*! Get a random order in which to render numItems items, e.g. pixel tiles, from the same shuffle as getShuffledXY.
+         The shuffled pixel offsets below numItems are kept in their shuffled order. numItems may not exceed the number of pixels. */
+        void getShuffledOrder(const size_t numItems, std::vector<size_t> &order) const
+        {
+            order.clear();
+            order.reserve(numItems);
+            
+            for (size_t i=0; (i<(width_*height_))&&(order.size()<numItems); ++i)
+            {
+                if (randomOffsetVect_[i]<numItems)
+                {
+                    order.push_back(randomOffsetVect_[i]);
+                }
+            }
+        }
+        
         Colour_t const & getMapValue(const size_t x, const size_t y) const
         {
             return map_[x+y*width_];
@@ -30,6 +30,7 @@
 #include "Timer.h"
 
 #include <vector>
+#include <algorithm>
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -60,17 +61,36 @@ stitch::ForwardRenderer::ForwardRenderer(Scene * const scene, uint8_t gatherDept
 Renderer(scene),
 gatherDepth_(gatherDepth),
 samplesPerPixel_(samplesPerPixel),
-printStats_(printStats)
+printStats_(printStats),
+primaryRayPacketSize_(1)
 {
 }
 
 
+//=======================================================================//
+void stitch::ForwardRenderer::setPrimaryRayPacketSize(const size_t packetSize)
+{
+    primaryRayPacketSize_=1;
+    
+    while (((primaryRayPacketSize_*2)<=packetSize)&&((primaryRayPacketSize_*2)<=RAYPACKET_MAX_SIZE))
+    {
+        primaryRayPacketSize_*=2;
+    }
+}
+
+
 //=======================================================================//
 void stitch::ForwardRenderer::renderTask(RadianceMap * const radianceMap,
                                          const stitch::Camera * const camera,
                                          const size_t taskID,
                                          const size_t iyStart, const size_t iyStride)
 {
+    if (primaryRayPacketSize_>1)
+    {
+        renderPacketTask(radianceMap, camera, taskID, iyStart, iyStride);
+        return;
+    }
+    
     const size_t imgWidth=radianceMap->getWidth();
     const size_t imgHeight=radianceMap->getHeight();
     
@@ -106,6 +126,7 @@ void stitch::ForwardRenderer::renderTask(RadianceMap * const radianceMap,
                                                   (y+0.5f-halfWindowHeight)*recipWindowWidth);
                     
                     ray.gatherDepth_=gatherDepth_;
+                    ray.visibilityMask_=RAY_VISIBILITY_CAMERA;
                     
                     this->gather(ray);
                     
@@ -140,6 +161,123 @@ void stitch::ForwardRenderer::renderTask(RadianceMap * const radianceMap,
 }
 
 
+//=======================================================================//
+void stitch::ForwardRenderer::renderPacketTask(RadianceMap * const radianceMap,
+                                               const stitch::Camera * const camera,
+                                               const size_t taskID,
+                                               const size_t tileStart, const size_t tileStride)
+{
+    const size_t imgWidth=radianceMap->getWidth();
+    const size_t imgHeight=radianceMap->getHeight();
+    
+    const float halfWindowHeight = radianceMap->getHeight() * 0.5f;
+    const float halfWindowWidth = radianceMap->getWidth() * 0.5f;
+    const float recipWindowWidth = 1.0f / radianceMap->getWidth();
+    
+    //=== Square tiles, or twice as wide as high, e.g. 2x2, 4x2 and 4x4 ===
+    size_t tileWidth=1;
+    while ((tileWidth*tileWidth)<primaryRayPacketSize_)
+    {
+        tileWidth*=2;
+    }
+    const size_t tileHeight=primaryRayPacketSize_/tileWidth;
+    //===
+    
+    const size_t numTileColumns=(imgWidth+tileWidth-1)/tileWidth;
+    const size_t numTileRows=(imgHeight+tileHeight-1)/tileHeight;
+    const size_t numTiles=numTileColumns*numTileRows;
+    const size_t progressTiles=std::max<size_t>(numTiles/100, 1);
+    
+    //Note: The tiles are remapped/shuffled like the pixels of renderTask, but the pixels within a tile are not so that the rays of a tile are coherent.
+    std::vector<size_t> tileOrder;
+    radianceMap->getShuffledOrder(numTiles, tileOrder);
+    
+    std::vector<Ray> rays;
+    rays.reserve(RAYPACKET_MAX_SIZE);
+    
+    std::vector<Intersection> intersects;
+    intersects.reserve(RAYPACKET_MAX_SIZE);
+    
+    for (size_t tileNum=tileStart; tileNum<numTiles; tileNum+=tileStride)
+    {
+        if (!stopRender_)
+        {
+            const size_t tileRow=tileOrder[tileNum]/numTileColumns;
+            const size_t tileColumn=tileOrder[tileNum]-tileRow*numTileColumns;
+            
+            const size_t tileY=tileRow*tileHeight;
+            const size_t tileEndY=std::min(tileY+tileHeight, imgHeight);
+            
+            const size_t tileX=tileColumn*tileWidth;
+            const size_t tileEndX=std::min(tileX+tileWidth, imgWidth);
+            
+            Colour_t mapRadiance[RAYPACKET_MAX_SIZE];
+            
+            for (size_t s=0; s<samplesPerPixel_; ++s)
+            {
+                //=== Generate the tile's primary rays ===
+                rays.clear();
+                intersects.clear();
+                
+                for (size_t y=tileY; y<tileEndY; ++y)
+                {
+                    for (size_t x=tileX; x<tileEndX; ++x)
+                    {
+                        rays.push_back(camera->getPrimaryRay(x, y,//RAY IDs
+                                                             (x+0.5f-halfWindowWidth)*recipWindowWidth,
+                                                             (y+0.5f-halfWindowHeight)*recipWindowWidth));
+                        rays.back().gatherDepth_=gatherDepth_;
+                        rays.back().visibilityMask_=RAY_VISIBILITY_CAMERA;
+                        
+                        intersects.push_back(Intersection(x, y, ((float)FLT_MAX)));
+                    }
+                }
+                //===
+                
+                if (gatherDepth_>0)
+                {
+                    scene_->calcPacketIntersection(RayPacket(rays.data(), rays.size()), intersects.data());
+                    
+                    for (size_t rayNum=0; rayNum<rays.size(); ++rayNum)
+                    {
+                        this->gatherAtIntersection(rays[rayNum], intersects[rayNum]);
+                        
+                        mapRadiance[rayNum]+=rays[rayNum].returnRadiance_;
+                    }
+                }
+            }
+            
+            //=== Store the tile's radiance ===
+            size_t rayNum=0;
+            
+            for (size_t y=tileY; y<tileEndY; ++y)
+            {
+                for (size_t x=tileX; x<tileEndX; ++x)
+                {
+                    mapRadiance[rayNum]*=1.0f/samplesPerPixel_;
+                    
+                    //Note: currently the angle between the radiancemap pixel normal and the incoming radiance direction is ignored!
+                    radianceMap->setMapValue(x, y, mapRadiance[rayNum], tileStart);
+                    ++rayNum;
+                }
+            }
+            //===
+            
+            if ((tileNum%progressTiles)==0)
+            {
+                std::cout << ".";
+                std::cout.flush();
+                
+                if ((taskID==0)&&(printStats_))
+                {
+                    std::cout << (tileNum * 100 / numTiles) << "%..";
+                }
+            }
+        }
+    }
+}
+
+
 //=======================================================================//
 void stitch::ForwardRenderer::render(RadianceMap &radianceMap,
                                      const stitch::Camera * const camera,
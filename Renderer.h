@@ -115,6 +115,15 @@ namespace stitch {
                             const stitch::Camera * const camera,
                             const float frameDeltaTime);
         
+        /*! Set the number of primary rays traced together as a packet. 4, 8 and 16 rays are traced as 2x2, 4x2 and 4x4 pixel
+         tiles respectively. The size is rounded down to a power of two and 1 disables the packets. Packets only pay off for
+         renderers that implement gatherAtIntersection. */
+        void setPrimaryRayPacketSize(const size_t packetSize);
+        
+        size_t getPrimaryRayPacketSize() const
+        {
+            return primaryRayPacketSize_;
+        }
         
     protected:
         virtual void preForwardRender(RadianceMap &radianceMap,
@@ -127,6 +136,16 @@ namespace stitch {
          */
         virtual void gather(Ray &ray) const = 0;
         
+        /*! \brief Gather radiance from the direction of the ray given its already calculated closest intersection.
+         
+         Used for the primary rays which are intersected with the scene as packets. Secondary rays are still gathered one
+         at a time. The default ignores the intersection and calls gather. Must be thread safe!!!
+         */
+        virtual void gatherAtIntersection(Ray &ray, const Intersection &intersect) const
+        {
+            gather(ray);
+        }
+        
         const uint8_t gatherDepth_;
         
         //! Samples per pixel.
@@ -134,6 +153,9 @@ namespace stitch {
         
         const bool printStats_;
         
+        //! The number of primary rays per packet. 1 if primary rays are traced one at a time. Sub-classes that implement gatherAtIntersection opt in from their constructors.
+        size_t primaryRayPacketSize_;
+        
     private:
         
         //!Worker method that renders a partial frame.
@@ -142,6 +164,12 @@ namespace stitch {
                                 const size_t taskID,
                                 const size_t iyStart, const size_t iyStride);
         
+        //!Worker method that renders a partial frame with the primary rays of each pixel tile traced as a packet. The tiles are rendered in the shuffled order of RadianceMap::getShuffledOrder and interleaved between the tasks.
+        void renderPacketTask(RadianceMap * const radianceMap,
+                              const stitch::Camera * const camera,
+                              const size_t taskID,
+                              const size_t tileStart, const size_t tileStride);
+        
         
     };
     
@@ -52,6 +52,7 @@ ForwardRenderer(scene, 3, 1, true),
 NumRayIntersectionsToSkip_(1),
 MaxLightPathLength_(3)
 {
+    setPrimaryRayPacketSize(RAYPACKET_MAX_SIZE);
     beamTree_=new stitch::BeamTree;
 }
 
@@ -61,6 +62,7 @@ void stitch::LightBeamRenderer::createBRDFPeakLightPath(stitch::Ray const & init
     //=== Add first path segment; may or may not end in an intersection ===///
     float convolvedGeneratorSD=0.0f;
     stitch::Ray ray=initialRay;
+    ray.visibilityMask_=RAY_VISIBILITY_PHOTON;
     stitch::Object const * generator=initialGenerator;
     uint32_t pathSegmentGroupID=(generator->itemID_) << 16; //! @todo The pathSegmentGroupID could be propagated from the mesh division operation and should really include spatial as well as object ID info!
     
@@ -120,6 +122,7 @@ void stitch::LightBeamRenderer::createBRDFPeakLightPath(stitch::Ray const & init
             //=== ===
             
             ray=stitch::Ray(ray.id0_, ray.id1_, BRDFPeakVec, ray.direction_*intersection.distance_ + ray.origin_ + BRDFPeakVec*(intersection.itemPtr_->radiusBV_ * 0.00001f));
+            ray.visibilityMask_=RAY_VISIBILITY_PHOTON;
             
             generator=static_cast<const stitch::Object *>(intersection.itemPtr_);
             pathSegmentGroupID=(pathSegmentGroupID>>16) + ((intersection.itemID_)<<16);//pathSegmentGroupID should be > 0
@@ -931,6 +934,14 @@ void stitch::LightBeamRenderer::gather(stitch::Ray &ray) const
         stitch::Intersection intersect=stitch::Intersection(ray.id0_, ray.id1_, ((float)FLT_MAX));
         scene_->calcIntersection(ray, intersect);
         
+        gatherAtIntersection(ray, intersect);
+    }
+}
+
+
+//=======================================================================//
+void stitch::LightBeamRenderer::gatherAtIntersection(stitch::Ray &ray, const stitch::Intersection &intersect) const
+{
         if (intersect.itemPtr_)
         {
             stitch::Material const * const intersectMaterial=(static_cast<const stitch::Object *>(intersect.itemPtr_))->pMaterial_;
@@ -1072,6 +1083,7 @@ void stitch::LightBeamRenderer::gather(stitch::Ray &ray) const
                                                  const float generatorDist=shadowDir.normalise_rt();
                                                  
                                                  Ray shadowRay(ray.id0_, ray.id1_, shadowDir, intersectPosition+shadowDir*intersect.itemPtr_->radiusBV_*0.0001f, 1);
+                                                 shadowRay.visibilityMask_=RAY_VISIBILITY_SHADOW;
                                                  stitch::Intersection intersect(ray.id0_, ray.id1_, ((float)FLT_MAX));
                                                  
                                                  scene_->calcIntersection(shadowRay, intersect);
@@ -1131,8 +1143,10 @@ void stitch::LightBeamRenderer::gather(stitch::Ray &ray) const
                         stitch::Vec3 reflDir=intersectMaterial->whittedSpecReflectRay(ray.direction_, intersectNormal);
                         
                         stitch::Ray rray(ray.id0_, ray.id1_, reflDir,
-                                         stitch::Vec3(intersectPosition, reflDir, intersect.itemPtr_->radiusBV_*0.0001f),
+                                         intersectPosition,
                                          ray.gatherDepth_-1);
+                        rray.tMin_=intersect.itemPtr_->radiusBV_*0.0001f;
+                        rray.visibilityMask_=RAY_VISIBILITY_CAMERA;
                         
                         gather(rray);
                         
@@ -1140,7 +1154,6 @@ void stitch::LightBeamRenderer::gather(stitch::Ray &ray) const
                     }
                 }
             }
-        }
     }
     
     
@@ -45,6 +45,7 @@ ForwardRenderer(scene, 3, 1, true)
 size_t stitch::LightFieldRenderer::tracePhotons(const float frameDeltaTime, const size_t photonTreeChunkSize)
 {
     photonMap_->clear();
+    stitch::Arena &photonArena=photonMap_->getItemArena();//The stored photons are all freed with the map's next clear.
     
     stitch::Timer timer;
     stitch::Timer_t startTick=timer.tick();
@@ -94,7 +95,10 @@ size_t stitch::LightFieldRenderer::tracePhotons(const float frameDeltaTime, cons
             stitch::Photon *photon=inFlightPhotonVector_[photonNum];
             
             stitch::Intersection intersect(photonNum, 0, ((float)FLT_MAX));
-            scene_->calcIntersection(stitch::Ray(photonNum, 0, photon->normDir_, photon->centre_), intersect);
+            stitch::Ray photonRay(photonNum, 0, photon->normDir_, photon->centre_);
+            photonRay.visibilityMask_=RAY_VISIBILITY_PHOTON;
+            
+            scene_->calcIntersection(photonRay, intersect);
             
             const stitch::BoundingVolume *item=intersect.itemPtr_;
             
@@ -103,7 +107,7 @@ size_t stitch::LightFieldRenderer::tracePhotons(const float frameDeltaTime, cons
                 stitch::Vec3 worldPosition=photon->centre_+photon->normDir_*intersect.distance_;
                 
                 {
-                    photonMap_->addItem(new stitch::Photon(worldPosition, photon->normDir_, photon->energy_, photon->scatterCount_));
+                    photonMap_->addItem(new (photonArena) stitch::Photon(worldPosition, photon->normDir_, photon->energy_, photon->scatterCount_));
                 }
                 
                 stitch::Material *pClosestMaterial=(static_cast<const stitch::Object *>(item))->pMaterial_;
@@ -219,6 +223,7 @@ size_t stitch::LightFieldRenderer::tracePhotons(const float frameDeltaTime, cons
     splitAxisVec.push_back(Vec3(0.0f, 0.0f, 1.0f));
     
     photonMap_->build(photonTreeChunkSize, 0, 1000, splitAxisVec);
+    photonMap_->relayout();
     
     //=== Delete last in-flight photons and clear the vector...
     std::vector<stitch::Photon *>::const_iterator photonIter=inFlightPhotonVector_.begin();
@@ -336,8 +341,10 @@ void stitch::LightFieldRenderer::gather(Ray &ray) const
                         
                         stitch::Ray tray(ray.id0_, ray.id1_,
                                          transRay,
-                                         stitch::Vec3(worldPosition, transRay, 0.05f), //0.05 to jump over the back face of the thin transparent brush.
+                                         worldPosition,
                                          ray.gatherDepth_-1);
+                        tray.tMin_=0.05f; //Starts 0.05 along the ray to jump over the back face of the thin transparent brush.
+                        tray.visibilityMask_=RAY_VISIBILITY_CAMERA;
                         
                         gather(tray);
                         
@@ -351,8 +358,10 @@ void stitch::LightFieldRenderer::gather(Ray &ray) const
                         stitch::Vec3 reflRay=pClosestMaterial->whittedSpecReflectRay(ray.direction_, worldNormal);
                         
                         stitch::Ray rray(ray.id0_, ray.id1_, reflRay,
-                                         stitch::Vec3(worldPosition, reflRay, 0.001f),
+                                         worldPosition,
                                          ray.gatherDepth_-1);
+                        rray.tMin_=0.001f;
+                        rray.visibilityMask_=RAY_VISIBILITY_CAMERA;
                         
                         gather(rray);
                         
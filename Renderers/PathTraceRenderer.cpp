@@ -90,8 +90,10 @@ void stitch::PathTraceRenderer::gather(Ray &ray) const
                         if (importanceDir.isNotZero())
                         {
                             stitch::Ray importanceRay(ray.id0_, ray.id1_, importanceDir,
-                                                      stitch::Vec3(worldPosition, importanceDir, 0.001f),
+                                                      worldPosition,
                                                       ray.gatherDepth_ - 1);
+                            importanceRay.tMin_=0.001f;
+                            importanceRay.visibilityMask_=RAY_VISIBILITY_CAMERA;
                             gather(importanceRay);
                             
                             const stitch::Colour_t refl=sRefl;
@@ -104,8 +106,10 @@ void stitch::PathTraceRenderer::gather(Ray &ray) const
                         if (importanceDir.isNotZero())
                         {
                             stitch::Ray importanceRay(ray.id0_, ray.id1_, importanceDir,
-                                                      stitch::Vec3(worldPosition, importanceDir, 0.001f),
+                                                      worldPosition,
                                                       ray.gatherDepth_ - 1);
+                            importanceRay.tMin_=0.001f;
+                            importanceRay.visibilityMask_=RAY_VISIBILITY_CAMERA;
                             gather(importanceRay);
                             
                             const stitch::Colour_t refl=dRefl;
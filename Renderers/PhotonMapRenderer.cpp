@@ -38,6 +38,7 @@
 stitch::PhotonMapRenderer::PhotonMapRenderer(Scene * const scene) :
 ForwardRenderer(scene, 3, 1, true)
 {
+    setPrimaryRayPacketSize(RAYPACKET_MAX_SIZE);
     inFlightPhotonVector_.reserve(1000000);
     photonMap_=new stitch::PhotonMap;
 }
@@ -46,6 +47,7 @@ ForwardRenderer(scene, 3, 1, true)
 size_t stitch::PhotonMapRenderer::tracePhotons(const float frameDeltaTime, const size_t photonTreeChunkSize)
 {
     photonMap_->clear();
+    stitch::Arena &photonArena=photonMap_->getItemArena();//The stored photons are all freed with the map's next clear.
     
     stitch::Timer timer;
     stitch::Timer_t startTick=timer.tick();
@@ -93,7 +95,10 @@ size_t stitch::PhotonMapRenderer::tracePhotons(const float frameDeltaTime, const
             stitch::Photon *photon=inFlightPhotonVector_[photonNum];
             
             stitch::Intersection intersect(photonNum, 0, ((float)FLT_MAX));
-            scene_->calcIntersection(stitch::Ray(photonNum, 0, photon->normDir_, photon->centre_), intersect);
+            stitch::Ray photonRay(photonNum, 0, photon->normDir_, photon->centre_);
+            photonRay.visibilityMask_=RAY_VISIBILITY_PHOTON;
+            
+            scene_->calcIntersection(photonRay, intersect);
             
             const stitch::BoundingVolume *item=intersect.itemPtr_;
             
@@ -105,7 +110,7 @@ size_t stitch::PhotonMapRenderer::tracePhotons(const float frameDeltaTime, const
                 if (photon->scatterCount_>0)//This is a scattered photon.
 #endif
                 {
-                    photonMap_->addItem(new stitch::Photon(worldPosition, photon->normDir_, photon->energy_, photon->scatterCount_));
+                    photonMap_->addItem(new (photonArena) stitch::Photon(worldPosition, photon->normDir_, photon->energy_, photon->scatterCount_));
                 }
                 
                 stitch::Material *pClosestMaterial=(static_cast<const stitch::Object *>(item))->pMaterial_;
@@ -207,6 +212,7 @@ size_t stitch::PhotonMapRenderer::tracePhotons(const float frameDeltaTime, const
     splitAxisVec.push_back(Vec3(0.0f, 0.0f, 1.0f));
     
     photonMap_->build(photonTreeChunkSize, 0, 1000, splitAxisVec);
+    photonMap_->relayout();
     
     //=== Delete last in-flight photons and clear the vector...
     std::vector<stitch::Photon *>::const_iterator photonIter=inFlightPhotonVector_.begin();
@@ -237,148 +243,160 @@ void stitch::PhotonMapRenderer::gather(Ray &ray) const
         stitch::Intersection intersect(ray.id0_, ray.id1_, ((float)FLT_MAX));
         scene_->calcIntersection(ray, intersect);
         
-        const stitch::BoundingVolume *item=intersect.itemPtr_;
+        gatherAtIntersection(ray, intersect);
+	}
+}
+
+
+//=======================================================================//
+void stitch::PhotonMapRenderer::gatherAtIntersection(Ray &ray, const Intersection &intersect) const
+{
+    const stitch::BoundingVolume *item=intersect.itemPtr_;
+    
+    if (item)
+    {//There is an object in the ray's path.
+        stitch::Material *pClosestMaterial=(static_cast<const stitch::Object *>(item))->pMaterial_;
+        
+        stitch::Vec3 worldPosition=ray.origin_ + ray.direction_*intersect.distance_;
+        stitch::Vec3 worldNormal=intersect.normal_;
         
-        if (item)
-        {//There is an object in the ray's path.
-            stitch::Material *pClosestMaterial=(static_cast<const stitch::Object *>(item))->pMaterial_;
-            
-            stitch::Vec3 worldPosition=ray.origin_ + ray.direction_*intersect.distance_;
-            stitch::Vec3 worldNormal=intersect.normal_;
+        //=== Photon map radiance estimate : BEGIN ===//
+        if (ray.gatherDepth_>1)
+        {
+            stitch::Colour_t diffuseRefl=pClosestMaterial->getDiffuseRefl(worldPosition);
             
-            //=== Photon map radiance estimate : BEGIN ===//
-            if (ray.gatherDepth_>1)
+            if (diffuseRefl.lengthSq() > 0.0f)
             {
-                stitch::Colour_t diffuseRefl=pClosestMaterial->getDiffuseRefl(worldPosition);
+                KNearestItems kNearestItems(worldPosition, powf(5.0f, 2.0f), 255);
+                photonMap_->getNearestK(&kNearestItems);
                 
-                if (diffuseRefl.lengthSq() > 0.0f)
+                if ((kNearestItems.searchRadiusSq_>0.0f)&&(kNearestItems.numItems_>0))
                 {
-                    KNearestItems kNearestItems(worldPosition, powf(5.0f, 2.0f), 255);
-                    photonMap_->getNearestK(&kNearestItems);
+                    //=== Calculate photon irradiance ===//
+                    stitch::Colour_t photonFlux;//Set to zero.
+                    size_t numPhotons=0;
+                    float filterWeightTotal=0.0f;
+                    
+                    const size_t numNearestItems=kNearestItems.numItems_;
+                    
+                    const float fluxRadiusSq=kNearestItems.heapArray_[0].first;//kNearestItems.searchRadiusSq_;//(kNearestItems.nearestItemVector_[0]->centre_-worldPosition).lengthSq();
                     
-                    if ((kNearestItems.searchRadiusSq_>0.0f)&&(kNearestItems.numItems_>0))
+                    for (size_t i=0; i<numNearestItems; ++i)
                     {
-                        //=== Calculate photon irradiance ===//
-                        stitch::Colour_t photonFlux;//Set to zero.
-                        size_t numPhotons=0;
-                        float filterWeightTotal=0.0f;
+                        stitch::Photon const *photon=dynamic_cast<Photon const *>(kNearestItems.heapArray_[i].second);
                         
-                        const size_t numNearestItems=kNearestItems.numItems_;
-                        
-                        const float fluxRadiusSq=kNearestItems.heapArray_[0].first;//kNearestItems.searchRadiusSq_;//(kNearestItems.nearestItemVector_[0]->centre_-worldPosition).lengthSq();
-                        
-                        for (size_t i=0; i<numNearestItems; ++i)
+                        //if (photon)
                         {
-                            stitch::Photon const *photon=dynamic_cast<Photon const *>(kNearestItems.heapArray_[i].second);
+                            const float distSq=kNearestItems.heapArray_[i].first;
                             
-                            //if (photon)
+                            const float cosTheta=((photon->normDir_ * worldNormal) * -1.0f);
+                            
+                            if (cosTheta>0.0f)
                             {
-                                const float distSq=kNearestItems.heapArray_[i].first;
-                                
-                                const float cosTheta=((photon->normDir_ * worldNormal) * -1.0f);
+                                const float filterWeight=1.0f - distSq/fluxRadiusSq;
+                                photonFlux.addScaled(photon->energy_, cosTheta*filterWeight);
                                 
-                                if (cosTheta>0.0f)
-                                {
-                                    const float filterWeight=1.0f - distSq/fluxRadiusSq;
-                                    photonFlux.addScaled(photon->energy_, cosTheta*filterWeight);
-                                    
-                                    filterWeightTotal+=filterWeight;
-                                    ++numPhotons;
-                                }
+                                filterWeightTotal+=filterWeight;
+                                ++numPhotons;
                             }
                         }
-                        
+                    }
+                    
+                    {
+                        if (numPhotons>8)
                         {
-                            if (numPhotons>8)
-                            {
-                                filterWeightTotal/=numPhotons;
-                                
-                                //! @todo Calculate the convex hull of the photons to find the fluxArea.
-                                const float fluxArea=(((float)M_PI)*fluxRadiusSq);
-                                
-                                Colour_t Fr=diffuseRefl*((float)M_1_PI);//pClosestMaterial->BSDF(worldPosition, photon->normDir_*(-1.0f), ray.direction_*(-1.0f), worldNormal);
-                                ray.returnRadiance_+=(fluxArea==0.0f) ? stitch::Colour_t(0.0f, 0.0f, 0.0f) : (photonFlux / (filterWeightTotal*fluxArea)).cmult(Fr);
-                            }
+                            filterWeightTotal/=numPhotons;
+                            
+                            //! @todo Calculate the convex hull of the photons to find the fluxArea.
+                            const float fluxArea=(((float)M_PI)*fluxRadiusSq);
+                            
+                            Colour_t Fr=diffuseRefl*((float)M_1_PI);//pClosestMaterial->BSDF(worldPosition, photon->normDir_*(-1.0f), ray.direction_*(-1.0f), worldNormal);
+                            ray.returnRadiance_+=(fluxArea==0.0f) ? stitch::Colour_t(0.0f, 0.0f, 0.0f) : (photonFlux / (filterWeightTotal*fluxArea)).cmult(Fr);
                         }
-                        //=== ===//
-                        
                     }
+                    //=== ===//
+                    
                 }
-                
             }
-            //=== Photon map radiance estimate : END ===//
             
+        }
+        //=== Photon map radiance estimate : END ===//
+        
+        
+        {
+            //Calculate emitted radiance from closest hit.
+            ray.returnRadiance_+=pClosestMaterial->getEmittedRadiance(worldNormal, ray.direction_*(-1.0f), worldPosition);
             
-            {
-                //Calculate emitted radiance from closest hit.
-                ray.returnRadiance_+=pClosestMaterial->getEmittedRadiance(worldNormal, ray.direction_*(-1.0f), worldPosition);
-                
-                if (ray.gatherDepth_>1)
-                {//Will still gather 'gatherDepth' levels.
+            if (ray.gatherDepth_>1)
+            {//Will still gather 'gatherDepth' levels.
 #ifndef USE_PHOTON_DIRECT_IRRADIANCE
-                    //Whitted style direct irradiance term. Compare with photon irradiance.
-                    /*
-                     stitch::Colour_t diffuseRefl=pClosestMaterial->getDiffuseRefl(worldPosition);
-                     
-                     if (diffuseRefl.isNotZero())
-                     {
-                     //Gather radiance from direction of point light.
-                     stitch::Vec3 shadowRay=(scene_->light_->centre_ - worldPosition);
-                     float lightDistSq=shadowRay.lengthSq();
-                     shadowRay/=sqrtf(lightDistSq);
-                     float sr=(((float)M_PI)*scene_->light_->radius_ * scene_->light_->radius_)/lightDistSq;
-                     
-                     const float cosTheta=worldNormal*shadowRay;
-                     
-                     if (cosTheta>0.0f)//Back faces of objects will be in shadow!
-                     {
-                     stitch::Ray sray(shadowRay, stitch::Vec3(worldPosition, shadowRay, 0.001f), 1);
-                     
-                     gather(sray);
-                     
-                     ray.returnRadiance_+=diffuseRefl.cmult(sray.returnRadiance_ * (sr * cosTheta * (1.0f/((float)stitch::M_PI))));
-                     }
-                     }
-                     */
+                //Whitted style direct irradiance term. Compare with photon irradiance.
+                /*
+                 stitch::Colour_t diffuseRefl=pClosestMaterial->getDiffuseRefl(worldPosition);
+                 
+                 if (diffuseRefl.isNotZero())
+                 {
+                 //Gather radiance from direction of point light.
+                 stitch::Vec3 shadowRay=(scene_->light_->centre_ - worldPosition);
+                 float lightDistSq=shadowRay.lengthSq();
+                 shadowRay/=sqrtf(lightDistSq);
+                 float sr=(((float)M_PI)*scene_->light_->radius_ * scene_->light_->radius_)/lightDistSq;
+                 
+                 const float cosTheta=worldNormal*shadowRay;
+                 
+                 if (cosTheta>0.0f)//Back faces of objects will be in shadow!
+                 {
+                 stitch::Ray sray(shadowRay, stitch::Vec3(worldPosition, shadowRay, 0.001f), 1);
+                 
+                 gather(sray);
+                 
+                 ray.returnRadiance_+=diffuseRefl.cmult(sray.returnRadiance_ * (sr * cosTheta * (1.0f/((float)stitch::M_PI))));
+                 }
+                 }
+                 */
 #endif
+                
+                //Gather from specular trans direction.
+                stitch::Colour_t specTrans=pClosestMaterial->getSpecularTrans();
+                if (specTrans.isNotZero())
+                {//Gather radiance from specular trans direction.
+                    stitch::Vec3 transRay=pClosestMaterial->whittedSpecRefractRay(ray.direction_, worldNormal);
                     
-                    //Gather from specular trans direction.
-                    stitch::Colour_t specTrans=pClosestMaterial->getSpecularTrans();
-                    if (specTrans.isNotZero())
-                    {//Gather radiance from specular trans direction.
-                        stitch::Vec3 transRay=pClosestMaterial->whittedSpecRefractRay(ray.direction_, worldNormal);
-                        
-                        stitch::Ray tray(ray.id0_, ray.id1_,
-                                         transRay,
-                                         stitch::Vec3(worldPosition, transRay, 0.05f), //0.05 to jump over the back face of the thin transparent brush.
-                                         ray.gatherDepth_-1);
-                        
-                        gather(tray);
-                        
-                        ray.returnRadiance_+=specTrans.cmult(tray.returnRadiance_);
-                    }
+                    stitch::Ray tray(ray.id0_, ray.id1_,
+                                     transRay,
+                                     worldPosition,
+                                     ray.gatherDepth_-1);
+                    tray.tMin_=0.05f; //Starts 0.05 along the ray to jump over the back face of the thin transparent brush.
+                    tray.visibilityMask_=RAY_VISIBILITY_CAMERA;
                     
-                    //Gather from specular refl direction.
-                    stitch::Colour_t specRefl=pClosestMaterial->getSpecularRefl();
-                    if (specRefl.isNotZero())
-                    {//Gather radiance from specular refl direction.
-                        stitch::Vec3 reflRay=pClosestMaterial->whittedSpecReflectRay(ray.direction_, worldNormal);
-                        
-                        stitch::Ray rray(ray.id0_, ray.id1_, reflRay,
-                                         stitch::Vec3(worldPosition, reflRay, 0.001f),
-                                         ray.gatherDepth_-1);
-                        
-                        gather(rray);
-                        
-                        ray.returnRadiance_+=specRefl.cmult(rray.returnRadiance_);
-                    }
+                    gather(tray);
+                    
+                    ray.returnRadiance_+=specTrans.cmult(tray.returnRadiance_);
+                }
+                
+                //Gather from specular refl direction.
+                stitch::Colour_t specRefl=pClosestMaterial->getSpecularRefl();
+                if (specRefl.isNotZero())
+                {//Gather radiance from specular refl direction.
+                    stitch::Vec3 reflRay=pClosestMaterial->whittedSpecReflectRay(ray.direction_, worldNormal);
+                    
+                    stitch::Ray rray(ray.id0_, ray.id1_, reflRay,
+                                     worldPosition,
+                                     ray.gatherDepth_-1);
+                    rray.tMin_=0.001f;
+                    rray.visibilityMask_=RAY_VISIBILITY_CAMERA;
+                    
+                    gather(rray);
+                    
+                    ray.returnRadiance_+=specRefl.cmult(rray.returnRadiance_);
                 }
             }
-            //=========================================//
         }
-	}
+        //=========================================//
+    }
 }
 
+
 //=======================================================================//
 void stitch::PhotonMapRenderer::preForwardRender(RadianceMap &radianceMap,
                                                  const stitch::Camera * const camera,
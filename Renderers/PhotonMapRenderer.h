@@ -72,6 +72,8 @@ namespace stitch {
                                       const float frameDeltaTime);
         
         virtual void gather(Ray &ray) const;
+        
+        virtual void gatherAtIntersection(Ray &ray, const Intersection &intersect) const;
     };
 }
 
@@ -121,7 +121,10 @@ size_t stitch::PhotonTraceRenderer::tracePhotons(const stitch::Camera * const ca
 		stitch::Photon *inFlightPhoton=inFlightPhotonVector_[photonNum];
 		
         stitch::Intersection intersect(photonNum, 0, ((float)FLT_MAX));
-        scene_->calcIntersection(stitch::Ray(photonNum, 0, inFlightPhoton->normDir_, inFlightPhoton->centre_), intersect);
+        stitch::Ray photonRay(photonNum, 0, inFlightPhoton->normDir_, inFlightPhoton->centre_);
+        photonRay.visibilityMask_=RAY_VISIBILITY_PHOTON;
+        
+        scene_->calcIntersection(photonRay, intersect);
         
         const stitch::BoundingVolume *item=intersect.itemPtr_;
 		
@@ -153,11 +156,12 @@ size_t stitch::PhotonTraceRenderer::tracePhotons(const stitch::Camera * const ca
                 stitch::Vec3 cameraDir=(camera->m_position_-worldPosition);
                 const float cameraDist=cameraDir.normalise_rt();
                 
-                stitch::Intersection intersect(photonNum, 0, ((float)FLT_MAX));
-                scene_->calcIntersection(stitch::Ray(photonNum, 0, cameraDir, worldPosition+cameraDir*0.01f), intersect);
+                stitch::Ray cameraRay(photonNum, 0, cameraDir, worldPosition);
+                cameraRay.tMin_=0.01f;
+                cameraRay.tMax_=cameraDist;
+                cameraRay.visibilityMask_=RAY_VISIBILITY_SHADOW;
                 
-                if ((intersect.itemID_==0) ||
-                    (intersect.distance_>cameraDist))
+                if (!scene_->occluded(cameraRay))
                 {//There are no objects between the scattered photon's origin and the camera.
                     //So record a photon on the focal plane.
                     const stitch::Vec3 fpPos=camera->getFocalPlaneIntersect(worldPosition);
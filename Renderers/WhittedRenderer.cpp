@@ -35,6 +35,7 @@
 stitch::WhittedRenderer::WhittedRenderer(Scene * const scene) :
 ForwardRenderer(scene, 3, 1, false)
 {
+    setPrimaryRayPacketSize(RAYPACKET_MAX_SIZE);
 }
 
 
@@ -48,80 +49,100 @@ void stitch::WhittedRenderer::gather(Ray &ray) const
         stitch::Intersection intersect(ray.id0_, ray.id1_, ((float)FLT_MAX));
         scene_->calcIntersection(ray, intersect);
         
-        const stitch::BoundingVolume *item=intersect.itemPtr_;
+        gatherAtIntersection(ray, intersect);
+    }
+}
+
+
+//=======================================================================//
+void stitch::WhittedRenderer::gatherAtIntersection(Ray &ray, const Intersection &intersect) const
+{
+    const stitch::BoundingVolume *item=intersect.itemPtr_;
+    
+    if (item)
+    {//There is an object in the ray's path.
+        stitch::Material *pClosestMaterial=(static_cast<const stitch::Object *>(item))->pMaterial_;
         
-        if (item)
-        {//There is an object in the ray's path.
-            stitch::Material *pClosestMaterial=(static_cast<const stitch::Object *>(item))->pMaterial_;
-            
-            //=== Find radiance from closest entry ===//
-            stitch::Vec3 worldPosition=ray.direction_;
-            worldPosition*=intersect.distance_;
-            worldPosition+=ray.origin_;
-            
-            stitch::Vec3 worldNormal=intersect.normal_;
-            
-            //Calculate emitted radiance from closest hit.
-            ray.returnRadiance_+=pClosestMaterial->getEmittedRadiance(worldNormal, ray.direction_*(-1.0f), worldPosition);
+        //=== Find radiance from closest entry ===//
+        stitch::Vec3 worldPosition=ray.direction_;
+        worldPosition*=intersect.distance_;
+        worldPosition+=ray.origin_;
+        
+        stitch::Vec3 worldNormal=intersect.normal_;
+        
+        //Calculate emitted radiance from closest hit.
+        ray.returnRadiance_+=pClosestMaterial->getEmittedRadiance(worldNormal, ray.direction_*(-1.0f), worldPosition);
+        
+        if (ray.gatherDepth_>1)
+        {//Will still gather 'gatherDepth' levels.
+            stitch::Colour_t diffuseRefl=pClosestMaterial->getDiffuseRefl(worldPosition);
             
-            if (ray.gatherDepth_>1)
-            {//Will still gather 'gatherDepth' levels.
-                stitch::Colour_t diffuseRefl=pClosestMaterial->getDiffuseRefl(worldPosition);
+            if (diffuseRefl.isNotZero())
+            {
+                //Gather radiance from direction of point light.
+                stitch::Vec3 shadowRay=(scene_->light_->centre_ - worldPosition);
+                float lightDistSq=shadowRay.lengthSq();
+                const float lightDist=sqrtf(lightDistSq);
+                shadowRay/=lightDist;
+                float sr=(((float)M_PI)*scene_->light_->radiusBV_ * scene_->light_->radiusBV_)/lightDistSq;
+                
+                const float cosTheta=worldNormal*shadowRay;
                 
-                if (diffuseRefl.isNotZero())
+                if (cosTheta>0.0f)//Back faces of objects will be in shadow!
                 {
-                    //Gather radiance from direction of point light.
-                    stitch::Vec3 shadowRay=(scene_->light_->centre_ - worldPosition);
-                    float lightDistSq=shadowRay.lengthSq();
-                    shadowRay/=sqrtf(lightDistSq);
-                    float sr=(((float)M_PI)*scene_->light_->radiusBV_ * scene_->light_->radiusBV_)/lightDistSq;
-                    
-                    const float cosTheta=worldNormal*shadowRay;
+                    stitch::Ray sray(ray.id0_, ray.id1_, shadowRay,
+                                     worldPosition,
+                                     1);
+                    sray.tMin_=0.001f;
+                    sray.tMax_=lightDist - scene_->light_->radiusBV_*1.01f;//Ends just before the light's surface so that the light itself is not a blocker.
+                    sray.visibilityMask_=RAY_VISIBILITY_SHADOW;
                     
-                    if (cosTheta>0.0f)//Back faces of objects will be in shadow!
+                    if (!scene_->occluded(sray))
                     {
-                        stitch::Ray sray(ray.id0_, ray.id1_, shadowRay,
-                                         stitch::Vec3(worldPosition, shadowRay, 0.001f),
-                                         1);
+                        const stitch::Vec3 lightNormal=shadowRay*(-1.0f);
+                        const stitch::Colour_t lightRadiance=scene_->light_->pMaterial_->getEmittedRadiance(lightNormal, lightNormal,
+                                                                                                            scene_->light_->centre_ + lightNormal*scene_->light_->radiusBV_);
                         
-                        gather(sray);
-                        
-                        ray.returnRadiance_+=diffuseRefl.cmult(sray.returnRadiance_ * (sr * cosTheta * ((float)M_1_PI)));
+                        ray.returnRadiance_+=diffuseRefl.cmult(lightRadiance * (sr * cosTheta * ((float)M_1_PI)));
                     }
                 }
+            }
+            
+            //Gather from specular trans direction.
+            stitch::Colour_t specTrans=pClosestMaterial->getSpecularTrans();
+            if (specTrans.isNotZero())
+            {//Gather radiance from specular trans direction.
+                stitch::Vec3 transDir=pClosestMaterial->whittedSpecRefractRay(ray.direction_, worldNormal);
                 
-                //Gather from specular trans direction.
-                stitch::Colour_t specTrans=pClosestMaterial->getSpecularTrans();
-                if (specTrans.isNotZero())
-                {//Gather radiance from specular trans direction.
-                    stitch::Vec3 transDir=pClosestMaterial->whittedSpecRefractRay(ray.direction_, worldNormal);
-                    
-                    stitch::Ray tray(ray.id0_, ray.id1_, transDir,
-                                     stitch::Vec3(worldPosition, transDir, 0.05f), //0.05 to jump over the back face of the thin transparent brush.
-                                     ray.gatherDepth_-1);
-                    
-                    gather(tray);
-                    
-                    ray.returnRadiance_+=specTrans.cmult(tray.returnRadiance_);
-                }
+                stitch::Ray tray(ray.id0_, ray.id1_, transDir,
+                                 worldPosition,
+                                 ray.gatherDepth_-1);
+                tray.tMin_=0.05f; //Starts 0.05 along the ray to jump over the back face of the thin transparent brush.
+                tray.visibilityMask_=RAY_VISIBILITY_CAMERA;
                 
-                //Gather from specular refl direction.
-                stitch::Colour_t specRefl=pClosestMaterial->getSpecularRefl();
-                if (specRefl.isNotZero())
-                {//Gather radiance from specular refl direction.
-                    stitch::Vec3 reflDir=pClosestMaterial->whittedSpecReflectRay(ray.direction_, worldNormal);
-                    
-                    stitch::Ray rray(ray.id0_, ray.id1_, reflDir,
-                                     stitch::Vec3(worldPosition, reflDir, 0.001f),
-                                     ray.gatherDepth_-1);
-                    gather(rray);
-                    
-                    ray.returnRadiance_+=specRefl.cmult(rray.returnRadiance_);
-                }
+                gather(tray);
                 
+                ray.returnRadiance_+=specTrans.cmult(tray.returnRadiance_);
             }
-            //=========================================//
+            
+            //Gather from specular refl direction.
+            stitch::Colour_t specRefl=pClosestMaterial->getSpecularRefl();
+            if (specRefl.isNotZero())
+            {//Gather radiance from specular refl direction.
+                stitch::Vec3 reflDir=pClosestMaterial->whittedSpecReflectRay(ray.direction_, worldNormal);
+                
+                stitch::Ray rray(ray.id0_, ray.id1_, reflDir,
+                                 worldPosition,
+                                 ray.gatherDepth_-1);
+                rray.tMin_=0.001f;
+                rray.visibilityMask_=RAY_VISIBILITY_CAMERA;
+                gather(rray);
+                
+                ray.returnRadiance_+=specRefl.cmult(rray.returnRadiance_);
+            }
+            
         }
+        //=========================================//
     }
 }
 
@@ -30,6 +30,7 @@
 
 #include "Objects/BrushModel.h"
 #include "Objects/PolygonModel.h"
+#include "Objects/ObjectInstance.h"
 #include "Lights/PointLight.h"
 #include "Materials/PhongMaterial.h"
 #include "Materials/BlinnPhongMaterial.h"
@@ -37,8 +38,19 @@
 #include "Materials/GlossyMaterial.h"
 #include "Beam.h"
 
+#include <memory>
+#include <sstream>
+#include <cstring>
+#include <thread>
+
+#include <sys/stat.h>
+
 //=======================================================================//
-stitch::Scene::Scene()
+stitch::Scene::Scene() :
+treeType_(BallTree::BALL_TREE),
+wideNodes_(false),
+compactNodes_(false),
+objectTreeChunkSize_(0)
 {
     light_=nullptr;
     
@@ -58,8 +70,21 @@ size_t stitch::Scene::create(const std::string scene_name, const Vec3 &light_ori
                              const size_t objectTreeChunkSize, const size_t internalObjectTreeChunkSize,
                              bool createOSGLineGeometry,
                              bool createOSGNormalGeometry,
-                             float glossySD)
+                             float glossySD,
+                             const BallTree::TreeType treeType,
+                             const bool wideNodes,
+                             const bool compactNodes)
 {
+    if (ballTree_->getTreeType()!=treeType)
+    {
+        delete ballTree_;
+        ballTree_=BallTree::create(treeType);
+    }
+    treeType_=treeType;
+    wideNodes_=wideNodes;
+    compactNodes_=compactNodes;
+    objectTreeChunkSize_=objectTreeChunkSize;
+    
     light_=new PointLight(light_orig, lightSPD);
     
     if (scene_name=="CausticGear")
@@ -108,14 +133,78 @@ size_t stitch::Scene::create(const std::string scene_name, const Vec3 &light_ori
     }
 #endif// USE_OSG
     
-    {//Create object tree acceleration structure.
-        if (ballTree_->itemVector_.size()>objectTreeChunkSize)
+    buildObjectTree();//Create object tree acceleration structure.
+    
+    {//Report the memory used by the trees.
+        const size_t treeMemorySize=ballTree_->getTreeMemorySize();
+        const size_t numPrimitives=ballTree_->getNumPrimitives();
+        
+        std::cout << "Tree memory: " << treeMemorySize << " bytes, "
+        << ((numPrimitives>0) ? (((double)treeMemorySize)/numPrimitives) : 0.0) << " bytes per primitive (" << numPrimitives << " primitives).\n";
+        std::cout.flush();
+    }
+    
+    return ballTree_->getNumItems();
+}
+
+void stitch::Scene::buildObjectTree()
+{
+    ballTree_->build(objectTreeChunkSize_, 0);//Also calculates the tree's bounding volume.
+    
+    if (compactNodes_)
+    {
+        ballTree_->freezeCompact();
+    } else
+        if (wideNodes_)
+        {
+            ballTree_->freezeWide();
+        } else
         {
-            ballTree_->build(objectTreeChunkSize, 0);
+            ballTree_->freeze();
+        }
+}
+
+void stitch::Scene::addObject(BoundingVolume * const object)
+{
+    if (ballTree_->hasBuildHierarchy())
+    {
+        ballTree_->insertItem(object);
+    } else
+    {
+        ballTree_->addItem(object);
+        
+        if (!ballTree_->isEditing())
+        {
+            buildObjectTree();
         }
-        ballTree_->updateBV();
     }
-    return ballTree_->getNumItems();
+}
+
+bool stitch::Scene::removeObject(BoundingVolume * const object)
+{
+    const bool hasBuildHierarchy=ballTree_->hasBuildHierarchy();
+    
+    if (!ballTree_->removeItem(object))
+    {
+        return false;
+    }
+    
+    if ((!hasBuildHierarchy)&&(!ballTree_->isEditing()))
+    {
+        buildObjectTree();
+    }
+    
+    return true;
+}
+
+void stitch::Scene::endObjectEdits()
+{
+    ballTree_->endEdits();
+    
+    if ((!ballTree_->isFrozen())&&(!ballTree_->isFrozenWide())&&(!ballTree_->isFrozenCompact()))
+    {//Edited without a build hierarchy, see addObject.
+        buildObjectTree();
+    }
 }
 
 
@@ -133,7 +222,7 @@ void stitch::Scene::createSphereBox2013(const size_t internalObjectTreeChunkSize
         polygonModel->calculateVertexNormals();
         
         polygonModel->generatePolygonObjectsFromVertices();
-        polygonModel->buildBallTree(internalObjectTreeChunkSize);
+        polygonModel->buildBallTree(internalObjectTreeChunkSize, treeType_, wideNodes_, compactNodes_);
         
         ballTree_->addItem(polygonModel);
     }
@@ -143,7 +232,7 @@ void stitch::Scene::createSphereBox2013(const size_t internalObjectTreeChunkSize
     polygonModel->loadOBJVertices("Data/teapot.obj", stitch::Vec3(0.0f, -1.0f, 0.0f), 0.1, false);
     polygonModel->calculateVertexNormals();
     polygonModel->generatePolygonObjectsFromVertices();
-    polygonModel->buildBallTree(internalObjectTreeChunkSize);
+    polygonModel->buildBallTree(internalObjectTreeChunkSize, treeType_, wideNodes_, compactNodes_);
     ballTree_->addItem(polygonModel);
     }
     */
@@ -262,29 +351,34 @@ void stitch::Scene::createSphereBox2013(const size_t internalObjectTreeChunkSize
     }
     
     
-    {
+    std::vector<ItemTask> itemTasks;
+    
+    itemTasks.push_back([this, internalObjectTreeChunkSize, glossySD](std::vector<BoundingVolume *> &items)
+    {//Small sphere
         stitch::PolygonModel *polygonModel=new stitch::PolygonModel(new stitch::GlossyMaterial(stitch::Colour_t(1.0f, 1.0f, 1.0f), glossySD));
         
         polygonModel->loadIcosahedronBasedSphere(300, stitch::Vec3(-6.0f, 4.5f, 0.1f), 2.5f, false);
         
         polygonModel->generatePolygonObjectsFromVertices();
-        polygonModel->buildBallTree(internalObjectTreeChunkSize);
+        polygonModel->buildBallTree(internalObjectTreeChunkSize, treeType_, wideNodes_, compactNodes_);
         
-        ballTree_->addItem(polygonModel);
-    }
+        items.push_back(polygonModel);
+    });
     
-    {
+    itemTasks.push_back([this, internalObjectTreeChunkSize, glossySD](std::vector<BoundingVolume *> &items)
+    {//Large sphere
         stitch::PolygonModel *polygonModel=new stitch::PolygonModel(new stitch::GlossyMaterial(stitch::Colour_t(1.0f, 1.0f, 1.0f), glossySD));
         
         polygonModel->loadIcosahedronBasedSphere(2000, stitch::Vec3(4.0f, 1.0f, -4.0f), 3.0f, true);
         
         polygonModel->generatePolygonObjectsFromVertices();
-        polygonModel->buildBallTree(internalObjectTreeChunkSize);
+        polygonModel->buildBallTree(internalObjectTreeChunkSize, treeType_, wideNodes_, compactNodes_);
         
-        ballTree_->addItem(polygonModel);
-    }
+        items.push_back(polygonModel);
+    });
 
-    {
+    itemTasks.push_back([this, internalObjectTreeChunkSize, glossySD](std::vector<BoundingVolume *> &items)
+    {//Gears
         std::vector<stitch::Vec3> vectors;
         std::vector<size_t> indices;
         
@@ -334,30 +428,128 @@ void stitch::Scene::createSphereBox2013(const size_t internalObjectTreeChunkSize
             }
         }
         
-        stitch::PolygonModel *gear1=new stitch::PolygonModel(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD));
-        gear1->loadVectorsAndIndices(vectors, indices,
-                                     stitch::Vec3(0.0f-3.0f, -1.4f, -7.0f),
-                                     1.0,
-                                     Vec3(0.0f, 1.0f, 0.0f).normalised(),
-                                     true);
-        gear1->calculateVertexNormals();
-        gear1->generatePolygonObjectsFromVertices();
-        gear1->buildBallTree(internalObjectTreeChunkSize);
-        ballTree_->addItem(gear1);
-        
-        stitch::PolygonModel *gear2=new stitch::PolygonModel(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD));
-        gear2->loadVectorsAndIndices(vectors, indices,
-                                     stitch::Vec3(2.0f-3.0f, -0.7f, -7.0f),
-                                     1.0,
-                                     Vec3(0.5f, 1.0f, 0.0f).normalised(),
-                                     true);
-        gear2->calculateVertexNormals();
-        gear2->generatePolygonObjectsFromVertices();
-        gear2->buildBallTree(internalObjectTreeChunkSize);
-        ballTree_->addItem(gear2);
+        //=== The gear mesh and its tree are shared by the gear instances ===
+        std::shared_ptr<stitch::PolygonModel> gearModel=std::make_shared<stitch::PolygonModel>(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD));
+        gearModel->loadVectorsAndIndices(vectors, indices,
+                                         stitch::Vec3(0.0f, 0.0f, 0.0f),
+                                         1.0,
+                                         Vec3(0.0f, 0.0f, 1.0f),//The z-axis up vector leaves the vectors unrotated.
+                                         true);
+        gearModel->calculateVertexNormals();
+        gearModel->generatePolygonObjectsFromVertices();
+        gearModel->buildBallTree(internalObjectTreeChunkSize, treeType_, wideNodes_, compactNodes_);
+        //===
+        
+        stitch::ObjectInstance *gear1=new stitch::ObjectInstance(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD),
+                                                                 gearModel,
+                                                                 stitch::Vec3(0.0f-3.0f, -1.4f, -7.0f),
+                                                                 1.0f,
+                                                                 Vec3(0.0f, 1.0f, 0.0f).normalised());
+        items.push_back(gear1);
+        
+        stitch::ObjectInstance *gear2=new stitch::ObjectInstance(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD),
+                                                                 gearModel,
+                                                                 stitch::Vec3(2.0f-3.0f, -0.7f, -7.0f),
+                                                                 1.0f,
+                                                                 Vec3(0.5f, 1.0f, 0.0f).normalised());
+        items.push_back(gear2);
+    });
+    
+    addItemsConcurrently(itemTasks);
+}
+
+
+//=======================================================================//
+stitch::PolygonModel *stitch::Scene::loadPolygonModel(Material * const pMaterial, const std::string &fileName,
+                                                      const Vec3 &centre, const float scale, const bool invertNormals,
+                                                      const size_t internalObjectTreeChunkSize) const
+{
+    stitch::PolygonModel *polygonModel=new stitch::PolygonModel(pMaterial);
+    
+    //=== The key changes when the model file or any of the parameters that the prepared model depends on change ===
+    struct stat fileStat;
+    if (stat(fileName.c_str(), &fileStat)!=0)
+    {
+        memset(&fileStat, 0, sizeof(fileStat));
+    }
+    
+    std::ostringstream keyStream;
+    keyStream.precision(9);
+    keyStream << fileName << " " << fileStat.st_size << " " << fileStat.st_mtime << " "
+    << centre.x() << " " << centre.y() << " " << centre.z() << " " << scale << " " << invertNormals << " "
+    << treeType_ << " " << wideNodes_ << " " << compactNodes_ << " " << internalObjectTreeChunkSize;
+    
+    const std::string key=keyStream.str();
+    const std::string cacheFileName=fileName+SCENE_MODEL_CACHE_SUFFIX;
+    //===
+    
+    if (polygonModel->loadCache(cacheFileName, key))
+    {
+        std::cout << "Loaded prepared model " << cacheFileName << ".\n";
+        std::cout.flush();
+    } else
+    {
+        if ((fileName.size()>=4)&&(fileName.compare(fileName.size()-4, 4, ".obj")==0))
+        {
+            polygonModel->loadOBJVertices(fileName, centre, scale, invertNormals);
+        } else
+        {
+            polygonModel->loadPLYVertices(fileName, centre, scale, invertNormals);
+        }
+        
+        if (!polygonModel->hasSmoothNormals())
+        {//The file did not have normals.
+            polygonModel->calculateVertexNormals();
+        }
+        
+        polygonModel->generatePolygonObjectsFromVertices();
+        polygonModel->buildBallTree(internalObjectTreeChunkSize, treeType_, wideNodes_, compactNodes_);
+        
+        if (!polygonModel->saveCache(cacheFileName, key))
+        {
+            std::cout << "Could not write the prepared model " << cacheFileName << ".\n";
+            std::cout.flush();
+        }
     }
+    
+    return polygonModel;
 }
 
+//=======================================================================//
+void stitch::Scene::addItemsConcurrently(const std::vector<ItemTask> &itemTasks)
+{
+    const size_t numTasks=itemTasks.size();
+    std::vector<std::vector<BoundingVolume *> > taskItems(numTasks);
+    
+    if (numTasks==1)
+    {
+        itemTasks[0](taskItems[0]);
+    } else
+    {
+        std::vector<std::thread> threadVect;
+        threadVect.reserve(numTasks);
+        
+        for (size_t taskNum=0; taskNum<numTasks; ++taskNum)
+        {
+            threadVect.emplace_back(itemTasks[taskNum], std::ref(taskItems[taskNum]));
+        }
+        
+        for (size_t taskNum=0; taskNum<numTasks; ++taskNum)
+        {
+            threadVect[taskNum].join();
+        }
+    }
+    
+    for (size_t taskNum=0; taskNum<numTasks; ++taskNum)
+    {
+        const std::vector<BoundingVolume *> &items=taskItems[taskNum];
+        
+        for (size_t itemNum=0; itemNum<items.size(); ++itemNum)
+        {
+            ballTree_->addItem(items[itemNum]);
+        }
+    }
+}
 
 //=======================================================================//
 void stitch::Scene::createCausticRing(const size_t internalObjectTreeChunkSize, float glossySD)
@@ -366,6 +558,9 @@ void stitch::Scene::createCausticRing(const size_t internalObjectTreeChunkSize,
         ballTree_->addItem(light_);
     }
     
+    std::vector<ItemTask> itemTasks;
+    
+    itemTasks.push_back([this, glossySD](std::vector<BoundingVolume *> &items)
     {//Ring Object
         const float ringMinZ=-1.90f;
         const float ringMaxZ=0.50f;
@@ -428,10 +623,11 @@ void stitch::Scene::createCausticRing(const size_t internalObjectTreeChunkSize,
         ringModel->calculateVertexNormals();
         
         ringModel->generatePolygonObjectsFromVertices();
-        ringModel->buildBallTree(20);
-        ballTree_->addItem(ringModel);
-    }
+        ringModel->buildBallTree(20, treeType_, wideNodes_, compactNodes_);
+        items.push_back(ringModel);
+    });
     
+    itemTasks.push_back([](std::vector<BoundingVolume *> &items)
     {//floor
         stitch::Brush *brush=new stitch::Brush(new stitch::PhongMaterial(stitch::Colour_t(0.9f, 0.9f, 0.9f), stitch::Colour_t(0.0f, 0.0f, 0.0f), stitch::Colour_t(0.0f, 0.0f, 0.0f), 10.0f, "Data/wood2.jpg"));
         //stitch::Brush *brush=new stitch::Brush(new stitch::DiffuseMaterial(stitch::Colour_t(0.7f, 0.7f, 0.7f)));
@@ -447,8 +643,10 @@ void stitch::Scene::createCausticRing(const size_t internalObjectTreeChunkSize,
         brush->updateLinesVerticesAndBoundingVolume(false);
         brush->optimiseFaceOrder();
         
-        ballTree_->addItem(brush);
-    }
+        items.push_back(brush);
+    });
+    
+    addItemsConcurrently(itemTasks);
 }
 
 
@@ -459,18 +657,18 @@ void stitch::Scene::createCausticBunny(const size_t internalObjectTreeChunkSize,
         ballTree_->addItem(light_);
     }
     
+    std::vector<ItemTask> itemTasks;
+    
+    itemTasks.push_back([this, internalObjectTreeChunkSize, glossySD](std::vector<BoundingVolume *> &items)
     {//Load PLY file.
-        stitch::PolygonModel *polygonModel=new stitch::PolygonModel(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD));
-        
-        polygonModel->loadPLYVertices("Data/bunny.ply", stitch::Vec3(0.0f, -2.75f, -2.0f), 20.0, false);
-        polygonModel->calculateVertexNormals();
+        stitch::PolygonModel *polygonModel=loadPolygonModel(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD),
+                                                             "Data/bunny.ply", stitch::Vec3(0.0f, -2.75f, -2.0f), 20.0, false,
+                                                             internalObjectTreeChunkSize);
         
-        polygonModel->generatePolygonObjectsFromVertices();
-        polygonModel->buildBallTree(internalObjectTreeChunkSize);
-        
-        ballTree_->addItem(polygonModel);
-    }
+        items.push_back(polygonModel);
+    });
     
+    itemTasks.push_back([](std::vector<BoundingVolume *> &items)
     {//floor
         stitch::Brush *brush=new stitch::Brush(new stitch::PhongMaterial(stitch::Colour_t(0.9f, 0.9f, 0.9f), stitch::Colour_t(0.0f, 0.0f, 0.0f), stitch::Colour_t(0.0f, 0.0f, 0.0f), 10.0f, "Data/wood2.jpg"));
         //stitch::Brush *brush=new stitch::Brush(new stitch::DiffuseMaterial(stitch::Colour_t(0.7f, 0.7f, 0.7f)));
@@ -486,8 +684,10 @@ void stitch::Scene::createCausticBunny(const size_t internalObjectTreeChunkSize,
         brush->updateLinesVerticesAndBoundingVolume(false);
         brush->optimiseFaceOrder();
         
-        ballTree_->addItem(brush);
-    }
+        items.push_back(brush);
+    });
+    
+    addItemsConcurrently(itemTasks);
 }
 
 //=======================================================================//
@@ -497,18 +697,18 @@ void stitch::Scene::createCausticDragon(const size_t internalObjectTreeChunkSize
         ballTree_->addItem(light_);
     }
     
+    std::vector<ItemTask> itemTasks;
+    
+    itemTasks.push_back([this, internalObjectTreeChunkSize, glossySD](std::vector<BoundingVolume *> &items)
     {//Load PLY file.
-        stitch::PolygonModel *polygonModel=new stitch::PolygonModel(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD));
-        
-        polygonModel->loadPLYVertices("Data/dragon.ply", stitch::Vec3(0.0f, -2.75f, -2.0f), 20.0, false);
-        polygonModel->calculateVertexNormals();
-        
-        polygonModel->generatePolygonObjectsFromVertices();
-        polygonModel->buildBallTree(internalObjectTreeChunkSize);
+        stitch::PolygonModel *polygonModel=loadPolygonModel(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD),
+                                                             "Data/dragon.ply", stitch::Vec3(0.0f, -2.75f, -2.0f), 20.0, false,
+                                                             internalObjectTreeChunkSize);
         
-        ballTree_->addItem(polygonModel);
-    }
+        items.push_back(polygonModel);
+    });
     
+    itemTasks.push_back([](std::vector<BoundingVolume *> &items)
     {//floor
         stitch::Brush *brush=new stitch::Brush(new stitch::PhongMaterial(stitch::Colour_t(0.9f, 0.9f, 0.9f), stitch::Colour_t(0.0f, 0.0f, 0.0f), stitch::Colour_t(0.0f, 0.0f, 0.0f), 10.0f, "Data/wood2.jpg"));
         //stitch::Brush *brush=new stitch::Brush(new stitch::DiffuseMaterial(stitch::Colour_t(0.7f, 0.7f, 0.7f)));
@@ -524,8 +724,10 @@ void stitch::Scene::createCausticDragon(const size_t internalObjectTreeChunkSize
         brush->updateLinesVerticesAndBoundingVolume(false);
         brush->optimiseFaceOrder();
         
-        ballTree_->addItem(brush);
-    }
+        items.push_back(brush);
+    });
+    
+    addItemsConcurrently(itemTasks);
 }
 
 //=======================================================================//
@@ -536,7 +738,10 @@ void stitch::Scene::createCausticGear(const size_t internalObjectTreeChunkSize,
     }
     
     
-    {
+    std::vector<ItemTask> itemTasks;
+    
+    itemTasks.push_back([this, internalObjectTreeChunkSize, glossySD](std::vector<BoundingVolume *> &items)
+    {//Gears
         std::vector<stitch::Vec3> vectors;
         std::vector<size_t> indices;
         
@@ -586,29 +791,34 @@ void stitch::Scene::createCausticGear(const size_t internalObjectTreeChunkSize,
             }
         }
         
-        stitch::PolygonModel *gear1=new stitch::PolygonModel(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD));
-        gear1->loadVectorsAndIndices(vectors, indices,
-                                            stitch::Vec3(0.0f, -1.4f, 0.0f),
-                                            1.0,
-                                            Vec3(0.0f, 1.0f, 0.0f).normalised(),
-                                            true);
-        gear1->calculateVertexNormals();
-        gear1->generatePolygonObjectsFromVertices();
-        gear1->buildBallTree(internalObjectTreeChunkSize);
-        ballTree_->addItem(gear1);
-
-        stitch::PolygonModel *gear2=new stitch::PolygonModel(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD));
-        gear2->loadVectorsAndIndices(vectors, indices,
-                                     stitch::Vec3(2.0f, -0.7f, 0.0f),
-                                     1.0,
-                                     Vec3(0.5f, 1.0f, 0.0f).normalised(),
-                                     true);
-        gear2->calculateVertexNormals();
-        gear2->generatePolygonObjectsFromVertices();
-        gear2->buildBallTree(internalObjectTreeChunkSize);
-        ballTree_->addItem(gear2);
-    }
+        //=== The gear mesh and its tree are shared by the gear instances ===
+        std::shared_ptr<stitch::PolygonModel> gearModel=std::make_shared<stitch::PolygonModel>(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD));
+        gearModel->loadVectorsAndIndices(vectors, indices,
+                                         stitch::Vec3(0.0f, 0.0f, 0.0f),
+                                         1.0,
+                                         Vec3(0.0f, 0.0f, 1.0f),//The z-axis up vector leaves the vectors unrotated.
+                                         true);
+        gearModel->calculateVertexNormals();
+        gearModel->generatePolygonObjectsFromVertices();
+        gearModel->buildBallTree(internalObjectTreeChunkSize, treeType_, wideNodes_, compactNodes_);
+        //===
+        
+        stitch::ObjectInstance *gear1=new stitch::ObjectInstance(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD),
+                                                                 gearModel,
+                                                                 stitch::Vec3(0.0f, -1.4f, 0.0f),
+                                                                 1.0f,
+                                                                 Vec3(0.0f, 1.0f, 0.0f).normalised());
+        items.push_back(gear1);
+        
+        stitch::ObjectInstance *gear2=new stitch::ObjectInstance(new stitch::GlossyMaterial(stitch::Colour_t(0.6f, 0.8f, 0.9f), glossySD),
+                                                                 gearModel,
+                                                                 stitch::Vec3(2.0f, -0.7f, 0.0f),
+                                                                 1.0f,
+                                                                 Vec3(0.5f, 1.0f, 0.0f).normalised());
+        items.push_back(gear2);
+    });
     
+    itemTasks.push_back([](std::vector<BoundingVolume *> &items)
     {//floor
         stitch::Brush *brush=new stitch::Brush(new stitch::PhongMaterial(stitch::Colour_t(0.9f, 0.9f, 0.9f), stitch::Colour_t(0.0f, 0.0f, 0.0f), stitch::Colour_t(0.0f, 0.0f, 0.0f), 10.0f, "Data/wood2.jpg"));
         //stitch::Brush *brush=new stitch::Brush(new stitch::DiffuseMaterial(stitch::Colour_t(0.7f, 0.7f, 0.7f)));
@@ -624,8 +834,10 @@ void stitch::Scene::createCausticGear(const size_t internalObjectTreeChunkSize,
         brush->updateLinesVerticesAndBoundingVolume(false);
         brush->optimiseFaceOrder();
         
-        ballTree_->addItem(brush);
-    }
+        items.push_back(brush);
+    });
+    
+    addItemsConcurrently(itemTasks);
     
     {//ceiling
         stitch::Brush *brush=new stitch::Brush(new stitch::DiffuseMaterial(stitch::Colour_t(0.7f, 0.7f, 0.7f)));
@@ -834,7 +1046,7 @@ void stitch::Scene::createCGF2010(const size_t internalObjectTreeChunkSize, floa
         
         //brushModel->updateVertexNormalsToSmooth();
         
-        brushModel->buildBallTree(internalObjectTreeChunkSize);
+        brushModel->buildBallTree(internalObjectTreeChunkSize, treeType_, wideNodes_, compactNodes_);
         
         ballTree_->addItem(brushModel);
     }
@@ -1085,7 +1297,7 @@ void stitch::Scene::createMultiBounce1(const size_t internalObjectTreeChunkSize,
         
         //brushModel->updateVertexNormalsToSmooth();
         
-        brushModel->buildBallTree(internalObjectTreeChunkSize);
+        brushModel->buildBallTree(internalObjectTreeChunkSize, treeType_, wideNodes_, compactNodes_);
         
         //Test copy of brush model and internal object tree.
         stitch::BrushModel *brushModelCopy=new stitch::BrushModel(*brushModel);
@@ -1150,7 +1362,7 @@ void stitch::Scene::createMultiBounce1(const size_t internalObjectTreeChunkSize,
         
         //brushModel->updateVertexNormalsToSmooth();
         
-        brushModel->buildBallTree(internalObjectTreeChunkSize);
+        brushModel->buildBallTree(internalObjectTreeChunkSize, treeType_, wideNodes_, compactNodes_);
         
         //Test copy of brush model and internal object tree.
         stitch::BrushModel *brushModelCopy=new stitch::BrushModel(*brushModel);
@@ -1166,7 +1378,7 @@ void stitch::Scene::createMultiBounce1(const size_t internalObjectTreeChunkSize,
      polygonModel->loadOBJVertices("Data/teapot.obj", stitch::Vec3(0.0f, -1.0f, 9.0f), 0.1, false);
      polygonModel->calculateVertexNormals();
      polygonModel->generatePolygonObjectsFromVertices();
-     polygonModel->buildBallTree(internalObjectTreeChunkSize);
+     polygonModel->buildBallTree(internalObjectTreeChunkSize, treeType_, wideNodes_, compactNodes_);
      ballTree_->addItem(polygonModel);
      */
     //=================================
@@ -1250,7 +1462,7 @@ void stitch::Scene::createReport1(const size_t internalObjectTreeChunkSize, floa
         
         //brushModel->updateVertexNormalsToSmooth();
         
-        brushModel->buildBallTree(internalObjectTreeChunkSize);
+        brushModel->buildBallTree(internalObjectTreeChunkSize, treeType_, wideNodes_, compactNodes_);
         
         ballTree_->addItem(brushModel);
     }
@@ -1290,13 +1502,9 @@ void stitch::Scene::createSponza(const size_t internalObjectTreeChunkSize, float
 {
     
     {
-        stitch::PolygonModel *polygonModel=new stitch::PolygonModel(new stitch::DiffuseMaterial(stitch::Colour_t(0.9, 0.9, 0.9)));
-        
-        polygonModel->loadOBJVertices("Data/crytek/sponza.obj", stitch::Vec3(0.0f, 0.0f, 0.0f), 20.0, false);
-        polygonModel->calculateVertexNormals();
-        
-        polygonModel->generatePolygonObjectsFromVertices();
-        polygonModel->buildBallTree(internalObjectTreeChunkSize);
+        stitch::PolygonModel *polygonModel=loadPolygonModel(new stitch::DiffuseMaterial(stitch::Colour_t(0.9, 0.9, 0.9)),
+                                                             "Data/crytek/sponza.obj", stitch::Vec3(0.0f, 0.0f, 0.0f), 20.0, false,
+                                                             internalObjectTreeChunkSize);
         
         ballTree_->addItem(polygonModel);
     }
@@ -31,14 +31,21 @@
 
 namespace stitch {
     class Scene;
+    class PolygonModel;
 }
 
+#define SCENE_MODEL_CACHE_SUFFIX ".cache" //Appended to a model's file name to name its prepared model cache.
+
 #include "BallTree.h"
 #include "Math/Vec3.h"
+#include "Math/RayPacket.h"
 #include "Math/Colour.h"
 
 #include "Light.h"
 
+#include <functional>
+#include <vector>
+
 namespace stitch {
 	
     //! Contains the object tree and light source that together make up the scene to be rendered. 
@@ -53,12 +60,19 @@ namespace stitch {
             delete ballTree_;
         }
         
+        /*! Create one of the named scenes.
+         @param treeType The type of tree built over the scene's objects and over each model's polygons/brushes. The chunk sizes are only used by BallTree::BALL_TREE.
+         @param wideNodes Collapse the frozen trees into 4-wide nodes (see BallTree::freezeWide).
+         @param compactNodes Low-memory mode. Quantise the wide nodes and release the rest of the trees (see BallTree::freezeCompact). */
         size_t create(const std::string scene_name, const Vec3 &light_orig, const Colour_t &lightSPD,
                              const size_t objectTreeChunkSize,
                              const size_t internalObjectTreeChunkSize,
                              bool createOSGLineGeometry,
                              bool createOSGNormalGeometry,
-                             float glossySD);
+                             float glossySD,
+                             const BallTree::TreeType treeType=BallTree::BALL_TREE,
+                             const bool wideNodes=false,
+                             const bool compactNodes=false);
         
         void createCausticRing(const size_t internalObjectTreeChunkSize, float glossySD);
         void createCausticBunny(const size_t internalObjectTreeChunkSize, float glossySD);
@@ -73,15 +87,128 @@ namespace stitch {
         
         Light *light_;
         
+        /*! Find the closest intersection of the ray with the scene, including its shading normal.
+         @param intersect The intersection so far. Initialised by the caller. */
         inline void calcIntersection(const Ray &ray, Intersection &intersect) const
         {
+            const float incomingDistance=intersect.distance_;
+            
             ballTree_->calcIntersection(ray, intersect);
+            
+            if (intersect.distance_<incomingDistance)
+            {//The normal of only the closest hit is calculated, see BoundingVolume::calcShadingNormal.
+                intersect.itemPtr_->calcShadingNormal(ray, intersect);
+            }
+        }
+        
+        /*! Check whether any object blocks the ray closer than tMax. Stops at the first blocker so it is cheaper than
+         calcIntersection for shadow and visibility rays.
+         @param tMax The end of the ray, e.g. the distance to the light or camera. The ray's own tMax_ still applies. */
+        inline bool occluded(const Ray &ray, const float tMax) const
+        {
+            return ballTree_->occluded(ray, MathUtil::min(tMax, ray.tMax_));
+        }
+        
+        /*! Check whether any object blocks the ray within its [tMin_, tMax_) interval. */
+        inline bool occluded(const Ray &ray) const
+        {
+            return ballTree_->occluded(ray, ray.tMax_);
+        }
+        
+        /*! Update the scene's tree after objects (or the light) have moved, e.g. between the frames of an animation, which is
+         much cheaper than building it again. Subtrees that the motion degraded are rebuilt (see BallTree::refit and BVHTree::refit).
+         @return The number of rebuilt subtrees. */
+        inline size_t refit()
+        {
+            return ballTree_->refit();
+        }
+        
+        /*! Add an object to the created scene, e.g. while editing a layout, without building the scene's tree again (see
+         BallTree::insertItem). The tree is built again only if it has no build hierarchy left, e.g. in low-memory mode.
+         The scene takes ownership of the object. The preview scene graph is not updated. */
+        void addObject(BoundingVolume * const object);
+        
+        /*! Remove an object from the created scene without building the scene's tree again (see BallTree::removeItem). The
+         object is not deleted; its ownership passes back to the caller.
+         @return False if the object is not in the scene. */
+        bool removeObject(BoundingVolume * const object);
+        
+        /*! Start a batch of addObject and removeObject calls, e.g. the objects that change between two frames. The scene's
+         tree is then frozen again once by endObjectEdits instead of after every edit (see BallTree::beginEdits). */
+        inline void beginObjectEdits()
+        {
+            ballTree_->beginEdits();
+        }
+        
+        /*! Freeze the scene's tree again after a batch of edits, or build it again if it had no build hierarchy left. */
+        void endObjectEdits();
+        
+        /*! The number of bytes used by the scene's tree and the trees of its objects. */
+        inline size_t getTreeMemorySize() const
+        {
+            return ballTree_->getTreeMemorySize();
+        }
+        
+        /*! Intersect a packet of coherent rays (e.g. the primary rays of a pixel tile) with the scene.
+         @param intersects The closest intersection of each ray of the packet. Initialised by the caller. */
+        inline void calcPacketIntersection(const RayPacket &packet, Intersection * const intersects) const
+        {
+            const uint32_t fullMask=packet.getFullMask();
+            float incomingDistances[RAYPACKET_MAX_SIZE];
+            
+            for (uint32_t laneMask=fullMask; laneMask; laneMask&=laneMask-1)
+            {
+                const size_t laneNum=RayPacket::lowestLane(laneMask);
+                incomingDistances[laneNum]=intersects[laneNum].distance_;
+            }
+            
+            ballTree_->calcPacketIntersection(packet, intersects, fullMask);
+            
+            for (uint32_t laneMask=fullMask; laneMask; laneMask&=laneMask-1)
+            {
+                const size_t laneNum=RayPacket::lowestLane(laneMask);
+                Intersection &intersect=intersects[laneNum];
+                
+                if (intersect.distance_<incomingDistances[laneNum])
+                {
+                    intersect.itemPtr_->calcShadingNormal(packet.getRay(laneNum), intersect);
+                }
+            }
         }
 
         
     private:
+        /*! Load a PLY or OBJ model, calculate its vertex normals, generate its polygons and build its tree. The prepared model is
+         cached next to the model file (see SCENE_MODEL_CACHE_SUFFIX) and memory mapped from there on later runs while the model
+         file and the parameters are unchanged. */
+        PolygonModel *loadPolygonModel(Material * const pMaterial, const std::string &fileName,
+                                       const Vec3 &centre, const float scale, const bool invertNormals,
+                                       const size_t internalObjectTreeChunkSize) const;
+        
+        //! Builds independent items of a scene, e.g. loads and prepares a model, and appends them to items.
+        typedef std::function<void (std::vector<BoundingVolume *> &items)> ItemTask;
+        
+        /*! Run the tasks concurrently, each on its own thread, and then add their items to the scene's tree in the order of
+         the tasks so that the tree does not depend on which task finishes first. The tasks may not touch the scene's tree. */
+        void addItemsConcurrently(const std::vector<ItemTask> &itemTasks);
+        
+        /*! Build the scene's tree over its objects and freeze it as set up by create. */
+        void buildObjectTree();
+        
         stitch::BallTree *ballTree_;
         
+        //! The tree type used for the scene and the internal object trees.
+        BallTree::TreeType treeType_;
+        
+        //! Whether the scene and the internal object trees are frozen with wide nodes.
+        bool wideNodes_;
+        
+        //! Whether the scene and the internal object trees are frozen with quantised wide nodes.
+        bool compactNodes_;
+        
+        //! The chunk size of the scene's tree. Kept to build the tree again when objects are added or removed later.
+        size_t objectTreeChunkSize_;
+        
         
     public:
 #ifdef USE_OSG
@@ -0,0 +1,98 @@
+/*
+ *  TreeLayout.h
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STITCH_TREE_LAYOUT_H
+#define STITCH_TREE_LAYOUT_H
+
+#include <vector>
+#include <cstddef>
+
+namespace stitch {
+    
+    /*! Append the nodes that are depth levels below the node to nodes, left to right.
+     @param getChildren Called as getChildren(node, children) to append a node's children to a vector. */
+    template <class Node, class GetChildren>
+    void appendTreeNodesAtDepth(const Node &node, const size_t depth, const GetChildren &getChildren, std::vector<Node> &nodes)
+    {
+        if (depth==0)
+        {
+            nodes.push_back(node);
+            return;
+        }
+        
+        std::vector<Node> children;
+        getChildren(node, children);
+        
+        for (size_t childNum=0; childNum<children.size(); ++childNum)
+        {
+            appendTreeNodesAtDepth(children[childNum], depth-1, getChildren, nodes);
+        }
+    }
+    
+    /*! The number of levels of the tree below and including the node. */
+    template <class Node, class GetChildren>
+    size_t getTreeHeight(const Node &node, const GetChildren &getChildren)
+    {
+        std::vector<Node> children;
+        getChildren(node, children);
+        
+        size_t maxChildHeight=0;
+        for (size_t childNum=0; childNum<children.size(); ++childNum)
+        {
+            const size_t childHeight=getTreeHeight(children[childNum], getChildren);
+            
+            if (childHeight>maxChildHeight)
+            {
+                maxChildHeight=childHeight;
+            }
+        }
+        
+        return maxChildHeight+1;
+    }
+    
+    /*! Append the top height levels of the node's subtree to order in the cache oblivious van Emde Boas layout. The subtree is
+     cut at half its height and the top half is laid out before each of the subtrees below it, all recursively in the same
+     way. A subtree of a few levels then occupies a contiguous range whatever the cache line or page size so a path from the
+     root touches few blocks. Parents always come before their children.
+     @param getChildren Called as getChildren(node, children) to append a node's children to a vector. */
+    template <class Node, class GetChildren>
+    void appendVanEmdeBoasOrder(const Node &node, const size_t height, const GetChildren &getChildren, std::vector<Node> &order)
+    {
+        if (height<=1)
+        {
+            order.push_back(node);
+            return;
+        }
+        
+        const size_t topHeight=height/2;
+        appendVanEmdeBoasOrder(node, topHeight, getChildren, order);
+        
+        std::vector<Node> bottomNodes;
+        appendTreeNodesAtDepth(node, topHeight, getChildren, bottomNodes);
+        
+        for (size_t bottomNum=0; bottomNum<bottomNodes.size(); ++bottomNum)
+        {
+            appendVanEmdeBoasOrder(bottomNodes[bottomNum], height-topHeight, getChildren, order);
+        }
+    }
+}
+
+#endif// STITCH_TREE_LAYOUT_H
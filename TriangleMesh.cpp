@@ -0,0 +1,133 @@
+/*
+ *  TriangleMesh.cpp
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "TriangleMesh.h"
+#include "Math/MathUtil.h"
+
+//=======================================================================//
+stitch::TriangleMesh::TriangleMesh(const std::vector<Vec3> &vertCoords,
+                                   const std::vector<Vec3> &vertNormals,
+                                   const std::vector<size_t> &indices)
+{
+    const size_t numVertices=vertCoords.size();
+    
+    x_.resize(numVertices);
+    y_.resize(numVertices);
+    z_.resize(numVertices);
+    normalX_.resize(numVertices);
+    normalY_.resize(numVertices);
+    normalZ_.resize(numVertices);
+    
+    for (size_t vertexNum=0; vertexNum<numVertices; ++vertexNum)
+    {
+        x_[vertexNum]=vertCoords[vertexNum].x();
+        y_[vertexNum]=vertCoords[vertexNum].y();
+        z_[vertexNum]=vertCoords[vertexNum].z();
+        
+        normalX_[vertexNum]=vertNormals[vertexNum].x();
+        normalY_[vertexNum]=vertNormals[vertexNum].y();
+        normalZ_[vertexNum]=vertNormals[vertexNum].z();
+    }
+    
+    indices_.assign(indices.begin(), indices.begin()+(indices.size()/3)*3);//Whole triangles only.
+    
+    firstItemID_=BoundingVolume::allocateItemIDs(getNumTriangles());
+}
+
+stitch::TriangleMesh::TriangleMesh(const size_t numVertices, const size_t numTriangles) :
+x_(numVertices),
+y_(numVertices),
+z_(numVertices),
+normalX_(numVertices),
+normalY_(numVertices),
+normalZ_(numVertices),
+indices_(numTriangles*3)
+{
+    firstItemID_=BoundingVolume::allocateItemIDs(numTriangles);
+}
+
+
+//=======================================================================//
+stitch::MeshTriangle::MeshTriangle(const TriangleMesh * const mesh, const uint32_t triangleIndex) :
+mesh_(mesh),
+triangleIndex_(triangleIndex)
+{
+    itemID_=mesh_->getItemID(triangleIndex_);
+    calcBoundingSphere(mesh_, triangleIndex_, centre_, radiusBV_);
+}
+
+void stitch::MeshTriangle::calcBoundingSphere(const TriangleMesh * const mesh, const uint32_t triangleIndex, Vec3 &centre, float &radiusBV)
+{
+    Vec3 v0, v1, v2;
+    mesh->getTriangle(triangleIndex, v0, v1, v2);
+    
+    centre=(v0+v1+v2)/3.0f;
+    
+    radiusBV=Vec3::calcDistToPointSq(v0, centre);
+    radiusBV=MathUtil::max(radiusBV, Vec3::calcDistToPointSq(v1, centre));
+    radiusBV=MathUtil::max(radiusBV, Vec3::calcDistToPointSq(v2, centre));
+    radiusBV=sqrtf(radiusBV)*1.001f;//1% bigger to ensure rendering of full poly.
+}
+
+
+//=======================================================================//
+void stitch::MeshTriangle::splitAABB(const AABB &box, const uint8_t axis, const float position, AABB &leftBox, AABB &rightBox) const
+{//Each vertex goes to its side of the plane and each edge that crosses the plane adds the crossing to both sides.
+    Vec3 v0, v1, v2;
+    mesh_->getTriangle(triangleIndex_, v0, v1, v2);
+    
+    const Vec3 * const vertices[3]={&v0, &v1, &v2};
+    
+    AABB left, right;
+    
+    for (size_t vertexNum=0; vertexNum<3; ++vertexNum)
+    {
+        const Vec3 &a=*vertices[vertexNum];
+        const Vec3 &b=*vertices[(vertexNum+1)%3];
+        
+        const float aPos=a[axis];
+        const float bPos=b[axis];
+        
+        if (aPos<=position)
+        {
+            left.expand(a);
+        }
+        
+        if (aPos>=position)
+        {
+            right.expand(a);
+        }
+        
+        if (((aPos<position)&&(bPos>position))||((aPos>position)&&(bPos<position)))
+        {
+            Vec3 crossing=a+(b-a)*((position-aPos)/(bPos-aPos));
+            crossing.v_[axis]=position;
+            
+            left.expand(crossing);
+            right.expand(crossing);
+        }
+    }
+    
+    //The item may already have been clipped by an earlier split, so keep within the box.
+    leftBox=left.intersection(box);
+    rightBox=right.intersection(box);
+}
+
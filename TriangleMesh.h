@@ -0,0 +1,336 @@
+/*
+ *  TriangleMesh.h
+ *  StitchEngine
+ *
+ *  This file is part of StitchEngine.
+
+ *  StitchEngine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ *  StitchEngine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with StitchEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STITCH_TRIANGLE_MESH_H
+#define STITCH_TRIANGLE_MESH_H
+
+namespace stitch {
+    class TriangleMesh;
+    class MeshTriangle;
+}
+
+#include "BoundingVolume.h"
+#include "Arena.h"
+#include "Math/Vec3.h"
+#include "Math/AABB.h"
+#include "Math/Ray.h"
+
+#include <vector>
+
+#ifdef USE_CXX11
+#include <cstdint>
+#else
+#include <stdint.h>
+#endif
+
+namespace stitch {
+    
+    //! Triangles that share structure-of-arrays vertex coordinates and normals, indexed with 32-bit vertex indices.
+    //! The mesh is the only copy of a model's triangles once they are generated. A frozen tree references them by
+    //! triangle index (see BallTree::freezeMesh) and MeshTriangles wrap them as items while the tree is built.
+    class TriangleMesh
+    {
+    public:
+        /*! Copy the model's vertices, normals and indices into the mesh. There must be fewer than 2^32 vertices. */
+        TriangleMesh(const std::vector<Vec3> &vertCoords,
+                     const std::vector<Vec3> &vertNormals,
+                     const std::vector<size_t> &indices);
+        
+        /*! Size the arrays for the given number of vertices and triangles, e.g. to copy them from a cache. */
+        TriangleMesh(const size_t numVertices, const size_t numTriangles);
+        
+        size_t getNumVertices() const
+        {
+            return x_.size();
+        }
+        
+        size_t getNumTriangles() const
+        {
+            return indices_.size()/3;
+        }
+        
+        inline Vec3 getVertex(const size_t vertexIndex) const
+        {
+            return Vec3(x_[vertexIndex], y_[vertexIndex], z_[vertexIndex]);
+        }
+        
+        inline Vec3 getNormal(const size_t vertexIndex) const
+        {
+            return Vec3(normalX_[vertexIndex], normalY_[vertexIndex], normalZ_[vertexIndex]);
+        }
+        
+        inline void getTriangle(const uint32_t triangleIndex, Vec3 &v0, Vec3 &v1, Vec3 &v2) const
+        {
+            const uint32_t * const triangle=&indices_[triangleIndex*3];
+            
+            v0=Vec3(x_[triangle[0]], y_[triangle[0]], z_[triangle[0]]);
+            v1=Vec3(x_[triangle[1]], y_[triangle[1]], z_[triangle[1]]);
+            v2=Vec3(x_[triangle[2]], y_[triangle[2]], z_[triangle[2]]);
+        }
+        
+        /*! The item ID reported for a hit on the triangle. The mesh reserves one ID per triangle when it is created. */
+        inline uint32_t getItemID(const uint32_t triangleIndex) const
+        {
+            return firstItemID_+triangleIndex*2;
+        }
+        
+        /*! Find the hit of the ray on the triangle that is closer than maxDistance and within the ray's interval.
+         @return True if the ray hits the triangle. distance, b1 and b2 are only meaningful then. */
+        inline bool intersect(const uint32_t triangleIndex, const Ray &ray, const float maxDistance, float &distance, float &b1, float &b2) const
+        {
+            return (testTriangle(triangleIndex, ray, distance, b1, b2))&&(distance>ray.tMin_)&&(distance<maxDistance)&&(distance<ray.tMax_);
+        }
+        
+        /*! Check whether the ray hits the triangle after its tMin_ and before tMax. */
+        inline bool occluded(const uint32_t triangleIndex, const Ray &ray, const float tMax) const
+        {
+            float distance, b1, b2;
+            
+            return (testTriangle(triangleIndex, ray, distance, b1, b2))&&(distance>ray.tMin_)&&(distance<tMax);
+        }
+        
+        /*! Set normal to the normalised vertex normal interpolated at the barycentric coordinates b1 and b2 of the triangle. */
+        inline void interpolateNormal(const uint32_t triangleIndex, const float b1, const float b2, Vec3 &normal) const
+        {
+            const uint32_t * const triangle=&indices_[triangleIndex*3];
+            
+            normal.setToSumScaleAndNormalise(Vec3(normalX_[triangle[0]], normalY_[triangle[0]], normalZ_[triangle[0]]), 1.0f-b1-b2,
+                                             Vec3(normalX_[triangle[1]], normalY_[triangle[1]], normalZ_[triangle[1]]), b1,
+                                             Vec3(normalX_[triangle[2]], normalY_[triangle[2]], normalZ_[triangle[2]]), b2);
+        }
+        
+        float calcArea(const uint32_t triangleIndex) const
+        {
+            Vec3 v0, v1, v2;
+            getTriangle(triangleIndex, v0, v1, v2);
+            
+            return stitch::Vec3::crossLength(v2, v1, v0)*0.5f;
+        }
+        
+        AABB getTriangleAABB(const uint32_t triangleIndex) const
+        {
+            Vec3 v0, v1, v2;
+            getTriangle(triangleIndex, v0, v1, v2);
+            
+            AABB box(v0, v0);
+            box.expand(v1);
+            box.expand(v2);
+            return box;
+        }
+        
+        /*! The number of bytes used by the vertex and index arrays. */
+        size_t getMemorySize() const
+        {
+            return (x_.size()+y_.size()+z_.size()+normalX_.size()+normalY_.size()+normalZ_.size())*sizeof(float) + indices_.size()*sizeof(uint32_t);
+        }
+        
+    public:
+        std::vector<float> x_;
+        std::vector<float> y_;
+        std::vector<float> z_;
+        
+        std::vector<float> normalX_;
+        std::vector<float> normalY_;
+        std::vector<float> normalZ_;
+        
+        //! Three vertex indices per triangle.
+        std::vector<uint32_t> indices_;
+        
+    private:
+        /*! Moller and Trumbore - 1997, "Fast, minimum storage ray-triangle intersection.", Journal of Graphics Tools 2(1), 21-28.
+         Coded from PBRT Book, Second Ed, p140. FrozenTriangles tests four triangles in the same order of operations.
+         @return True if the ray's line crosses the triangle. The distance limits are left to the caller. */
+        inline bool testTriangle(const uint32_t triangleIndex, const Ray &ray, float &distance, float &b1, float &b2) const
+        {
+            Vec3 v0, v1, v2;
+            getTriangle(triangleIndex, v0, v1, v2);
+            
+            const Vec3 e1(v0,v1);//v1 - v0
+            const Vec3 e2(v0,v2);//v2 - v0
+            const Vec3 s1=stitch::Vec3::cross(ray.direction_, e2);
+            
+            const float divisor=stitch::Vec3::dot(s1, e1);
+            
+            if (divisor==0.0f)
+            {
+                return false;
+            }
+            
+            const float recipDivisor=1.0f/divisor;
+            
+            const Vec3 d(v0, ray.origin_);//ray.origin_ - v0
+            
+            b1 = stitch::Vec3::dotscale(d, s1, recipDivisor);
+            
+            if (!((b1>=0.0f) && (b1<=1.0f)))
+            {
+                return false;
+            }
+            
+            const Vec3 s2 = stitch::Vec3::cross(d, e1);
+            b2 = stitch::Vec3::dotscale(ray.direction_, s2, recipDivisor);
+            
+            if (!((b2>=0.0f) && ((b1+b2)<=1.0f)))
+            {
+                return false;
+            }
+            
+            distance=stitch::Vec3::dotscale(e2, s2, recipDivisor);
+            
+            return true;
+        }
+        
+    private:
+        //! The item ID of the first triangle, see getItemID.
+        uint32_t firstItemID_;
+    };
+    
+    
+    //! One triangle of a TriangleMesh as an item of a tree that is being built. Only refers to the shared mesh, so it is
+    //! small enough to have one per triangle. The tree references the triangle by index once it is frozen over the mesh
+    //! (see BallTree::freezeMesh) and the MeshTriangles are then released.
+    //! An intersection reports the triangle as the item hit; the model that owns the mesh replaces it with itself.
+    //! A model allocates its MeshTriangles from its own arena, e.g. new (arena) MeshTriangle(mesh, triangleIndex). Those are
+    //! freed with the arena and must never be deleted (see PolygonModel::releaseMeshTriangles). Clones are on the heap.
+    class MeshTriangle : public BoundingVolume
+    {
+    public:
+        static void *operator new(size_t size)
+        {
+            return ::operator new(size);
+        }
+        
+        static void *operator new(size_t size, Arena &arena)
+        {
+            return arena.allocate(size, alignof(MeshTriangle));
+        }
+        
+        /*! Only for MeshTriangles on the heap. */
+        static void operator delete(void *memory)
+        {
+            ::operator delete(memory);
+        }
+        
+        /*! Only called if a constructor throws. The memory stays in the arena. */
+        static void operator delete(void *memory, Arena &arena)
+        {
+        }
+        
+        
+        MeshTriangle(const TriangleMesh * const mesh, const uint32_t triangleIndex);
+        
+        /*! Construct with the bounding sphere already calculated by calcBoundingSphere, e.g. in parallel for a whole mesh. */
+        MeshTriangle(const TriangleMesh * const mesh, const uint32_t triangleIndex, const Vec3 &centre, const float radiusBV) :
+        BoundingVolume(centre, radiusBV),
+        mesh_(mesh),
+        triangleIndex_(triangleIndex)
+        {
+            itemID_=mesh_->getItemID(triangleIndex_);
+        }
+        
+        MeshTriangle(const MeshTriangle &lValue) :
+        BoundingVolume(lValue),
+        mesh_(lValue.mesh_),
+        triangleIndex_(lValue.triangleIndex_)
+        {}
+        
+        virtual MeshTriangle * clone() const;
+        
+        virtual MeshTriangle & operator = (const MeshTriangle &lValue)
+        {
+            BoundingVolume::operator=(lValue);
+            
+            mesh_=lValue.mesh_;
+            triangleIndex_=lValue.triangleIndex_;
+            
+            return *this;
+        }
+        
+        virtual ~MeshTriangle()
+        {
+        }
+        
+        virtual void calcIntersection(const Ray &ray, Intersection &intersect) const
+        {
+            //if (BVIntersected(orig, normDir)) This is currently executed by the calling code!
+            float distance, b1, b2;
+            
+            if (mesh_->intersect(triangleIndex_, ray, intersect.distance_, distance, b1, b2))
+            {
+                setTriangleIntersection(ray, distance, b1, b2, intersect);
+            }
+        }
+        
+        /*! Same triangle test as calcIntersection without the normal interpolation. */
+        virtual bool occluded(const Ray &ray, const float tMax) const
+        {
+            return mesh_->occluded(triangleIndex_, ray, tMax);
+        }
+        
+        virtual bool getTriangle(Vec3 &v0, Vec3 &v1, Vec3 &v2) const
+        {
+            mesh_->getTriangle(triangleIndex_, v0, v1, v2);
+            return true;
+        }
+        
+        /*! Records the hit without its normal, see calcShadingNormal. */
+        virtual void setTriangleIntersection(const Ray &ray, const float distance, const float b1, const float b2, Intersection &intersect) const
+        {
+            intersect.distance_=distance;
+            intersect.itemID_=this->itemID_;
+            intersect.itemPtr_=this;
+            intersect.primitiveID_=triangleIndex_;
+            intersect.b1_=b1;
+            intersect.b2_=b2;
+        }
+        
+        virtual void calcShadingNormal(const Ray &ray, Intersection &intersect) const
+        {
+            mesh_->interpolateNormal(intersect.primitiveID_, intersect.b1_, intersect.b2_, intersect.normal_);
+            intersect.itemID_|=(intersect.normal_*ray.direction_>0.0f)?0:1;//back surface gets even ID, front surface gets odd ID.
+        }
+        
+        virtual AABB getAABB() const
+        {
+            return mesh_->getTriangleAABB(triangleIndex_);
+        }
+        
+        /*! Split the bounds of the triangle inside box by the plane at position along axis. */
+        virtual void splitAABB(const AABB &box, const uint8_t axis, const float position, AABB &leftBox, AABB &rightBox) const;
+        
+        /*! The bounding sphere of a triangle of the mesh. */
+        static void calcBoundingSphere(const TriangleMesh * const mesh, const uint32_t triangleIndex, Vec3 &centre, float &radiusBV);
+        
+    public:
+        const TriangleMesh *mesh_;
+        uint32_t triangleIndex_;
+    };
+    
+    
+    inline MeshTriangle * MeshTriangle::clone() const
+    {
+        return new MeshTriangle(*this);
+    }
+    
+}
+
+
+#endif// STITCH_TRIANGLE_MESH_H